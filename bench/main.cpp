@@ -0,0 +1,51 @@
+/// Native runner for the shared benchmark kernels
+///
+/// Build and run with `pio run -e native_bench -t exec`. Google Benchmark's own flags apply, so
+/// `--benchmark_format=csv` or `--benchmark_out=results.json` produce a report to compare against earlier builds.
+
+#include <benchmark/benchmark.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <bench/kernels.hpp>
+
+/// Operations per call into a kernel, so the indirect call doesn't dominate the cheapest kernels
+static constexpr uint32_t BATCH = 64;
+
+/// A cycle count where the CPU has one that's cheap to read, otherwise 0. On x86 it's the time stamp counter, which
+/// matches core cycles when the clock isn't boosted or scaled.
+static uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+int main(int argc, char** argv) {
+	for (const auto& kernel : bench::kernels()) {
+		benchmark::RegisterBenchmark(kernel.name, [&kernel](benchmark::State& state) {
+			uint64_t start = read_cycles();
+			for (auto _ : state) {
+				benchmark::DoNotOptimize(kernel.run(BATCH));
+			}
+			uint64_t cycles = read_cycles() - start;
+
+			// Reported as items per second; its inverse matches the BENCH_APP's cycles per iteration
+			state.SetItemsProcessed(state.iterations() * BATCH);
+			if (cycles != 0) {
+				state.counters["cycles_per_item"] = static_cast<double>(cycles) / (state.iterations() * BATCH);
+			}
+		});
+	}
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+		return 1;
+	}
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
@@ -0,0 +1,372 @@
+#include <bench/kernels.hpp>
+
+#include <array>
+#include <cstdio>
+#include <string_view>
+
+#include <embedded_util/clock.hpp>
+#include <embedded_util/cobs.hpp>
+#include <embedded_util/control_register.hpp>
+#include <embedded_util/format.hpp>
+#include <embedded_util/mixer.hpp>
+#include <embedded_util/speed_estimator.hpp>
+#include <embedded_util/logger.hpp>
+#include <embedded_util/varint.hpp>
+#include <esp32_at/at_parser.hpp>
+#include <hifive1b_bsp/devices/pll.hpp>
+#include <hifive1b_bsp/edge_capture.hpp>
+#include <hifive1b_bsp/leds.hpp>
+#include <hifive1b_bsp/spi_driver.hpp>
+
+// Fields laid out like a typical peripheral control register
+
+static constexpr auto FIELD_LOW = BitField<uint32_t>::from_range<3, 0>();
+static constexpr auto FIELD_MID = BitField<uint32_t>::from_range<15, 8>();
+static constexpr auto FIELD_FLAG = BitField<uint32_t>::single_bit<31>();
+
+/// Stands in for pllcfg with the lock bit already set, so configure_and_select() doesn't wait
+static constexpr uint32_t PLLCFG_LOCKED = 0x80070DF1;
+
+/// A short AT exchange: an info line, the final response, a URC and a +IPD payload
+static constexpr std::string_view AT_RESPONSE =
+	"AT+CIPSTATUS\r\nSTATUS:3\r\n+CIPSTATUS:0,\"TCP\",\"192.168.1.2\",8080,4321,0\r\n\r\nOK\r\n"
+	"WIFI GOT IP\r\n+IPD,0,12:hello, world\r\n";
+
+static uint32_t control_register_set_field(uint32_t iterations) {
+	uint32_t word = 0;
+	const ControlRegister<uint32_t> reg(reinterpret_cast<uintptr_t>(&word));
+
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < iterations; ++i) {
+		reg.set_field(FIELD_MID, i & 0xFF);
+		sum += reg.get_field(FIELD_MID);
+	}
+	return sum;
+}
+
+static uint32_t control_register_transaction(uint32_t iterations) {
+	uint32_t word = 0;
+	const ControlRegister<uint32_t> reg(reinterpret_cast<uintptr_t>(&word));
+
+	for (uint32_t i = 0; i < iterations; ++i) {
+		auto transaction = reg.start_atomic_transaction();
+		transaction.set_field(FIELD_LOW, i & 0xF);
+		transaction.set_field(FIELD_MID, i & 0xFF);
+		transaction.set_field(FIELD_FLAG, i & 1);
+		transaction.finalize();
+	}
+	return reg.read();
+}
+
+static uint32_t control_register_copy(uint32_t iterations) {
+	uint32_t word = 0x80001203;
+	const ControlRegister<uint32_t> reg(reinterpret_cast<uintptr_t>(&word));
+
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < iterations; ++i) {
+		auto copy = reg.copy_value();
+		sum += copy.get_field(FIELD_LOW) + copy.get_field(FIELD_MID) + copy.get_field(FIELD_FLAG);
+	}
+	return sum;
+}
+
+static uint32_t pll_encode(uint32_t iterations) {
+	uint32_t pllcfg = PLLCFG_LOCKED;
+	const hifive1b::Pll pll(reinterpret_cast<uintptr_t>(&pllcfg));
+
+	hifive1b::Pll::ConfigStatus cfg;
+	cfg.reference_select = hifive1b::Pll::ReferenceClock::HFXOSC;
+	cfg.R = 2;
+	cfg.Q = 2;
+	// Bypassing still encodes every field, but skips the fixed wait for the PLL to settle that would swamp it
+	cfg.bypass = true;
+
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < iterations; ++i) {
+		// Even values of F from 48 to 78 keep the VCO within 384-768 MHz
+		cfg.F = static_cast<uint8_t>(48 + 2 * (i % 16));
+		pll.configure_and_select(cfg);
+		sum += pllcfg;
+	}
+	return sum;
+}
+
+static uint32_t pll_decode(uint32_t iterations) {
+	uint32_t pllcfg = PLLCFG_LOCKED;
+	const hifive1b::Pll pll(reinterpret_cast<uintptr_t>(&pllcfg));
+
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < iterations; ++i) {
+		sum += static_cast<uint32_t>(pll.get_output_frequency().count());
+	}
+	return sum;
+}
+
+/// Switches between two PLL settings like CoreClock, but only tells its listeners instead of reprogramming the PRCI
+class BenchClock : public Clock {
+	public:
+		Frequency get_frequency() override { return current; }
+
+		void change(const hifive1b::Pll::ConfigStatus& cfg) {
+			Frequency next = hifive1b::Pll::get_output_frequency(cfg);
+			emit_frequency_pending(next);
+			current = next;
+			emit_frequency_change(next);
+		}
+
+	private:
+		Frequency current = hifive1b::Pll::HFXOSC_FREQUENCY;
+};
+
+static uint32_t clock_change(uint32_t iterations) {
+	// Drivers on fake registers, listening as they do on the board. Listeners can't be removed, so they're set up once.
+	static std::array<uint32_t, 0x80 / 4> spi_registers {};
+	static std::array<uint32_t, 0x30 / 4> pwm_registers {};
+	static BenchClock clock;
+	static hifive1b::SpiDriver spi(1, reinterpret_cast<uintptr_t>(spi_registers.data()));
+	static hifive1b::LedDriver leds(clock, 0, 0, 0, reinterpret_cast<uintptr_t>(pwm_registers.data()));
+	static const bool initialized = [] {
+		spi.initialize(clock);
+		spi.set_baud_rate(8'000'000);
+		leds.blink({0, 0, 0xFF}, 500);
+		return true;
+	}();
+	(void)initialized;
+
+	// Between 192 MHz and the 320 MHz that set_max_speed() selects
+	hifive1b::Pll::ConfigStatus cfg;
+	cfg.R = 2;
+	cfg.Q = 2;
+
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < iterations; ++i) {
+		cfg.F = (i & 1) ? 80 : 48;
+		clock.change(cfg);
+		// SCKDIV and PWMCFG
+		sum += spi_registers[0] + pwm_registers[0];
+	}
+	return sum;
+}
+
+static uint32_t edge_capture(uint32_t iterations) {
+	// Alternate edges on fake GPIO registers, with the main loop's take() after each like a busy channel
+	std::array<uint32_t, 0x40 / 4> gpio {};
+	hifive1b::EdgeCapture capture(9, reinterpret_cast<uintptr_t>(gpio.data()));
+
+	uint32_t sum = 0;
+	hifive1b::EdgeCapture::Edge edge;
+	for (uint32_t i = 0; i < iterations; ++i) {
+		gpio[0x1C / 4] = (i & 1) ? 0 : 1UL << 9;
+		gpio[0x24 / 4] = (i & 1) ? 1UL << 9 : 0;
+		capture.handle_interrupt(i * 8000);
+		if (capture.take(edge)) {
+			sum += edge.cycles + edge.rising;
+		}
+	}
+	return sum;
+}
+
+static uint32_t speed_estimator(uint32_t iterations) {
+	// 40 kHz of edges at 320 MHz, updated every 16 edges
+	SpeedEstimator estimator({320'000'000, 20'000'000, 15'000'000, 1'000});
+
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < iterations; ++i) {
+		estimator.on_edge(i * 8000, i & 1);
+		if ((i & 15) == 15) {
+			sum += estimator.update(i * 8000 + 4000, i + 1);
+		}
+	}
+	return sum;
+}
+
+/// 8 inputs (throttle, steer, pitch, roll, yaw and three switches) to 8 outputs: tank drive, four trimmed and rate
+/// limited servos, and two pass-through channels
+static constexpr mixer::Topology<8, 8, 16> MIXER_8X8 {
+	.expo = {0, 30, 40, 40, 20, 0, 0, 0},
+	.rules = {{
+		{0, 0, mixer::percent(100)}, {1, 0, mixer::percent(100)},
+		{0, 1, mixer::percent(100)}, {1, 1, mixer::percent(-100)},
+		{2, 2, mixer::percent(80)}, {3, 2, mixer::percent(50)},
+		{2, 3, mixer::percent(80)}, {3, 3, mixer::percent(-50)},
+		{4, 4, mixer::percent(100)}, {0, 4, mixer::percent(-15)},
+		{1, 5, mixer::percent(60)}, {4, 5, mixer::percent(40)},
+		{5, 6, mixer::percent(100)},
+		{6, 7, mixer::percent(50)}, {7, 7, mixer::percent(50)}, {0, 7, mixer::percent(10)},
+	}},
+	.outputs = {{
+		{}, {},
+		{500, -24000, 24000, 800}, {-300, -24000, 24000, 800},
+		{0, -28000, 28000, 1200}, {120, -20000, 20000, 1200},
+		{}, {},
+	}},
+};
+
+/// Sweeping inputs so every rule and expo segment sees changing values
+static mixer::Value sweep(uint32_t i, uint32_t channel) {
+	return static_cast<mixer::Value>(static_cast<int32_t>(((i + channel * 4099) * 2731) & 0xFFFF) - 32768);
+}
+
+template<typename Mixer>
+static uint32_t run_mixer(Mixer& mix, uint32_t iterations) {
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < iterations; ++i) {
+		typename Mixer::Inputs in;
+		for (uint32_t c = 0; c < in.size(); ++c) {
+			in[c] = sweep(i, c);
+		}
+		for (auto v : mix.mix(in)) {
+			sum += static_cast<uint16_t>(v);
+		}
+	}
+	return sum;
+}
+
+static uint32_t mixer_8x8(uint32_t iterations) {
+	mixer::Mixer<MIXER_8X8> mix;
+	return run_mixer(mix, iterations);
+}
+
+static uint32_t mixer_8x8_runtime(uint32_t iterations) {
+	mixer::RuntimeMixer mix(MIXER_8X8);
+	return run_mixer(mix, iterations);
+}
+
+/// Swallows the output, keeping a sum of the bytes so the writes can't be skipped
+class SinkStream : public BasicOutStream<uint8_t> {
+	public:
+		void write(std::basic_string_view<uint8_t> data) override {
+			for (auto c : data) {
+				sum += c;
+			}
+		}
+
+		uint32_t sum = 0;
+};
+
+static uint32_t logger_write(uint32_t iterations) {
+	SinkStream stream;
+	for (uint32_t i = 0; i < iterations; ++i) {
+		stream << std::string_view("pll: ") << std::string_view("locked at 320 MHz") << std::string_view("\r\n");
+	}
+	return stream.sum;
+}
+
+// format_line and snprintf_line print the same status line so their cycles per line compare directly
+
+static uint32_t format_line(uint32_t iterations) {
+	SinkStream stream;
+	for (uint32_t i = 0; i < iterations; ++i) {
+		format::write<"spi{}: sck {} Hz, {:.2} MB/s, status 0x{:08x}\r\n">(stream, 1, 8'000'000u, 1234u + i, 0xA5F0u ^ i);
+	}
+	return stream.sum;
+}
+
+static uint32_t snprintf_line(uint32_t iterations) {
+	SinkStream stream;
+	char line[96];
+	for (uint32_t i = 0; i < iterations; ++i) {
+		uint32_t rate = 1234u + i;
+		int len = snprintf(line, sizeof(line), "spi%d: sck %lu Hz, %lu.%02lu MB/s, status 0x%08lx\r\n", 1, 8'000'000ul,
+			static_cast<unsigned long>(rate / 100), static_cast<unsigned long>(rate % 100),
+			static_cast<unsigned long>(0xA5F0u ^ i));
+		stream.write(std::basic_string_view<uint8_t>(reinterpret_cast<const uint8_t*>(line), len));
+	}
+	return stream.sum;
+}
+
+/// Counts what the parser reports
+class CountingListener : public esp32::AtParser::Listener {
+	public:
+		void on_line(esp32::AtParser::LineType type, std::string_view line) override {
+			sum += static_cast<uint32_t>(type) + line.size();
+		}
+
+		void on_prompt() override {
+			++sum;
+		}
+
+		void on_ipd(const esp32::AtParser::IpdFragment& fragment) override {
+			sum += fragment.data.size();
+		}
+
+		uint32_t sum = 0;
+};
+
+static uint32_t at_parser_feed(uint32_t iterations) {
+	CountingListener listener;
+	esp32::AtParser parser(listener);
+	for (uint32_t i = 0; i < iterations; ++i) {
+		parser.feed(AT_RESPONSE);
+	}
+	return listener.sum;
+}
+
+static uint32_t at_parser_split_feed(uint32_t iterations) {
+	// Arbitrary split points force lines through the carry buffer
+	CountingListener listener;
+	esp32::AtParser parser(listener);
+	for (uint32_t i = 0; i < iterations; ++i) {
+		parser.feed(AT_RESPONSE.substr(0, 19));
+		parser.feed(AT_RESPONSE.substr(19, 40));
+		parser.feed(AT_RESPONSE.substr(59));
+	}
+	return listener.sum;
+}
+
+static uint32_t cobs_round_trip(uint32_t iterations) {
+	std::array<uint8_t, 64> frame;
+	std::array<uint8_t, cobs::max_encoded_size(64) + 1> encoded;
+	for (std::size_t i = 0; i < frame.size(); ++i) {
+		frame[i] = static_cast<uint8_t>(i % 7);
+	}
+
+	uint32_t sum = 0;
+	cobs::Encoder encoder;
+	for (uint32_t i = 0; i < iterations; ++i) {
+		encoder.begin(encoded.data());
+		encoder.put(frame.data(), frame.size());
+		std::size_t len = encoder.finish(false);
+		sum += cobs::decode(encoded.data(), len, encoded.data());
+	}
+	return sum;
+}
+
+static uint32_t varint_round_trip(uint32_t iterations) {
+	uint8_t buffer[varint::MAX_BYTES];
+
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < iterations; ++i) {
+		// Spread the values over every encoded length
+		uint32_t value = i * 0x9E3779B9 >> (i % 32);
+		std::size_t len = varint::encode(value, buffer);
+		uint32_t decoded;
+		varint::decode(buffer, len, decoded);
+		sum += decoded;
+	}
+	return sum;
+}
+
+static constexpr std::array<bench::Kernel, 17> KERNELS = {{
+	{"control_register_set_field", control_register_set_field},
+	{"control_register_transaction", control_register_transaction},
+	{"control_register_copy", control_register_copy},
+	{"pll_encode", pll_encode},
+	{"pll_decode", pll_decode},
+	{"clock_change", clock_change},
+	{"edge_capture", edge_capture},
+	{"speed_estimator", speed_estimator},
+	{"mixer_8x8", mixer_8x8},
+	{"mixer_8x8_runtime", mixer_8x8_runtime},
+	{"logger_write", logger_write},
+	{"format_line", format_line},
+	{"snprintf_line", snprintf_line},
+	{"at_parser_feed", at_parser_feed},
+	{"at_parser_split_feed", at_parser_split_feed},
+	{"cobs_round_trip", cobs_round_trip},
+	{"varint_round_trip", varint_round_trip},
+}};
+
+std::span<const bench::Kernel> bench::kernels() {
+	return KERNELS;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+/// Microbenchmark kernels shared by the native Google Benchmark runner (bench/) and the on-target BENCH_APP
+///
+/// Both sides time exactly the same code, so a regression seen on the desktop can be confirmed on the board and vice
+/// versa. Kernels only touch RAM (fake registers included), never real peripherals.
+namespace bench {
+
+struct Kernel {
+	/// Stable identifier used in reports; renaming a kernel breaks comparisons with earlier builds
+	const char* name;
+
+	/// Repeat the operation `iterations` times
+	/// @return A value derived from every result, so the work can't be optimized away. It doesn't depend on the
+	/// 	platform, which makes it a cheap check that both builds did the same work.
+	uint32_t (*run)(uint32_t iterations);
+};
+
+/// Every kernel, in report order
+std::span<const Kernel> kernels();
+
+} // namespace bench
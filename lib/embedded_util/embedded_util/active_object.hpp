@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <embedded_util/event_queue.hpp>
+#include <embedded_util/safety.hpp>
+
+/// An object that owns its state and only changes it in response to events, one at a time
+///
+/// Interrupt handlers and other active objects post events to it through a Dispatcher instead of calling it, so its
+/// handler never runs at interrupt level and never interrupts itself.
+template<typename Event>
+class ActiveObject {
+	public:
+		/// Handle one event. Runs to completion before the next event is dispatched.
+		virtual void on_event(const Event& event) = 0;
+};
+
+/// Delivers posted events to their active objects in the main context
+///
+/// Events from all producers share one EventQueue and are dispatched in the order they were posted. When the queue is
+/// empty run() hands control to a sleep function so the core can wait for an interrupt.
+///
+/// @tparam Event Trivially copyable event type (ex. an enum, or a struct with a type field and payload)
+/// @tparam CAPACITY Events that can wait at once, a power of two
+template<typename Event, std::size_t CAPACITY>
+class Dispatcher {
+	public:
+
+		using Target = ActiveObject<Event>;
+
+		/// Free-running timestamp in any unit (ex. core cycles), used to measure how long events wait
+		using Timestamp = uint32_t (*)();
+
+		struct Stats {
+			uint32_t dispatched = 0;
+			/// Time from post() to the target's handler starting, in timestamp units
+			uint32_t last_latency = 0;
+			uint32_t max_latency = 0;
+		};
+
+		explicit Dispatcher(Timestamp now) :
+			now(now)
+		{}
+
+		DISALLOW_COPY_AND_MOVE(Dispatcher);
+
+		/// Queue an event for a target. Safe from any context.
+		/// @return false if the queue is full, in which case the event is dropped
+		bool post(Target& target, const Event& event) {
+			return queue.post({&target, event, now()});
+		}
+
+		/// Run the handler for the oldest event
+		/// @return false if there was none
+		bool dispatch_one() {
+			Posted posted;
+			if (!queue.take(posted)) {
+				return false;
+			}
+
+			uint32_t latency = now() - posted.time;
+			posted.target->on_event(posted.event);
+
+			++stats.dispatched;
+			stats.last_latency = latency;
+			if (latency > stats.max_latency) {
+				stats.max_latency = latency;
+			}
+			return true;
+		}
+
+		/// Run handlers until the queue is empty, including for events they post
+		/// @return The number of events dispatched
+		std::size_t dispatch_all() {
+			std::size_t n = 0;
+			while (dispatch_one()) {
+				++n;
+			}
+			return n;
+		}
+
+		/// Dispatch events forever, sleeping whenever there are none
+		///
+		/// @param sleep Called as sleep(ready) with the queue empty. It must return once ready() is true, and check it
+		///	in a way that a post between the check and going to sleep still wakes it (ex. check with interrupts disabled,
+		///	then wait with `wfi`).
+		template<typename Sleep>
+		[[noreturn]] void run(Sleep&& sleep) {
+			for (;;) {
+				dispatch_all();
+				sleep([this] { return !queue.empty(); });
+			}
+		}
+
+		bool empty() const { return queue.empty(); }
+
+		const Stats& get_stats() const { return stats; }
+
+		/// Most events that have waited at once
+		uint32_t get_high_water() const { return queue.get_high_water(); }
+
+		/// Events dropped because the queue was full
+		uint32_t get_dropped() const { return queue.get_dropped(); }
+
+	private:
+		struct Posted {
+			Target* target;
+			Event event;
+			uint32_t time;
+		};
+
+		Timestamp now;
+		EventQueue<Posted, CAPACITY> queue;
+		Stats stats;
+};
@@ -13,6 +13,13 @@ class Clock {
 		void add_frequency_change_listener(const std::function<void(Frequency)>& callback) {
 			callbacks.emplace_back(callback);
 		}
+
+		/// Add a function that will run just before the clock changes, receiving the frequency it is about to change to
+		///
+		/// Devices that break above some input frequency (ex. a bus clocked from a divider) use this to slow down first
+		void add_frequency_pending_listener(const std::function<void(Frequency)>& callback) {
+			pending_callbacks.emplace_back(callback);
+		}
 	
 	protected:
 
@@ -22,7 +29,14 @@ class Clock {
 			}
 		}
 
+		void emit_frequency_pending(Frequency new_frequency) {
+			for (auto& cbk : pending_callbacks) {
+				cbk(new_frequency);
+			}
+		}
+
 	private:
 		std::vector<std::function<void(Frequency)>> callbacks;
+		std::vector<std::function<void(Frequency)>> pending_callbacks;
 
 };
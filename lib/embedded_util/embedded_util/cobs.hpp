@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Consistent Overhead Byte Stuffing
+///
+/// COBS removes every zero byte from a frame at a cost of at most one byte per 254, so a zero can delimit frames in a
+/// byte stream. A receiver that joins mid-stream or loses bytes resynchronizes at the next zero.
+namespace cobs {
+
+/// Largest encoded size of a frame of n bytes, not counting the delimiter
+constexpr std::size_t max_encoded_size(std::size_t n) {
+	return n + n / 254 + 1;
+}
+
+/// Streaming encoder that writes directly to its output buffer, so frames don't need to be staged and then copied
+class Encoder {
+	public:
+		/// Start a frame
+		/// @param buffer Storage for the encoded frame, with room for max_encoded_size() of the data plus the delimiter
+		void begin(uint8_t* buffer) {
+			out = buffer;
+			code_pos = 0;
+			pos = 1;
+			code = 1;
+		}
+
+		void put(uint8_t byte) {
+			if (byte != 0) {
+				out[pos++] = byte;
+				++code;
+			}
+
+			// A zero ends the current block, and so does reaching the longest block that a code byte can describe
+			if (byte == 0 || code == 0xFF) {
+				out[code_pos] = code;
+				code_pos = pos++;
+				code = 1;
+			}
+		}
+
+		void put(const uint8_t* data, std::size_t len) {
+			for (std::size_t i = 0; i < len; ++i) {
+				put(data[i]);
+			}
+		}
+
+		/// Close the frame
+		/// @param delimit Append the zero that separates frames
+		/// @return The total length of the encoded frame
+		std::size_t finish(bool delimit = true) {
+			out[code_pos] = code;
+			if (delimit) {
+				out[pos++] = 0;
+			}
+			return pos;
+		}
+
+		/// Bytes written so far, counting the pending code byte
+		std::size_t size() const { return pos; }
+
+	private:
+		uint8_t* out = nullptr;
+		std::size_t code_pos = 0;
+		std::size_t pos = 0;
+		uint8_t code = 1;
+};
+
+/// Decode one frame (without its delimiter). in and out may be the same buffer.
+/// @return The decoded length, or 0 if the frame is malformed
+inline std::size_t decode(const uint8_t* in, std::size_t len, uint8_t* out) {
+	std::size_t read = 0;
+	std::size_t written = 0;
+
+	while (read < len) {
+		uint8_t code = in[read++];
+		if (code == 0 || read + code - 1 > len) {
+			return 0;
+		}
+
+		for (uint8_t i = 1; i < code; ++i) {
+			out[written++] = in[read++];
+		}
+
+		// Every block but the last and the longest ones ends with a zero in the original data
+		if (code != 0xFF && read < len) {
+			out[written++] = 0;
+		}
+	}
+
+	return written;
+}
+
+} // namespace cobs
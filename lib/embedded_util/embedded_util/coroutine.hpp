@@ -0,0 +1,562 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include <embedded_util/event_queue.hpp>
+#include <embedded_util/safety.hpp>
+
+/// Bytes in each coroutine frame. A coroutine whose frame is larger can't be started.
+#ifndef COROUTINE_FRAME_SIZE
+#	define COROUTINE_FRAME_SIZE 256
+#endif
+
+/// Coroutine frames that can exist at once, counting every task in a chain of co_awaits
+#ifndef COROUTINE_FRAMES
+#	define COROUTINE_FRAMES 8
+#endif
+
+/// Fixed set of equally sized blocks for coroutine frames, so starting a coroutine never touches the heap
+///
+/// Frames are only allocated and freed where coroutines are started and where they finish, which is always the
+/// executor's context and never an interrupt handler, so the pool isn't locked.
+template<std::size_t FRAME_SIZE, std::size_t FRAMES>
+class FramePool {
+	public:
+		struct Stats {
+			uint32_t in_use = 0;
+			uint32_t high_water = 0;
+			/// Coroutines that couldn't start, for lack of a free frame or because theirs was too large
+			uint32_t failures = 0;
+			/// Largest frame requested, for sizing FRAME_SIZE
+			uint32_t largest = 0;
+		};
+
+		FramePool() = default;
+		DISALLOW_COPY_AND_MOVE(FramePool);
+
+		/// @return A free frame, or nullptr if there is none or size is larger than a frame
+		void* allocate(std::size_t size) {
+			if (size > stats.largest) {
+				stats.largest = static_cast<uint32_t>(size);
+			}
+
+			if (size <= FRAME_SIZE) {
+				for (std::size_t i = 0; i < FRAMES; ++i) {
+					if (!used[i]) {
+						used[i] = true;
+						if (++stats.in_use > stats.high_water) {
+							stats.high_water = stats.in_use;
+						}
+						return &frames[i];
+					}
+				}
+			}
+
+			++stats.failures;
+			return nullptr;
+		}
+
+		void free(void* frame) {
+			used[static_cast<std::size_t>(static_cast<Frame*>(frame) - frames.data())] = false;
+			--stats.in_use;
+		}
+
+		const Stats& get_stats() const { return stats; }
+
+	private:
+		struct alignas(std::max_align_t) Frame {
+			std::byte bytes[FRAME_SIZE];
+		};
+
+		std::array<Frame, FRAMES> frames;
+		std::array<bool, FRAMES> used {};
+		Stats stats;
+};
+
+/// The pool every Task's frame comes from
+inline FramePool<COROUTINE_FRAME_SIZE, COROUTINE_FRAMES> coroutine_frames;
+
+class Executor;
+
+/// State shared by the promises of every Task
+class TaskPromiseBase {
+	public:
+		/// Resumes whatever awaited the task when it finishes, or frees a spawned task's frame
+		struct FinalAwaiter {
+			bool await_ready() const noexcept { return false; }
+
+			template<typename Promise>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept {
+				TaskPromiseBase& promise = self.promise();
+				if (promise.continuation) {
+					return promise.continuation;
+				}
+				if (promise.detached) {
+					self.destroy();
+				}
+				return std::noop_coroutine();
+			}
+
+			void await_resume() const noexcept {}
+		};
+
+		static void* operator new(std::size_t size) noexcept { return coroutine_frames.allocate(size); }
+		static void operator delete(void* frame) { coroutine_frames.free(frame); }
+
+		/// Tasks don't run until they are awaited or spawned, so they always know their executor
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		FinalAwaiter final_suspend() const noexcept { return {}; }
+
+		void unhandled_exception() const { std::terminate(); }
+
+		/// The executor running the chain of tasks this one belongs to
+		Executor* executor = nullptr;
+
+		/// The coroutine awaiting this task, resumed when it finishes
+		std::coroutine_handle<> continuation;
+
+		/// Set for tasks handed to Executor::spawn(), which free their own frame when they finish
+		bool detached = false;
+};
+
+/// Where a Task keeps the value it returns. T must be default constructible.
+template<typename T>
+class TaskResult {
+	public:
+		void return_value(T result) { value = std::move(result); }
+		T take() { return std::move(value); }
+
+	private:
+		T value {};
+};
+
+template<>
+class TaskResult<void> {
+	public:
+		void return_void() const {}
+		void take() const {}
+};
+
+/// A coroutine that starts when it is awaited or spawned on an Executor, and hands back a T when it finishes
+///
+/// Awaiting a task runs it until it finishes, with the awaiting coroutine suspended until then; the task inherits
+/// the awaiting coroutine's executor. Frames come from coroutine_frames, and if none is free the task is empty
+/// (valid() is false) rather than failing with an exception. Awaiting an empty task gives a default T at once.
+template<typename T = void>
+class [[nodiscard]] Task {
+	public:
+		class promise_type : public TaskPromiseBase, public TaskResult<T> {
+			public:
+				Task get_return_object() noexcept { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+				static Task get_return_object_on_allocation_failure() noexcept { return Task(); }
+		};
+
+		using Handle = std::coroutine_handle<promise_type>;
+
+		Task() = default;
+
+		Task(Task&& other) noexcept :
+			handle(std::exchange(other.handle, {}))
+		{}
+
+		Task& operator=(Task&& other) noexcept {
+			if (this != &other) {
+				if (handle) {
+					handle.destroy();
+				}
+				handle = std::exchange(other.handle, {});
+			}
+			return *this;
+		}
+
+		Task(const Task&) = delete;
+		Task& operator=(const Task&) = delete;
+
+		~Task() {
+			if (handle) {
+				handle.destroy();
+			}
+		}
+
+		/// False if there was no frame for the coroutine
+		bool valid() const { return static_cast<bool>(handle); }
+
+		/// Give up ownership of the frame, which then has to free itself
+		Handle release() { return std::exchange(handle, {}); }
+
+		/// Runs the task with the awaiting coroutine suspended until it finishes
+		class Awaiter {
+			public:
+				explicit Awaiter(Handle task) :
+					task(task)
+				{}
+
+				bool await_ready() const noexcept { return !task; }
+
+				template<typename Promise>
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> caller) noexcept {
+					task.promise().executor = caller.promise().executor;
+					task.promise().continuation = caller;
+					return task;
+				}
+
+				T await_resume() {
+					if constexpr (!std::is_void_v<T>) {
+						return task ? task.promise().take() : T {};
+					}
+				}
+
+			private:
+				Handle task;
+		};
+
+		Awaiter operator co_await() noexcept { return Awaiter(handle); }
+
+	private:
+		explicit Task(Handle handle) :
+			handle(handle)
+		{}
+
+		Handle handle;
+};
+
+/// Runs coroutines in one context (the main loop), resuming them when what they wait for happens
+///
+/// Interrupt handlers finish operations through a Completion, which queues the waiting coroutine here, so coroutines
+/// only ever resume in poll() and never at interrupt level. Coroutines can also sleep with sleep_for() and
+/// sleep_until(), in ticks of the executor's timestamp.
+class Executor {
+	public:
+
+		/// Free-running time in any unit, which sets the unit of every sleep and timeout
+		using Timestamp = uint32_t (*)();
+
+		/// Something waiting for a time, kept in a list sorted by deadline
+		class Timer {
+			public:
+				/// Run by poll() once the deadline has passed, after the timer has been taken off the list
+				virtual void expire() = 0;
+
+				uint32_t deadline = 0;
+
+			private:
+				friend class Executor;
+				Timer* next = nullptr;
+				bool armed = false;
+		};
+
+		/// A coroutine waits on at most one thing at a time, so every suspended one fits and scheduling can't fail
+		static constexpr std::size_t READY_CAPACITY = std::bit_ceil(static_cast<std::size_t>(COROUTINE_FRAMES));
+
+		explicit Executor(Timestamp now) :
+			timestamp(now)
+		{}
+
+		DISALLOW_COPY_AND_MOVE(Executor);
+
+		/// Start a task, which runs until it first waits. Its frame is freed when it finishes.
+		/// @return false if the task is empty because there was no frame for it
+		bool spawn(Task<>&& task) {
+			if (!task.valid()) {
+				return false;
+			}
+
+			auto handle = task.release();
+			handle.promise().executor = this;
+			handle.promise().detached = true;
+			handle.resume();
+			return true;
+		}
+
+		/// Queue a suspended coroutine to be resumed by poll(). Safe from interrupt handlers.
+		void schedule(std::coroutine_handle<> coroutine) {
+			ready.post(coroutine);
+		}
+
+		/// Expire timers whose deadline has passed, then resume every queued coroutine
+		/// @return The number of timers expired and coroutines resumed
+		std::size_t poll() {
+			std::size_t n = 0;
+
+			uint32_t time = now();
+			while (timers && expired(timers->deadline, time)) {
+				Timer* timer = timers;
+				timers = timer->next;
+				timer->armed = false;
+				timer->expire();
+				++n;
+			}
+
+			std::coroutine_handle<> coroutine;
+			while (ready.take(coroutine)) {
+				coroutine.resume();
+				++n;
+			}
+
+			resumed += static_cast<uint32_t>(n);
+			return n;
+		}
+
+		/// Run coroutines forever, sleeping whenever none is ready
+		///
+		/// @param sleep Called as sleep(ready, deadline), where deadline is the earliest timer if there is one. It
+		///	must return once ready() is true or the deadline passes, and check ready() in a way that a schedule() just
+		///	before going to sleep still wakes it (see Dispatcher::run()).
+		template<typename Sleep>
+		[[noreturn]] void run(Sleep&& sleep) {
+			for (;;) {
+				poll();
+				sleep([this] { return !ready.empty(); }, next_deadline());
+			}
+		}
+
+		/// Deadline of the earliest timer, if any
+		std::optional<uint32_t> next_deadline() const {
+			if (!timers) {
+				return std::nullopt;
+			}
+			return timers->deadline;
+		}
+
+		uint32_t now() const { return timestamp(); }
+
+		void add_timer(Timer& timer) {
+			cancel_timer(timer);
+
+			// Timers with the same deadline expire in the order they were added
+			Timer** link = &timers;
+			while (*link && !before(timer.deadline, (*link)->deadline)) {
+				link = &(*link)->next;
+			}
+			timer.next = *link;
+			timer.armed = true;
+			*link = &timer;
+		}
+
+		/// Take a timer off the list if it hasn't expired
+		void cancel_timer(Timer& timer) {
+			if (!timer.armed) {
+				return;
+			}
+			for (Timer** link = &timers; *link; link = &(*link)->next) {
+				if (*link == &timer) {
+					*link = timer.next;
+					break;
+				}
+			}
+			timer.armed = false;
+		}
+
+		/// True once time has reached deadline, allowing for the timestamp wrapping around
+		static bool expired(uint32_t deadline, uint32_t time) { return static_cast<int32_t>(time - deadline) >= 0; }
+
+		/// Timers expired and coroutines resumed since the executor was created
+		uint32_t get_resumed() const { return resumed; }
+
+		/// Most coroutines that have been queued to resume at once
+		uint32_t get_ready_high_water() const { return ready.get_high_water(); }
+
+	private:
+		static bool before(uint32_t a, uint32_t b) { return static_cast<int32_t>(a - b) < 0; }
+
+		Timestamp timestamp;
+		EventQueue<std::coroutine_handle<>, READY_CAPACITY> ready;
+		Timer* timers = nullptr;
+		uint32_t resumed = 0;
+};
+
+/// Awaitable for sleep_for() and sleep_until()
+class SleepTimer : public Executor::Timer {
+	public:
+		SleepTimer(uint32_t time, bool relative) :
+			time(time),
+			relative(relative)
+		{}
+
+		bool await_ready() const noexcept { return relative && time == 0; }
+
+		template<typename Promise>
+		bool await_suspend(std::coroutine_handle<Promise> caller) {
+			Executor& executor = *caller.promise().executor;
+			deadline = relative ? executor.now() + time : time;
+			if (Executor::expired(deadline, executor.now())) {
+				return false;
+			}
+
+			coroutine = caller;
+			executor.add_timer(*this);
+			return true;
+		}
+
+		void await_resume() const noexcept {}
+
+		void expire() override { coroutine.resume(); }
+
+	private:
+		uint32_t time;
+		bool relative;
+		std::coroutine_handle<> coroutine;
+};
+
+/// Suspend the coroutine for a number of executor ticks
+inline SleepTimer sleep_for(uint32_t ticks) { return SleepTimer(ticks, true); }
+
+/// Suspend the coroutine until the executor's timestamp reaches a deadline
+inline SleepTimer sleep_until(uint32_t deadline) { return SleepTimer(deadline, false); }
+
+/// An operation that an interrupt handler finishes and one coroutine awaits
+///
+/// A driver reset()s it when starting the operation and calls complete() from its interrupt handler. If the
+/// operation finished before the coroutine got to co_await, the coroutine carries straight on; otherwise complete()
+/// queues it on its executor. A state word changed only by atomic exchanges decides which happened, so the two sides
+/// never need interrupts disabled.
+template<typename T = void>
+class Completion {
+	private:
+		struct Empty {};
+
+	public:
+		using Value = std::conditional_t<std::is_void_v<T>, Empty, T>;
+
+		Completion() = default;
+		DISALLOW_COPY_AND_MOVE(Completion);
+
+		/// Start over for a new operation. Must not be called while a coroutine waits.
+		void reset() {
+			state.store(IDLE, std::memory_order_release);
+		}
+
+		/// Finish the operation and resume the coroutine waiting for it, if any. Safe from interrupt handlers.
+		template<typename... Result>
+		void complete(Result&&... result) {
+			if constexpr (!std::is_void_v<T>) {
+				value = T(std::forward<Result>(result)...);
+			}
+			if (state.exchange(DONE, std::memory_order_acq_rel) == WAITING) {
+				executor->schedule(waiter);
+			}
+		}
+
+		bool done() const { return state.load(std::memory_order_acquire) == DONE; }
+
+		/// The result of the last operation to complete
+		const Value& get() const { return value; }
+
+		/// Awaitable for operator co_await
+		class Awaiter {
+			public:
+				explicit Awaiter(Completion& completion) :
+					completion(completion)
+				{}
+
+				bool await_ready() const noexcept { return completion.done(); }
+
+				template<typename Promise>
+				bool await_suspend(std::coroutine_handle<Promise> caller) noexcept {
+					return completion.wait(caller, *caller.promise().executor);
+				}
+
+				T await_resume() const {
+					if constexpr (!std::is_void_v<T>) {
+						return completion.value;
+					}
+				}
+
+			private:
+				Completion& completion;
+		};
+
+		/// Wait for complete(), giving its result
+		Awaiter operator co_await() noexcept { return Awaiter(*this); }
+
+		/// Awaitable from wait_for()
+		class TimedAwaiter : public Executor::Timer {
+			public:
+				TimedAwaiter(Completion& completion, uint32_t ticks) :
+					completion(completion),
+					ticks(ticks)
+				{}
+
+				bool await_ready() const noexcept { return completion.done(); }
+
+				template<typename Promise>
+				bool await_suspend(std::coroutine_handle<Promise> caller) {
+					executor = caller.promise().executor;
+					coroutine = caller;
+					deadline = executor->now() + ticks;
+
+					// Armed first, so the timer exists whenever complete() could have queued the coroutine
+					executor->add_timer(*this);
+					if (!completion.wait(caller, *executor)) {
+						executor->cancel_timer(*this);
+						return false;
+					}
+					return true;
+				}
+
+				/// @return true if the operation completed, false if the time ran out first
+				bool await_resume() {
+					if (executor) {
+						executor->cancel_timer(*this);
+					}
+					return !timed_out;
+				}
+
+				void expire() override {
+					if (completion.abandon()) {
+						timed_out = true;
+						coroutine.resume();
+					}
+				}
+
+			private:
+				Completion& completion;
+				uint32_t ticks;
+				Executor* executor = nullptr;
+				std::coroutine_handle<> coroutine;
+				bool timed_out = false;
+		};
+
+		/// Wait for complete() for at most a number of executor ticks. The result is available from get().
+		///
+		/// After a timeout a late complete() is ignored, but the driver should still stop the operation before
+		/// starting another one, or the late completion would be taken for the new one's.
+		TimedAwaiter wait_for(uint32_t ticks) { return TimedAwaiter(*this, ticks); }
+
+	private:
+		enum State : uint8_t {
+			IDLE,
+			WAITING,
+			DONE,
+		};
+
+		/// Register a coroutine to be queued by complete()
+		/// @return false if the operation has already completed, in which case the coroutine should carry on
+		bool wait(std::coroutine_handle<> coroutine, Executor& to_schedule) {
+			waiter = coroutine;
+			executor = &to_schedule;
+			uint8_t expected = IDLE;
+			return state.compare_exchange_strong(expected, WAITING, std::memory_order_acq_rel);
+		}
+
+		/// Stop waiting after a timeout
+		/// @return false if complete() got there first and has already queued the coroutine
+		bool abandon() {
+			uint8_t expected = WAITING;
+			return state.compare_exchange_strong(expected, DONE, std::memory_order_acq_rel);
+		}
+
+		std::atomic<uint8_t> state {IDLE};
+		std::coroutine_handle<> waiter;
+		Executor* executor = nullptr;
+		Value value {};
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/// CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF, no reflection)
+///
+/// Uses a 16-entry table and processes a nibble at a time, which is a good trade between code size and speed on a
+/// core without a CRC instruction.
+class Crc16 {
+	public:
+		static constexpr uint16_t INITIAL = 0xFFFF;
+
+		void update(uint8_t byte) {
+			crc = (crc << 4) ^ TABLE[((crc >> 12) ^ (byte >> 4)) & 0x0F];
+			crc = (crc << 4) ^ TABLE[((crc >> 12) ^ byte) & 0x0F];
+		}
+
+		void update(const uint8_t* data, std::size_t len) {
+			for (std::size_t i = 0; i < len; ++i) {
+				update(data[i]);
+			}
+		}
+
+		uint16_t value() const { return crc; }
+
+		void reset() { crc = INITIAL; }
+
+		/// Calculate the CRC of a buffer in one call
+		static uint16_t calculate(const uint8_t* data, std::size_t len) {
+			Crc16 c;
+			c.update(data, len);
+			return c.value();
+		}
+
+	private:
+		static constexpr std::array<uint16_t, 16> TABLE = [] {
+			std::array<uint16_t, 16> table {};
+			for (uint16_t i = 0; i < 16; ++i) {
+				uint16_t value = i << 12;
+				for (int bit = 0; bit < 4; ++bit) {
+					value = (value & 0x8000) ? static_cast<uint16_t>((value << 1) ^ 0x1021) : static_cast<uint16_t>(value << 1);
+				}
+				table[i] = value;
+			}
+			return table;
+		}();
+
+		uint16_t crc = INITIAL;
+};
+
+/// CRC-32 as used by Ethernet, zlib and PNG (reflected polynomial 0xEDB88320, initial value and final XOR 0xFFFFFFFF)
+///
+/// Nibble table like Crc16, for checking firmware images as they are received.
+class Crc32 {
+	public:
+		static constexpr uint32_t INITIAL = 0xFFFFFFFF;
+
+		void update(uint8_t byte) {
+			crc = (crc >> 4) ^ TABLE[(crc ^ byte) & 0x0F];
+			crc = (crc >> 4) ^ TABLE[(crc ^ (byte >> 4)) & 0x0F];
+		}
+
+		void update(const uint8_t* data, std::size_t len) {
+			for (std::size_t i = 0; i < len; ++i) {
+				update(data[i]);
+			}
+		}
+
+		uint32_t value() const { return crc ^ 0xFFFFFFFF; }
+
+		void reset() { crc = INITIAL; }
+
+		/// Calculate the CRC of a buffer in one call
+		static uint32_t calculate(const uint8_t* data, std::size_t len) {
+			Crc32 c;
+			c.update(data, len);
+			return c.value();
+		}
+
+	private:
+		static constexpr std::array<uint32_t, 16> TABLE = [] {
+			std::array<uint32_t, 16> table {};
+			for (uint32_t i = 0; i < 16; ++i) {
+				uint32_t value = i;
+				for (int bit = 0; bit < 4; ++bit) {
+					value = (value & 1) ? (value >> 1) ^ 0xEDB88320 : value >> 1;
+				}
+				table[i] = value;
+			}
+			return table;
+		}();
+
+		uint32_t crc = INITIAL;
+};
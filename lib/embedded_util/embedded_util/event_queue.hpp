@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include <embedded_util/safety.hpp>
+
+/// Bounded lock-free queue with any number of producers and one consumer
+///
+/// Producers may be interrupt handlers, including ones that interrupt another producer or the consumer. Each slot
+/// carries a sequence number: a producer claims a slot by advancing the tail with compare-and-swap, copies the event
+/// in, then publishes it by bumping the slot's sequence. The consumer only takes a slot once it is published, so it
+/// never sees a half-written event. Nothing blocks and nothing is allocated; a post to a full queue fails.
+///
+/// @tparam T Event type, copied in and out, so it must be trivially copyable
+/// @tparam CAPACITY Number of slots, which must be a power of two
+template<typename T, std::size_t CAPACITY>
+class EventQueue {
+	public:
+
+		static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "EventQueue: capacity must be a power of two");
+		static_assert(std::is_trivially_copyable_v<T>, "EventQueue: events must be trivially copyable");
+
+		EventQueue() {
+			for (std::size_t i = 0; i < CAPACITY; ++i) {
+				slots[i].sequence.store(static_cast<uint32_t>(i), std::memory_order_relaxed);
+			}
+		}
+
+		DISALLOW_COPY_AND_MOVE(EventQueue);
+
+		/// Add an event. Safe from any context.
+		/// @return false if the queue is full
+		bool post(const T& event) {
+			uint32_t position = tail.load(std::memory_order_relaxed);
+			Slot* slot;
+
+			for (;;) {
+				slot = &slots[position & MASK];
+				uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+				int32_t difference = static_cast<int32_t>(sequence - position);
+
+				if (difference == 0) {
+					// The slot is free for this position; claim it unless another producer got there first
+					if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if (difference < 0) {
+					// The consumer hasn't freed the slot from the previous lap
+					dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				} else {
+					position = tail.load(std::memory_order_relaxed);
+				}
+			}
+
+			slot->event = event;
+			slot->sequence.store(position + 1, std::memory_order_release);
+
+			// Depth counting the event just added; the consumer may already have taken some
+			uint32_t depth = position + 1 - head.load(std::memory_order_relaxed);
+			uint32_t mark = high_water.load(std::memory_order_relaxed);
+			while (depth > mark && !high_water.compare_exchange_weak(mark, depth, std::memory_order_relaxed)) {}
+			return true;
+		}
+
+		/// Remove the oldest published event. Only the consumer may call this.
+		/// @return false if the queue is empty, or the oldest event is still being written by an interrupted producer
+		bool take(T& event) {
+			uint32_t position = head.load(std::memory_order_relaxed);
+			Slot& slot = slots[position & MASK];
+			if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+				return false;
+			}
+
+			event = slot.event;
+			slot.sequence.store(position + CAPACITY, std::memory_order_release);
+			head.store(position + 1, std::memory_order_relaxed);
+			return true;
+		}
+
+		/// True if take() would find nothing. Only meaningful to the consumer.
+		bool empty() const {
+			uint32_t position = head.load(std::memory_order_relaxed);
+			return slots[position & MASK].sequence.load(std::memory_order_acquire) != position + 1;
+		}
+
+		/// Most events there have been in the queue at once
+		uint32_t get_high_water() const { return high_water.load(std::memory_order_relaxed); }
+
+		/// Events refused because the queue was full
+		uint32_t get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+		static constexpr std::size_t capacity() { return CAPACITY; }
+
+	private:
+		static constexpr uint32_t MASK = CAPACITY - 1;
+
+		struct Slot {
+			std::atomic<uint32_t> sequence;
+			T event;
+		};
+
+		std::array<Slot, CAPACITY> slots;
+		std::atomic<uint32_t> tail {0};
+		std::atomic<uint32_t> head {0};
+
+		std::atomic<uint32_t> high_water {0};
+		std::atomic<uint32_t> dropped {0};
+};
@@ -0,0 +1,445 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/// Type-safe formatting without printf
+///
+/// The format string is a template argument, so it is parsed and checked against the arguments during compilation and
+/// only the conversions remain at run time. Output goes through a small buffer on the stack to any stream with
+/// write(std::basic_string_view<uint8_t>) (ex. a BasicOutStream), or into a character array.
+///
+/// Replacement fields follow std::format: {[:[fill]<|>][0][width][.precision][type]}, with "{{" and "}}" for braces.
+/// - Integers: d (default), x, X, b or c. A precision prints a fixed-point value: {:.2} shows 1234 as "12.34".
+/// - bool prints true or false; char, const char* and std::string_view print as text.
+/// - Numbers align right by default and text aligns left. 0 pads with zeros after the sign.
+///
+/// ex. format::write<"sck {} Hz, {:.2} MB/s, status 0x{:08x}\n">(stream, sck, rate_x100, status);
+namespace format {
+
+/// A format string as a template argument
+template<std::size_t N>
+struct Literal {
+	consteval Literal(const char (&s)[N]) {
+		std::copy_n(s, N, text);
+	}
+
+	/// Length without the terminator
+	static constexpr std::size_t size() { return N - 1; }
+
+	char text[N] {};
+};
+
+enum class Type : uint8_t {
+	DEFAULT,
+	DECIMAL,
+	HEX,
+	HEX_UPPER,
+	BINARY,
+	CHAR,
+};
+
+enum class Align : uint8_t {
+	DEFAULT,
+	LEFT,
+	RIGHT,
+};
+
+/// A parsed replacement field
+struct Spec {
+	char fill = ' ';
+	Align align = Align::DEFAULT;
+	bool zero_pad = false;
+	uint8_t width = 0;
+	/// Decimal places of a fixed-point integer, or -1 for none
+	int8_t precision = -1;
+	Type type = Type::DEFAULT;
+};
+
+namespace detail {
+
+/// Not constexpr, so reaching it while parsing stops compilation with the message in the diagnostic
+void error(const char* message);
+
+/// Text before a replacement field (with escapes resolved) and the field itself
+struct Piece {
+	std::size_t text_start = 0;
+	std::size_t text_length = 0;
+	Spec spec;
+};
+
+template<std::size_t N, std::size_t FIELDS>
+struct Parsed {
+	std::array<char, N> text {};
+	std::array<Piece, FIELDS> pieces {};
+	/// Text after the last field
+	std::size_t tail_start = 0;
+	std::size_t tail_length = 0;
+};
+
+template<std::size_t N>
+constexpr std::size_t count_fields(const Literal<N>& format) {
+	std::size_t fields = 0;
+	for (std::size_t i = 0; i < format.size(); ++i) {
+		char c = format.text[i];
+		if ((c == '{' || c == '}') && i + 1 < format.size() && format.text[i + 1] == c) {
+			++i;
+		} else if (c == '{') {
+			++fields;
+		}
+	}
+	return fields;
+}
+
+constexpr Spec parse_spec(const char* s, std::size_t length) {
+	Spec spec;
+	std::size_t i = 0;
+
+	// [fill]<|> looks ahead one character so a fill can itself be '<' or '>'
+	auto is_align = [](char c) { return c == '<' || c == '>'; };
+	if (i + 1 < length && is_align(s[i + 1])) {
+		spec.fill = s[i];
+		spec.align = (s[i + 1] == '<') ? Align::LEFT : Align::RIGHT;
+		i += 2;
+	} else if (i < length && is_align(s[i])) {
+		spec.align = (s[i] == '<') ? Align::LEFT : Align::RIGHT;
+		++i;
+	}
+
+	if (i < length && s[i] == '0') {
+		spec.zero_pad = true;
+		++i;
+	}
+
+	uint32_t width = 0;
+	for (; i < length && s[i] >= '0' && s[i] <= '9'; ++i) {
+		width = width * 10 + static_cast<uint32_t>(s[i] - '0');
+	}
+	if (width > 64) {
+		error("format: width above 64");
+	}
+	spec.width = static_cast<uint8_t>(width);
+
+	if (i < length && s[i] == '.') {
+		++i;
+		if (i >= length || s[i] < '0' || s[i] > '9') {
+			error("format: '.' must be followed by a precision");
+		}
+		spec.precision = static_cast<int8_t>(s[i++] - '0');
+		if (spec.precision > 9) {
+			error("format: precision above 9");
+		}
+	}
+
+	if (i < length) {
+		switch (s[i++]) {
+			case 'd': spec.type = Type::DECIMAL; break;
+			case 'x': spec.type = Type::HEX; break;
+			case 'X': spec.type = Type::HEX_UPPER; break;
+			case 'b': spec.type = Type::BINARY; break;
+			case 'c': spec.type = Type::CHAR; break;
+			default: error("format: unknown type in replacement field");
+		}
+	}
+
+	if (i != length) {
+		error("format: unexpected characters in replacement field");
+	}
+	if (spec.precision >= 0 && spec.type != Type::DEFAULT && spec.type != Type::DECIMAL) {
+		error("format: a precision only applies to decimal numbers");
+	}
+	return spec;
+}
+
+template<std::size_t FIELDS, std::size_t N>
+constexpr Parsed<N, FIELDS> parse(const Literal<N>& format) {
+	Parsed<N, FIELDS> parsed;
+	std::size_t length = 0;
+	std::size_t start = 0;
+	std::size_t field = 0;
+
+	for (std::size_t i = 0; i < format.size(); ++i) {
+		char c = format.text[i];
+		if ((c == '{' || c == '}') && i + 1 < format.size() && format.text[i + 1] == c) {
+			parsed.text[length++] = c;
+			++i;
+		} else if (c == '}') {
+			error("format: unmatched '}'");
+		} else if (c == '{') {
+			std::size_t close = i + 1;
+			while (close < format.size() && format.text[close] != '}') {
+				if (format.text[close] == '{') {
+					error("format: '{' inside a replacement field");
+				}
+				++close;
+			}
+			if (close == format.size()) {
+				error("format: unmatched '{'");
+			}
+
+			Spec spec;
+			if (close > i + 1) {
+				if (format.text[i + 1] != ':') {
+					error("format: replacement fields take no index or name");
+				}
+				spec = parse_spec(format.text + i + 2, close - i - 2);
+			}
+			parsed.pieces[field++] = Piece {start, length - start, spec};
+			start = length;
+			i = close;
+		} else {
+			parsed.text[length++] = c;
+		}
+	}
+
+	parsed.tail_start = start;
+	parsed.tail_length = length - start;
+	return parsed;
+}
+
+template<Literal FORMAT>
+inline constexpr auto PARSED = parse<count_fields(FORMAT)>(FORMAT);
+
+/// Buffers output to a stream so it's written in a few large pieces
+template<typename Stream>
+class StreamSink {
+	public:
+		explicit StreamSink(Stream& stream) :
+			stream(stream)
+		{}
+
+		~StreamSink() {
+			flush();
+		}
+
+		void put(char c) {
+			if (used == buffer.size()) {
+				flush();
+			}
+			buffer[used++] = c;
+		}
+
+		void put(std::string_view s) {
+			// Long text goes straight through rather than in buffer-sized pieces
+			if (s.size() > buffer.size() - used) {
+				flush();
+				if (s.size() >= buffer.size()) {
+					stream.write(std::basic_string_view<uint8_t>(reinterpret_cast<const uint8_t*>(s.data()), s.size()));
+					return;
+				}
+			}
+			std::copy(s.begin(), s.end(), buffer.begin() + used);
+			used += s.size();
+		}
+
+		void flush() {
+			if (used > 0) {
+				stream.write(std::basic_string_view<uint8_t>(reinterpret_cast<const uint8_t*>(buffer.data()), used));
+				used = 0;
+			}
+		}
+
+	private:
+		Stream& stream;
+		std::array<char, 64> buffer;
+		std::size_t used = 0;
+};
+
+/// Writes into a character array like snprintf: truncated to fit with a terminator, while counting the full length
+class BufferSink {
+	public:
+		BufferSink(char* buffer, std::size_t capacity) :
+			buffer(buffer),
+			capacity(capacity)
+		{}
+
+		void put(char c) {
+			if (length + 1 < capacity) {
+				buffer[length] = c;
+			}
+			++length;
+		}
+
+		void put(std::string_view s) {
+			if (length + 1 < capacity) {
+				std::size_t n = std::min(s.size(), capacity - 1 - length);
+				std::copy_n(s.data(), n, buffer + length);
+			}
+			length += s.size();
+		}
+
+		/// Terminate the output and return the length it would have had without truncation
+		std::size_t finish() {
+			if (capacity > 0) {
+				buffer[std::min(length, capacity - 1)] = '\0';
+			}
+			return length;
+		}
+
+	private:
+		char* buffer;
+		std::size_t capacity;
+		std::size_t length = 0;
+};
+
+template<typename Sink>
+void pad(Sink& sink, char fill, std::size_t n) {
+	for (std::size_t i = 0; i < n; ++i) {
+		sink.put(fill);
+	}
+}
+
+/// Write text with padding to the field's width
+template<Spec SPEC, typename Sink>
+void put_padded(Sink& sink, std::string_view text, Align default_align) {
+	std::size_t padding = (SPEC.width > text.size()) ? SPEC.width - text.size() : 0;
+	bool left = (SPEC.align == Align::DEFAULT) ? default_align == Align::LEFT : SPEC.align == Align::LEFT;
+	if (!left) {
+		pad(sink, SPEC.fill, padding);
+	}
+	sink.put(text);
+	if (left) {
+		pad(sink, SPEC.fill, padding);
+	}
+}
+
+/// Write the digits of value backwards, ending at end
+/// @return The first digit
+template<unsigned BASE, bool UPPER, typename U>
+char* put_digits(U value, char* end, int min_digits = 1) {
+	constexpr const char* DIGITS = UPPER ? "0123456789ABCDEF" : "0123456789abcdef";
+	char* p = end;
+	do {
+		*--p = DIGITS[value % BASE];
+		value /= BASE;
+		--min_digits;
+	} while (value != 0 || min_digits > 0);
+	return p;
+}
+
+constexpr uint32_t power_of_ten(int n) {
+	uint32_t p = 1;
+	for (int i = 0; i < n; ++i) {
+		p *= 10;
+	}
+	return p;
+}
+
+template<Spec SPEC, typename Sink, typename T>
+void put_integer(Sink& sink, T value) {
+	// Anything that fits converts in 32 bits, so RV32 doesn't need the 64-bit division routines
+	using U = std::conditional_t<(sizeof(T) <= sizeof(uint32_t)), uint32_t, uint64_t>;
+	bool negative = false;
+	U magnitude = static_cast<U>(value);
+	if constexpr (std::is_signed_v<T>) {
+		if (value < 0) {
+			negative = true;
+			magnitude = U(0) - magnitude;
+		}
+	}
+
+	// Room for 64 binary digits, or 20 decimal ones and a point
+	char digits[66];
+	char* end = digits + sizeof(digits);
+	char* first;
+	if constexpr (SPEC.type == Type::HEX || SPEC.type == Type::HEX_UPPER) {
+		first = put_digits<16, SPEC.type == Type::HEX_UPPER>(magnitude, end);
+	} else if constexpr (SPEC.type == Type::BINARY) {
+		first = put_digits<2, false>(magnitude, end);
+	} else if constexpr (SPEC.precision > 0) {
+		constexpr U SCALE = power_of_ten(SPEC.precision);
+		first = put_digits<10, false>(magnitude % SCALE, end, SPEC.precision);
+		*--first = '.';
+		first = put_digits<10, false>(magnitude / SCALE, first);
+	} else {
+		first = put_digits<10, false>(magnitude, end);
+	}
+	std::string_view number(first, static_cast<std::size_t>(end - first));
+
+	if constexpr (SPEC.zero_pad && SPEC.align == Align::DEFAULT) {
+		// Zeros go between the sign and the digits
+		if (negative) {
+			sink.put('-');
+		}
+		std::size_t used = number.size() + (negative ? 1 : 0);
+		pad(sink, '0', (SPEC.width > used) ? SPEC.width - used : 0);
+		sink.put(number);
+	} else {
+		if (negative) {
+			*--first = '-';
+			number = std::string_view(first, static_cast<std::size_t>(end - first));
+		}
+		put_padded<SPEC>(sink, number, Align::RIGHT);
+	}
+}
+
+template<Spec SPEC, typename Sink, typename T>
+void put_value(Sink& sink, const T& value) {
+	constexpr bool TEXT_ONLY = SPEC.type == Type::DEFAULT && SPEC.precision < 0 && !SPEC.zero_pad;
+
+	if constexpr (std::is_same_v<T, bool>) {
+		static_assert(TEXT_ONLY, "format: bool takes no type, precision or zero padding");
+		put_padded<SPEC>(sink, value ? "true" : "false", Align::LEFT);
+	} else if constexpr (std::is_same_v<T, char>) {
+		static_assert(SPEC.type == Type::DEFAULT || SPEC.type == Type::CHAR,
+			"format: char prints as a character; cast it to print its value");
+		put_padded<SPEC>(sink, std::string_view(&value, 1), Align::LEFT);
+	} else if constexpr (std::is_integral_v<T>) {
+		if constexpr (SPEC.type == Type::CHAR) {
+			char c = static_cast<char>(value);
+			put_padded<SPEC>(sink, std::string_view(&c, 1), Align::LEFT);
+		} else {
+			put_integer<SPEC>(sink, value);
+		}
+	} else if constexpr (std::is_enum_v<T>) {
+		put_value<SPEC>(sink, static_cast<std::underlying_type_t<T>>(value));
+	} else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+		static_assert(TEXT_ONLY, "format: text takes no type, precision or zero padding");
+		put_padded<SPEC>(sink, std::string_view(value), Align::LEFT);
+	} else {
+		static_assert(!sizeof(T), "format: unsupported argument type");
+	}
+}
+
+template<Literal FORMAT, typename Sink, typename... Args>
+void format_to_sink(Sink& sink, const Args&... args) {
+	constexpr auto& parsed = PARSED<FORMAT>;
+	static_assert(parsed.pieces.size() == sizeof...(Args),
+		"format: the number of arguments doesn't match the replacement fields");
+
+	auto text = [&parsed](std::size_t start, std::size_t length) {
+		return std::string_view(parsed.text.data() + start, length);
+	};
+
+	[&]<std::size_t... I>(std::index_sequence<I...>) {
+		((sink.put(text(parsed.pieces[I].text_start, parsed.pieces[I].text_length)),
+			put_value<parsed.pieces[I].spec>(sink, args)), ...);
+	}(std::index_sequence_for<Args...>{});
+
+	sink.put(text(parsed.tail_start, parsed.tail_length));
+}
+
+} // namespace detail
+
+/// Format to a stream, such as a BasicOutStream<uint8_t>
+template<Literal FORMAT, typename Stream, typename... Args>
+void write(Stream& stream, const Args&... args) {
+	detail::StreamSink<Stream> sink(stream);
+	detail::format_to_sink<FORMAT>(sink, args...);
+}
+
+/// Format into buffer, truncating to fit and always terminating it when capacity isn't 0
+/// @return The length of the complete output, not counting the terminator, as snprintf returns
+template<Literal FORMAT, typename... Args>
+std::size_t to_buffer(char* buffer, std::size_t capacity, const Args&... args) {
+	detail::BufferSink sink(buffer, capacity);
+	detail::format_to_sink<FORMAT>(sink, args...);
+	return sink.finish();
+}
+
+} // namespace format
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
+#include <ratio>
 
 /// Type-safe containers for frequencies
 ///
@@ -10,10 +12,35 @@ namespace frequency {
 // Since we are mapping frequencies to durations, the units are inverted (ex. 1 GHz should be
 // multiplied to 1000 MHz as 1 second is multiplied to 1000 ms)
 
-using GHz = std::chrono::duration<uint64_t>;
-using MHz = std::chrono::duration<uint64_t, std::milli>;
-using KHz = std::chrono::duration<uint64_t, std::micro>;
-using Hz = std::chrono::duration<uint64_t, std::nano>;
+// Counts are 32 bits, which holds up to 4.29 GHz in Hz and covers every clock on the board. Arithmetic on them is
+// native on RV32, where 64-bit division is a libgcc call (__udivdi3) costing hundreds of cycles.
+
+using GHz = std::chrono::duration<uint32_t>;
+using MHz = std::chrono::duration<uint32_t, std::milli>;
+using KHz = std::chrono::duration<uint32_t, std::micro>;
+using Hz = std::chrono::duration<uint32_t, std::nano>;
+
+/// For intermediate results that can pass 4.29 GHz (ex. a reference clock times a multiplier before dividing)
+using WideHz = std::chrono::duration<uint64_t, std::nano>;
+
+/// Convert between units, like std::chrono::duration_cast but without widening to intmax_t
+///
+/// duration_cast computes in intmax_t, so even Hz to MHz is a 64-bit division. Here the factor between the units is a
+/// compile-time constant, which the compiler turns into a multiply, and 32-bit counts stay 32-bit. Only converting from
+/// WideHz divides in 64 bits. Converting to a finer unit must not overflow the destination; converting to a coarser one
+/// truncates as duration_cast does.
+template<typename To, typename Rep, typename Period>
+constexpr To cast(std::chrono::duration<Rep, Period> from) {
+	using ToRep = typename To::rep;
+	using Factor = std::ratio_divide<Period, typename To::period>;
+	static_assert(Factor::num == 1 || Factor::den == 1, "frequency::cast: units must be whole multiples of each other");
+
+	if constexpr (Factor::den == 1) {
+		return To(static_cast<ToRep>(from.count()) * static_cast<ToRep>(Factor::num));
+	} else {
+		return To(static_cast<ToRep>(from.count() / static_cast<Rep>(Factor::den)));
+	}
+}
 
 } // namespace frequency
 
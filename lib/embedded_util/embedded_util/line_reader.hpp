@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <embedded_util/coroutine.hpp>
+#include <embedded_util/event_queue.hpp>
+#include <embedded_util/safety.hpp>
+
+/// Text received by an interrupt handler, handed to a coroutine a line at a time
+///
+/// The receive handler push()es each character as it arrives, and read_line() waits until a whole line is there.
+/// The coroutine is only woken at the end of a line or when the queue fills, not for every character. Characters
+/// that arrive while the queue is full are dropped.
+///
+/// @tparam CAPACITY Characters that can wait to be read, a power of two
+template<std::size_t CAPACITY>
+class LineReader {
+	public:
+		LineReader() = default;
+		DISALLOW_COPY_AND_MOVE(LineReader);
+
+		/// Add a received character. Safe from interrupt handlers.
+		void push(char c) {
+			bool queued = chars.post(c);
+			if (!queued || c == '\r' || c == '\n') {
+				line.complete();
+			}
+		}
+
+		/// Wait for a line and copy it into a buffer without its terminator
+		///
+		/// Lines end with \r, \n or both. Empty lines are skipped, and a line longer than the buffer is cut short.
+		/// @return The number of characters stored
+		Task<std::size_t> read_line(char* buffer, std::size_t capacity) {
+			std::size_t len = 0;
+			for (;;) {
+				char c = 0;
+				while (chars.take(c)) {
+					if (c == '\r' || c == '\n') {
+						if (len > 0) {
+							co_return len;
+						}
+					} else if (len < capacity) {
+						buffer[len++] = c;
+					}
+				}
+
+				// Reset before looking once more, so a line ending pushed in between still ends the wait
+				line.reset();
+				if (chars.empty()) {
+					co_await line;
+				}
+			}
+		}
+
+		/// Characters dropped because the queue was full
+		uint32_t get_dropped() const { return chars.get_dropped(); }
+
+	private:
+		EventQueue<char, CAPACITY> chars;
+		Completion<> line;
+};
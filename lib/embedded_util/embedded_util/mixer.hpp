@@ -0,0 +1,255 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/// Channel mixing and input shaping in fixed point
+///
+/// Inputs (ex. RC sticks) are shaped by an expo curve, summed into outputs (ex. motors and servos) by weighted rules,
+/// then trimmed, clamped and rate limited. A Topology lists all of it, and Mixer takes the Topology as a template
+/// argument: every index and weight is a constant, so mix() compiles to straight-line code with no table walks, no
+/// multiplies for weights of +-1 and nothing at all for inputs without expo. Expo curves are interpolated from tables
+/// computed at compile time, so there is no floating point at run time. RuntimeMixer does the same from a Topology
+/// that's only known at run time.
+///
+/// ex. Tank steering, left = throttle + steer and right = throttle - steer:
+///
+///     constexpr mixer::Topology<2, 2, 4> TANK {
+///         .expo = {0, 30},
+///         .rules = {{{0, 0, mixer::percent(100)}, {1, 0, mixer::percent(100)},
+///                    {0, 1, mixer::percent(100)}, {1, 1, mixer::percent(-100)}}},
+///     };
+///     mixer::Mixer<TANK> tank;
+///     auto& motors = tank.mix({throttle, steer});
+namespace mixer {
+
+/// Channel values are Q15: -32767 to 32767 for -1 to 1
+using Value = int16_t;
+
+constexpr int32_t FULL = 32767;
+
+/// Weights are Q14, so a rule can scale an input by up to +-2
+constexpr int32_t UNITY = 1 << 14;
+
+consteval int16_t percent(int p) {
+	return static_cast<int16_t>(p * UNITY / 100);
+}
+
+/// Add input times weight to output
+struct Rule {
+	uint8_t input;
+	uint8_t output;
+	int16_t weight;
+};
+
+struct OutputConfig {
+	/// Added after mixing, ex. a servo's center trim
+	int16_t trim = 0;
+	int16_t min = -FULL;
+	int16_t max = FULL;
+	/// Largest change per mix, or 0 for no limit
+	uint16_t max_step = 0;
+};
+
+template<std::size_t INPUTS, std::size_t OUTPUTS, std::size_t RULES>
+struct Topology {
+	/// Expo of each input in percent: 0 is linear, 100 is a pure cubic
+	std::array<uint8_t, INPUTS> expo {};
+	std::array<Rule, RULES> rules {};
+	std::array<OutputConfig, OUTPUTS> outputs {};
+};
+
+/// Segments of an expo table. Each covers 2048 input steps, so interpolating is a shift.
+constexpr std::size_t EXPO_SEGMENTS = 16;
+constexpr int32_t EXPO_SEGMENT_BITS = 11;
+
+using ExpoTable = std::array<int16_t, EXPO_SEGMENTS + 1>;
+
+/// Points of (1 - e) x + e x^3 on [0, 1], for e = percent / 100
+constexpr ExpoTable make_expo_table(uint8_t percent) {
+	ExpoTable table {};
+	for (std::size_t i = 0; i <= EXPO_SEGMENTS; ++i) {
+		int64_t x = static_cast<int64_t>(i) << EXPO_SEGMENT_BITS;
+		int64_t cube = (x * x >> 15) * x >> 15;
+		int64_t y = ((100 - percent) * x + percent * cube) / 100;
+		table[i] = static_cast<int16_t>((y > FULL) ? FULL : y);
+	}
+	return table;
+}
+
+template<uint8_t PERCENT>
+inline constexpr ExpoTable EXPO_TABLE = make_expo_table(PERCENT);
+
+/// Apply an expo curve, which is odd, so only the magnitude is looked up
+constexpr int32_t shape(const ExpoTable& table, int32_t value) {
+	// Full scale sits one step short of the table's last point, so it's returned as is to map -1 and 1 exactly
+	int32_t magnitude = (value < 0) ? -value : value;
+	if (magnitude >= FULL) {
+		return (value < 0) ? -FULL : FULL;
+	}
+
+	int32_t index = magnitude >> EXPO_SEGMENT_BITS;
+	int32_t fraction = magnitude & ((1 << EXPO_SEGMENT_BITS) - 1);
+	int32_t y = table[index] + (((table[index + 1] - table[index]) * fraction) >> EXPO_SEGMENT_BITS);
+	return (value < 0) ? -y : y;
+}
+
+/// A rule's term in Q15, rounded. Each term is scaled down on its own so a sum of many can't overflow.
+constexpr int32_t weigh(int32_t value, int32_t weight) {
+	return (value * weight + (1 << 13)) >> 14;
+}
+
+/// Trim, clamp and rate limit a summed output against its previous value
+constexpr Value finish(const OutputConfig& config, int32_t sum, Value previous) {
+	int32_t value = sum + config.trim;
+	value = (value < config.min) ? config.min : (value > config.max) ? config.max : value;
+
+	if (config.max_step != 0) {
+		int32_t step = value - previous;
+		if (step > config.max_step) {
+			value = previous + config.max_step;
+		} else if (step < -static_cast<int32_t>(config.max_step)) {
+			value = previous - config.max_step;
+		}
+	}
+	return static_cast<Value>(value);
+}
+
+template<std::size_t INPUTS, std::size_t OUTPUTS, std::size_t RULES>
+constexpr bool is_valid(const Topology<INPUTS, OUTPUTS, RULES>& topology) {
+	for (const auto& rule : topology.rules) {
+		if (rule.input >= INPUTS || rule.output >= OUTPUTS) {
+			return false;
+		}
+	}
+	for (auto expo : topology.expo) {
+		if (expo > 100) {
+			return false;
+		}
+	}
+	for (const auto& output : topology.outputs) {
+		if (output.min > output.max) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Mixer specialized for a topology known at compile time
+template<auto TOPOLOGY>
+class Mixer {
+	public:
+		static constexpr std::size_t INPUTS = TOPOLOGY.expo.size();
+		static constexpr std::size_t OUTPUTS = TOPOLOGY.outputs.size();
+		static constexpr std::size_t RULES = TOPOLOGY.rules.size();
+
+		static_assert(is_valid(TOPOLOGY), "Mixer: a rule, expo or output limit is out of range");
+
+		using Inputs = std::array<Value, INPUTS>;
+		using Outputs = std::array<Value, OUTPUTS>;
+
+		/// Shape and mix the inputs into the outputs
+		/// @return The outputs, valid until the next mix
+		const Outputs& mix(const Inputs& in) {
+			std::array<int32_t, INPUTS> shaped;
+			std::array<int32_t, OUTPUTS> sums {};
+			shape_all(in, shaped, std::make_index_sequence<INPUTS>{});
+			apply_all(shaped, sums, std::make_index_sequence<RULES>{});
+			finish_all(sums, std::make_index_sequence<OUTPUTS>{});
+			return outputs;
+		}
+
+		/// Set where rate limited outputs start from
+		void reset(const Outputs& values = {}) {
+			outputs = values;
+		}
+
+		const Outputs& get_outputs() const { return outputs; }
+
+	private:
+		template<std::size_t... I>
+		static void shape_all(const Inputs& in, std::array<int32_t, INPUTS>& shaped, std::index_sequence<I...>) {
+			((shaped[I] = shape_input<I>(in[I])), ...);
+		}
+
+		template<std::size_t I>
+		static int32_t shape_input(Value value) {
+			if constexpr (TOPOLOGY.expo[I] == 0) {
+				return value;
+			} else {
+				return shape(EXPO_TABLE<TOPOLOGY.expo[I]>, value);
+			}
+		}
+
+		template<std::size_t... R>
+		static void apply_all(const std::array<int32_t, INPUTS>& shaped, std::array<int32_t, OUTPUTS>& sums,
+				std::index_sequence<R...>) {
+			(apply_rule<TOPOLOGY.rules[R]>(shaped, sums), ...);
+		}
+
+		template<Rule RULE>
+		static void apply_rule(const std::array<int32_t, INPUTS>& shaped, std::array<int32_t, OUTPUTS>& sums) {
+			if constexpr (RULE.weight == UNITY) {
+				sums[RULE.output] += shaped[RULE.input];
+			} else if constexpr (RULE.weight == -UNITY) {
+				sums[RULE.output] -= shaped[RULE.input];
+			} else if constexpr (RULE.weight != 0) {
+				sums[RULE.output] += weigh(shaped[RULE.input], RULE.weight);
+			}
+		}
+
+		template<std::size_t... O>
+		void finish_all(const std::array<int32_t, OUTPUTS>& sums, std::index_sequence<O...>) {
+			((outputs[O] = finish(TOPOLOGY.outputs[O], sums[O], outputs[O])), ...);
+		}
+
+		Outputs outputs {};
+};
+
+/// Mixer for a topology that's only known at run time (ex. loaded from the parameter store), giving the same results
+/// as Mixer by walking the tables
+template<std::size_t INPUTS, std::size_t OUTPUTS, std::size_t RULES>
+class RuntimeMixer {
+	public:
+		using Inputs = std::array<Value, INPUTS>;
+		using Outputs = std::array<Value, OUTPUTS>;
+
+		/// The topology must pass is_valid()
+		explicit constexpr RuntimeMixer(const Topology<INPUTS, OUTPUTS, RULES>& topology) :
+			topology(topology)
+		{
+			for (std::size_t i = 0; i < INPUTS; ++i) {
+				tables[i] = make_expo_table(topology.expo[i]);
+			}
+		}
+
+		const Outputs& mix(const Inputs& in) {
+			std::array<int32_t, INPUTS> shaped;
+			for (std::size_t i = 0; i < INPUTS; ++i) {
+				shaped[i] = (topology.expo[i] == 0) ? in[i] : shape(tables[i], in[i]);
+			}
+
+			std::array<int32_t, OUTPUTS> sums {};
+			for (const auto& rule : topology.rules) {
+				sums[rule.output] += weigh(shaped[rule.input], rule.weight);
+			}
+
+			for (std::size_t o = 0; o < OUTPUTS; ++o) {
+				outputs[o] = finish(topology.outputs[o], sums[o], outputs[o]);
+			}
+			return outputs;
+		}
+
+		void reset(const Outputs& values = {}) {
+			outputs = values;
+		}
+
+	private:
+		Topology<INPUTS, OUTPUTS, RULES> topology;
+		std::array<ExpoTable, INPUTS> tables {};
+		Outputs outputs {};
+};
+
+} // namespace mixer
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+#include <embedded_util/safety.hpp>
+
+class PbufPool;
+
+/// One fixed-size segment of a packet buffer
+///
+/// Data larger than a segment is held in a chain linked through next. Each segment is reference counted on its own and
+/// holds a reference to the next one, so a consumer can keep the segment holding the bytes it needs while the segments
+/// before it return to the pool.
+struct Pbuf {
+	Pbuf* next = nullptr;
+	PbufPool* pool = nullptr;
+	uint8_t* storage = nullptr;
+	/// Bytes used in this segment
+	uint16_t length = 0;
+	uint16_t capacity = 0;
+	uint8_t refs = 0;
+
+	std::span<const uint8_t> data() const { return {storage, length}; }
+	std::string_view chars() const { return {reinterpret_cast<const char*>(storage), length}; }
+};
+
+/// Allocator for Pbuf segments from fixed storage
+///
+/// Allocation and release are O(1) through a free list. Use StaticPbufPool to provide the storage.
+class PbufPool {
+	public:
+
+		struct Stats {
+			/// Fewest free segments there have been
+			uint16_t low_water = 0;
+			/// Allocations refused because the pool was empty
+			uint32_t failures = 0;
+		};
+
+		DISALLOW_COPY_AND_MOVE(PbufPool);
+
+		/// Take one empty segment with a reference count of 1
+		/// @return nullptr if the pool is empty
+		Pbuf* allocate() {
+			Pbuf* p = free_list;
+			if (p == nullptr) {
+				++stats.failures;
+				return nullptr;
+			}
+
+			free_list = p->next;
+			p->next = nullptr;
+			p->length = 0;
+			p->refs = 1;
+
+			if (--free_count < stats.low_water) {
+				stats.low_water = free_count;
+			}
+			return p;
+		}
+
+		/// Take a chain of segments holding len bytes in total, each segment filled in order
+		/// @return nullptr if there aren't enough free segments, in which case nothing is taken
+		Pbuf* allocate_chain(std::size_t len) {
+			std::size_t needed = (len == 0) ? 1 : (len + segment_size - 1) / segment_size;
+			if (needed > free_count) {
+				++stats.failures;
+				return nullptr;
+			}
+
+			Pbuf* head = nullptr;
+			Pbuf** link = &head;
+			for (std::size_t i = 0; i < needed; ++i) {
+				Pbuf* p = allocate();
+				p->length = static_cast<uint16_t>((len > segment_size) ? segment_size : len);
+				len -= p->length;
+				*link = p;
+				link = &p->next;
+			}
+			return head;
+		}
+
+		/// Add a reference to one segment
+		static void retain(Pbuf* p) {
+			if (p != nullptr) {
+				++p->refs;
+			}
+		}
+
+		/// Drop a reference to a chain. Each segment whose count reaches zero goes back to its pool, along with the
+		/// reference it held to the next segment.
+		static void release(Pbuf* p) {
+			while (p != nullptr && --p->refs == 0) {
+				Pbuf* next = p->next;
+				p->pool->give_back(p);
+				p = next;
+			}
+		}
+
+		std::size_t segment_capacity() const { return segment_size; }
+		std::size_t available() const { return free_count; }
+		const Stats& get_stats() const { return stats; }
+
+	protected:
+
+		PbufPool(Pbuf* headers, uint8_t* storage, std::size_t segment_size, std::size_t count) :
+			segment_size(segment_size),
+			free_count(count)
+		{
+			for (std::size_t i = 0; i < count; ++i) {
+				headers[i].pool = this;
+				headers[i].storage = storage + i * segment_size;
+				headers[i].capacity = static_cast<uint16_t>(segment_size);
+				headers[i].next = (i + 1 < count) ? &headers[i + 1] : nullptr;
+			}
+			free_list = (count > 0) ? headers : nullptr;
+			stats.low_water = static_cast<uint16_t>(count);
+		}
+
+	private:
+
+		void give_back(Pbuf* p) {
+			p->next = free_list;
+			free_list = p;
+			++free_count;
+		}
+
+		std::size_t segment_size;
+		std::size_t free_count;
+		Pbuf* free_list = nullptr;
+		Stats stats;
+};
+
+/// Storage for StaticPbufPool, a base class so it's constructed before the pool links it into the free list
+template<std::size_t SEGMENT_SIZE, std::size_t COUNT>
+struct PbufPoolStorage {
+	std::array<Pbuf, COUNT> headers;
+	std::array<uint8_t, SEGMENT_SIZE * COUNT> storage;
+};
+
+/// PbufPool with its own storage for COUNT segments of SEGMENT_SIZE bytes
+template<std::size_t SEGMENT_SIZE, std::size_t COUNT>
+class StaticPbufPool : private PbufPoolStorage<SEGMENT_SIZE, COUNT>, public PbufPool {
+	public:
+		static_assert(SEGMENT_SIZE <= UINT16_MAX, "StaticPbufPool: segment too large");
+		static_assert(COUNT <= UINT16_MAX, "StaticPbufPool: too many segments");
+
+		StaticPbufPool() :
+			PbufPool(this->headers.data(), this->storage.data(), SEGMENT_SIZE, COUNT)
+		{}
+
+		/// RAM used including segment headers
+		static constexpr std::size_t footprint() { return COUNT * (SEGMENT_SIZE + sizeof(Pbuf)); }
+};
+
+/// Counted reference to a Pbuf chain, released when the last copy is destroyed
+///
+/// Copying a reference shares the memory rather than duplicating it. The chain can be read as a scatter/gather list by
+/// walking the segments from get().
+class PbufRef {
+	public:
+		PbufRef() = default;
+
+		/// Take ownership of a reference, such as one returned by PbufPool::allocate()
+		explicit PbufRef(Pbuf* p) :
+			p(p)
+		{}
+
+		PbufRef(const PbufRef& other) :
+			p(other.p)
+		{
+			PbufPool::retain(p);
+		}
+
+		PbufRef(PbufRef&& other) noexcept :
+			p(other.p)
+		{
+			other.p = nullptr;
+		}
+
+		PbufRef& operator=(PbufRef other) noexcept {
+			Pbuf* old = p;
+			p = other.p;
+			other.p = old;
+			return *this;
+		}
+
+		~PbufRef() {
+			PbufPool::release(p);
+		}
+
+		Pbuf* get() const { return p; }
+		explicit operator bool() const { return p != nullptr; }
+
+		/// Total bytes in the chain
+		std::size_t size() const {
+			std::size_t total = 0;
+			for (const Pbuf* s = p; s != nullptr; s = s->next) {
+				total += s->length;
+			}
+			return total;
+		}
+
+		/// Gather up to len bytes starting at offset into dest
+		/// @return The number of bytes copied
+		std::size_t copy_out(uint8_t* dest, std::size_t offset, std::size_t len) const {
+			std::size_t copied = 0;
+			for (const Pbuf* s = p; s != nullptr && copied < len; s = s->next) {
+				if (offset >= s->length) {
+					offset -= s->length;
+					continue;
+				}
+				std::size_t n = s->length - offset;
+				if (n > len - copied) {
+					n = len - copied;
+				}
+				std::memcpy(dest + copied, s->storage + offset, n);
+				copied += n;
+				offset = 0;
+			}
+			return copied;
+		}
+
+	private:
+		Pbuf* p = nullptr;
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+/// Single-producer, single-consumer byte FIFO
+///
+/// The read and write positions run freely and are masked on access, so a full buffer is distinguished from an empty
+/// one without giving up a slot. Readers can look at the stored bytes in place with peek() and consume() rather than
+/// copying them out.
+///
+/// @tparam CAPACITY Size in bytes, which must be a power of two
+template<std::size_t CAPACITY>
+class RingBuffer {
+	public:
+
+		static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "RingBuffer: capacity must be a power of two");
+
+		/// Append up to len bytes
+		/// @return The number of bytes stored, which is less than len if the buffer filled up
+		std::size_t write(const uint8_t* data, std::size_t len) {
+			if (len > free_space()) {
+				len = free_space();
+			}
+
+			std::size_t start = tail & MASK;
+			std::size_t first = (len < CAPACITY - start) ? len : CAPACITY - start;
+			std::memcpy(&storage[start], data, first);
+			std::memcpy(&storage[0], data + first, len - first);
+			tail += len;
+			return len;
+		}
+
+		/// The oldest stored bytes that are contiguous in memory. Call again after consume() for the rest.
+		std::span<const uint8_t> peek() const {
+			std::size_t start = head & MASK;
+			std::size_t len = size();
+			if (len > CAPACITY - start) {
+				len = CAPACITY - start;
+			}
+			return std::span<const uint8_t>(&storage[start], len);
+		}
+
+		/// Discard the n oldest bytes
+		void consume(std::size_t n) {
+			head += (n < size()) ? n : size();
+		}
+
+		/// Copy out and remove up to max bytes
+		/// @return The number of bytes copied
+		std::size_t read(uint8_t* dest, std::size_t max) {
+			std::size_t copied = 0;
+			while (copied < max && size() > 0) {
+				auto chunk = peek();
+				std::size_t n = (chunk.size() < max - copied) ? chunk.size() : max - copied;
+				std::memcpy(dest + copied, chunk.data(), n);
+				consume(n);
+				copied += n;
+			}
+			return copied;
+		}
+
+		void clear() { head = tail; }
+
+		std::size_t size() const { return tail - head; }
+		std::size_t free_space() const { return CAPACITY - size(); }
+		bool empty() const { return head == tail; }
+
+		static constexpr std::size_t capacity() { return CAPACITY; }
+
+	private:
+		static constexpr std::size_t MASK = CAPACITY - 1;
+
+		std::array<uint8_t, CAPACITY> storage;
+		std::size_t head = 0;
+		std::size_t tail = 0;
+};
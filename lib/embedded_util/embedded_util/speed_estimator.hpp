@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+
+/// Edge rate of an encoder from timestamped edges, switching between measuring periods and counting edges
+///
+/// At low rates the time between edges is long compared to the timestamp jitter, so the last period gives a precise
+/// rate and updates on every edge. Its error grows with the rate, while counting the edges seen between updates has an
+/// error of one edge per window, which shrinks with the rate. The two are even around
+/// sqrt(clock / (jitter * window)): with 50 cycles of jitter at 320 MHz and a 10 ms window, about 25 kHz. The estimator
+/// switches to counting above count_above_mhz and back below period_below_mhz; keep a gap between them so it doesn't
+/// flip back and forth.
+///
+/// Periods are measured between edges of the same polarity, so an uneven duty cycle doesn't matter. When edges stop,
+/// the time since the last one bounds the period, so the rate falls away smoothly and reads 0 below min_mhz.
+///
+/// Rates are edges per second in thousandths (mHz). Timestamps are a free-running 32-bit cycle count, and update() has
+/// to be called before it wraps (13 s at 320 MHz).
+class SpeedEstimator {
+	public:
+		enum class Mode : uint8_t {
+			PERIOD,
+			COUNT,
+		};
+
+		struct Config {
+			/// Rate of the timestamps
+			uint32_t clock_hz;
+			/// Switch to counting edges above this rate
+			uint32_t count_above_mhz;
+			/// Switch back to measuring periods below this rate
+			uint32_t period_below_mhz;
+			/// Report 0 below this rate
+			uint32_t min_mhz;
+		};
+
+		explicit constexpr SpeedEstimator(const Config& config) :
+			config(config)
+		{}
+
+		/// Feed an edge, in the order they happened
+		/// @param after_gap Edges were lost before this one, so it doesn't complete a period
+		void on_edge(uint32_t cycles, bool rising, bool after_gap = false) {
+			if (after_gap) {
+				forget_edges();
+			}
+
+			uint32_t polarity = rising ? 1 : 0;
+			if (seen[polarity]) {
+				period = cycles - last[polarity];
+				have_period = true;
+			}
+			last[polarity] = cycles;
+			seen[polarity] = true;
+			last_rising = rising;
+			last_edge = cycles;
+		}
+
+		/// Work out the rate at a fixed interval, after feeding the edges so far
+		/// @param edge_count Running total of edges, including any that weren't fed
+		/// @return The edge rate in mHz
+		uint32_t update(uint32_t now, uint32_t edge_count) {
+			// Edges too old to end a period above min_mhz are forgotten before the time since them can wrap around
+			if ((seen[0] || seen[1]) && now - last_edge > max_period()) {
+				forget_edges();
+			}
+
+			uint32_t counted = edge_count - last_count;
+			uint32_t elapsed = now - last_update;
+			last_count = edge_count;
+			last_update = now;
+
+			if (mode == Mode::COUNT) {
+				rate_mhz = (elapsed == 0) ? rate_mhz : scale(counted, elapsed);
+				if (rate_mhz < config.period_below_mhz) {
+					mode = Mode::PERIOD;
+				}
+			} else {
+				rate_mhz = period_rate(now);
+				if (rate_mhz > config.count_above_mhz) {
+					mode = Mode::COUNT;
+				}
+			}
+
+			if (rate_mhz < config.min_mhz) {
+				rate_mhz = 0;
+			}
+			return rate_mhz;
+		}
+
+		/// Change the rate of the timestamps, such as after a core clock change. Edges stamped before it are forgotten.
+		void set_clock(uint32_t clock_hz) {
+			config.clock_hz = clock_hz;
+			forget_edges();
+		}
+
+		uint32_t get_rate_mhz() const { return rate_mhz; }
+		Mode get_mode() const { return mode; }
+
+	private:
+		/// mHz for a number of edges over a number of cycles, done once per update so 64 bits are affordable
+		uint32_t scale(uint32_t edges, uint32_t cycles) const {
+			uint64_t mhz = static_cast<uint64_t>(edges) * config.clock_hz * 1000 / cycles;
+			return (mhz > UINT32_MAX) ? UINT32_MAX : static_cast<uint32_t>(mhz);
+		}
+
+		/// Longest period that's still above min_mhz, at most half the timestamps' range
+		uint32_t max_period() const {
+			uint64_t cycles = 2000ULL * config.clock_hz / (config.min_mhz ? config.min_mhz : 1);
+			return (cycles > UINT32_MAX / 2) ? UINT32_MAX / 2 : static_cast<uint32_t>(cycles);
+		}
+
+		uint32_t period_rate(uint32_t now) const {
+			if (!have_period) {
+				return 0;
+			}
+
+			// The next edge has the other polarity and ends a period that started at the last edge of that polarity,
+			// so that period is already at least this long
+			uint32_t other = last_rising ? 0 : 1;
+			uint32_t open = seen[other] ? now - last[other] : 0;
+			uint32_t bound = (open > period) ? open : period;
+
+			// Each period holds a rising and a falling edge
+			return scale(2, bound);
+		}
+
+		void forget_edges() {
+			seen[0] = false;
+			seen[1] = false;
+			have_period = false;
+		}
+
+		Config config;
+		Mode mode = Mode::PERIOD;
+		uint32_t rate_mhz = 0;
+
+		/// Last timestamp of a falling (0) and rising (1) edge
+		uint32_t last[2] = {0, 0};
+		bool seen[2] = {false, false};
+		bool last_rising = false;
+		uint32_t last_edge = 0;
+		uint32_t period = 0;
+		bool have_period = false;
+
+		uint32_t last_count = 0;
+		uint32_t last_update = 0;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Variable-length integer encoding (LEB128) with zigzag mapping for signed values
+///
+/// Small magnitudes take fewer bytes: values in [-64, 63] fit in one byte after zigzag mapping, which is what makes
+/// delta-encoded samples compact.
+namespace varint {
+
+/// Longest encoding of a 32-bit value
+constexpr std::size_t MAX_BYTES = 5;
+
+/// Map signed values to unsigned so that small magnitudes of either sign become small numbers
+constexpr uint32_t zigzag_encode(int32_t value) {
+	return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+constexpr int32_t zigzag_decode(uint32_t value) {
+	return static_cast<int32_t>((value >> 1) ^ (~(value & 1) + 1));
+}
+
+/// Change from previous to value, wrapping around instead of overflowing so any two values have a delta
+constexpr int32_t delta(int32_t value, int32_t previous) {
+	return static_cast<int32_t>(static_cast<uint32_t>(value) - static_cast<uint32_t>(previous));
+}
+
+/// Reverse delta(), returning the value that previous changed into
+constexpr int32_t apply_delta(int32_t previous, int32_t change) {
+	return static_cast<int32_t>(static_cast<uint32_t>(previous) + static_cast<uint32_t>(change));
+}
+
+/// Write value to out, which must have room for MAX_BYTES
+/// @return The number of bytes written
+inline std::size_t encode(uint32_t value, uint8_t* out) {
+	std::size_t n = 0;
+	while (value >= 0x80) {
+		out[n++] = static_cast<uint8_t>(value) | 0x80;
+		value >>= 7;
+	}
+	out[n++] = static_cast<uint8_t>(value);
+	return n;
+}
+
+/// Read a value from in
+/// @return The number of bytes consumed, or 0 if the input ended early or the encoding is too long
+inline std::size_t decode(const uint8_t* in, std::size_t len, uint32_t& value) {
+	value = 0;
+	for (std::size_t n = 0; n < len && n < MAX_BYTES; ++n) {
+		value |= static_cast<uint32_t>(in[n] & 0x7F) << (7 * n);
+		if (!(in[n] & 0x80)) {
+			return n + 1;
+		}
+	}
+	return 0;
+}
+
+} // namespace varint
@@ -0,0 +1,204 @@
+#include <esp32_at/at_client.hpp>
+
+#include <utility>
+
+/// Sent after a timeout. Its answer is the last one owed, since the ESP32 answers in order.
+static constexpr std::string_view RESYNC_COMMAND = "AT\r\n";
+
+esp32::AtClient::AtClient(AtTransport& transport, uint8_t max_in_flight) :
+	transport(transport),
+	parser(*this),
+	max_in_flight(max_in_flight == 0 ? 1 : max_in_flight)
+{}
+
+bool esp32::AtClient::submit(Command command) {
+	if (count == QUEUE_CAPACITY) {
+		return false;
+	}
+
+	Slot& s = slot(count);
+	s.command = std::move(command);
+	s.prompt_seen = false;
+	++count;
+
+	return true;
+}
+
+void esp32::AtClient::poll(uint32_t now) {
+	now_ms = now;
+
+	// Parse everything that has arrived; the handlers complete commands as their final responses are found
+	for (auto chunk = transport.receive(); !chunk.empty(); chunk = transport.receive()) {
+		parser.feed(chunk, transport.receive_buffer());
+	}
+
+	// If the marker isn't answered in time, the owed answers were lost and everything before it has arrived
+	if (resyncing) {
+		if (marker_sent && static_cast<int32_t>(now_ms - marker_deadline_ms) >= 0) {
+			resyncing = false;
+			unanswered = 0;
+		}
+	} else if (sent > 0 && static_cast<int32_t>(now_ms - slot(0).deadline_ms) >= 0) {
+		// Only the oldest command can time out since later ones can't be answered before it
+		expire();
+	}
+
+	send_pending();
+}
+
+void esp32::AtClient::abort_all() {
+	parser.reset();
+	hold = false;
+	resyncing = false;
+	unanswered = 0;
+	sent = count;
+	while (count > 0) {
+		complete(Result::ABORTED);
+	}
+}
+
+void esp32::AtClient::send_pending() {
+	if (resyncing) {
+		if (!marker_sent && transport.send(RESYNC_COMMAND)) {
+			marker_sent = true;
+			++unanswered;
+			marker_deadline_ms = now_ms + DEFAULT_TIMEOUT_MS;
+		}
+		return;
+	}
+
+	// With nothing in flight there's no completion to wait for, so retry after a short delay instead
+	if (hold && sent == 0 && static_cast<int32_t>(now_ms - retry_ms) >= 0) {
+		hold = false;
+	}
+
+	while (!hold && sent < count && sent < max_in_flight) {
+		Slot& next = slot(sent);
+
+		// Data for CIPSEND must follow its prompt immediately, so those commands are never pipelined
+		if (sent > 0 && (!next.command.payload.empty() || !slot(0).command.payload.empty())) {
+			break;
+		}
+
+		if (!transport.send(next.command.text)) {
+			break;
+		}
+
+		next.deadline_ms = now_ms + next.command.timeout_ms;
+		++sent;
+	}
+}
+
+void esp32::AtClient::complete(Result result) {
+	Slot& done = slot(0);
+	CompletionHandler handler = std::move(done.command.on_complete);
+	done.command = Command();
+
+	head = (head + 1) % QUEUE_CAPACITY;
+	--count;
+	--sent;
+	hold = false;
+
+	// The slot is released first so the handler can submit a follow-up command
+	if (handler) {
+		handler(result);
+	}
+}
+
+void esp32::AtClient::expire() {
+	// Every command in flight still owes one final response. The parser is left alone so an answer that is already half
+	// received is counted when it completes.
+	unanswered = sent;
+	resyncing = true;
+	marker_sent = false;
+
+	complete(Result::TIMEOUT);
+	while (sent > 0) {
+		complete(Result::ABORTED);
+	}
+}
+
+void esp32::AtClient::discard(AtParser::LineType type) {
+	// A busy answer also ends a command, since the ESP32 dropped it
+	if (type == AtParser::LineType::INFO || unanswered == 0) {
+		return;
+	}
+	if (--unanswered == 0 && marker_sent) {
+		resyncing = false;
+	}
+}
+
+void esp32::AtClient::on_line(AtParser::LineType type, std::string_view line) {
+	using LineType = AtParser::LineType;
+
+	if (resyncing && type != LineType::URC) {
+		discard(type);
+		return;
+	}
+
+	if (type == LineType::URC || sent == 0) {
+		if (urc_handler) {
+			urc_handler(line);
+		}
+		return;
+	}
+
+	Slot& current = slot(0);
+
+	switch (type) {
+		case LineType::INFO:
+			if (current.command.on_line) {
+				current.command.on_line(line);
+			}
+			break;
+
+		case LineType::OK:
+			// For CIPSEND the first OK only acknowledges the command and the prompt follows
+			if (current.command.payload.empty() || current.prompt_seen) {
+				complete(Result::OK);
+			}
+			break;
+
+		case LineType::SEND_OK:
+			complete(Result::OK);
+			break;
+
+		case LineType::ERROR:
+		case LineType::SEND_FAIL:
+			complete(Result::ERROR);
+			break;
+
+		case LineType::FAIL:
+			complete(Result::FAIL);
+			break;
+
+		case LineType::BUSY:
+			// The most recently sent command was dropped; send it again after the oldest completes
+			--sent;
+			hold = true;
+			retry_ms = now_ms + BUSY_RETRY_MS;
+			break;
+
+		case LineType::URC:
+			break;
+	}
+}
+
+void esp32::AtClient::on_prompt() {
+	if (sent == 0) {
+		return;
+	}
+
+	Slot& current = slot(0);
+	if (!current.command.payload.empty() && !current.prompt_seen) {
+		current.prompt_seen = true;
+		transport.send(current.command.payload);
+		current.deadline_ms = now_ms + current.command.timeout_ms;
+	}
+}
+
+void esp32::AtClient::on_ipd(const AtParser::IpdFragment& fragment) {
+	if (data_handler) {
+		data_handler(fragment);
+	}
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+#include <embedded_util/safety.hpp>
+
+#include <esp32_at/at_parser.hpp>
+#include <esp32_at/at_transport.hpp>
+
+namespace esp32 {
+
+/// Non-blocking client for the ESP32 AT command set
+///
+/// Commands are queued with a timeout and completion callbacks, then sent from poll() as the link allows. Up to
+/// max_in_flight commands are sent before their responses arrive; the ESP32 answers in order so the responses are
+/// matched to commands first-in, first-out. If the ESP32 reports that it is busy, the dropped command is sent again once
+/// the command ahead of it completes.
+///
+/// A command that times out may still be answered, and that answer would be matched to the command behind it. So a
+/// timeout also gives up on the commands sent after it, and nothing more is sent until a marker command confirms that
+/// the late answers have been discarded.
+class AtClient : private AtParser::Listener {
+	public:
+
+		/// Outcome of a command
+		enum class Result : uint8_t {
+			OK,
+			ERROR,
+			FAIL,
+			TIMEOUT,
+			/// Removed from the queue by abort_all() before completing, or sent behind a command that timed out. The
+			/// ESP32 may or may not have carried it out.
+			ABORTED,
+		};
+
+		using LineHandler = std::function<void(std::string_view)>;
+		using CompletionHandler = std::function<void(Result)>;
+		using DataHandler = std::function<void(const AtParser::IpdFragment&)>;
+
+		static constexpr uint32_t DEFAULT_TIMEOUT_MS = 1000;
+
+		/// Delay before resending a command that was dropped as busy when nothing else is in flight
+		static constexpr uint32_t BUSY_RETRY_MS = 20;
+
+		/// Maximum number of commands waiting or in flight
+		static constexpr std::size_t QUEUE_CAPACITY = 8;
+
+		struct Command {
+			/// Command text including the trailing CR LF. The memory must remain valid until completion.
+			std::string_view text {};
+
+			/// Time allowed for the response, counted from when the command is sent
+			uint32_t timeout_ms = DEFAULT_TIMEOUT_MS;
+
+			/// Called with each intermediate response line (optional)
+			LineHandler on_line {};
+
+			/// Called once when the command finishes (optional)
+			CompletionHandler on_complete {};
+
+			/// Data sent after the ESP32 answers with the '>' prompt (for AT+CIPSEND=<len>). The command then completes
+			/// on "SEND OK" rather than "OK". The memory must remain valid until completion.
+			std::string_view payload {};
+		};
+
+		explicit AtClient(AtTransport& transport, uint8_t max_in_flight = 4);
+
+		DISALLOW_COPY_AND_MOVE(AtClient);
+
+		/// Add a command to the queue
+		/// @return false if the queue is full
+		bool submit(Command command);
+
+		/// Receive and dispatch responses, expire timed out commands, and send queued commands (or the marker command
+		/// after a timeout)
+		/// @param now_ms A free-running millisecond timestamp (wrap-around is handled)
+		void poll(uint32_t now_ms);
+
+		/// Complete every queued command with Result::ABORTED and discard any partially parsed response
+		void abort_all();
+
+		/// Handle unsolicited notifications, and INFO lines received while no command is in flight
+		void set_urc_handler(LineHandler handler) { urc_handler = std::move(handler); }
+
+		/// Handle +IPD network data as it is parsed
+		void set_data_handler(DataHandler handler) { data_handler = std::move(handler); }
+
+		/// Number of commands that have not completed, including those in flight
+		std::size_t pending() const { return count; }
+
+		/// Number of commands sent and waiting for a response
+		std::size_t in_flight() const { return sent; }
+
+	private:
+
+		struct Slot {
+			Command command;
+			uint32_t deadline_ms = 0;
+			bool prompt_seen = false;
+		};
+
+		void on_line(AtParser::LineType type, std::string_view line) override;
+		void on_prompt() override;
+		void on_ipd(const AtParser::IpdFragment& fragment) override;
+
+		/// Send queued commands while the pipeline has room
+		void send_pending();
+
+		/// Remove the oldest command from the queue and report its result
+		void complete(Result result);
+
+		/// Time out the oldest command, give up on the ones sent after it, and start discarding their answers
+		void expire();
+
+		/// Count a response while discarding the answers to expired commands
+		void discard(AtParser::LineType type);
+
+		Slot& slot(std::size_t i) { return queue[(head + i) % QUEUE_CAPACITY]; }
+
+		AtTransport& transport;
+		AtParser parser;
+		uint8_t max_in_flight;
+
+		std::array<Slot, QUEUE_CAPACITY> queue;
+		std::size_t head = 0;
+		std::size_t count = 0;
+		std::size_t sent = 0;
+
+		/// Set when the ESP32 reported busy; no more commands are sent until the oldest one completes
+		bool hold = false;
+		uint32_t retry_ms = 0;
+
+		/// Set after a timeout until the answers still owed by the ESP32 have been discarded
+		bool resyncing = false;
+		bool marker_sent = false;
+
+		/// Final responses still owed for expired commands, including the marker once it is sent
+		std::size_t unanswered = 0;
+		uint32_t marker_deadline_ms = 0;
+
+		uint32_t now_ms = 0;
+
+		LineHandler urc_handler;
+		DataHandler data_handler;
+
+};
+
+} // namespace esp32
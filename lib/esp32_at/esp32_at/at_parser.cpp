@@ -0,0 +1,193 @@
+#include <esp32_at/at_parser.hpp>
+
+#include <algorithm>
+
+static constexpr std::string_view IPD_PREFIX = "+IPD,";
+
+/// Lines that the ESP32 sends on its own rather than in response to a command
+static constexpr std::string_view URC_PREFIXES[] = {
+	"ready",
+	"WIFI ",
+	"+STA_",
+	"+DIST_STA_IP",
+	"+LINK_CONN",
+	"CONNECT",
+	"CLOSED",
+};
+
+static bool starts_with(std::string_view str, std::string_view prefix) {
+	return str.substr(0, prefix.size()) == prefix;
+}
+
+/// Parse a decimal field, returning false if it contains anything but digits
+static bool parse_uint(std::string_view str, uint32_t& value) {
+	if (str.empty()) {
+		return false;
+	}
+
+	value = 0;
+	for (char c : str) {
+		if (c < '0' || c > '9') {
+			return false;
+		}
+		value = value * 10 + (c - '0');
+	}
+	return true;
+}
+
+esp32::AtParser::LineType esp32::AtParser::classify(std::string_view line) {
+	if (line == "OK") {
+		return LineType::OK;
+	} else if (line == "ERROR") {
+		return LineType::ERROR;
+	} else if (line == "FAIL") {
+		return LineType::FAIL;
+	} else if (line == "SEND OK") {
+		return LineType::SEND_OK;
+	} else if (line == "SEND FAIL") {
+		return LineType::SEND_FAIL;
+	} else if (starts_with(line, "busy ")) {
+		return LineType::BUSY;
+	}
+
+	// Connection notifications are prefixed with the link ID in multiple connection mode (ex. "0,CONNECT")
+	std::string_view unprefixed = line;
+	if (line.size() >= 2 && line[0] >= '0' && line[0] <= '9' && line[1] == ',') {
+		unprefixed = line.substr(2);
+	}
+
+	for (auto prefix : URC_PREFIXES) {
+		if (starts_with(unprefixed, prefix)) {
+			return LineType::URC;
+		}
+	}
+
+	return LineType::INFO;
+}
+
+void esp32::AtParser::feed(std::string_view chunk, Pbuf* buffer) {
+	std::size_t pos = 0;
+	ipd.buffer = buffer;
+
+	while (pos < chunk.size()) {
+
+		// Hand payload bytes straight to the listener
+		if (state == State::PAYLOAD) {
+			std::size_t count = std::min<std::size_t>(ipd.length - ipd.offset, chunk.size() - pos);
+			ipd.data = chunk.substr(pos, count);
+			listener.on_ipd(ipd);
+
+			ipd.offset += count;
+			pos += count;
+			if (ipd.offset == ipd.length) {
+				state = State::LINE;
+			}
+			continue;
+		}
+
+		// The CIPSEND prompt is not followed by a line terminator
+		if (carry_length == 0 && chunk[pos] == '>') {
+			listener.on_prompt();
+			++pos;
+			continue;
+		}
+
+		// Scan for the end of the line. A +IPD header ends at the ':' before its payload instead.
+		std::size_t start = pos;
+		bool terminated = false;
+		for (; pos < chunk.size(); ++pos) {
+			char c = chunk[pos];
+			if (c == '\n') {
+				std::string_view line = (carry_length == 0) ?
+					chunk.substr(start, pos - start) : append_carry(chunk, start, pos);
+				++pos;
+				finish_line(line);
+				terminated = true;
+				break;
+			} else if (c == ':' && line_is_ipd(chunk, start, pos)) {
+				std::string_view header = (carry_length == 0) ?
+					chunk.substr(start, pos - start) : append_carry(chunk, start, pos);
+				++pos;
+				finish_ipd_header(header);
+				terminated = true;
+				break;
+			}
+		}
+
+		// Save an unterminated line until the rest of it arrives
+		if (!terminated) {
+			append_carry(chunk, start, chunk.size());
+		}
+	}
+}
+
+void esp32::AtParser::reset() {
+	state = State::LINE;
+	carry_length = 0;
+	ipd = {-1, 0, 0, {}, nullptr};
+}
+
+void esp32::AtParser::finish_line(std::string_view line) {
+	carry_length = 0;
+
+	if (!line.empty() && line.back() == '\r') {
+		line.remove_suffix(1);
+	}
+
+	// Responses are padded with blank lines
+	if (line.empty()) {
+		return;
+	}
+
+	listener.on_line(classify(line), line);
+}
+
+void esp32::AtParser::finish_ipd_header(std::string_view header) {
+	carry_length = 0;
+
+	// The header is "+IPD,<len>" or "+IPD,<link ID>,<len>", optionally followed by the remote IP and port
+	header.remove_prefix(IPD_PREFIX.size());
+
+	std::size_t comma = header.find(',');
+	std::string_view first = header.substr(0, comma);
+	std::string_view second = (comma == std::string_view::npos) ? std::string_view() : header.substr(comma + 1);
+	second = second.substr(0, second.find(','));
+
+	uint32_t first_value = 0;
+	uint32_t second_value = 0;
+	if (!parse_uint(first, first_value)) {
+		// Malformed header; report it like any other line so it isn't silently lost
+		listener.on_line(LineType::INFO, header);
+		return;
+	}
+
+	// A second numeric field means the first was the link ID. In single connection mode the second field, if
+	// present, is the remote IP which is never a bare number.
+	if (parse_uint(second, second_value)) {
+		ipd = {static_cast<int8_t>(first_value), static_cast<uint16_t>(second_value), 0, {}, ipd.buffer};
+	} else {
+		ipd = {-1, static_cast<uint16_t>(first_value), 0, {}, ipd.buffer};
+	}
+
+	if (ipd.length > 0) {
+		state = State::PAYLOAD;
+	}
+}
+
+bool esp32::AtParser::line_is_ipd(std::string_view chunk, std::size_t start, std::size_t end) const {
+	// The line may be split between the carry buffer and this chunk
+	std::size_t from_carry = std::min(carry_length, IPD_PREFIX.size());
+	if (std::string_view(carry.data(), from_carry) != IPD_PREFIX.substr(0, from_carry)) {
+		return false;
+	}
+
+	std::size_t from_chunk = IPD_PREFIX.size() - from_carry;
+	return end - start >= from_chunk && chunk.substr(start, from_chunk) == IPD_PREFIX.substr(from_carry);
+}
+
+std::string_view esp32::AtParser::append_carry(std::string_view chunk, std::size_t start, std::size_t end) {
+	std::size_t count = std::min(end - start, CARRY_CAPACITY - carry_length);
+	std::copy_n(chunk.data() + start, count, carry.data() + carry_length);
+	carry_length += count;
+	return std::string_view(carry.data(), carry_length);
+}
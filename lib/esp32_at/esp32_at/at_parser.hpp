@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <embedded_util/pbuf.hpp>
+
+namespace esp32 {
+
+/// Incremental tokenizer for responses from the ESP32 AT firmware
+///
+/// Data is fed in arbitrary chunks as it arrives from the link. Complete lines and +IPD payloads are reported as views
+/// into the chunk that was fed, so nothing is copied in the common case. Only a line that is split across two chunks is
+/// assembled in a small carry buffer.
+class AtParser {
+	public:
+
+		/// Classification of a complete response line
+		enum class LineType : uint8_t {
+			/// Intermediate response to the current command (ex. "+CIFSR:STAIP,...")
+			INFO,
+			/// Final responses
+			OK,
+			ERROR,
+			FAIL,
+			SEND_OK,
+			SEND_FAIL,
+			/// "busy p..." or "busy s...": the ESP32 dropped a command because it was still processing another
+			BUSY,
+			/// Unsolicited notification that is not part of a command response (ex. "WIFI CONNECTED", "0,CLOSED")
+			URC,
+		};
+
+		/// A piece of a +IPD network data payload
+		struct IpdFragment {
+			/// Connection number when multiple connections are enabled (AT+CIPMUX=1), otherwise -1
+			int8_t link_id;
+			/// Total length of the payload announced in the +IPD header
+			uint16_t length;
+			/// Offset of this fragment within the payload
+			uint16_t offset;
+			/// Payload bytes, pointing into the chunk being parsed
+			std::string_view data;
+			/// Segment holding data if the chunk came from a PbufPool (otherwise nullptr). Retain it to keep the data.
+			Pbuf* buffer;
+
+			/// True if this fragment completes the payload
+			bool is_last() const { return offset + data.size() == length; }
+		};
+
+		/// Receives the tokens found by the parser. Views are only valid for the duration of the call.
+		class Listener {
+			public:
+				virtual void on_line(LineType type, std::string_view line) = 0;
+				/// The '>' prompt that requests the data for AT+CIPSEND
+				virtual void on_prompt() = 0;
+				virtual void on_ipd(const IpdFragment& fragment) = 0;
+		};
+
+		/// Longest line that can be reassembled when split across chunks; longer lines are truncated
+		static constexpr std::size_t CARRY_CAPACITY = 128;
+
+		explicit AtParser(Listener& listener) :
+			listener(listener)
+		{}
+
+		/// Parse the next chunk of received data
+		/// @param buffer The segment holding chunk, passed on with +IPD fragments so handlers can keep them
+		void feed(std::string_view chunk, Pbuf* buffer = nullptr);
+
+		/// Discard any partial line or payload (ex. after the link was resynchronized)
+		void reset();
+
+		/// Classify a line with its terminator removed
+		static LineType classify(std::string_view line);
+
+	private:
+
+		enum class State : uint8_t {
+			LINE,
+			PAYLOAD,
+		};
+
+		/// Handle a line terminated by '\n'
+		void finish_line(std::string_view line);
+
+		/// Handle a "+IPD,..." header terminated by ':'
+		void finish_ipd_header(std::string_view header);
+
+		/// Return true if the line being assembled from the carry buffer and chunk[start, end) begins with "+IPD,"
+		bool line_is_ipd(std::string_view chunk, std::size_t start, std::size_t end) const;
+
+		/// Append chunk[start, end) to the carry buffer and return the assembled line
+		std::string_view append_carry(std::string_view chunk, std::size_t start, std::size_t end);
+
+		Listener& listener;
+
+		State state = State::LINE;
+
+		/// Remaining payload for the current +IPD
+		IpdFragment ipd {-1, 0, 0, {}, nullptr};
+
+		std::array<char, CARRY_CAPACITY> carry;
+		std::size_t carry_length = 0;
+
+};
+
+} // namespace esp32
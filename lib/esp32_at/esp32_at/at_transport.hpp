@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string_view>
+
+#include <embedded_util/pbuf.hpp>
+
+namespace esp32 {
+
+/// Byte transport between the host and the ESP32 AT firmware
+///
+/// Implementations frame the data for the physical link (SPI, UART, or a simulator). Both calls must return without
+/// waiting on the ESP32 so the AT client can be polled from the main loop.
+class AtTransport {
+	public:
+		/// Send a complete message (usually one AT command with its CR LF) to the ESP32
+		/// @return false if the link could not accept the message
+		virtual bool send(std::string_view data) = 0;
+
+		/// Return the next chunk of data received from the ESP32, or an empty view if nothing is waiting
+		///
+		/// The returned view points into the transport's own receive buffer and is valid until the next call
+		virtual std::string_view receive() = 0;
+
+		/// The segment holding the view last returned by receive(), if the transport receives into a PbufPool
+		///
+		/// Consumers can retain it to keep received data past the next call without copying it.
+		virtual Pbuf* receive_buffer() { return nullptr; }
+};
+
+} // namespace esp32
@@ -0,0 +1,141 @@
+#include <esp32_at/control_uplink.hpp>
+
+#include <cstring>
+
+#include <embedded_util/crc.hpp>
+
+static uint16_t read_u16(const uint8_t* p) {
+	return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_u32(const uint8_t* p) {
+	return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16)
+		| (static_cast<uint32_t>(p[3]) << 24);
+}
+
+esp32::ControlUplink::ControlUplink(int8_t link_id, uint32_t failsafe_us) :
+	link_id(link_id),
+	failsafe_us(failsafe_us)
+{}
+
+bool esp32::ControlUplink::on_ipd(const AtParser::IpdFragment& fragment, uint32_t now_us) {
+	if (fragment.link_id != link_id) {
+		return false;
+	}
+
+	if (fragment.offset == 0) {
+		packet_length = 0;
+		packet_oversize = fragment.length != PACKET_SIZE;
+	}
+
+	if (!packet_oversize) {
+		std::size_t n = fragment.data.size();
+		if (packet_length + n > packet.size()) {
+			packet_oversize = true;
+		} else {
+			std::memcpy(packet.data() + packet_length, fragment.data.data(), n);
+			packet_length += n;
+		}
+	}
+
+	if (fragment.is_last()) {
+		if (packet_oversize || packet_length != PACKET_SIZE) {
+			++stats.corrupt;
+		} else {
+			accept(now_us);
+		}
+		packet_length = 0;
+	}
+	return true;
+}
+
+bool esp32::ControlUplink::poll(uint32_t now_us) {
+	if (!failsafe && now_us - slot.received_us > failsafe_us) {
+		failsafe = true;
+		++stats.failsafes;
+	}
+	return failsafe;
+}
+
+bool esp32::ControlUplink::take_update() {
+	bool was_updated = updated;
+	updated = false;
+	return was_updated;
+}
+
+void esp32::ControlUplink::reset_stats() {
+	stats = Stats();
+	have_transit = false;
+	jitter_scaled = 0;
+}
+
+void esp32::ControlUplink::accept(uint32_t now_us) {
+	if (packet[0] != VERSION || Crc16::calculate(packet.data(), PACKET_SIZE - 2) != read_u16(&packet[PACKET_SIZE - 2])) {
+		++stats.corrupt;
+		return;
+	}
+
+	uint16_t sequence = read_u16(&packet[1]);
+
+	// Sequence numbers are compared with wrap-around, so anything up to half the range behind is old. Once packets have
+	// stopped for the failsafe time the next one starts the count again, since a sender that restarted begins from 0,
+	// and its clock may have restarted too.
+	bool expired = failsafe || now_us - slot.received_us > failsafe_us;
+	if (have_packet && !expired) {
+		int16_t ahead = static_cast<int16_t>(sequence - slot.sequence);
+		if (ahead <= 0) {
+			++stats.stale;
+			return;
+		}
+		stats.lost += ahead - 1;
+	} else if (have_packet) {
+		have_transit = false;
+	}
+
+	slot.sequence = sequence;
+	slot.sent_us = read_u32(&packet[3]);
+	slot.received_us = now_us;
+	for (std::size_t i = 0; i < CHANNELS; ++i) {
+		slot.channels[i] = static_cast<int16_t>(read_u16(&packet[7 + 2 * i]));
+	}
+
+	have_packet = true;
+	updated = true;
+	failsafe = false;
+	++stats.received;
+
+	record_latency(now_us - slot.sent_us);
+}
+
+void esp32::ControlUplink::record_latency(uint32_t transit_us) {
+	if (!have_transit) {
+		min_transit_us = transit_us;
+		last_transit_us = transit_us;
+		have_transit = true;
+	}
+
+	// A faster packet than any before moves the reference. Earlier measurements were relative to a slower one and are
+	// slightly overstated, which is acceptable since the minimum settles quickly.
+	int32_t behind_min = static_cast<int32_t>(transit_us - min_transit_us);
+	if (behind_min < 0) {
+		min_transit_us = transit_us;
+		behind_min = 0;
+	}
+	uint32_t latency = static_cast<uint32_t>(behind_min);
+
+	std::size_t bucket = 0;
+	while (bucket < HISTOGRAM_BOUNDS_US.size() && latency >= HISTOGRAM_BOUNDS_US[bucket]) {
+		++bucket;
+	}
+	++stats.latency_histogram[bucket];
+	if (latency > stats.max_latency_us) {
+		stats.max_latency_us = latency;
+	}
+
+	// J += (|D| - J) / 16
+	int32_t d = static_cast<int32_t>(transit_us - last_transit_us);
+	uint32_t abs_d = static_cast<uint32_t>(d < 0 ? -d : d);
+	jitter_scaled += abs_d - ((jitter_scaled + 8) >> 4);
+	stats.jitter_us = jitter_scaled >> 4;
+	last_transit_us = transit_us;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <embedded_util/safety.hpp>
+
+#include <esp32_at/at_parser.hpp>
+
+namespace esp32 {
+
+/// Receives control packets from +IPD network data and keeps only the most recent one
+///
+/// Packet layout (multi-byte fields little-endian):
+/// - uint8 version, uint16 sequence number, uint32 sender timestamp in microseconds
+/// - CHANNELS int16 channel values
+/// - uint16 CRC-16/CCITT of everything above
+///
+/// Packets are assembled straight from the parser's fragments, checked, and written into a single latest-value slot, so
+/// a late packet never queues up behind a newer one. Packets older than the one in the slot are dropped, except after
+/// the failsafe time without packets, when the next packet is taken whatever its sequence number so a sender that
+/// restarted is followed again.
+///
+/// The sender and receiver clocks are not synchronized, so one-way latency is measured relative to the fastest packet
+/// seen: the smallest arrival minus send time is taken as the fixed offset, and each packet's latency is how far it
+/// trails that. Jitter is the smoothed change in transit time between consecutive packets as in RFC 3550.
+class ControlUplink {
+	public:
+
+		static constexpr std::size_t CHANNELS = 8;
+
+		static constexpr uint8_t VERSION = 1;
+		static constexpr std::size_t PACKET_SIZE = 1 + 2 + 4 + CHANNELS * 2 + 2;
+
+		/// Enter failsafe when no valid packet arrives for this long
+		static constexpr uint32_t DEFAULT_FAILSAFE_US = 250'000;
+
+		/// Upper bounds of the latency histogram buckets in microseconds. The last bucket counts everything larger.
+		static constexpr std::array<uint32_t, 9> HISTOGRAM_BOUNDS_US {
+			250, 500, 1'000, 2'000, 4'000, 8'000, 16'000, 32'000, 64'000
+		};
+
+		struct Command {
+			uint16_t sequence = 0;
+			/// Sender's timestamp
+			uint32_t sent_us = 0;
+			/// Local time the packet finished arriving
+			uint32_t received_us = 0;
+			std::array<int16_t, CHANNELS> channels {};
+		};
+
+		struct Stats {
+			uint32_t received = 0;
+			/// Packets with a bad length, version or CRC
+			uint32_t corrupt = 0;
+			/// Packets older than the one already in the slot
+			uint32_t stale = 0;
+			/// Sequence numbers skipped over
+			uint32_t lost = 0;
+			/// Number of times the failsafe engaged
+			uint32_t failsafes = 0;
+			/// Smoothed jitter in microseconds
+			uint32_t jitter_us = 0;
+			/// Largest relative latency seen
+			uint32_t max_latency_us = 0;
+			std::array<uint32_t, HISTOGRAM_BOUNDS_US.size() + 1> latency_histogram {};
+		};
+
+		/// @param link_id Connection to accept packets from, or -1 when multiple connections are disabled
+		explicit ControlUplink(int8_t link_id = -1, uint32_t failsafe_us = DEFAULT_FAILSAFE_US);
+
+		DISALLOW_COPY_AND_MOVE(ControlUplink);
+
+		/// Handle a +IPD fragment. Fragments from other connections are ignored.
+		/// @param now_us A free-running microsecond timestamp (wrap-around is handled)
+		/// @return true if the fragment was consumed
+		bool on_ipd(const AtParser::IpdFragment& fragment, uint32_t now_us);
+
+		/// Check for lost packets
+		/// @return true if in failsafe
+		bool poll(uint32_t now_us);
+
+		/// The most recent valid command. Check in_failsafe() before acting on it.
+		const Command& latest() const { return slot; }
+
+		/// True until the first packet arrives, and whenever packets stop for the failsafe time
+		bool in_failsafe() const { return failsafe; }
+
+		/// True once per new command since the last call
+		bool take_update();
+
+		const Stats& get_stats() const { return stats; }
+
+		/// Clear the statistics and latency reference, keeping the current command
+		void reset_stats();
+
+	private:
+
+		/// Check a complete packet and update the slot
+		void accept(uint32_t now_us);
+
+		void record_latency(uint32_t transit_us);
+
+		int8_t link_id;
+		uint32_t failsafe_us;
+
+		std::array<uint8_t, PACKET_SIZE> packet;
+		std::size_t packet_length = 0;
+		bool packet_oversize = false;
+
+		Command slot;
+		bool have_packet = false;
+		bool updated = false;
+		bool failsafe = true;
+
+		/// Transit time (arrival minus send time) of the fastest packet and the previous packet
+		uint32_t min_transit_us = 0;
+		uint32_t last_transit_us = 0;
+		bool have_transit = false;
+
+		/// Jitter scaled by 16 to keep the fraction of the 1/16 smoothing
+		uint32_t jitter_scaled = 0;
+
+		Stats stats;
+
+};
+
+} // namespace esp32
@@ -0,0 +1,84 @@
+#include <esp32_at/link_supervisor.hpp>
+
+esp32::LinkSupervisor::LinkSupervisor(SpiLink& link, AtClient& client) :
+	link(link),
+	client(client)
+{}
+
+bool esp32::LinkSupervisor::poll() {
+	if (state == State::HEALTHY) {
+		if (!requested && link.get_error_streak() < TRIGGER_ERRORS) {
+			return true;
+		}
+		requested = false;
+		recover();
+		return state == State::HEALTHY;
+	}
+
+	uint32_t now = link.now_us();
+	if (now - last_ping_us < RESET_PING_INTERVAL_US) {
+		return false;
+	}
+	last_ping_us = now;
+
+	// The ESP32 may have sent its boot messages at any rate while it came up; clear them out before checking
+	if (link.resync(MAX_RESYNC_EXCHANGES)) {
+		link.negotiate();
+		finish(Level::RESET);
+		return true;
+	}
+
+	if (now - reset_us > RESET_TIMEOUT_US) {
+		++stats.reset_timeouts;
+		start_reset();
+	}
+	return false;
+}
+
+void esp32::LinkSupervisor::recover() {
+	fault_us = link.now_us();
+
+	// Responses to anything in flight are lost
+	client.abort_all();
+
+	if (link.resync(MAX_RESYNC_EXCHANGES)) {
+		finish(Level::RESYNC);
+		return;
+	}
+
+	// The errors may come from the clock rate rather than the ESP32 itself
+	link.use_slowest_clock();
+	if (link.resync(MAX_RESYNC_EXCHANGES)) {
+		link.negotiate();
+		finish(Level::SLOW_CLOCK);
+		return;
+	}
+
+	start_reset();
+}
+
+void esp32::LinkSupervisor::start_reset() {
+	// Sent directly since the ESP32 won't answer through the AT client. The command gets through even when reads fail.
+	link.use_slowest_clock();
+	link.send("AT+RST\r\n");
+
+	state = State::RESETTING;
+	reset_us = link.now_us();
+	last_ping_us = reset_us;
+}
+
+void esp32::LinkSupervisor::finish(Level level) {
+	state = State::HEALTHY;
+
+	uint32_t elapsed = link.now_us() - fault_us;
+	++stats.recoveries[static_cast<std::size_t>(level)];
+	stats.last_recovery_us = elapsed;
+	stats.total_recovery_us += elapsed;
+	if (elapsed > stats.max_recovery_us) {
+		stats.max_recovery_us = elapsed;
+	}
+
+	if (on_recovered) {
+		on_recovered(level);
+	}
+}
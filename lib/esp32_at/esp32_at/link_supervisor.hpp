@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include <embedded_util/safety.hpp>
+
+#include <esp32_at/at_client.hpp>
+#include <esp32_at/spi_link.hpp>
+
+namespace esp32 {
+
+/// Watches the SPI link and brings it back when it falls out of step with the ESP32
+///
+/// A run of failed transfers (handshake timeouts or malformed length phases) starts a recovery that escalates through
+/// increasingly disruptive steps, stopping at the first one after which the ESP32 answers "AT":
+/// 1. RESYNC: a bounded number of header exchanges to flush whatever the ESP32 is trying to send
+/// 2. SLOW_CLOCK: the same at the slowest clock, then negotiating the rate again
+/// 3. RESET: AT+RST, waiting for the ESP32 to boot, then negotiating the rate again
+///
+/// The first two steps take milliseconds and run within one poll(). The reset is waited on across polls. Queued AT
+/// commands are aborted when recovery starts since their responses are lost.
+class LinkSupervisor {
+	public:
+
+		/// The step that recovered the link
+		enum class Level : uint8_t {
+			RESYNC,
+			SLOW_CLOCK,
+			RESET,
+		};
+
+		struct Stats {
+			/// Recoveries completed at each level
+			std::array<uint32_t, 3> recoveries {};
+			/// Resets after which the ESP32 did not answer in time
+			uint32_t reset_timeouts = 0;
+			/// Time from detecting the fault to a working link
+			uint32_t last_recovery_us = 0;
+			uint32_t max_recovery_us = 0;
+			uint32_t total_recovery_us = 0;
+		};
+
+		using RecoveryHandler = std::function<void(Level)>;
+
+		/// Failed transfers in a row that start a recovery
+		static constexpr uint32_t TRIGGER_ERRORS = 3;
+
+		/// Header exchanges allowed in each resync
+		static constexpr uint8_t MAX_RESYNC_EXCHANGES = 8;
+
+		/// Time allowed for the ESP32 to boot after AT+RST, and how often to check on it
+		static constexpr uint32_t RESET_TIMEOUT_US = 5'000'000;
+		static constexpr uint32_t RESET_PING_INTERVAL_US = 100'000;
+
+		LinkSupervisor(SpiLink& link, AtClient& client);
+
+		DISALLOW_COPY_AND_MOVE(LinkSupervisor);
+
+		/// Check the link and advance any recovery in progress
+		/// @return true if the link is usable and the AT client can be polled
+		bool poll();
+
+		/// Start a recovery on the next poll(), for faults the link can't see (ex. commands timing out)
+		void request_recovery() { requested = true; }
+
+		/// Called when the link is working again. After a RESET the ESP32 has lost its configuration.
+		void set_recovery_handler(RecoveryHandler handler) { on_recovered = std::move(handler); }
+
+		bool is_recovering() const { return state != State::HEALTHY; }
+		const Stats& get_stats() const { return stats; }
+
+	private:
+
+		enum class State : uint8_t {
+			HEALTHY,
+			/// Waiting for the ESP32 to boot after AT+RST
+			RESETTING,
+		};
+
+		/// Run the quick recovery steps, falling back to a reset
+		void recover();
+
+		/// Send AT+RST and start waiting for the ESP32 to boot
+		void start_reset();
+
+		void finish(Level level);
+
+		SpiLink& link;
+		AtClient& client;
+
+		State state = State::HEALTHY;
+		bool requested = false;
+
+		uint32_t fault_us = 0;
+		uint32_t reset_us = 0;
+		uint32_t last_ping_us = 0;
+
+		Stats stats;
+		RecoveryHandler on_recovered;
+
+};
+
+} // namespace esp32
@@ -0,0 +1,156 @@
+#include <esp32_at/ota_session.hpp>
+
+#include <algorithm>
+
+static uint32_t load_u32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+esp32::OtaSession::OtaSession(SocketLayer& sockets, storage::OtaWriter& writer) :
+	sockets(sockets),
+	writer(writer)
+{}
+
+bool esp32::OtaSession::start(std::string_view host, uint16_t port) {
+	socket = sockets.open(SocketLayer::Protocol::TCP, host, port);
+	if (socket < 0) {
+		state = State::FAILED;
+		return false;
+	}
+
+	writer.abort();
+	header_length = 0;
+	header_received = false;
+	acknowledged = 0;
+	final_sent = false;
+	state = State::CONNECTING;
+	return true;
+}
+
+void esp32::OtaSession::poll() {
+	// A session that never got a socket has no server to tell
+	if (state == State::IDLE || socket < 0) {
+		return;
+	}
+
+	uint8_t events = sockets.poll(socket);
+
+	if (state == State::DONE || state == State::FAILED) {
+		// Tell the server the outcome, then hang up
+		if (!final_sent) {
+			if (events & (SocketLayer::HANGUP | SocketLayer::ERROR)) {
+				final_sent = true;
+			} else if (acknowledge(true)) {
+				final_sent = true;
+				sockets.close(socket);
+			}
+		}
+		return;
+	}
+
+	if (state == State::CONNECTING) {
+		if (events & SocketLayer::WRITABLE) {
+			state = State::RECEIVING;
+		} else if (events & (SocketLayer::HANGUP | SocketLayer::ERROR)) {
+			finish(State::FAILED);
+			return;
+		} else {
+			return;
+		}
+	}
+
+	if (!header_received && !read_header()) {
+		if (state == State::FAILED || (events & (SocketLayer::HANGUP | SocketLayer::ERROR))) {
+			finish(State::FAILED);
+		}
+		return;
+	}
+
+	// Feed the writer straight from the socket's receive queue
+	for (auto chunk = sockets.peek(socket); !chunk.empty(); chunk = sockets.peek(socket)) {
+		std::size_t taken = writer.write(chunk.data(), chunk.size());
+		sockets.consume(socket, taken);
+		if (taken < chunk.size()) {
+			break;
+		}
+	}
+
+	writer.poll();
+
+	switch (writer.get_state()) {
+		case storage::OtaWriter::State::VERIFYING:
+			state = State::VERIFYING;
+			break;
+		case storage::OtaWriter::State::DONE:
+			finish(State::DONE);
+			return;
+		case storage::OtaWriter::State::FAILED:
+		case storage::OtaWriter::State::IDLE:
+			finish(State::FAILED);
+			return;
+		default:
+			break;
+	}
+
+	// The server went away before the image was complete, or the socket had to discard data and the stream has a gap
+	if ((sockets.poll(socket) & (SocketLayer::HANGUP | SocketLayer::ERROR)) || sockets.get_stats(socket).rx_dropped > 0) {
+		writer.abort();
+		finish(State::FAILED);
+		return;
+	}
+
+	acknowledge(false);
+}
+
+bool esp32::OtaSession::read_header() {
+	while (header_length < HEADER_SIZE) {
+		std::size_t n = sockets.recv(socket, header.data() + header_length, HEADER_SIZE - header_length);
+		if (n == 0) {
+			return false;
+		}
+		header_length += n;
+	}
+
+	if (load_u32(header.data()) != STREAM_MAGIC || !writer.begin(load_u32(header.data() + 4), load_u32(header.data() + 8))) {
+		state = State::FAILED;
+		return false;
+	}
+
+	header_received = true;
+	return true;
+}
+
+bool esp32::OtaSession::acknowledge(bool force) {
+	uint32_t received = writer.get_received();
+	if (!force && (received == acknowledged || (received - acknowledged < ACK_INTERVAL && received != writer.get_image_size()))) {
+		return false;
+	}
+	if (!(sockets.poll(socket) & SocketLayer::WRITABLE)) {
+		return false;
+	}
+
+	Status status = Status::RECEIVING;
+	if (state == State::DONE) {
+		status = Status::DONE;
+	} else if (state == State::FAILED) {
+		status = Status::FAILED;
+	}
+
+	ack[0] = static_cast<uint8_t>(received);
+	ack[1] = static_cast<uint8_t>(received >> 8);
+	ack[2] = static_cast<uint8_t>(received >> 16);
+	ack[3] = static_cast<uint8_t>(received >> 24);
+	ack[4] = static_cast<uint8_t>(status);
+
+	if (!sockets.send(socket, std::string_view(reinterpret_cast<const char*>(ack.data()), ack.size()))) {
+		return false;
+	}
+	acknowledged = received;
+	return true;
+}
+
+void esp32::OtaSession::finish(State final_state) {
+	state = final_state;
+	final_sent = false;
+	poll();
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <embedded_util/safety.hpp>
+
+#include <esp32_at/socket_layer.hpp>
+
+#include <storage/ota_writer.hpp>
+
+namespace esp32 {
+
+/// Downloads a firmware update over TCP into an OtaWriter
+///
+/// The device connects to the update server, which sends a header and then the image. Data is handed to the writer
+/// straight from the socket's receive queue; what the writer can't take yet stays queued, and the acknowledgements tell
+/// the server how far it may send. The writer erases and programs the flash in between, so the download runs at the
+/// pace of the network for as long as the flash keeps up.
+///
+/// Protocol (multi-byte fields little-endian):
+/// - server: uint32 STREAM_MAGIC, uint32 image size, uint32 CRC-32 of the image, then the image
+/// - device: acknowledgements of uint32 image bytes taken and uint8 Status. The server must not send more than WINDOW
+///   bytes past the last count acknowledged. The final acknowledgement reports DONE or FAILED.
+class OtaSession {
+	public:
+
+		/// "OTAS"
+		static constexpr uint32_t STREAM_MAGIC = 0x5341544F;
+
+		static constexpr std::size_t HEADER_SIZE = 12;
+		static constexpr std::size_t ACK_SIZE = 5;
+
+		/// Bytes the server may have outstanding: as much as the socket holds while the writer is behind, leaving room
+		/// for the header at the start
+		static constexpr std::size_t WINDOW = SocketLayer::RX_QUOTA - HEADER_SIZE;
+
+		/// Progress between acknowledgements. Each one costs an AT+CIPSEND round trip, so they aren't sent per packet.
+		static constexpr std::size_t ACK_INTERVAL = WINDOW / 4;
+
+		enum class State : uint8_t {
+			IDLE,
+			CONNECTING,
+			/// Waiting for the header or receiving the image
+			RECEIVING,
+			/// The image has arrived and is being checked
+			VERIFYING,
+			/// The update is stored and installs on the next boot
+			DONE,
+			FAILED,
+		};
+
+		/// Status byte of an acknowledgement
+		enum class Status : uint8_t {
+			RECEIVING = 0,
+			DONE = 1,
+			FAILED = 2,
+		};
+
+		OtaSession(SocketLayer& sockets, storage::OtaWriter& writer);
+
+		DISALLOW_COPY_AND_MOVE(OtaSession);
+
+		/// Connect to the update server. The socket layer must be ready.
+		/// @return false if no socket could be opened, which leaves the session FAILED with nothing more to do
+		bool start(std::string_view host, uint16_t port);
+
+		/// Move received data to the writer, run the writer and send acknowledgements
+		void poll();
+
+		State get_state() const { return state; }
+
+		/// Image bytes received so far, and the total once the header has arrived
+		uint32_t get_received() const { return writer.get_received(); }
+		uint32_t get_image_size() const { return writer.get_image_size(); }
+
+	private:
+		/// Take the header from the front of the stream
+		/// @return false if it's incomplete or invalid
+		bool read_header();
+
+		/// Send an acknowledgement if one is due and the socket is free
+		/// @param force Send even if nothing new has been received
+		/// @return true if one was queued
+		bool acknowledge(bool force);
+
+		/// Enter DONE or FAILED. The connection is closed once the final acknowledgement has been queued.
+		void finish(State final_state);
+
+		SocketLayer& sockets;
+		storage::OtaWriter& writer;
+
+		State state = State::IDLE;
+		int socket = -1;
+
+		std::array<uint8_t, HEADER_SIZE> header;
+		std::size_t header_length = 0;
+		bool header_received = false;
+
+		/// Count last sent to the server
+		uint32_t acknowledged = 0;
+		/// Holds an acknowledgement until it is sent
+		std::array<uint8_t, ACK_SIZE> ack;
+		/// The final acknowledgement has been queued, or can't be sent
+		bool final_sent = false;
+
+};
+
+} // namespace esp32
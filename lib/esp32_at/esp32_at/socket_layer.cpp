@@ -0,0 +1,310 @@
+#include <esp32_at/socket_layer.hpp>
+
+#include <cstring>
+
+#include <embedded_util/format.hpp>
+
+/// Connecting can take several seconds for TCP while the handshake completes
+static constexpr uint32_t CONNECT_TIMEOUT_MS = 10000;
+
+/// Sending includes the '>' prompt round trip and, for TCP, waiting for the data to be acknowledged
+static constexpr uint32_t SEND_TIMEOUT_MS = 5000;
+
+esp32::SocketLayer::SocketLayer(AtClient& client, PbufPool& pool) :
+	client(client),
+	pool(pool)
+{}
+
+esp32::SocketLayer::~SocketLayer() {
+	for (auto& s : sockets) {
+		clear(s);
+	}
+}
+
+bool esp32::SocketLayer::initialize() {
+	return client.submit({.text = "AT+CIPMUX=1\r\n", .on_complete = [this](AtClient::Result result) {
+		ready = (result == AtClient::Result::OK);
+	}});
+}
+
+int esp32::SocketLayer::open(Protocol protocol, std::string_view host, uint16_t remote_port, uint16_t local_port) {
+	if (!ready) {
+		return -1;
+	}
+
+	int id = 0;
+	while (id < static_cast<int>(MAX_SOCKETS) && sockets[id].state != SocketState::CLOSED) {
+		++id;
+	}
+	if (id == MAX_SOCKETS) {
+		return -1;
+	}
+
+	Socket& s = sockets[id];
+	std::size_t len;
+	if (protocol == Protocol::UDP && local_port != 0) {
+		// Mode 2 lets the remote end change, so replies go to whoever sent last
+		len = format::to_buffer<"AT+CIPSTART={},\"UDP\",\"{}\",{},{},2\r\n">(s.connect_command.data(),
+			s.connect_command.size(), id, host, remote_port, local_port);
+	} else {
+		len = format::to_buffer<"AT+CIPSTART={},\"{}\",\"{}\",{}\r\n">(s.connect_command.data(), s.connect_command.size(),
+			id, protocol == Protocol::TCP ? "TCP" : "UDP", host, remote_port);
+	}
+	if (len >= s.connect_command.size()) {
+		return -1;
+	}
+
+	bool queued = client.submit({.text = std::string_view(s.connect_command.data(), len), .timeout_ms = CONNECT_TIMEOUT_MS,
+		.on_complete = [this, id](AtClient::Result result) {
+			Socket& s = sockets[id];
+			if (s.state == SocketState::CONNECTING) {
+				s.state = (result == AtClient::Result::OK) ? SocketState::OPEN : SocketState::FAILED;
+			}
+		}
+	});
+	if (!queued) {
+		return -1;
+	}
+
+	s.state = SocketState::CONNECTING;
+	s.protocol = protocol;
+	s.sending = false;
+	s.dropping = false;
+	clear(s);
+	s.stats = Stats();
+	return id;
+}
+
+bool esp32::SocketLayer::send(int socket, std::string_view data) {
+	if (!valid(socket) || data.empty() || data.size() > MAX_SEND) {
+		return false;
+	}
+
+	Socket& s = sockets[socket];
+	if (s.state != SocketState::OPEN || s.sending) {
+		return false;
+	}
+
+	std::size_t len = format::to_buffer<"AT+CIPSEND={},{}\r\n">(s.send_command.data(), s.send_command.size(), socket,
+		data.size());
+
+	// The payload is sent from the caller's memory once the ESP32 prompts for it
+	bool queued = client.submit({.text = std::string_view(s.send_command.data(), len), .timeout_ms = SEND_TIMEOUT_MS,
+		.on_complete = [this, socket, size = data.size()](AtClient::Result result) {
+			Socket& s = sockets[socket];
+			s.sending = false;
+			if (result == AtClient::Result::OK) {
+				s.stats.tx_bytes += size;
+			} else {
+				++s.stats.send_errors;
+			}
+		},
+		.payload = data
+	});
+	s.sending = queued;
+	return queued;
+}
+
+std::span<const uint8_t> esp32::SocketLayer::peek(int socket) const {
+	if (!valid(socket) || sockets[socket].rx_count == 0) {
+		return {};
+	}
+
+	const Socket& s = sockets[socket];
+	const Fragment& f = s.rx[s.rx_head];
+	return std::span<const uint8_t>(f.data, f.length);
+}
+
+void esp32::SocketLayer::consume(int socket, std::size_t n) {
+	if (!valid(socket)) {
+		return;
+	}
+
+	Socket& s = sockets[socket];
+	while (n > 0 && s.rx_count > 0) {
+		Fragment& f = s.rx[s.rx_head];
+		std::size_t used = (n < f.length) ? n : f.length;
+		f.data += used;
+		f.length -= used;
+		s.rx_bytes -= used;
+		n -= used;
+
+		if (f.length == 0) {
+			PbufPool::release(f.segment);
+			f = Fragment();
+			s.rx_head = (s.rx_head + 1) % RX_QUEUE_DEPTH;
+			--s.rx_count;
+		}
+	}
+}
+
+std::size_t esp32::SocketLayer::recv(int socket, uint8_t* dest, std::size_t max) {
+	std::size_t copied = 0;
+	for (auto chunk = peek(socket); !chunk.empty() && copied < max; chunk = peek(socket)) {
+		std::size_t n = (chunk.size() < max - copied) ? chunk.size() : max - copied;
+		std::memcpy(dest + copied, chunk.data(), n);
+		consume(socket, n);
+		copied += n;
+	}
+	return copied;
+}
+
+void esp32::SocketLayer::close(int socket) {
+	if (!valid(socket)) {
+		return;
+	}
+
+	Socket& s = sockets[socket];
+	if (s.state == SocketState::CLOSED || s.state == SocketState::CLOSING) {
+		return;
+	}
+
+	// A socket that never connected has nothing to close on the ESP32
+	if (s.state == SocketState::FAILED) {
+		s.state = SocketState::CLOSED;
+		return;
+	}
+
+	std::size_t len = format::to_buffer<"AT+CIPCLOSE={}\r\n">(s.close_command.data(), s.close_command.size(), socket);
+	bool queued = client.submit({.text = std::string_view(s.close_command.data(), len),
+		.on_complete = [this, socket](AtClient::Result) {
+			sockets[socket].state = SocketState::CLOSED;
+		}
+	});
+	if (queued) {
+		s.state = SocketState::CLOSING;
+	}
+}
+
+uint8_t esp32::SocketLayer::poll(int socket) const {
+	if (!valid(socket)) {
+		return ERROR;
+	}
+
+	const Socket& s = sockets[socket];
+	uint8_t events = 0;
+	if (s.rx_count > 0) {
+		events |= READABLE;
+	}
+
+	switch (s.state) {
+		case SocketState::OPEN:
+			if (!s.sending) {
+				events |= WRITABLE;
+			}
+			break;
+		case SocketState::CLOSED:
+		case SocketState::CLOSING:
+			events |= HANGUP;
+			break;
+		case SocketState::FAILED:
+			events |= ERROR;
+			break;
+		case SocketState::CONNECTING:
+			break;
+	}
+	return events;
+}
+
+esp32::SocketLayer::SocketState esp32::SocketLayer::get_state(int socket) const {
+	return valid(socket) ? sockets[socket].state : SocketState::CLOSED;
+}
+
+const esp32::SocketLayer::Stats& esp32::SocketLayer::get_stats(int socket) const {
+	return sockets[valid(socket) ? socket : 0].stats;
+}
+
+bool esp32::SocketLayer::on_ipd(const AtParser::IpdFragment& fragment) {
+	if (!valid(fragment.link_id)) {
+		return false;
+	}
+
+	Socket& s = sockets[fragment.link_id];
+
+	// Keep UDP datagrams whole: one that can't fit entirely is dropped rather than truncated
+	if (fragment.offset == 0) {
+		s.dropping = (s.protocol == Protocol::UDP && fragment.length > RX_QUOTA - s.rx_bytes);
+	}
+
+	auto data = reinterpret_cast<const uint8_t*>(fragment.data.data());
+	std::size_t len = fragment.data.size();
+	if (len > RX_QUOTA - s.rx_bytes) {
+		len = RX_QUOTA - s.rx_bytes;
+	}
+
+	std::size_t stored = 0;
+	if (!s.dropping && len > 0) {
+		if (fragment.buffer != nullptr) {
+			stored = push(s, fragment.buffer, data, len) ? len : 0;
+		} else {
+			stored = push_copy(s, data, len);
+		}
+	}
+
+	s.stats.rx_bytes += stored;
+	s.stats.rx_dropped += fragment.data.size() - stored;
+	return true;
+}
+
+bool esp32::SocketLayer::on_urc(std::string_view line) {
+	// "<id>,CONNECT" or "<id>,CLOSED"
+	if (line.size() < 3 || line[0] < '0' || line[0] >= static_cast<char>('0' + MAX_SOCKETS) || line[1] != ',') {
+		return false;
+	}
+
+	Socket& s = sockets[line[0] - '0'];
+	auto event = line.substr(2);
+	if (event == "CONNECT") {
+		return true;
+	}
+	if (event == "CLOSED" || event == "CONNECT FAIL") {
+		if (s.state == SocketState::CONNECTING) {
+			s.state = SocketState::FAILED;
+		} else if (s.state != SocketState::FAILED) {
+			s.state = SocketState::CLOSED;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool esp32::SocketLayer::push(Socket& s, Pbuf* segment, const uint8_t* data, std::size_t len) {
+	if (s.rx_count == RX_QUEUE_DEPTH) {
+		return false;
+	}
+
+	PbufPool::retain(segment);
+	s.rx[(s.rx_head + s.rx_count) % RX_QUEUE_DEPTH] = {segment, data, static_cast<uint16_t>(len)};
+	++s.rx_count;
+	s.rx_bytes += len;
+	return true;
+}
+
+std::size_t esp32::SocketLayer::push_copy(Socket& s, const uint8_t* data, std::size_t len) {
+	std::size_t stored = 0;
+	while (stored < len && s.rx_count < RX_QUEUE_DEPTH) {
+		PbufRef segment(pool.allocate());
+		if (!segment) {
+			break;
+		}
+
+		Pbuf* p = segment.get();
+		std::size_t n = (len - stored < p->capacity) ? len - stored : p->capacity;
+		std::memcpy(p->storage, data + stored, n);
+		p->length = static_cast<uint16_t>(n);
+
+		push(s, p, p->storage, n);
+		stored += n;
+	}
+	return stored;
+}
+
+void esp32::SocketLayer::clear(Socket& s) {
+	while (s.rx_count > 0) {
+		PbufPool::release(s.rx[s.rx_head].segment);
+		s.rx[s.rx_head] = Fragment();
+		s.rx_head = (s.rx_head + 1) % RX_QUEUE_DEPTH;
+		--s.rx_count;
+	}
+	s.rx_bytes = 0;
+}
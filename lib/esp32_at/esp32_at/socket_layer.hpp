@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include <embedded_util/pbuf.hpp>
+#include <embedded_util/safety.hpp>
+
+#include <esp32_at/at_client.hpp>
+#include <esp32_at/at_parser.hpp>
+
+namespace esp32 {
+
+/// Non-blocking sockets on top of the ESP32's multiple connection mode (AT+CIPMUX=1)
+///
+/// Each of the ESP32's five link IDs is a socket with its own receive queue. When the transport receives into a
+/// PbufPool, +IPD payloads are queued by holding a reference to the segment they arrived in, so applications read them
+/// with peek() and consume() from the memory the SPI controller filled. Fragments from other transports are copied into
+/// segments from the pool once. Each socket may hold at most RX_QUOTA bytes, so one that stops reading only loses its
+/// own data and can't starve the link or the other sockets of buffers.
+///
+/// The owner routes +IPD fragments to on_ipd() and notifications to on_urc(), typically from the AtClient handlers.
+class SocketLayer {
+	public:
+
+		/// The ESP32 supports link IDs 0 to 4
+		static constexpr std::size_t MAX_SOCKETS = 5;
+
+		/// Most received bytes each socket may hold
+		static constexpr std::size_t RX_QUOTA = 512;
+
+		/// Most received fragments each socket may hold
+		static constexpr std::size_t RX_QUEUE_DEPTH = 8;
+
+		/// Largest payload the ESP32 accepts in one AT+CIPSEND
+		static constexpr std::size_t MAX_SEND = 2048;
+
+		enum class Protocol : uint8_t {
+			TCP,
+			UDP,
+		};
+
+		enum class SocketState : uint8_t {
+			CLOSED,
+			CONNECTING,
+			OPEN,
+			CLOSING,
+			/// The connection could not be opened or a send failed; close() to reuse the socket
+			FAILED,
+		};
+
+		/// Flags returned by poll()
+		enum Event : uint8_t {
+			/// Received data is waiting
+			READABLE = 1 << 0,
+			/// send() will accept data
+			WRITABLE = 1 << 1,
+			/// The connection was closed, by either end
+			HANGUP = 1 << 2,
+			ERROR = 1 << 3,
+		};
+
+		struct Stats {
+			uint32_t rx_bytes = 0;
+			uint32_t tx_bytes = 0;
+			/// Received bytes discarded because the socket's quota or queue was full, or the pool was empty
+			uint32_t rx_dropped = 0;
+			uint32_t send_errors = 0;
+		};
+
+		/// @param pool Segments for payloads that don't arrive in one
+		SocketLayer(AtClient& client, PbufPool& pool);
+
+		~SocketLayer();
+
+		DISALLOW_COPY_AND_MOVE(SocketLayer);
+
+		/// Queue AT+CIPMUX=1. No socket can be opened until it completes.
+		/// @return false if the command queue is full
+		bool initialize();
+
+		/// True once multiple connection mode is enabled
+		bool is_ready() const { return ready; }
+
+		/// Start connecting a socket
+		/// @param local_port UDP only: the local port, or 0 to let the ESP32 choose. UDP sockets with a local port accept
+		/// datagrams from any sender.
+		/// @return The socket number, or -1 if none are free, the host name is too long, or the queue is full
+		int open(Protocol protocol, std::string_view host, uint16_t remote_port, uint16_t local_port = 0);
+
+		/// Queue data to send
+		/// @param data The memory must remain valid until poll() reports the socket as WRITABLE again
+		/// @return false if the socket is not open, a send is already in progress, or data is too large
+		bool send(int socket, std::string_view data);
+
+		/// The oldest received fragment, or what is left of it; empty if nothing is waiting
+		std::span<const uint8_t> peek(int socket) const;
+
+		/// Discard the n oldest received bytes
+		void consume(int socket, std::size_t n);
+
+		/// Copy out and remove up to max received bytes
+		/// @return The number of bytes copied
+		std::size_t recv(int socket, uint8_t* dest, std::size_t max);
+
+		/// Queue AT+CIPCLOSE. Received data stays readable until the socket is reused by open().
+		void close(int socket);
+
+		/// Readiness of a socket as a combination of Event flags
+		uint8_t poll(int socket) const;
+
+		SocketState get_state(int socket) const;
+		const Stats& get_stats(int socket) const;
+
+		/// Handle a +IPD fragment
+		/// @return false if it doesn't belong to any socket
+		bool on_ipd(const AtParser::IpdFragment& fragment);
+
+		/// Handle a notification, taking "<id>,CONNECT" and "<id>,CLOSED"
+		/// @return true if the notification was consumed
+		bool on_urc(std::string_view line);
+
+	private:
+
+		/// A received payload fragment, holding a reference to the segment it's stored in
+		struct Fragment {
+			Pbuf* segment = nullptr;
+			const uint8_t* data = nullptr;
+			uint16_t length = 0;
+		};
+
+		struct Socket {
+			SocketState state = SocketState::CLOSED;
+			Protocol protocol = Protocol::TCP;
+			bool sending = false;
+			/// The current UDP datagram didn't fit and is being discarded
+			bool dropping = false;
+			std::array<Fragment, RX_QUEUE_DEPTH> rx;
+			uint8_t rx_head = 0;
+			uint8_t rx_count = 0;
+			std::size_t rx_bytes = 0;
+			Stats stats;
+			/// Commands are held until sent, in separate buffers since a close can be queued behind a send
+			std::array<char, 64> connect_command;
+			std::array<char, 24> send_command;
+			std::array<char, 20> close_command;
+		};
+
+		bool valid(int socket) const { return socket >= 0 && static_cast<std::size_t>(socket) < MAX_SOCKETS; }
+
+		/// Queue a fragment stored in segment, taking a new reference to it
+		/// @return false if the queue is full
+		static bool push(Socket& s, Pbuf* segment, const uint8_t* data, std::size_t len);
+
+		/// Queue a copy of data in segments from the pool
+		/// @return The number of bytes queued
+		std::size_t push_copy(Socket& s, const uint8_t* data, std::size_t len);
+
+		/// Release every queued fragment
+		static void clear(Socket& s);
+
+		AtClient& client;
+		PbufPool& pool;
+		bool ready = false;
+
+		std::array<Socket, MAX_SOCKETS> sockets;
+
+};
+
+} // namespace esp32
@@ -0,0 +1,326 @@
+#include <esp32_at/spi_link.hpp>
+
+#include <algorithm>
+
+// Header phase flags
+static constexpr uint8_t HEADER_MASTER_WRITE = 0x02;
+static constexpr uint8_t HEADER_MASTER_READ = 0x01;
+
+// Markers in the last byte of the length phase
+static constexpr uint8_t LENGTH_MARKER_WRITE = 'A';
+static constexpr uint8_t LENGTH_MARKER_READ = 'B';
+
+/// Echoed back by the ESP32 during negotiation. Alternating bits and every character class catch both clock skew and
+/// dropped bytes.
+static constexpr std::string_view PROBE_COMMAND = "AT+LINKTEST=UUUU****0123456789abcdefxyzXYZ~~~~!@#$\r\n";
+
+/// Longest time to wait for a complete response to a command during negotiation
+static constexpr uint32_t COMMAND_TIMEOUT_US = 200'000;
+
+esp32::SpiLink::SpiLink(SpiPort& port, PbufPool& pool) :
+	port(port),
+	pool(pool)
+{
+	set_rung(0);
+	goodput_start_us = port.now_us();
+}
+
+uint32_t esp32::SpiLink::negotiate(std::size_t max_rung) {
+	max_rung = std::min(max_rung, CLOCK_LADDER.size() - 1);
+
+	set_rung(0);
+	drain();
+
+	// The probes rely on the ESP32 echoing them back
+	std::array<uint8_t, 64> response;
+	std::size_t len = 0;
+	if (!command("ATE1\r\n", response.data(), response.size(), len)) {
+		return clock_hz;
+	}
+
+	std::size_t best = 0;
+	for (std::size_t candidate = 1; candidate <= max_rung; ++candidate) {
+		set_rung(candidate);
+
+		bool passed = true;
+		for (uint8_t i = 0; i < PROBES_PER_RATE && passed; ++i) {
+			passed = probe();
+		}
+
+		if (!passed) {
+			break;
+		}
+		best = candidate;
+	}
+
+	// Return to the best rate and clear out anything left over from a failed probe
+	set_rung(best);
+	drain();
+	command("ATE0\r\n", response.data(), response.size(), len);
+
+	// Start the error window fresh so negotiation failures don't count against the selected rate
+	window_transactions = 0;
+	window_errors = 0;
+	consecutive_errors = 0;
+
+	return clock_hz;
+}
+
+bool esp32::SpiLink::send(std::string_view data) {
+	auto status = write_message(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+	record(status, (status == Status::OK) ? data.size() : 0);
+	stats.tx_bytes += (status == Status::OK) ? data.size() : 0;
+	return status == Status::OK;
+}
+
+std::string_view esp32::SpiLink::receive() {
+	// Hand out the rest of the current message before reading another. Each segment is unlinked as it's handed out so
+	// a consumer that keeps one doesn't also keep the rest of the message.
+	if (rx_segment != nullptr && rx_segment->next != nullptr) {
+		Pbuf* next = rx_segment->next;
+		rx_segment->next = nullptr;
+		rx_message = PbufRef(next);
+		rx_segment = next;
+		return rx_segment->chars();
+	}
+	rx_message = PbufRef();
+	rx_segment = nullptr;
+
+	// The ESP32 raises the handshake line when it has something to send
+	if (!port.handshake()) {
+		return {};
+	}
+
+	std::size_t len = 0;
+	auto status = begin_read(len);
+	if (status == Status::OK && len > 0) {
+		rx_message = PbufRef(pool.allocate_chain(len));
+		if (rx_message) {
+			// One phase across the whole chain, so the chip select stays asserted between segments
+			for (Pbuf* p = rx_message.get(); p != nullptr; p = p->next) {
+				if (p->next != nullptr) {
+					port.transfer_partial(nullptr, p->storage, p->length);
+				} else {
+					port.transfer(nullptr, p->storage, p->length);
+				}
+			}
+		} else {
+			// The whole phase must still be clocked out
+			port.transfer(nullptr, nullptr, len);
+			status = Status::NO_BUFFER;
+			++stats.dropped;
+			len = 0;
+		}
+	}
+	record(status, (status == Status::OK) ? len : 0);
+	stats.rx_bytes += (status == Status::OK) ? len : 0;
+
+	if (!rx_message) {
+		return {};
+	}
+	rx_segment = rx_message.get();
+	return rx_segment->chars();
+}
+
+void esp32::SpiLink::drain() {
+	std::size_t len = 0;
+	for (uint8_t i = 0; i < 16 && port.handshake(); ++i) {
+		read_message(nullptr, 0, len);
+	}
+}
+
+bool esp32::SpiLink::ping() {
+	std::array<uint8_t, 32> response;
+	std::size_t len = 0;
+	if (!command("AT\r\n", response.data(), response.size(), len)) {
+		return false;
+	}
+
+	std::string_view received(reinterpret_cast<const char*>(response.data()), len);
+	if (received.find("OK\r\n") == std::string_view::npos) {
+		return false;
+	}
+	error_streak = 0;
+	return true;
+}
+
+bool esp32::SpiLink::resync(uint8_t max_exchanges) {
+	std::size_t len = 0;
+	for (uint8_t i = 0; i < max_exchanges && port.handshake(); ++i) {
+		read_message(nullptr, 0, len);
+	}
+	return ping();
+}
+
+esp32::SpiLink::Status esp32::SpiLink::write_message(const uint8_t* data, std::size_t len) {
+	if (len > MAX_TRANSFER) {
+		return Status::BAD_LENGTH;
+	}
+
+	const uint8_t header[4] = {HEADER_MASTER_WRITE, 0x00, 0x00, 0x00};
+	port.transfer(header, nullptr, sizeof(header));
+	if (!wait_handshake()) {
+		return Status::HANDSHAKE_TIMEOUT;
+	}
+
+	// The length is split into two 7-bit halves
+	const uint8_t length[4] = {
+		static_cast<uint8_t>(len & 0x7F), static_cast<uint8_t>(len >> 7), 0x00, LENGTH_MARKER_WRITE
+	};
+	port.transfer(length, nullptr, sizeof(length));
+	if (!wait_handshake()) {
+		return Status::HANDSHAKE_TIMEOUT;
+	}
+
+	port.transfer(data, nullptr, len);
+	return Status::OK;
+}
+
+esp32::SpiLink::Status esp32::SpiLink::begin_read(std::size_t& len) {
+	len = 0;
+
+	const uint8_t header[4] = {HEADER_MASTER_READ, 0x00, 0x00, 0x00};
+	port.transfer(header, nullptr, sizeof(header));
+	if (!wait_handshake()) {
+		return Status::HANDSHAKE_TIMEOUT;
+	}
+
+	uint8_t length[4] = {0};
+	port.transfer(nullptr, length, sizeof(length));
+
+	// Don't trust the length unless the rest of the phase is intact. The two halves are 7 bits each.
+	if (length[3] != LENGTH_MARKER_READ) {
+		return Status::BAD_MARKER;
+	}
+	std::size_t data_len = (static_cast<std::size_t>(length[1]) << 7) + length[0];
+	if ((length[0] & 0x80) || (length[1] & 0x80) || data_len > MAX_TRANSFER) {
+		return Status::BAD_LENGTH;
+	}
+
+	if (data_len > 0 && !wait_handshake()) {
+		return Status::HANDSHAKE_TIMEOUT;
+	}
+
+	len = data_len;
+	return Status::OK;
+}
+
+esp32::SpiLink::Status esp32::SpiLink::read_message(uint8_t* dest, std::size_t capacity, std::size_t& len) {
+	std::size_t data_len = 0;
+	auto status = begin_read(data_len);
+	len = 0;
+	if (status != Status::OK || data_len == 0) {
+		return status;
+	}
+
+	// The whole phase must be clocked out even if it doesn't fit
+	std::size_t kept = std::min(data_len, capacity);
+	if (dest == nullptr) {
+		kept = 0;
+	}
+	if (kept < data_len) {
+		if (kept > 0) {
+			port.transfer_partial(nullptr, dest, kept);
+		}
+		port.transfer(nullptr, nullptr, data_len - kept);
+	} else {
+		port.transfer(nullptr, dest, kept);
+	}
+
+	len = kept;
+	return (dest != nullptr && kept < data_len) ? Status::OVERRUN : Status::OK;
+}
+
+bool esp32::SpiLink::wait_handshake() {
+	uint32_t start = port.now_us();
+	while (!port.handshake()) {
+		if (port.now_us() - start > HANDSHAKE_TIMEOUT_US) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void esp32::SpiLink::record(Status status, std::size_t payload) {
+	last_status = status;
+	++stats.transactions;
+
+	// Running out of buffers says nothing about the health of the link
+	if (status == Status::OK || status == Status::NO_BUFFER) {
+		consecutive_errors = 0;
+		error_streak = 0;
+	} else {
+		++stats.errors;
+		++window_errors;
+		++consecutive_errors;
+		++error_streak;
+	}
+
+	// Step down one rate if errors are rising
+	if (window_errors > MAX_WINDOW_ERRORS || consecutive_errors >= MAX_CONSECUTIVE_ERRORS) {
+		if (rung > 0) {
+			set_rung(rung - 1);
+			++stats.fallbacks;
+		}
+		window_transactions = 0;
+		window_errors = 0;
+		consecutive_errors = 0;
+	} else if (++window_transactions >= ERROR_WINDOW) {
+		window_transactions = 0;
+		window_errors = 0;
+	}
+
+	// Update the goodput once per window
+	goodput_bytes += payload;
+	uint32_t now = port.now_us();
+	uint32_t elapsed = now - goodput_start_us;
+	if (elapsed >= GOODPUT_WINDOW_US) {
+		goodput = static_cast<uint32_t>((static_cast<uint64_t>(goodput_bytes) * 1'000'000) / elapsed);
+		goodput_bytes = 0;
+		goodput_start_us = now;
+	}
+}
+
+void esp32::SpiLink::set_rung(std::size_t new_rung) {
+	rung = new_rung;
+	clock_hz = port.set_clock(CLOCK_LADDER[rung]);
+}
+
+bool esp32::SpiLink::command(std::string_view text, uint8_t* response, std::size_t capacity, std::size_t& len) {
+	len = 0;
+	if (write_message(reinterpret_cast<const uint8_t*>(text.data()), text.size()) != Status::OK) {
+		return false;
+	}
+
+	uint32_t start = port.now_us();
+	while (port.now_us() - start < COMMAND_TIMEOUT_US) {
+		if (!port.handshake()) {
+			continue;
+		}
+
+		std::size_t chunk = 0;
+		if (read_message(response + len, capacity - len, chunk) != Status::OK) {
+			return false;
+		}
+		len += chunk;
+
+		std::string_view received(reinterpret_cast<const char*>(response), len);
+		if (received.find("OK\r\n") != std::string_view::npos || received.find("ERROR\r\n") != std::string_view::npos) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool esp32::SpiLink::probe() {
+	// The echo, blank line, and ERROR for the unknown command
+	std::array<uint8_t, PROBE_COMMAND.size() + 16> response;
+	std::size_t len = 0;
+
+	if (!command(PROBE_COMMAND, response.data(), response.size(), len)) {
+		return false;
+	}
+
+	std::string_view received(reinterpret_cast<const char*>(response.data()), len);
+	return received.substr(0, PROBE_COMMAND.size()) == PROBE_COMMAND;
+}
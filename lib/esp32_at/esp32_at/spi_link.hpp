@@ -0,0 +1,181 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <embedded_util/pbuf.hpp>
+#include <embedded_util/safety.hpp>
+
+#include <esp32_at/at_transport.hpp>
+#include <esp32_at/spi_port.hpp>
+
+namespace esp32 {
+
+/// Link layer for the ESP32 SPI AT interface
+///
+/// Every message is moved in three chip-select framed phases, waiting for the handshake line between them:
+/// 1. A 4-byte header where 0x02 announces data for the ESP32 and 0x01 requests data from it
+/// 2. A 4-byte length in two 7-bit halves, with 'A' in the last byte when sending and 'B' when receiving
+/// 3. The data itself
+///
+/// Received length phases are checked before the data phase is trusted, and every phase is bounded by a handshake
+/// timeout. Received messages are read straight into a chain of pool segments, in one data phase with the chip select
+/// held between segments, and handed out one segment per receive() call, so the parser and application work on the
+/// memory the SPI controller filled. negotiate() finds the fastest SPI clock at which echoed test patterns come back
+/// intact. After that the error rate is watched over a sliding window of transactions and the clock steps back down
+/// when it rises.
+class SpiLink : public AtTransport {
+	public:
+
+		/// Result of a single message transfer
+		enum class Status : uint8_t {
+			OK,
+			/// The ESP32 did not raise the handshake line in time
+			HANDSHAKE_TIMEOUT,
+			/// The length phase did not end with the expected marker
+			BAD_MARKER,
+			/// The announced length is larger than the ESP32 can send
+			BAD_LENGTH,
+			/// The message did not fit in the receive buffer and was truncated
+			OVERRUN,
+			/// Not enough pool segments were free and the message was discarded
+			NO_BUFFER,
+		};
+
+		struct Stats {
+			uint32_t transactions = 0;
+			uint32_t errors = 0;
+			/// Number of times the clock was lowered because of errors
+			uint32_t fallbacks = 0;
+			/// Payload bytes moved in each direction, not counting header and length phases
+			uint32_t tx_bytes = 0;
+			uint32_t rx_bytes = 0;
+			/// Messages discarded for lack of buffers. These don't count as link errors.
+			uint32_t dropped = 0;
+		};
+
+		/// SPI clocks tried by negotiate(), slowest first. The slowest is the rate the original demo used.
+		static constexpr std::array<uint32_t, 9> CLOCK_LADDER {
+			80'000, 500'000, 1'000'000, 2'000'000, 4'000'000, 8'000'000, 10'000'000, 16'000'000, 20'000'000
+		};
+
+		/// Largest message the ESP32 SPI AT firmware sends in one data phase
+		static constexpr std::size_t MAX_TRANSFER = 4092;
+
+		static constexpr uint32_t HANDSHAKE_TIMEOUT_US = 50'000;
+
+		/// Probes that must all pass before a clock rate is accepted
+		static constexpr uint8_t PROBES_PER_RATE = 8;
+
+		/// The clock steps down when more than MAX_WINDOW_ERRORS of ERROR_WINDOW transactions fail, or when
+		/// MAX_CONSECUTIVE_ERRORS fail in a row
+		static constexpr uint8_t ERROR_WINDOW = 32;
+		static constexpr uint8_t MAX_WINDOW_ERRORS = 2;
+		static constexpr uint8_t MAX_CONSECUTIVE_ERRORS = 3;
+
+		/// Goodput is averaged over at least this long
+		static constexpr uint32_t GOODPUT_WINDOW_US = 1'000'000;
+
+		/// Construct the link at the slowest clock rate
+		/// @param pool Source of receive buffers
+		SpiLink(SpiPort& port, PbufPool& pool);
+
+		DISALLOW_COPY_AND_MOVE(SpiLink);
+
+		/// Find the fastest reliable clock rate by probing the ladder from the slowest rate upward
+		///
+		/// Each probe sends a command containing a test pattern with echo enabled and checks that it comes back intact,
+		/// which exercises all three phases in both directions. Echo is disabled again when finished.
+		/// @param max_rung Index of the fastest rate in CLOCK_LADDER to try
+		/// @return The selected clock rate in hertz
+		uint32_t negotiate(std::size_t max_rung = CLOCK_LADDER.size() - 1);
+
+		bool send(std::string_view data) override;
+		std::string_view receive() override;
+		Pbuf* receive_buffer() override { return rx_segment; }
+
+		/// Read and discard anything the ESP32 has waiting
+		void drain();
+
+		/// Send "AT" and wait for "OK", bypassing the AT client. Used to check the link while recovering.
+		bool ping();
+
+		/// Bring the phases back in step after errors
+		///
+		/// While the ESP32 holds the handshake line up, read headers are exchanged and any data is discarded, up to
+		/// max_exchanges times. The link is then checked with ping().
+		/// @return true if the ping succeeded
+		bool resync(uint8_t max_exchanges);
+
+		/// Drop to the slowest rate in CLOCK_LADDER. negotiate() finds the fastest reliable rate again.
+		void use_slowest_clock() { set_rung(0); }
+
+		Status get_last_status() const { return last_status; }
+
+		/// Number of transfers that have failed since the last one that succeeded
+		uint32_t get_error_streak() const { return error_streak; }
+
+		/// The port's microsecond timestamp
+		uint32_t now_us() const { return port.now_us(); }
+		const Stats& get_stats() const { return stats; }
+
+		/// The SPI clock rate currently in use in hertz
+		uint32_t get_clock() const { return clock_hz; }
+
+		/// Payload bytes per second in both directions, measured over the last complete window
+		uint32_t get_goodput() const { return goodput; }
+
+	private:
+
+		/// Run the three phases of a message to the ESP32
+		Status write_message(const uint8_t* data, std::size_t len);
+
+		/// Run the header and length phases of a message from the ESP32, leaving the data phase to be clocked out
+		/// @param len Set to the length of the data phase
+		Status begin_read(std::size_t& len);
+
+		/// Run the three phases of a message from the ESP32 into dest
+		/// @param len Set to the number of bytes stored
+		Status read_message(uint8_t* dest, std::size_t capacity, std::size_t& len);
+
+		/// Wait for the handshake line with a timeout
+		bool wait_handshake();
+
+		/// Update the statistics and error window with the result of a transfer
+		void record(Status status, std::size_t payload);
+
+		void set_rung(std::size_t new_rung);
+
+		/// Send a command and collect the response until "OK" or "ERROR"
+		bool command(std::string_view text, uint8_t* response, std::size_t capacity, std::size_t& len);
+
+		/// Send one test pattern and check the echo
+		bool probe();
+
+		SpiPort& port;
+		PbufPool& pool;
+
+		std::size_t rung = 0;
+		uint32_t clock_hz = 0;
+
+		Status last_status = Status::OK;
+		Stats stats;
+
+		uint8_t window_transactions = 0;
+		uint8_t window_errors = 0;
+		uint8_t consecutive_errors = 0;
+		uint32_t error_streak = 0;
+
+		uint32_t goodput = 0;
+		uint32_t goodput_start_us = 0;
+		uint32_t goodput_bytes = 0;
+
+		/// The message being handed out by receive() and the segment last returned
+		PbufRef rx_message;
+		Pbuf* rx_segment = nullptr;
+
+};
+
+} // namespace esp32
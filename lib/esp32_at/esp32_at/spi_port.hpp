@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esp32 {
+
+/// Hardware used by the SPI link to the ESP32: an SPI master, the handshake input, and a microsecond timer
+class SpiPort {
+	public:
+		/// Exchange len bytes in one chip-select framed transaction (one protocol phase)
+		/// @param tx Bytes to send, or nullptr to send zeros
+		/// @param rx Storage for received bytes, or nullptr to discard them
+		virtual void transfer(const uint8_t* tx, uint8_t* rx, std::size_t len) = 0;
+
+		/// Exchange the first part of a phase and keep the chip select asserted, so the phase can be spread over
+		/// several buffers. The next transfer() carries on the same phase and ends it.
+		virtual void transfer_partial(const uint8_t* tx, uint8_t* rx, std::size_t len) = 0;
+
+		/// Return true if the ESP32 is raising the handshake line to signal that it is ready for the next phase
+		virtual bool handshake() = 0;
+
+		/// Change the SPI clock
+		/// @return The clock rate actually configured in hertz, which may be lower than requested
+		virtual uint32_t set_clock(uint32_t hz) = 0;
+
+		/// A free-running microsecond timestamp
+		virtual uint32_t now_us() = 0;
+};
+
+} // namespace esp32
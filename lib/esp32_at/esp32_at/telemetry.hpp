@@ -0,0 +1,187 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include <embedded_util/cobs.hpp>
+#include <embedded_util/crc.hpp>
+#include <embedded_util/varint.hpp>
+
+namespace esp32 {
+
+/// Format version written at the start of every telemetry frame
+constexpr uint8_t TELEMETRY_VERSION = 1;
+
+/// Largest UDP payload that avoids IP fragmentation on a 1500-byte Ethernet/WiFi MTU
+constexpr std::size_t UDP_MTU = 1472;
+
+/// A set of channel values captured at one time
+template<std::size_t CHANNELS>
+struct TelemetrySample {
+	uint32_t timestamp_us = 0;
+	std::array<int32_t, CHANNELS> values {};
+};
+
+/// Packs telemetry samples into compact, self-contained datagrams
+///
+/// Frame layout before COBS encoding (multi-byte fields little-endian):
+/// - uint8 version, uint8 channel count, uint16 sequence number
+/// - varint timestamp of the first sample in microseconds
+/// - for each sample: varint time since the previous sample, then one zigzag varint per channel holding the change
+///   from the previous sample (the first sample is relative to zero)
+/// - uint16 CRC-16/CCITT of everything above
+///
+/// Frames are COBS encoded as they are built, directly into the datagram buffer, and end with a zero delimiter. Each
+/// frame decodes on its own, so a lost datagram only loses its own samples, and a receiver can find frame boundaries
+/// even if the ESP32 splits or merges datagrams in transparent mode.
+///
+/// @tparam CHANNELS Number of values in each sample
+/// @tparam MTU Largest datagram to produce
+template<std::size_t CHANNELS, std::size_t MTU = UDP_MTU>
+class TelemetryBatcher {
+	public:
+
+		using Sample = TelemetrySample<CHANNELS>;
+
+		/// Largest encoding of one sample before COBS
+		static constexpr std::size_t MAX_SAMPLE_BYTES = varint::MAX_BYTES * (CHANNELS + 1);
+
+		/// Add a sample to the current frame. Call finish() first if has_room() is false.
+		void add(const Sample& sample) {
+			if (samples == 0) {
+				begin_frame(sample.timestamp_us);
+			}
+
+			uint8_t bytes[MAX_SAMPLE_BYTES];
+			std::size_t n = varint::encode(sample.timestamp_us - previous.timestamp_us, bytes);
+			for (std::size_t i = 0; i < CHANNELS; ++i) {
+				n += varint::encode(varint::zigzag_encode(varint::delta(sample.values[i], previous.values[i])), bytes + n);
+			}
+			put(bytes, n);
+
+			previous = sample;
+			++samples;
+		}
+
+		/// Return true if a worst-case sample still fits in the current frame
+		bool has_room() const {
+			// Space for the sample and CRC after COBS expansion, and the delimiter
+			constexpr std::size_t worst_case = cobs::max_encoded_size(MAX_SAMPLE_BYTES + 2) + 1;
+			return samples == 0 || encoder.size() + worst_case <= MTU;
+		}
+
+		/// Number of samples in the current frame
+		uint16_t sample_count() const { return samples; }
+
+		/// Close the current frame
+		/// @return The encoded datagram, valid until the next call to add()
+		std::span<const uint8_t> finish() {
+			if (samples == 0) {
+				return {};
+			}
+
+			uint16_t crc_value = crc.value();
+			uint8_t trailer[2] = {static_cast<uint8_t>(crc_value), static_cast<uint8_t>(crc_value >> 8)};
+			encoder.put(trailer, sizeof(trailer));
+
+			std::size_t len = encoder.finish();
+			samples = 0;
+			++sequence;
+			return std::span<const uint8_t>(buffer.data(), len);
+		}
+
+	private:
+		static_assert(MTU >= cobs::max_encoded_size(4 + varint::MAX_BYTES + MAX_SAMPLE_BYTES + 2) + 1,
+			"TelemetryBatcher: MTU is too small for a single sample");
+
+		void begin_frame(uint32_t timestamp_us) {
+			encoder.begin(buffer.data());
+			crc.reset();
+
+			uint8_t header[4 + varint::MAX_BYTES] = {
+				TELEMETRY_VERSION,
+				static_cast<uint8_t>(CHANNELS),
+				static_cast<uint8_t>(sequence),
+				static_cast<uint8_t>(sequence >> 8),
+			};
+			std::size_t n = 4 + varint::encode(timestamp_us, header + 4);
+			put(header, n);
+
+			// Deltas restart in every frame so frames decode independently
+			previous = Sample();
+			previous.timestamp_us = timestamp_us;
+		}
+
+		void put(const uint8_t* data, std::size_t len) {
+			crc.update(data, len);
+			encoder.put(data, len);
+		}
+
+		std::array<uint8_t, MTU> buffer;
+		cobs::Encoder encoder;
+		Crc16 crc;
+
+		Sample previous;
+		uint16_t samples = 0;
+		uint16_t sequence = 0;
+};
+
+/// Decode one telemetry frame produced by TelemetryBatcher
+///
+/// @param frame The COBS-encoded frame without its delimiter. It is decoded in place.
+/// @param on_sample Called with each decoded TelemetrySample in order
+/// @param sequence Set to the frame's sequence number
+/// @return false if the frame is malformed, fails its CRC, or has a different channel count
+template<std::size_t CHANNELS, typename SampleHandler>
+bool decode_telemetry_frame(uint8_t* frame, std::size_t len, SampleHandler&& on_sample, uint16_t& sequence) {
+	len = cobs::decode(frame, len, frame);
+	if (len < 4 + 1 + 2) {
+		return false;
+	}
+
+	uint16_t expected_crc = frame[len - 2] | (frame[len - 1] << 8);
+	len -= 2;
+	if (Crc16::calculate(frame, len) != expected_crc) {
+		return false;
+	}
+
+	if (frame[0] != TELEMETRY_VERSION || frame[1] != CHANNELS) {
+		return false;
+	}
+	sequence = frame[2] | (frame[3] << 8);
+
+	std::size_t pos = 4;
+	uint32_t value = 0;
+	std::size_t n = varint::decode(frame + pos, len - pos, value);
+	if (n == 0) {
+		return false;
+	}
+	pos += n;
+
+	TelemetrySample<CHANNELS> sample;
+	sample.timestamp_us = value;
+
+	while (pos < len) {
+		if ((n = varint::decode(frame + pos, len - pos, value)) == 0) {
+			return false;
+		}
+		pos += n;
+		sample.timestamp_us += value;
+
+		for (std::size_t i = 0; i < CHANNELS; ++i) {
+			if ((n = varint::decode(frame + pos, len - pos, value)) == 0) {
+				return false;
+			}
+			pos += n;
+			sample.values[i] = varint::apply_delta(sample.values[i], varint::zigzag_decode(value));
+		}
+
+		on_sample(static_cast<const TelemetrySample<CHANNELS>&>(sample));
+	}
+
+	return true;
+}
+
+} // namespace esp32
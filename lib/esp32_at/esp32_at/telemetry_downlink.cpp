@@ -0,0 +1,72 @@
+#include <esp32_at/telemetry_downlink.hpp>
+
+#include <embedded_util/format.hpp>
+
+/// Ends transparent transmission. It must arrive on its own, without a line ending.
+static constexpr std::string_view EXIT_TRANSPARENT = "+++";
+
+esp32::TelemetryDownlink::TelemetryDownlink(AtClient& client, AtTransport& transport) :
+	client(client),
+	transport(transport)
+{}
+
+bool esp32::TelemetryDownlink::start(std::string_view host, uint16_t remote_port, uint16_t local_port) {
+	// Link ID, keep-alive and mode are fixed: a single connection whose remote end never changes
+	std::size_t len = format::to_buffer<"AT+CIPSTART=\"UDP\",\"{}\",{},{},0\r\n">(connect_command.data(),
+		connect_command.size(), host, remote_port, local_port);
+	if (len >= connect_command.size()) {
+		return false;
+	}
+
+	if (client.pending() + 4 > AtClient::QUEUE_CAPACITY) {
+		return false;
+	}
+
+	state = State::CONNECTING;
+
+	auto setup = [this](AtClient::Result result) { on_setup_result(result, false); };
+	client.submit({.text = "AT+CIPMUX=0\r\n", .on_complete = setup});
+	client.submit({.text = std::string_view(connect_command.data(), len), .timeout_ms = 5000, .on_complete = setup});
+	client.submit({.text = "AT+CIPMODE=1\r\n", .on_complete = setup});
+	client.submit({.text = "AT+CIPSEND\r\n", .on_complete = [this](AtClient::Result result) {
+		on_setup_result(result, true);
+	}});
+	return true;
+}
+
+bool esp32::TelemetryDownlink::send(std::span<const uint8_t> datagram, uint16_t samples) {
+	if (datagram.empty()) {
+		return true;
+	}
+
+	if (state != State::STREAMING
+		|| !transport.send(std::string_view(reinterpret_cast<const char*>(datagram.data()), datagram.size()))) {
+		++stats.dropped;
+		return false;
+	}
+
+	++stats.datagrams;
+	stats.samples += samples;
+	stats.bytes += datagram.size();
+	return true;
+}
+
+void esp32::TelemetryDownlink::stop() {
+	if (state == State::STREAMING) {
+		transport.send(EXIT_TRANSPARENT);
+	}
+	state = State::IDLE;
+}
+
+void esp32::TelemetryDownlink::on_setup_result(AtClient::Result result, bool last) {
+	// Stay failed once any step fails; later steps still complete and report their own results
+	if (state != State::CONNECTING) {
+		return;
+	}
+
+	if (result != AtClient::Result::OK) {
+		state = State::FAILED;
+	} else if (last) {
+		state = State::STREAMING;
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include <embedded_util/safety.hpp>
+
+#include <esp32_at/at_client.hpp>
+#include <esp32_at/at_transport.hpp>
+
+namespace esp32 {
+
+/// Streams telemetry datagrams to a UDP endpoint through the ESP32's transparent transmission mode
+///
+/// start() queues the commands that open a single UDP connection and switch to transparent transmission. After that
+/// each datagram is handed to the transport as one message, which the SPI link moves in a single transaction with no
+/// AT command or prompt round trip. Use TelemetryBatcher to fill datagrams up to the MTU.
+class TelemetryDownlink {
+	public:
+
+		enum class State : uint8_t {
+			IDLE,
+			/// Waiting for the ESP32 to open the connection and enter transparent mode
+			CONNECTING,
+			STREAMING,
+			/// A setup command failed
+			FAILED,
+		};
+
+		struct Stats {
+			uint32_t datagrams = 0;
+			uint32_t samples = 0;
+			/// Payload bytes handed to the transport
+			uint32_t bytes = 0;
+			/// Datagrams discarded because the downlink was not streaming or the transport failed
+			uint32_t dropped = 0;
+		};
+
+		TelemetryDownlink(AtClient& client, AtTransport& transport);
+
+		DISALLOW_COPY_AND_MOVE(TelemetryDownlink);
+
+		/// Queue the commands that connect to host:remote_port and enter transparent transmission
+		/// @param local_port Local UDP port, or 0 to let the ESP32 choose
+		/// @return false if the host name is too long or the command queue is full
+		bool start(std::string_view host, uint16_t remote_port, uint16_t local_port = 0);
+
+		/// Send one finished datagram
+		/// @param samples Number of samples in the datagram, for the statistics
+		/// @return false if the datagram was dropped
+		bool send(std::span<const uint8_t> datagram, uint16_t samples);
+
+		/// Leave transparent transmission. The ESP32 needs about a second of silence after this before it accepts
+		/// AT commands again.
+		void stop();
+
+		State get_state() const { return state; }
+		const Stats& get_stats() const { return stats; }
+
+	private:
+
+		/// Record the result of a setup command
+		void on_setup_result(AtClient::Result result, bool last);
+
+		AtClient& client;
+		AtTransport& transport;
+
+		State state = State::IDLE;
+		Stats stats;
+
+		/// Holds the AT+CIPSTART command until it is sent
+		std::array<char, 96> connect_command;
+
+};
+
+} // namespace esp32
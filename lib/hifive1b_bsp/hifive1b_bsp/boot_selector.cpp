@@ -0,0 +1,113 @@
+/// Boot selector: installs a staged firmware update before the program starts
+///
+/// The bootloader jumps to the start of the boot region (see hifive1_revb_custom.ld), where boot_selector_entry() is
+/// placed. If an update is waiting in the OTA slot it is copied over the program region, then execution continues at
+/// _enter, the program's normal start. Nothing in the program region is used along the way, so an install interrupted
+/// by a power loss is finished on the next boot.
+///
+/// This runs before the C runtime: .data, .bss and constructors aren't set up. While the program region is rewritten
+/// instructions can't be fetched from the flash at all, so the installer runs from ITIM, which the boot selector loads
+/// itself, and everything it uses is forced inline.
+
+#ifndef NATIVE
+
+#include <cstddef>
+#include <cstdint>
+
+#include <storage/ota_image.hpp>
+
+#include <hifive1b_bsp/flash_commands.hpp>
+#include <hifive1b_bsp/flash_controller.hpp>
+#include <hifive1b_bsp/xip_flash.hpp>
+
+using hifive1b::FlashController;
+using hifive1b::XipFlash;
+
+namespace {
+
+/// The flash as install_pending() uses it, without going through the program region
+class BootFlash {
+	public:
+		static constexpr uintptr_t BASE = 0x10014000;
+
+		ALWAYS_INLINE std::size_t sector_size() const { return FlashController::SECTOR_SIZE; }
+
+		ALWAYS_INLINE void read(uint32_t address, uint8_t* data, std::size_t len) {
+			// Volatile so the compiler can't turn the loop into a call to memcpy
+			auto source = reinterpret_cast<const volatile uint8_t*>(FlashController::MEMORY_MAPPED_BASE + address);
+			for (std::size_t i = 0; i < len; ++i) {
+				data[i] = source[i];
+			}
+		}
+
+		ALWAYS_INLINE void program(uint32_t address, const uint8_t* data, std::size_t len) {
+			run(hifive1b::spi_flash::PAGE_PROGRAM, address, data, len);
+		}
+
+		ALWAYS_INLINE void erase_sector(uint32_t address) {
+			run(hifive1b::spi_flash::SECTOR_ERASE, address, nullptr, 0);
+		}
+
+		/// Every operation finishes before returning
+		ALWAYS_INLINE void wait_ready() {}
+
+	private:
+		ALWAYS_INLINE void run(uint8_t command, uint32_t address, const uint8_t* data, std::size_t len) {
+			uint32_t saved_fmt = hifive1b::spi_flash::suspend_reads(BASE);
+			hifive1b::spi_flash::modify(BASE, command, address, data, len);
+			hifive1b::spi_flash::resume_reads(BASE, saved_fmt);
+		}
+};
+
+} // namespace
+
+extern "C" {
+
+// Set by the linker script
+extern volatile uint32_t boot_selector_itim_source_start[];
+extern volatile uint32_t boot_selector_itim_target_start[];
+extern volatile uint32_t boot_selector_itim_target_end[];
+
+/// Copy the update over the program region. Runs from ITIM.
+__attribute__((section(".boot_selector.itim"), noinline, used)) void boot_selector_install() {
+	BootFlash flash;
+	storage::install_pending(flash, XipFlash::OTA_SLOT_OFFSET, XipFlash::APP_REGION_OFFSET, XipFlash::APP_REGION_SIZE);
+
+	// The instruction cache may hold lines of the old program
+	asm volatile ("fence.i" ::: "memory");
+}
+
+/// Load the installer into ITIM and run it if an update is waiting
+__attribute__((section(".boot_selector.text"), noinline, used)) void boot_selector_main() {
+	auto manifest = reinterpret_cast<const volatile storage::OtaManifest*>(
+		FlashController::MEMORY_MAPPED_BASE + XipFlash::OTA_SLOT_OFFSET);
+	if (manifest->magic != storage::OtaManifest::MAGIC || manifest->status != storage::OtaManifest::PENDING) {
+		return;
+	}
+
+	volatile uint32_t* source = boot_selector_itim_source_start;
+	for (volatile uint32_t* target = boot_selector_itim_target_start; target < boot_selector_itim_target_end; ++target) {
+		*target = *source++;
+	}
+	asm volatile ("fence.i" ::: "memory");
+
+	boot_selector_install();
+}
+
+/// First instruction after the bootloader. Sets up the stack, which the installer needs, and the global pointer, which
+/// compiled code may assume, then continues to the program.
+__attribute__((section(".boot_selector.entry"), naked, used)) void boot_selector_entry() {
+	asm volatile (
+		".option push\n"
+		".option norelax\n"
+		"la gp, __global_pointer$\n"
+		".option pop\n"
+		"la sp, _sp\n"
+		"call boot_selector_main\n"
+		"tail _enter\n"
+	);
+}
+
+} // extern "C"
+
+#endif // NATIVE
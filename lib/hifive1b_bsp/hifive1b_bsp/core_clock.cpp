@@ -35,6 +35,7 @@ void hifive1b::CoreClock::set_max_speed() {
 	cfg.bypass = false;
 
 	// Apply this configuration
+	emit_frequency_pending(Pll::get_output_frequency(cfg));
 	pll_driver.configure_and_select(cfg);
 
 	emit_frequency_change(get_frequency());
@@ -50,6 +51,7 @@ void hifive1b::CoreClock::set_low_speed() {
 	// Shut off and bypass the PLL, using the reference clock directly
 	cfg.bypass = true;
 
+	emit_frequency_pending(Pll::get_output_frequency(cfg));
 	pll_driver.configure_and_select(cfg);
 
 	emit_frequency_change(get_frequency());
@@ -0,0 +1,166 @@
+/// Access to the machine-mode control and status registers of the E31 core
+///
+/// Native builds get stand-ins, so drivers using these can be tested against fake memory-mapped registers. mstatus, mie
+/// and mcycle are plain variables there, and tests can hook `wfi` and the moment interrupts are enabled to play the
+/// part of the hardware.
+
+#pragma once
+
+#include <cstdint>
+
+#ifdef NATIVE
+#include <functional>
+#endif
+
+namespace hifive1b::csr {
+
+constexpr uint32_t MSTATUS_MIE = 1UL << 3;
+
+constexpr uint32_t MIE_MSIE = 1UL << 3;
+constexpr uint32_t MIE_MTIE = 1UL << 7;
+constexpr uint32_t MIE_MEIE = 1UL << 11;
+
+/// mtvec mode where interrupts jump to BASE + 4 * cause and exceptions to BASE
+constexpr uint32_t MTVEC_VECTORED = 1;
+
+/// Set in mcause for interrupts
+constexpr uint32_t MCAUSE_INTERRUPT = 1UL << 31;
+
+#ifdef NATIVE
+
+namespace native {
+
+inline uint32_t mstatus = 0;
+inline uint32_t mie = 0;
+inline uint32_t mcycle = 0;
+
+/// Called by wfi(), such as to advance fake time or raise a fake interrupt
+inline std::function<void()> on_wfi;
+
+/// Called when set_mstatus() sets MIE, to run the handlers of whatever the test has made pending
+inline std::function<void()> on_interrupts_enabled;
+
+/// Put everything back as at reset
+inline void reset() {
+	mstatus = 0;
+	mie = 0;
+	mcycle = 0;
+	on_wfi = nullptr;
+	on_interrupts_enabled = nullptr;
+}
+
+}
+
+inline uint32_t clear_mstatus(uint32_t bits) {
+	uint32_t value = native::mstatus;
+	native::mstatus &= ~bits;
+	return value;
+}
+
+inline void set_mstatus(uint32_t bits) {
+	native::mstatus |= bits;
+	if ((bits & MSTATUS_MIE) && native::on_interrupts_enabled) {
+		native::on_interrupts_enabled();
+	}
+}
+
+inline uint32_t read_mie() { return native::mie; }
+inline void write_mie(uint32_t value) { native::mie = value; }
+inline void set_mie(uint32_t bits) { native::mie |= bits; }
+inline void clear_mie(uint32_t bits) { native::mie &= ~bits; }
+inline uint32_t swap_mtvec(uint32_t) { return 0; }
+inline uint32_t read_mscratch() { return 0; }
+inline uint32_t read_mcause() { return 0; }
+inline uint32_t read_mepc() { return 0; }
+inline uint32_t read_mtval() { return 0; }
+inline uint32_t read_mcycle() { return native::mcycle; }
+
+inline void wfi() {
+	if (native::on_wfi) {
+		native::on_wfi();
+	}
+}
+
+inline void ebreak() {}
+
+#else
+
+/// Clear bits of mstatus and return its previous value
+inline uint32_t clear_mstatus(uint32_t bits) {
+	uint32_t value;
+	asm volatile ("csrrc %0, mstatus, %1" : "=r"(value) : "r"(bits) : "memory");
+	return value;
+}
+
+inline void set_mstatus(uint32_t bits) {
+	asm volatile ("csrs mstatus, %0" :: "r"(bits) : "memory");
+}
+
+inline uint32_t read_mie() {
+	uint32_t value;
+	asm volatile ("csrr %0, mie" : "=r"(value));
+	return value;
+}
+
+inline void write_mie(uint32_t value) {
+	asm volatile ("csrw mie, %0" :: "r"(value) : "memory");
+}
+
+inline void set_mie(uint32_t bits) {
+	asm volatile ("csrs mie, %0" :: "r"(bits) : "memory");
+}
+
+inline void clear_mie(uint32_t bits) {
+	asm volatile ("csrc mie, %0" :: "r"(bits) : "memory");
+}
+
+/// Write mtvec and return its previous value
+inline uint32_t swap_mtvec(uint32_t value) {
+	uint32_t previous;
+	asm volatile ("csrrw %0, mtvec, %1" : "=r"(previous) : "r"(value) : "memory");
+	return previous;
+}
+
+inline uint32_t read_mscratch() {
+	uint32_t value;
+	asm volatile ("csrr %0, mscratch" : "=r"(value));
+	return value;
+}
+
+inline uint32_t read_mcause() {
+	uint32_t value;
+	asm volatile ("csrr %0, mcause" : "=r"(value));
+	return value;
+}
+
+inline uint32_t read_mepc() {
+	uint32_t value;
+	asm volatile ("csrr %0, mepc" : "=r"(value));
+	return value;
+}
+
+inline uint32_t read_mtval() {
+	uint32_t value;
+	asm volatile ("csrr %0, mtval" : "=r"(value));
+	return value;
+}
+
+/// Low word of the core cycle counter
+inline uint32_t read_mcycle() {
+	uint32_t value;
+	asm volatile ("csrr %0, mcycle" : "=r"(value));
+	return value;
+}
+
+inline void wfi() {
+	asm volatile ("wfi" ::: "memory");
+}
+
+/// Take a breakpoint exception, which lands in the trap handler like any other fault
+inline void ebreak() {
+	asm volatile ("ebreak" ::: "memory");
+}
+
+#endif
+
+}
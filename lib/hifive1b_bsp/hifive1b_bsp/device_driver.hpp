@@ -1,20 +1,46 @@
 #pragma once
 
 #include <array>
+#include <type_traits>
 
 #include <hifive1b_bsp/core_clock.hpp>
+#include <hifive1b_bsp/flash_controller.hpp>
 #include <hifive1b_bsp/freedom_logger.hpp>
+#include <hifive1b_bsp/idle.hpp>
 #include <hifive1b_bsp/leds.hpp>
+#include <hifive1b_bsp/pinmux.hpp>
 #include <hifive1b_bsp/spi_driver.hpp>
 
+#include <embedded_util/logger.hpp>
 #include <embedded_util/safety.hpp>
 
-extern "C" {
-#	include "metal/cpu.h"
-}
-
 namespace hifive1b {
 
+/// Every pin the board's drivers use
+inline constexpr std::array<PinConfig, 10> HIFIVE1B_PINS {{
+	// UART0 to the debug interface. The pull-up holds RX idle while the USB side is unpowered.
+	{16, PinFunction::IOF0, true},
+	{17, PinFunction::IOF0},
+
+	// SPI1 to the ESP32: MOSI, MISO, SCK and CS2, and its handshake line (WF_INT)
+	{3, PinFunction::IOF0},
+	{4, PinFunction::IOF0},
+	{5, PinFunction::IOF0},
+	{9, PinFunction::IOF0},
+	{10, PinFunction::GPIO_INPUT},
+
+	// RGB LED on PWM1 channels 1-3: green, blue, red
+	{19, PinFunction::IOF1},
+	{21, PinFunction::IOF1},
+	{22, PinFunction::IOF1},
+}};
+
+inline constexpr PinMux HIFIVE1B_PINMUX = PinMux::from(HIFIVE1B_PINS);
+
+static_assert(HIFIVE1B_PINMUX.conflicts == 0, "A pin is listed more than once in HIFIVE1B_PINS");
+static_assert(HIFIVE1B_PINMUX.unavailable == 0, "A pin in HIFIVE1B_PINS is given an IOF it doesn't have");
+static_assert(!HIFIVE1B_PINMUX.invalid, "A pin number in HIFIVE1B_PINS is out of range");
+
 /**
  * Device driver for the Hifive1 Rev B board
 */
@@ -22,19 +48,28 @@ template<typename Logger = MetalUartStream,
 	typename SpiDriverT = SpiDriver,
 	typename CoreClockDriverT = CoreClock>
 class Hifive1B {
-	//static_assert(std::is_base_of_v<BasicOutStream<uint8_t>, Logger>, "Logger must be a BasicOutStream that consumes uint8_t");
+	static_assert(std::is_base_of_v<BasicOutStream<uint8_t>, Logger>, "Logger must be a BasicOutStream that consumes uint8_t");
 
 	public:
 		Hifive1B() :
-			core(metal_cpu_get(metal_cpu_get_current_hartid())),
-
 			// Set LEDs to orange during initialization
-			leds(1, 1, 0),
+			leds(hf_clock, 1, 1, 0),
 
 			// Construct 3 SPI devices
 			spi_drivers{SpiDriverT(0), SpiDriverT(1), SpiDriverT(2)}
 		{
-			// Devices are constructed above
+			// Devices are constructed above, and the LED's PWM already shows orange when its pins are connected
+			HIFIVE1B_PINMUX.apply();
+
+			// Speed up instruction fetch. If the flash refuses quad mode it keeps working in the slower reset format.
+			flash.initialize(hf_clock);
+
+			// Short delays count core cycles, so they're measured again at each clock speed
+			idle.calibrate();
+			hf_clock.add_frequency_change_listener([this](Frequency) {
+				idle.calibrate();
+			});
+			idle.reset_stats();
 
 			bool failure = false;
 
@@ -65,30 +100,27 @@ class Hifive1B {
 		/// Get the driver for the high-frequency clock (hfclk) that drives the core and other devices 
 		CoreClockDriverT& get_clock_driver() { return hf_clock; }
 
+		/// Get the driver for the flash that code executes from
+		FlashController& get_flash_controller() { return flash; }
+
+		/// Get the low-power waits and delays
+		Idle& get_idle() { return idle; }
+
 	private:
-		metal_cpu* core;
 		CoreClockDriverT hf_clock;
+		FlashController flash;
+		Idle idle;
 		LedDriver leds;
 		Logger logger;
 
 		std::array<SpiDriverT, 3> spi_drivers;
 
 		void halt_and_catch_fire() {
-			// Attempt to blink red led on failure; LED and CPU timer initialization will not fail
+			// Blink the red LED on failure; the blinking is done by the PWM hardware and LED initialization will not fail
 			logger << "Error initializing hardware\n";
-			bool toggle = false;
-			leds.set(1, 0, 0);
-
-			uint64_t endDelay = 0;
-			for (;;) {
-				// Minimal CPU delay function that works with default clocks
-				endDelay = metal_cpu_get_timer(core) + 20'000'000;
-				while (metal_cpu_get_timer(core) < endDelay) {
-					;
-				}
-				leds.set(toggle, 0, 0);
-				toggle = !toggle;
-			}
+			leds.blink({0xFF, 0, 0}, 1000);
+
+			Idle::halt();
 		}
 
 };
@@ -1,5 +1,8 @@
 #include <hifive1b_bsp/devices/pll.hpp>
 
+#include <array>
+#include <bit>
+
 #include <embedded_util/control_register.hpp>
 
 // Constants for the pllcfg register
@@ -14,18 +17,34 @@ static constexpr auto PLL_BYPASS = BitField<uint32_t>::single_bit<18>();
 
 static constexpr auto PLL_LOCK = BitField<uint32_t>::single_bit<31>();
 
+/// The reference frequency after the R divider, indexed by R - 1 as in the register and computed at compile time so
+/// decoding a configuration doesn't divide
+static constexpr auto REFERENCE_DIVIDED = [] {
+	std::array<uint32_t, 8> divided {};
+	for (uint32_t i = 0; i < divided.size(); ++i) {
+		divided[i] = hifive1b::Pll::HFXOSC_FREQUENCY.count() / (i + 1);
+	}
+	return divided;
+}();
+
 Frequency hifive1b::Pll::get_output_frequency() const {
 	// Calculate the frequency from the PLL clock configuration
 	ConfigStatus cfg;
 	get_config(cfg);
 
+	return get_output_frequency(cfg);
+}
+
+Frequency hifive1b::Pll::get_output_frequency(const ConfigStatus& cfg) {
 	// If bypassing the PLL, then the external oscillator frequency is being passed through
 	if (cfg.bypass) {
 		return HFXOSC_FREQUENCY;
 	}
 
-	// Otherwise, calculate how the reference frequency is transformed by the PLL
-	return HFXOSC_FREQUENCY / cfg.R * cfg.F / cfg.Q;
+	// Otherwise, calculate how the reference frequency is transformed by the PLL. The R divider is looked up and Q is a
+	// shift for every value the hardware supports, leaving a single 32-bit multiply.
+	uint32_t vco = REFERENCE_DIVIDED[(cfg.R - 1) & 0x7] * cfg.F;
+	return Frequency(std::has_single_bit(cfg.Q) ? vco >> std::countr_zero(cfg.Q) : vco / cfg.Q);
 }
 
 void hifive1b::Pll::set_config(const ConfigStatus& cfg) const {
@@ -115,7 +134,7 @@ void hifive1b::Pll::configure_and_select(const ConfigStatus& cfg) const {
 		// The lock signal will not be stable for up to 100 microseconds
 		// At the HFROSC reset frequency, counting to 1000 will surely exceed this
 		volatile uint32_t counter = 0;
-		while (counter < 1000) { ++counter; }
+		while (counter < 1000) { counter = counter + 1; }
 
 		// Wait for lock signal
 		do {
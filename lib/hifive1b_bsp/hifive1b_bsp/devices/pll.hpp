@@ -50,6 +50,9 @@ class Pll {
 		/// Calculate and return the output frequency
 		Frequency get_output_frequency() const;
 
+		/// Calculate the output frequency a configuration would produce
+		static Frequency get_output_frequency(const ConfigStatus& cfg);
+
 		/// Read the PLL configuration and status register
 		void get_config(ConfigStatus&) const;
 
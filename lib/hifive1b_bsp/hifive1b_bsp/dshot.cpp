@@ -0,0 +1,60 @@
+#include <hifive1b_bsp/dshot.hpp>
+
+std::size_t hifive1b::DshotOutput::encode(uint16_t frame, const Timing& timing, uint8_t* out) {
+	// Every DShot bit is a whole number of samples and there are 16, so the frame fills 2 * samples_per_bit bytes
+	std::size_t length = 2 * timing.samples_per_bit;
+	uint32_t byte = 0;
+	uint32_t filled = 0;
+	std::size_t written = 0;
+
+	for (int bit = 15; bit >= 0; --bit) {
+		uint32_t high = ((frame >> bit) & 1) ? timing.one_high : timing.zero_high;
+		for (uint32_t sample = 0; sample < timing.samples_per_bit; ++sample) {
+			byte = (byte << 1) | ((sample < high) ? 1 : 0);
+			if (++filled == 8) {
+				out[written++] = static_cast<uint8_t>(byte);
+				byte = 0;
+				filled = 0;
+			}
+		}
+	}
+
+	// MOSI keeps its last level once the controller stops, which the low byte makes sure is low
+	out[length] = 0;
+	return length + 1;
+}
+
+hifive1b::DshotOutput::DshotOutput(SpiDriver& spi, Clock& input_clock, Speed speed) :
+	spi(spi),
+	speed(speed)
+{
+	spi.set_chip_select_mode(SpiDriver::ChipSelectMode::OFF);
+	apply_timing(static_cast<uint32_t>(input_clock.get_frequency().count()));
+
+	// The driver has restored its own baud rate by the time this runs, since it started listening first
+	input_clock.add_frequency_change_listener([this](Frequency new_frequency) {
+		apply_timing(static_cast<uint32_t>(new_frequency.count()));
+	});
+}
+
+void hifive1b::DshotOutput::set_throttle(uint16_t throttle, bool telemetry) {
+	if (throttle > MAX_THROTTLE) {
+		throttle = MAX_THROTTLE;
+	}
+	send(static_cast<uint16_t>(throttle + MIN_THROTTLE_VALUE), telemetry);
+}
+
+void hifive1b::DshotOutput::send(uint16_t value, bool telemetry) {
+	length = encode(make_frame(value, telemetry), timing, buffer.data());
+	spi.transfer(buffer.data(), nullptr, length);
+}
+
+Completion<>& hifive1b::DshotOutput::send_async(uint16_t value, bool telemetry) {
+	length = encode(make_frame(value, telemetry), timing, buffer.data());
+	return spi.transfer_async(buffer.data(), nullptr, length);
+}
+
+void hifive1b::DshotOutput::apply_timing(uint32_t input_frequency) {
+	timing = choose_timing(input_frequency, speed);
+	spi.set_baud_rate(timing.samples_per_bit * static_cast<uint32_t>(speed));
+}
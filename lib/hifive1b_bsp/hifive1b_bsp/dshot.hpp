@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <embedded_util/clock.hpp>
+#include <embedded_util/coroutine.hpp>
+#include <embedded_util/safety.hpp>
+#include <hifive1b_bsp/spi_driver.hpp>
+
+namespace hifive1b {
+
+/// DShot digital ESC output, with an SPI controller's MOSI line as the waveform generator
+///
+/// A DShot frame is 16 bits, MSB first: an 11-bit value, a telemetry request bit and a 4-bit checksum. Every bit takes
+/// the same time and starts high. A 1 stays high for 3/4 of the bit and a 0 for 3/8. Each DShot bit becomes a run of
+/// SPI bits ("samples"): high samples, then low samples for the rest of the bit. The controller shifts them out, so
+/// the pulse timing comes from the SPI clock rather than the CPU.
+///
+/// The samples per bit are picked together with the SPI clock divider, so the bit rate lands as close to the DShot
+/// rate as the controller's input clock allows. The choice is made again whenever that clock changes. Chip selects
+/// aren't used; only the controller's MOSI pin needs to go to the ESC's signal input.
+class DshotOutput {
+	public:
+		enum class Speed : uint32_t {
+			DSHOT150 = 150'000,
+			DSHOT300 = 300'000,
+			DSHOT600 = 600'000,
+		};
+
+		/// Values below 48 are commands; 0 also stops the motor
+		static constexpr uint16_t MIN_THROTTLE_VALUE = 48;
+		static constexpr uint16_t MAX_VALUE = 2047;
+
+		/// Range of set_throttle()
+		static constexpr uint16_t MAX_THROTTLE = MAX_VALUE - MIN_THROTTLE_VALUE;
+
+		/// Samples per DShot bit to choose from. At least 8 keeps both pulse widths within 1/16 of a bit of nominal.
+		static constexpr uint32_t MIN_SAMPLES = 8;
+		static constexpr uint32_t MAX_SAMPLES = 16;
+
+		/// Largest bit rate error, in parts per million, that still counts as in tolerance. ESCs measure the pulses
+		/// against the bit period they see, so they accept a few percent.
+		static constexpr uint32_t MAX_RATE_ERROR_PPM = 30'000;
+
+		/// Bytes of a frame at MAX_SAMPLES, and a low byte that ends it
+		static constexpr std::size_t MAX_FRAME_BYTES = 16 * MAX_SAMPLES / 8 + 1;
+
+		/// How each DShot bit is drawn in SPI bits
+		struct Timing {
+			uint32_t samples_per_bit = 0;
+			/// High samples at the start of a 1 and of a 0
+			uint32_t one_high = 0;
+			uint32_t zero_high = 0;
+			/// SPI clock and resulting DShot bit rate
+			uint32_t sck_rate = 0;
+			uint32_t bit_rate = 0;
+			/// Distance of bit_rate from the DShot rate
+			uint32_t error_ppm = UINT32_MAX;
+		};
+
+		/// A frame with its checksum
+		static constexpr uint16_t make_frame(uint16_t value, bool telemetry) {
+			uint16_t data = static_cast<uint16_t>(((value & MAX_VALUE) << 1) | (telemetry ? 1 : 0));
+			uint16_t crc = (data ^ (data >> 4) ^ (data >> 8)) & 0xF;
+			return static_cast<uint16_t>((data << 4) | crc);
+		}
+
+		/// The best timing for a DShot speed from an SPI controller with this input clock
+		static constexpr Timing choose_timing(uint32_t input_frequency, Speed speed) {
+			uint32_t rate = static_cast<uint32_t>(speed);
+			Timing best;
+
+			for (uint32_t n = MIN_SAMPLES; n <= MAX_SAMPLES; ++n) {
+				uint32_t sck = SpiDriver::baud_rate_for(input_frequency, rate * n);
+				uint32_t bit_rate = sck / n;
+				uint32_t error = (bit_rate > rate) ? bit_rate - rate : rate - bit_rate;
+				uint32_t error_ppm = static_cast<uint32_t>(static_cast<uint64_t>(error) * 1'000'000 / rate);
+				if (error_ppm < best.error_ppm) {
+					// Rounded to the nearest sample
+					best = {n, (6 * n + 4) / 8, (3 * n + 4) / 8, sck, bit_rate, error_ppm};
+				}
+			}
+			return best;
+		}
+
+		/// Draw a frame as SPI bytes, MSB first, followed by a low byte
+		/// @return The number of bytes, 2 * samples_per_bit + 1
+		static std::size_t encode(uint16_t frame, const Timing& timing, uint8_t* out);
+
+		/// Take over an SPI controller for DShot. It must already be initialized with input_clock.
+		/// @param input_clock The clock driving the controller, which is the core clock
+		DshotOutput(SpiDriver& spi, Clock& input_clock, Speed speed);
+
+		DISALLOW_COPY_AND_MOVE(DshotOutput);
+
+		/// Send a throttle from 0 to MAX_THROTTLE, waiting until the frame has been shifted out (27 us at DShot600)
+		void set_throttle(uint16_t throttle, bool telemetry = false);
+
+		/// Send a raw 11-bit value, such as a command, waiting until the frame has been shifted out
+		void send(uint16_t value, bool telemetry = false);
+
+		/// Send a raw value in the background through SpiDriver::transfer_async()
+		///
+		/// The SPI controller's interrupt must be routed to SpiDriver::handle_interrupt(), and no other frame may be
+		/// sent until the returned completion is done.
+		Completion<>& send_async(uint16_t value, bool telemetry = false);
+
+		const Timing& get_timing() const { return timing; }
+
+		/// Whether the bit rate is within MAX_RATE_ERROR_PPM of the DShot rate
+		bool in_tolerance() const { return timing.error_ppm <= MAX_RATE_ERROR_PPM; }
+
+	private:
+		/// Pick the timing for an input clock and set the SPI baud rate to match
+		void apply_timing(uint32_t input_frequency);
+
+		SpiDriver& spi;
+		Speed speed;
+		Timing timing;
+
+		/// The frame being sent, which has to outlive a background transfer
+		std::array<uint8_t, MAX_FRAME_BYTES> buffer {};
+		std::size_t length = 0;
+};
+
+}
@@ -0,0 +1,121 @@
+#include <hifive1b_bsp/edge_capture.hpp>
+
+// GPIO register offsets. Each interrupt pending bit is cleared by writing 1.
+
+static constexpr uintptr_t GPIO_INPUT_VAL = 0x00;
+static constexpr uintptr_t GPIO_INPUT_EN = 0x04;
+static constexpr uintptr_t GPIO_PUE = 0x10;
+static constexpr uintptr_t GPIO_RISE_IE = 0x18;
+static constexpr uintptr_t GPIO_RISE_IP = 0x1C;
+static constexpr uintptr_t GPIO_FALL_IE = 0x20;
+static constexpr uintptr_t GPIO_FALL_IP = 0x24;
+
+// The handler runs from ITIM so its time doesn't depend on the instruction cache
+
+#ifdef NATIVE
+#	define ITIM_FUNCTION
+#else
+#	define ITIM_FUNCTION __attribute__((section(".itim"), noinline))
+#endif
+
+static inline volatile uint32_t& mmio(uintptr_t address) {
+	return *reinterpret_cast<volatile uint32_t*>(address);
+}
+
+/// PLIC source of a GPIO pin
+static constexpr uint32_t gpio_source(uint32_t pin) {
+	return 8 + pin;
+}
+
+hifive1b::EdgeCapture::EdgeCapture(uint32_t pin, uintptr_t gpio) :
+	pin(pin),
+	mask(1UL << pin),
+	gpio(gpio)
+{}
+
+bool hifive1b::EdgeCapture::start(InterruptController& interrupts, uint32_t priority, bool pull_up) {
+	if (pull_up) {
+		mmio(gpio + GPIO_PUE) = mmio(gpio + GPIO_PUE) | mask;
+	}
+	mmio(gpio + GPIO_INPUT_EN) = mmio(gpio + GPIO_INPUT_EN) | mask;
+
+	// Edges from before starting aren't ours to timestamp
+	mmio(gpio + GPIO_RISE_IP) = mask;
+	mmio(gpio + GPIO_FALL_IP) = mask;
+
+	this->interrupts = &interrupts;
+	if (!interrupts.attach(gpio_source(pin), priority, isr, this)) {
+		this->interrupts = nullptr;
+		return false;
+	}
+
+	mmio(gpio + GPIO_RISE_IE) = mmio(gpio + GPIO_RISE_IE) | mask;
+	mmio(gpio + GPIO_FALL_IE) = mmio(gpio + GPIO_FALL_IE) | mask;
+	return true;
+}
+
+void hifive1b::EdgeCapture::stop() {
+	mmio(gpio + GPIO_RISE_IE) = mmio(gpio + GPIO_RISE_IE) & ~mask;
+	mmio(gpio + GPIO_FALL_IE) = mmio(gpio + GPIO_FALL_IE) & ~mask;
+	mmio(gpio + GPIO_RISE_IP) = mask;
+	mmio(gpio + GPIO_FALL_IP) = mask;
+
+	if (interrupts) {
+		interrupts->detach(gpio_source(pin));
+		interrupts = nullptr;
+	}
+}
+
+ITIM_FUNCTION void hifive1b::EdgeCapture::handle_interrupt(uint32_t timestamp) {
+	bool rose = mmio(gpio + GPIO_RISE_IP) & mask;
+	bool fell = mmio(gpio + GPIO_FALL_IP) & mask;
+
+	// Cleared before reading the level, so an edge after this point raises the interrupt again
+	mmio(gpio + GPIO_RISE_IP) = mask;
+	mmio(gpio + GPIO_FALL_IP) = mask;
+	bool high = mmio(gpio + GPIO_INPUT_VAL) & mask;
+
+	uint32_t stamp = timestamp & ~(RISING | AFTER_GAP);
+	if (rose && fell) {
+		// The level is where the later edge left the pin
+		push(stamp | (high ? 0 : RISING));
+		push(stamp | (high ? RISING : 0));
+	} else if (rose || fell) {
+		push(stamp | (rose ? RISING : 0));
+	}
+}
+
+bool hifive1b::EdgeCapture::take(Edge& edge) {
+	uint32_t position = head.load(std::memory_order_relaxed);
+	if (position == tail.load(std::memory_order_acquire)) {
+		return false;
+	}
+
+	uint32_t entry = ring[position & (CAPACITY - 1)];
+	head.store(position + 1, std::memory_order_release);
+
+	edge.cycles = entry & ~(RISING | AFTER_GAP);
+	edge.rising = entry & RISING;
+	edge.after_gap = entry & AFTER_GAP;
+	return true;
+}
+
+ITIM_FUNCTION void hifive1b::EdgeCapture::isr(void* context) {
+	auto* self = static_cast<EdgeCapture*>(context);
+	self->handle_interrupt(self->interrupts->get_entry_cycles());
+}
+
+ITIM_FUNCTION void hifive1b::EdgeCapture::push(uint32_t entry) {
+	edge_count.store(edge_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	uint32_t position = tail.load(std::memory_order_relaxed);
+	if (position - head.load(std::memory_order_acquire) == CAPACITY) {
+		dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		gap = true;
+		return;
+	}
+
+	ring[position & (CAPACITY - 1)] = entry | (gap ? AFTER_GAP : 0);
+	gap = false;
+	tail.store(position + 1, std::memory_order_release);
+}
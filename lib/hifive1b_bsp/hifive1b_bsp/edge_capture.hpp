@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <embedded_util/safety.hpp>
+#include <hifive1b_bsp/interrupts.hpp>
+
+namespace hifive1b {
+
+/// Timestamps the rising and falling edges of a GPIO input, such as a wheel encoder channel
+///
+/// Each GPIO pin has its own PLIC source, so every channel gets its own interrupt and handler context. The handler
+/// takes the cycle count its vector was entered at, clears the pin's pending edges and queues them; it never loops, so
+/// its time is the same whatever the edge rate. Edges go into a single-producer, single-consumer ring that the main
+/// loop drains. When the ring is full new edges are dropped, but the edge count keeps counting them, and the next
+/// queued edge is marked as coming after a gap.
+///
+/// If a rising and a falling edge are both pending, the pin's level shows which came last, and both get the same
+/// timestamp. Pulses shorter than the interrupt latency are lost, as are both edges of a pulse that ends before the
+/// handler runs.
+///
+/// The timestamp is when the vector was entered, not when the edge happened, so anything that holds the interrupt off
+/// makes it late by that long: code running with interrupts disabled, a handler at the same or a higher priority, or an
+/// Idle wait that was started with interrupts disabled. Idle waits started with interrupts enabled let the handler run
+/// as soon as the edge wakes the core.
+///
+/// More information is available in the FE310-G002 Manual Chapters 9 (PLIC) and 17 (GPIO).
+class EdgeCapture {
+	public:
+		/// Queued edges per channel. Must be a power of two.
+		static constexpr std::size_t CAPACITY = 64;
+
+		struct Edge {
+			/// mcycle at the interrupt, with the lowest two bits cleared (a 12.5 ns step at 320 MHz)
+			uint32_t cycles;
+			bool rising;
+			/// Edges were dropped just before this one, so it doesn't follow the previous edge taken
+			bool after_gap;
+		};
+
+		/// @param pin GPIO number, 0 to 31
+		explicit EdgeCapture(uint32_t pin, uintptr_t gpio = 0x10012000);
+
+		DISALLOW_COPY_AND_MOVE(EdgeCapture);
+
+		/// Enable the pin's input and edge interrupts, and route its PLIC source to this channel
+		/// @param pull_up Enable the internal pull-up, such as for an open-collector sensor
+		/// @return false if the controller refused the source or priority
+		bool start(InterruptController& interrupts, uint32_t priority, bool pull_up = false);
+
+		/// Disable the pin's edge interrupts and detach its source
+		void stop();
+
+		/// Queue the pin's pending edges. Called from the interrupt handler.
+		/// @param timestamp mcycle when the interrupt was taken
+		void handle_interrupt(uint32_t timestamp);
+
+		/// Remove the oldest queued edge. Only one context may take edges.
+		/// @return false if there are none
+		bool take(Edge& edge);
+
+		/// Edges seen since start, including dropped ones. Wraps around.
+		uint32_t get_edge_count() const { return edge_count.load(std::memory_order_relaxed); }
+
+		/// Edges that didn't fit in the ring
+		uint32_t get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+		uint32_t get_pin() const { return pin; }
+
+	private:
+		static_assert((CAPACITY & (CAPACITY - 1)) == 0, "EdgeCapture: capacity must be a power of two");
+
+		// Entries are the timestamp with these flags in the low bits
+		static constexpr uint32_t RISING = 1;
+		static constexpr uint32_t AFTER_GAP = 2;
+
+		static void isr(void* context);
+
+		void push(uint32_t entry);
+
+		uint32_t pin;
+		uint32_t mask;
+		uintptr_t gpio;
+		InterruptController* interrupts = nullptr;
+
+		std::array<uint32_t, CAPACITY> ring {};
+		std::atomic<uint32_t> head {0};
+		std::atomic<uint32_t> tail {0};
+		std::atomic<uint32_t> edge_count {0};
+		std::atomic<uint32_t> dropped {0};
+		bool gap = false;
+};
+
+}
@@ -0,0 +1,141 @@
+/// Programmed I/O commands for the XIP flash on SPI0
+///
+/// Shared by the flash controller driver and the boot selector. Everything here is forced inline so it can be used by
+/// code that runs while memory-mapped reads are off, which must not call into or read constants from the flash.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef ALWAYS_INLINE
+#	define ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace hifive1b::spi_flash {
+
+// Register offsets
+
+constexpr uintptr_t CSMODE_OFFSET = 0x18;
+constexpr uintptr_t FMT_OFFSET = 0x40;
+constexpr uintptr_t TXDATA_OFFSET = 0x48;
+constexpr uintptr_t RXDATA_OFFSET = 0x4C;
+constexpr uintptr_t FCTRL_OFFSET = 0x60;
+
+constexpr uint32_t FCTRL_EN = 1;
+
+/// Single line, MSB first, receiving, 8-bit frames
+constexpr uint32_t FMT_PROGRAMMED_IO = 8UL << 16;
+
+constexpr uint32_t CSMODE_AUTO = 0;
+constexpr uint32_t CSMODE_HOLD = 2;
+
+// Status flags in the data registers
+
+constexpr uint32_t TXDATA_FULL = 1UL << 31;
+constexpr uint32_t RXDATA_EMPTY = 1UL << 31;
+
+// Flash commands and status register bits
+
+constexpr uint8_t WRITE_STATUS = 0x01;
+constexpr uint8_t PAGE_PROGRAM = 0x02;
+constexpr uint8_t READ_STATUS = 0x05;
+constexpr uint8_t WRITE_ENABLE = 0x06;
+constexpr uint8_t SECTOR_ERASE = 0x20;
+
+constexpr uint8_t STATUS_WIP = 0x01;
+constexpr uint8_t STATUS_QE = 0x40;
+
+ALWAYS_INLINE volatile uint32_t& mmio(uintptr_t address) {
+	return *reinterpret_cast<volatile uint32_t*>(address);
+}
+
+/// Clear mstatus.MIE and return its previous value. Interrupt handlers live in flash.
+ALWAYS_INLINE uint32_t disable_interrupts() {
+#ifdef NATIVE
+	return 0;
+#else
+	uint32_t mstatus;
+	asm volatile ("csrrci %0, mstatus, 8" : "=r"(mstatus) :: "memory");
+	return mstatus;
+#endif
+}
+
+ALWAYS_INLINE void restore_interrupts(uint32_t mstatus) {
+#ifdef NATIVE
+	(void) mstatus;
+#else
+	asm volatile ("csrs mstatus, %0" :: "r"(mstatus & 8) : "memory");
+#endif
+}
+
+/// Exchange one byte with the flash over programmed I/O
+ALWAYS_INLINE uint8_t exchange(uintptr_t base, uint8_t tx) {
+	while (mmio(base + TXDATA_OFFSET) & TXDATA_FULL) {}
+	mmio(base + TXDATA_OFFSET) = tx;
+
+	// Reading pops the FIFO, so keep the value from the read that found it non-empty
+	uint32_t rx;
+	do {
+		rx = mmio(base + RXDATA_OFFSET);
+	} while (rx & RXDATA_EMPTY);
+
+	return static_cast<uint8_t>(rx);
+}
+
+// Commands are sent a byte at a time rather than from arrays, which the compiler could initialize from flash
+
+ALWAYS_INLINE void begin_command(uintptr_t base, uint8_t command) {
+	mmio(base + CSMODE_OFFSET) = CSMODE_HOLD;
+	exchange(base, command);
+}
+
+/// Leaving hold mode releases the chip select, which is what ends the command
+ALWAYS_INLINE void end_command(uintptr_t base) {
+	mmio(base + CSMODE_OFFSET) = CSMODE_AUTO;
+}
+
+ALWAYS_INLINE uint8_t read_status(uintptr_t base) {
+	begin_command(base, READ_STATUS);
+	uint8_t status = exchange(base, 0);
+	end_command(base);
+	return status;
+}
+
+ALWAYS_INLINE void write_enable(uintptr_t base) {
+	begin_command(base, WRITE_ENABLE);
+	end_command(base);
+}
+
+/// Suspend memory-mapped reads and switch to programmed I/O
+/// @return The fmt register value to pass to resume_reads()
+ALWAYS_INLINE uint32_t suspend_reads(uintptr_t base) {
+	mmio(base + FCTRL_OFFSET) = 0;
+	uint32_t saved_fmt = mmio(base + FMT_OFFSET);
+	mmio(base + FMT_OFFSET) = FMT_PROGRAMMED_IO;
+	return saved_fmt;
+}
+
+ALWAYS_INLINE void resume_reads(uintptr_t base, uint32_t saved_fmt) {
+	mmio(base + FMT_OFFSET) = saved_fmt;
+	mmio(base + FCTRL_OFFSET) = FCTRL_EN;
+}
+
+/// Run a program or erase command and wait for the flash to finish it. Memory-mapped reads must be suspended.
+/// @param data Bytes to program, which must be in RAM
+ALWAYS_INLINE void modify(uintptr_t base, uint8_t command, uint32_t offset, const uint8_t* data, std::size_t len) {
+	write_enable(base);
+
+	begin_command(base, command);
+	exchange(base, static_cast<uint8_t>(offset >> 16));
+	exchange(base, static_cast<uint8_t>(offset >> 8));
+	exchange(base, static_cast<uint8_t>(offset));
+	for (std::size_t i = 0; i < len; ++i) {
+		exchange(base, data[i]);
+	}
+	end_command(base);
+
+	while (read_status(base) & STATUS_WIP) {}
+}
+
+} // namespace hifive1b::spi_flash
@@ -0,0 +1,185 @@
+#include <hifive1b_bsp/flash_controller.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+#include <embedded_util/control_register.hpp>
+
+#include <hifive1b_bsp/flash_commands.hpp>
+
+using namespace hifive1b::spi_flash;
+
+// Register offsets not covered by flash_commands.hpp
+
+static constexpr uintptr_t SCKDIV_OFFSET = 0x00;
+static constexpr uintptr_t FFMT_OFFSET = 0x64;
+
+// Constants for the ffmt register
+
+static constexpr auto FFMT_CMD_EN = BitField<uint32_t>::single_bit<0>();
+static constexpr auto FFMT_ADDR_LEN = BitField<uint32_t>::from_range<3, 1>();
+static constexpr auto FFMT_PAD_CNT = BitField<uint32_t>::from_range<7, 4>();
+static constexpr auto FFMT_CMD_PROTO = BitField<uint32_t>::from_range<9, 8>();
+static constexpr auto FFMT_ADDR_PROTO = BitField<uint32_t>::from_range<11, 10>();
+static constexpr auto FFMT_DATA_PROTO = BitField<uint32_t>::from_range<13, 12>();
+static constexpr auto FFMT_CMD_CODE = BitField<uint32_t>::from_range<23, 16>();
+static constexpr auto FFMT_PAD_CODE = BitField<uint32_t>::from_range<31, 24>();
+
+static constexpr uint32_t SCKDIV_MAX = 0xFFF;
+
+// Everything below that runs while the controller is being changed must not fetch from flash. These functions are
+// placed in ITIM and only use helpers that are forced inline.
+
+#ifdef NATIVE
+#	define ITIM_FUNCTION
+#else
+#	define ITIM_FUNCTION __attribute__((section(".itim"), noinline))
+#endif
+
+/// Suspend memory-mapped reads, optionally set the flash's QE bit, then resume with a new ffmt value
+/// @return false if quad mode was requested but the flash did not enable it (ffmt is left unchanged)
+static ITIM_FUNCTION bool reconfigure_flash(uintptr_t base, uint32_t ffmt, bool enable_quad) {
+	uint32_t mstatus = disable_interrupts();
+
+	uint32_t saved_fmt = suspend_reads(base);
+
+	bool ok = true;
+	if (enable_quad) {
+		uint8_t status = read_status(base);
+		if (!(status & STATUS_QE)) {
+			write_enable(base);
+			begin_command(base, WRITE_STATUS);
+			exchange(base, status | STATUS_QE);
+			end_command(base);
+
+			// The status register is non-volatile, so the write takes a few milliseconds
+			do {
+				status = read_status(base);
+			} while (status & STATUS_WIP);
+
+			ok = status & STATUS_QE;
+		}
+	}
+
+	if (ok) {
+		mmio(base + FFMT_OFFSET) = ffmt;
+	}
+
+	resume_reads(base, saved_fmt);
+
+	restore_interrupts(mstatus);
+	return ok;
+}
+
+/// Run a program or erase command with memory-mapped reads suspended
+/// @param data Bytes to program, which must be in RAM
+static ITIM_FUNCTION void modify_flash(uintptr_t base, uint8_t command, uint32_t offset, const uint8_t* data,
+		std::size_t len) {
+	uint32_t mstatus = disable_interrupts();
+	uint32_t saved_fmt = suspend_reads(base);
+
+	modify(base, command, offset, data, len);
+
+	resume_reads(base, saved_fmt);
+	restore_interrupts(mstatus);
+}
+
+/// Change the flash clock divider without fetching from flash while the clock changes
+static ITIM_FUNCTION void write_flash_divider(uintptr_t base, uint32_t div) {
+	uint32_t mstatus = disable_interrupts();
+	mmio(base + SCKDIV_OFFSET) = div;
+	restore_interrupts(mstatus);
+}
+
+bool hifive1b::FlashController::initialize(Clock& input_clock, uint32_t max_sck) {
+	this->max_sck = max_sck;
+
+	input_frequency = static_cast<uint32_t>(input_clock.get_frequency().count());
+	apply_divider(input_frequency);
+
+	// The divider has to be raised before the clock speeds up or the flash would be overclocked until the change
+	// listener runs, and instructions are fetched from it in between
+	input_clock.add_frequency_pending_listener([this](Frequency new_frequency) {
+		uint32_t f = static_cast<uint32_t>(new_frequency.count());
+		if (f > input_frequency) {
+			apply_divider(f);
+		}
+	});
+
+	// Once the clock settles the divider can be lowered again if it slowed down
+	input_clock.add_frequency_change_listener([this](Frequency new_frequency) {
+		input_frequency = static_cast<uint32_t>(new_frequency.count());
+		apply_divider(input_frequency);
+	});
+
+	if (!enable_quad_mode()) {
+		return false;
+	}
+
+	set_read_format(QUAD_IO_READ);
+	return true;
+}
+
+void hifive1b::FlashController::set_read_format(const ReadFormat& format) {
+	reconfigure_flash(base, encode_read_format(format), false);
+}
+
+bool hifive1b::FlashController::enable_quad_mode() {
+	// Keep the current format; only the flash's status register changes
+	return reconfigure_flash(base, ControlRegister<uint32_t>(base + FFMT_OFFSET).read(), true);
+}
+
+bool hifive1b::FlashController::program(uint32_t offset, const uint8_t* data, std::size_t len) {
+	if (len == 0 || len > PAGE_SIZE - offset % PAGE_SIZE || offset + len > FLASH_SIZE) {
+		return false;
+	}
+
+	// The caller's data could itself be in flash, which can't be read while programming
+	uint8_t page[PAGE_SIZE];
+	std::memcpy(page, data, len);
+
+	modify_flash(base, PAGE_PROGRAM, offset, page, len);
+	return true;
+}
+
+bool hifive1b::FlashController::erase_sector(uint32_t offset) {
+	if (offset >= FLASH_SIZE) {
+		return false;
+	}
+
+	modify_flash(base, SECTOR_ERASE, offset, nullptr, 0);
+	return true;
+}
+
+uint32_t hifive1b::FlashController::encode_read_format(const ReadFormat& format) {
+	// Build the value in a local variable standing in for the register
+	uint32_t value = 0;
+	const ControlRegister<uint32_t> ffmt(reinterpret_cast<uintptr_t>(&value));
+
+	ffmt.set_field(FFMT_CMD_EN, 1);
+	ffmt.set_field(FFMT_ADDR_LEN, format.address_bytes);
+	ffmt.set_field(FFMT_PAD_CNT, format.dummy_cycles);
+	ffmt.set_field(FFMT_CMD_PROTO, static_cast<uint32_t>(format.command_protocol));
+	ffmt.set_field(FFMT_ADDR_PROTO, static_cast<uint32_t>(format.address_protocol));
+	ffmt.set_field(FFMT_DATA_PROTO, static_cast<uint32_t>(format.data_protocol));
+	ffmt.set_field(FFMT_CMD_CODE, format.command);
+	ffmt.set_field(FFMT_PAD_CODE, format.pad_code);
+
+	return value;
+}
+
+uint32_t hifive1b::FlashController::divider_for(uint32_t input_frequency, uint32_t max_sck) {
+	// f_sck = f_in / (2 * (div + 1)), rounding the divider up so the result never exceeds max_sck
+	uint32_t div = (input_frequency + 2 * max_sck - 1) / (2 * max_sck);
+	div = (div == 0) ? 0 : div - 1;
+	return (div > SCKDIV_MAX) ? SCKDIV_MAX : div;
+}
+
+void hifive1b::FlashController::apply_divider(uint32_t input_frequency) {
+	uint32_t div = divider_for(input_frequency, max_sck);
+	if (div != divider || sck == 0) {
+		write_flash_divider(base, div);
+		divider = div;
+	}
+	sck = input_frequency / (2 * (div + 1));
+}
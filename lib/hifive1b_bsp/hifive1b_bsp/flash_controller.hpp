@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <embedded_util/clock.hpp>
+#include <embedded_util/safety.hpp>
+
+namespace hifive1b {
+
+/// Driver for the memory-mapped (XIP) flash interface of SPI0
+///
+/// Code executes in place from the ISSI IS25LP032D flash on SPI0. After reset the controller fetches with the slow
+/// single-line read command (0x03) at whatever clock divider the bootloader left. This driver switches instruction fetch
+/// to the quad I/O fast read command (0xEB) and keeps the SPI clock as fast as the flash allows as the core clock changes.
+///
+/// Reconfiguring SPI0 pulls the flash out from under the code that's running, so the routines that touch the
+/// controller are placed in ITIM and run with interrupts disabled.
+///
+/// More information on the flash interface is available in the FE310-G002 Manual Chapter 19.16
+class FlashController {
+	public:
+
+		/// Number of data lines used for one phase of a flash read (values of the ffmt protocol fields)
+		enum class Protocol : uint8_t {
+			SINGLE = 0,
+			DUAL = 1,
+			QUAD = 2,
+		};
+
+		/// Shape of the command the controller issues for each memory-mapped read
+		struct ReadFormat {
+			uint8_t command;
+			Protocol command_protocol;
+			Protocol address_protocol;
+			Protocol data_protocol;
+			uint8_t address_bytes;
+			/// Clock cycles between the address and the data, including any mode bits sent as pad_code
+			uint8_t dummy_cycles;
+			/// Byte driven during the first dummy cycles. 0x00 keeps the flash out of continuous read mode.
+			uint8_t pad_code;
+		};
+
+		/// The reset format: standard read (0x03) on a single line with no dummy cycles
+		static constexpr ReadFormat SINGLE_READ {0x03, Protocol::SINGLE, Protocol::SINGLE, Protocol::SINGLE, 3, 0, 0x00};
+
+		/// Fast read quad I/O (0xEB): the command on one line, the address and data on four. The flash's power-on
+		/// read parameters expect 6 dummy cycles (2 for the mode bits and 4 wait cycles), the fewest that are valid at
+		/// DEFAULT_MAX_SCK, so padding any more would only add latency to every cache line fill.
+		static constexpr ReadFormat QUAD_IO_READ {0xEB, Protocol::SINGLE, Protocol::QUAD, Protocol::QUAD, 3, 6, 0x00};
+
+		/// Sizes of the IS25LP032D's program and erase units
+		static constexpr std::size_t PAGE_SIZE = 256;
+		static constexpr std::size_t SECTOR_SIZE = 4096;
+
+		/// Capacity of the flash and where it appears in the address space
+		static constexpr std::size_t FLASH_SIZE = 4 * 1024 * 1024;
+		static constexpr uintptr_t MEMORY_MAPPED_BASE = 0x20000000;
+
+		/// Default limit for the flash clock, well under the flash's rating to leave margin for the board's routing
+		static constexpr uint32_t DEFAULT_MAX_SCK = 50000000;
+
+		/// Construct a driver for the controller at base_address (ex. mock registers for testing)
+		constexpr explicit FlashController(uintptr_t base_address = 0x10014000) :
+			base(base_address)
+		{}
+
+		DISALLOW_COPY_AND_MOVE(FlashController);
+
+		/// Enable quad mode in the flash, switch fetches to QUAD_IO_READ and follow changes of the input clock
+		/// @param input_clock The clock driving the controller (tlclk)
+		/// @param max_sck Fastest SPI clock to run the flash at
+		/// @return false if the flash did not accept quad mode, in which case the reset format is kept
+		bool initialize(Clock& input_clock, uint32_t max_sck = DEFAULT_MAX_SCK);
+
+		/// Change the command used for memory-mapped reads. The flash must already support the format.
+		void set_read_format(const ReadFormat& format);
+
+		/// Set the quad enable bit in the flash's status register if it isn't already set. The bit is non-volatile, so
+		/// it is only written the first time.
+		/// @return true if quad mode is enabled
+		bool enable_quad_mode();
+
+		/// Program data into one page of the flash (256 bytes). Instructions can't be fetched until the flash finishes,
+		/// so this returns once it has (typically under 1 ms) with interrupts disabled in the meantime.
+		/// @param offset Offset from the start of the flash
+		bool program(uint32_t offset, const uint8_t* data, std::size_t len);
+
+		/// Erase the 4 KiB sector containing offset. Like program(), this blocks with interrupts disabled until the
+		/// flash finishes, which typically takes 45 ms.
+		bool erase_sector(uint32_t offset);
+
+		/// Rate of the flash clock in hertz, or 0 before initialize()
+		inline uint32_t get_sck() const { return sck; }
+		inline uint32_t get_divider() const { return divider; }
+
+		/// Value of the ffmt register for a read format
+		static uint32_t encode_read_format(const ReadFormat& format);
+
+		/// Smallest sckdiv that keeps the flash clock at or below max_sck
+		static uint32_t divider_for(uint32_t input_frequency, uint32_t max_sck);
+
+	private:
+		/// Write sckdiv for the input frequency
+		void apply_divider(uint32_t input_frequency);
+
+		uint32_t max_sck = DEFAULT_MAX_SCK;
+		uint32_t input_frequency = 0;
+		uint32_t divider = 0;
+		uint32_t sck = 0;
+
+		uintptr_t base;
+
+};
+
+} // namespace hifive1b
@@ -1,13 +0,0 @@
-// #include <hifive1b_bsp/freedom_logger.hpp>
-
-// #include <cstdio>
-
-// void MetalUartStream::write(std::basic_string_view<uint8_t> data) {
-// 	char terminatedBuf[2];
-// 	terminatedBuf[1] = '\0';
-
-// 	for (auto c : data) {
-// 		terminatedBuf[0] = static_cast<char>(c);
-// 		printf(terminatedBuf);
-// 	}
-// }
@@ -1,30 +1,33 @@
 #pragma once
 
+#include <cstdint>
 #include <string_view>
 
+#include <embedded_util/logger.hpp>
+
+#ifdef NATIVE
+#include <cstdio>
+#else
+extern "C" {
+#include <metal/tty.h>
+}
+#endif
+
 /// Stream for the default UART serial interface through Freedom Metal BSP
 ///
+/// Bytes go straight to the TTY rather than through printf, so logging doesn't pull newlib's stdio into the image. Native
+/// builds write to stdout instead.
+///
 /// This is meant to be a temporary class that will be replaced once the custom UART driver is available
-class MetalUartStream {
+class MetalUartStream : public BasicOutStream<uint8_t> {
 	public:
-		void write(std::basic_string_view<uint8_t> data) {
-			char terminatedBuf[2];
-			terminatedBuf[1] = '\0';
-
+		void write(std::basic_string_view<uint8_t> data) override {
+#ifdef NATIVE
+			std::fwrite(data.data(), 1, data.size(), stdout);
+#else
 			for (auto c : data) {
-				terminatedBuf[0] = static_cast<char>(c);
-				printf(terminatedBuf);
+				metal_tty_putc(c);
 			}
+#endif
 		}
-
 };
-
-inline MetalUartStream& operator<<(MetalUartStream& stream, std::basic_string_view<uint8_t> data) {
-	stream.write(data);
-	return stream;
-}
-
-inline MetalUartStream& operator<<(MetalUartStream& stream, std::string_view str_view) {
-	stream.write(std::basic_string_view(reinterpret_cast<const uint8_t*>(str_view.data()), str_view.size()));
-	return stream;
-}
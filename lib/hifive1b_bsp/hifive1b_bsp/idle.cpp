@@ -0,0 +1,311 @@
+#include <hifive1b_bsp/idle.hpp>
+
+#include <algorithm>
+
+#include <hifive1b_bsp/csr.hpp>
+
+using namespace hifive1b::csr;
+
+// CLINT register offsets
+
+static constexpr uintptr_t MTIMECMP_LO = 0x4000;
+static constexpr uintptr_t MTIMECMP_HI = 0x4004;
+static constexpr uintptr_t MTIME_LO = 0xBFF8;
+static constexpr uintptr_t MTIME_HI = 0xBFFC;
+
+// PLIC register offsets for hart 0 in machine mode
+
+static constexpr uintptr_t PLIC_PRIORITY = 0x000000;
+static constexpr uintptr_t PLIC_ENABLE = 0x002000;
+static constexpr uintptr_t PLIC_THRESHOLD = 0x200000;
+static constexpr uintptr_t PLIC_CLAIM = 0x200004;
+
+static constexpr uint32_t PLIC_MAX_PRIORITY = 7;
+
+// GPIO register offsets. Each interrupt pending bit is cleared by writing 1.
+
+static constexpr uintptr_t GPIO_INPUT_VAL = 0x00;
+static constexpr uintptr_t GPIO_HIGH_IE = 0x28;
+static constexpr uintptr_t GPIO_HIGH_IP = 0x2C;
+static constexpr uintptr_t GPIO_LOW_IE = 0x30;
+static constexpr uintptr_t GPIO_LOW_IP = 0x34;
+
+/// mtime ticks that calibrate() counts cycles over
+static constexpr uint32_t CALIBRATION_TICKS = 8;
+
+/// Longest delay that counts cycles instead of sleeping
+static constexpr uint64_t SPIN_TICKS = 2;
+
+static inline volatile uint32_t& mmio(uintptr_t address) {
+	return *reinterpret_cast<volatile uint32_t*>(address);
+}
+
+void hifive1b::Idle::calibrate() {
+	// Start on an edge so the count covers whole ticks
+	uint64_t tick = now();
+	while (now() == tick) {}
+
+	uint32_t start = read_mcycle();
+	uint64_t end = tick + 1 + CALIBRATION_TICKS;
+	while (now() < end) {}
+
+	calibration_cycles = read_mcycle() - start;
+}
+
+uint64_t hifive1b::Idle::now() const {
+	uint32_t hi;
+	uint32_t lo;
+
+	// Re-read if the low word rolled over between the two reads
+	do {
+		hi = mmio(clint + MTIME_HI);
+		lo = mmio(clint + MTIME_LO);
+	} while (hi != mmio(clint + MTIME_HI));
+
+	return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+void hifive1b::Idle::delay_us(uint32_t us) {
+	if (us == 0) {
+		return;
+	}
+
+	uint64_t ticks = ticks_from_us(us);
+	if (ticks <= SPIN_TICKS && calibration_cycles != 0) {
+		// Rounded up like the tick count so the delay is never short
+		uint64_t scale = static_cast<uint64_t>(1000000) * CALIBRATION_TICKS;
+		uint32_t cycles = static_cast<uint32_t>((us * static_cast<uint64_t>(calibration_cycles) * MTIME_FREQUENCY +
+				scale - 1) / scale);
+
+		uint32_t start = read_mcycle();
+		while (read_mcycle() - start < cycles) {}
+		return;
+	}
+
+	// The current tick is partly over, so one more makes sure the whole time passes
+	sleep_until(now() + ticks + 1);
+}
+
+void hifive1b::Idle::sleep_until(uint64_t deadline) {
+	wait([] { return false; }, 0, deadline);
+}
+
+bool hifive1b::Idle::wait_for_pin(uint32_t pin, bool level, uint64_t deadline) {
+	uint32_t mask = 1UL << pin;
+	uintptr_t ie = gpio + (level ? GPIO_HIGH_IE : GPIO_LOW_IE);
+	uintptr_t ip = gpio + (level ? GPIO_HIGH_IP : GPIO_LOW_IP);
+
+	auto at_level = [this, mask, level] {
+		return ((mmio(gpio + GPIO_INPUT_VAL) & mask) != 0) == level;
+	};
+	if (at_level()) {
+		return true;
+	}
+
+	// A level interrupt stays pending while the pin is at the level, so a change before the wait can't be missed
+	mmio(ie) = mmio(ie) | mask;
+	bool result = wait(at_level, gpio_source(pin), deadline);
+
+	// Quiet the pin before disarm() completes its request, or the PLIC would take another one
+	mmio(ie) = mmio(ie) & ~mask;
+	mmio(ip) = mask;
+	return result;
+}
+
+void hifive1b::Idle::halt() {
+	clear_mstatus(MSTATUS_MIE);
+	write_mie(0);
+
+	// With nothing enabled `wfi` shouldn't return, but it may act as a no-op
+	for (;;) {
+		wfi();
+	}
+}
+
+uint32_t hifive1b::Idle::measure_wake_latency() {
+	if (calibration_cycles == 0) {
+		return 0;
+	}
+	uint32_t cycles_per_tick = calibration_cycles / CALIBRATION_TICKS;
+
+	// Only the timer, so nothing else ends `wfi` early
+	Saved saved = arm(0);
+	write_mie(MIE_MTIE);
+
+	// Two ticks ahead so the deadline can't pass before `wfi`
+	uint64_t deadline = now() + 2;
+	set_timer(deadline);
+	do {
+		wfi();
+	} while (now() < deadline);
+	uint32_t woke = read_mcycle();
+
+	uint64_t tick = now();
+	while (now() == tick) {}
+	uint32_t edge = read_mcycle() - cycles_per_tick;
+
+	disarm(saved);
+	return woke - edge + static_cast<uint32_t>(tick - deadline) * cycles_per_tick;
+}
+
+uint32_t hifive1b::Idle::get_residency_permille() const {
+	uint64_t elapsed = now() - stats_start;
+	if (elapsed == 0) {
+		return 0;
+	}
+	return static_cast<uint32_t>(stats.asleep_ticks * 1000 / elapsed);
+}
+
+void hifive1b::Idle::reset_stats() {
+	stats = Stats();
+	stats_start = now();
+}
+
+hifive1b::Idle::Saved hifive1b::Idle::arm(uint64_t sources) {
+	Saved saved;
+	saved.mstatus = clear_mstatus(MSTATUS_MIE);
+	saved.handlers = (saved.mstatus & MSTATUS_MIE) != 0;
+	saved.mie = read_mie();
+	saved.sources = sources;
+	saved.mtimecmp = get_timer();
+
+	if (sources != 0) {
+		for (uint32_t i = 0; i < 2; ++i) {
+			saved.enables[i] = mmio(plic + PLIC_ENABLE + 4 * i);
+		}
+		saved.threshold = mmio(plic + PLIC_THRESHOLD);
+
+		// The sources must be above the threshold to end `wfi`. Priority 0 never interrupts.
+		uint32_t floor = std::min(saved.threshold, PLIC_MAX_PRIORITY - 1) + 1;
+		for (uint32_t n = 1; n < 64; ++n) {
+			if ((sources >> n) & 1) {
+				volatile uint32_t& priority = mmio(plic + PLIC_PRIORITY + 4 * n);
+				if (priority < floor) {
+					priority = floor;
+				}
+			}
+		}
+	}
+
+	rearm(saved);
+	return saved;
+}
+
+void hifive1b::Idle::rearm(const Saved& saved) {
+	uint32_t bits = MIE_MTIE;
+	if (saved.sources != 0) {
+		bits |= MIE_MEIE;
+
+		for (uint32_t i = 0; i < 2; ++i) {
+			uint32_t enables = saved.handlers ? saved.enables[i] : 0;
+			mmio(plic + PLIC_ENABLE + 4 * i) = enables | static_cast<uint32_t>(saved.sources >> (32 * i));
+		}
+		// A threshold that masks everything is lowered for the wait, or its sources could never end it
+		mmio(plic + PLIC_THRESHOLD) = std::min(saved.threshold, PLIC_MAX_PRIORITY - 1);
+	}
+
+	// Without handlers only the armed interrupts end `wfi`, and anything else stays pending until the wait is over
+	write_mie(saved.handlers ? (saved.mie | bits) : bits);
+}
+
+bool hifive1b::Idle::sleep(uint64_t deadline, const Saved& saved) {
+	uint64_t start = now();
+	if (start >= deadline) {
+		return false;
+	}
+
+	uint64_t wake = deadline;
+	if (saved.handlers && (saved.mie & MIE_MTIE) && saved.mtimecmp < wake) {
+		wake = saved.mtimecmp;
+	}
+
+	set_timer(wake);
+	wfi();
+	uint64_t end = now();
+
+	++stats.sleeps;
+	stats.asleep_ticks += end - start;
+	if (deadline != FOREVER && end > deadline) {
+		uint32_t late = static_cast<uint32_t>(end - deadline);
+		++stats.late_wakes;
+		if (late > stats.max_late_ticks) {
+			stats.max_late_ticks = late;
+		}
+	}
+	return true;
+}
+
+void hifive1b::Idle::run_handlers(Saved& saved) {
+	if (!saved.handlers) {
+		return;
+	}
+
+	// Only what the handlers set up is enabled in the window, so a pending armed source isn't claimed by the
+	// controller and the timer handler doesn't see the wait's deadline
+	set_timer(saved.mtimecmp);
+	if (saved.sources != 0) {
+		mmio(plic + PLIC_THRESHOLD) = saved.threshold;
+		for (uint32_t i = 0; i < 2; ++i) {
+			mmio(plic + PLIC_ENABLE + 4 * i) = saved.enables[i];
+		}
+	}
+	write_mie(saved.mie);
+
+	set_mstatus(MSTATUS_MIE);
+	clear_mstatus(MSTATUS_MIE);
+
+	// A handler may have moved its deadline or changed what it has enabled
+	saved.mie = read_mie();
+	saved.mtimecmp = get_timer();
+	if (saved.sources != 0) {
+		for (uint32_t i = 0; i < 2; ++i) {
+			saved.enables[i] = mmio(plic + PLIC_ENABLE + 4 * i);
+		}
+		saved.threshold = mmio(plic + PLIC_THRESHOLD);
+	}
+	rearm(saved);
+}
+
+void hifive1b::Idle::disarm(const Saved& saved) {
+	// Put back the deadline of whatever else uses the timer. If it has passed, its interrupt is taken once interrupts
+	// are enabled again.
+	set_timer(saved.mtimecmp);
+
+	if (saved.sources != 0) {
+		// With only the armed sources enabled every claim is one of them, and a handler's request stays pending for
+		// it. A source whose device still asserts it is pending again as soon as it's completed; it will end the next
+		// wait at once, which just checks again.
+		for (uint32_t i = 0; i < 2; ++i) {
+			mmio(plic + PLIC_ENABLE + 4 * i) = static_cast<uint32_t>(saved.sources >> (32 * i));
+		}
+
+		uint64_t claimed = 0;
+		uint32_t id;
+		while ((id = mmio(plic + PLIC_CLAIM)) != 0) {
+			mmio(plic + PLIC_CLAIM) = id;
+			if ((claimed >> id) & 1) {
+				break;
+			}
+			claimed |= 1ULL << id;
+		}
+
+		mmio(plic + PLIC_THRESHOLD) = saved.threshold;
+		for (uint32_t i = 0; i < 2; ++i) {
+			mmio(plic + PLIC_ENABLE + 4 * i) = saved.enables[i];
+		}
+	}
+
+	write_mie(saved.mie);
+	set_mstatus(saved.mstatus & MSTATUS_MIE);
+}
+
+uint64_t hifive1b::Idle::get_timer() const {
+	return (static_cast<uint64_t>(mmio(clint + MTIMECMP_HI)) << 32) | mmio(clint + MTIMECMP_LO);
+}
+
+void hifive1b::Idle::set_timer(uint64_t deadline) {
+	// Raise the low word first so no value in between is below both the old and new deadlines
+	mmio(clint + MTIMECMP_LO) = UINT32_MAX;
+	mmio(clint + MTIMECMP_HI) = static_cast<uint32_t>(deadline >> 32);
+	mmio(clint + MTIMECMP_LO) = static_cast<uint32_t>(deadline);
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstdint>
+
+#include <embedded_util/safety.hpp>
+
+namespace hifive1b {
+
+/// Low-power waits for the FE310-G002
+///
+/// Instead of polling, waits stop the core with `wfi` until an interrupt they armed is pending, then check again what
+/// they were waiting for. The check and `wfi` run with interrupts globally disabled (mstatus.MIE): `wfi` still resumes
+/// on an interrupt that is enabled in mie, and an event that happens between checking the condition and executing
+/// `wfi` makes `wfi` return at once instead of being lost.
+///
+/// If interrupts were enabled when the wait began, such as with an InterruptController installed, the interrupts its
+/// handlers use stay enabled and also end `wfi`. After each wake the wait puts back the handlers' timer deadline and
+/// PLIC enables and enables interrupts for a moment, so pending handlers run before the condition is checked again.
+/// The wait's own sources are off during that window, so they never reach a handler. A wait that begins with
+/// interrupts disabled only wakes for its own sources and needs no trap vector.
+///
+/// Time comes from the CLINT's mtime, which counts the 32.768 kHz real-time clock whatever the core clock does. Waits
+/// borrow mtimecmp and put its previous value back. While handlers are running, a timer handler's deadline also ends
+/// `wfi`, so it runs on time.
+///
+/// More information is available in the FE310-G002 Manual Chapters 8 (CLINT), 9 (PLIC) and 17 (GPIO).
+class Idle {
+	public:
+		/// Frequency of mtime
+		static constexpr uint32_t MTIME_FREQUENCY = 32768;
+
+		/// Deadline of a wait with no timeout
+		static constexpr uint64_t FOREVER = UINT64_MAX;
+
+		/// PLIC interrupt sources, as bits for wait()
+		static constexpr uint64_t UART0_SOURCE = 1ULL << 3;
+		static constexpr uint64_t gpio_source(uint32_t pin) { return 1ULL << (8 + pin); }
+
+		struct Stats {
+			/// Number of times the core executed `wfi`
+			uint32_t sleeps = 0;
+			/// mtime ticks spent in `wfi`
+			uint64_t asleep_ticks = 0;
+			/// Timed waits that resumed one or more ticks after their deadline
+			uint32_t late_wakes = 0;
+			/// Most ticks between a deadline and resuming
+			uint32_t max_late_ticks = 0;
+		};
+
+		constexpr Idle(uintptr_t clint = 0x02000000, uintptr_t plic = 0x0C000000, uintptr_t gpio = 0x10012000) :
+			clint(clint),
+			plic(plic),
+			gpio(gpio)
+		{}
+
+		DISALLOW_COPY_AND_MOVE(Idle);
+
+		/// Count core cycles over a few mtime ticks so delay_us() can time short delays without sleeping
+		///
+		/// Takes about 250 us. Call it again whenever the core clock changes.
+		void calibrate();
+
+		/// Read mtime
+		uint64_t now() const;
+
+		/// mtime ticks in a number of microseconds, rounded up
+		static constexpr uint64_t ticks_from_us(uint64_t us) {
+			return (us * MTIME_FREQUENCY + 999999) / 1000000;
+		}
+
+		/// Microseconds in a number of mtime ticks, rounded down
+		static constexpr uint64_t us_from_ticks(uint64_t ticks) {
+			return ticks * 1000000 / MTIME_FREQUENCY;
+		}
+
+		/// Wait at least a number of microseconds
+		///
+		/// Delays of a couple of ticks or less count core cycles once calibrate() has run, since sleeping could only
+		/// end on a tick. Longer delays sleep, ending up to one tick (30.5 us) late.
+		void delay_us(uint32_t us);
+
+		/// Sleep until mtime reaches a deadline
+		void sleep_until(uint64_t deadline);
+
+		/// Sleep until a GPIO input is at a level. The pin's input must be enabled.
+		/// @return false if the deadline passed first
+		bool wait_for_pin(uint32_t pin, bool level, uint64_t deadline = FOREVER);
+
+		/// Sleep until a condition is true, checking it each time an armed interrupt source is pending
+		///
+		/// The device behind each source must already have its interrupt enabled (ex. the UART's receive watermark).
+		/// Pending requests from the sources are claimed and completed before returning, so no other code should be
+		/// enabling the same sources in the PLIC.
+		///
+		/// @param done Checked before each sleep with interrupts disabled, after any handlers for the wake have run
+		/// @param sources Bit n arms PLIC source n; 0 sleeps until the deadline only
+		/// @return false if the deadline passed before done() returned true
+		template<typename Condition>
+		bool wait(Condition&& done, uint64_t sources, uint64_t deadline = FOREVER) {
+			Saved saved = arm(sources);
+
+			bool result = false;
+			while (!(result = done()) && sleep(deadline, saved)) {
+				run_handlers(saved);
+			}
+
+			disarm(saved);
+			return result;
+		}
+
+		/// Stop for good, such as after an unrecoverable error. Hardware that runs on its own (ex. PWM) keeps going.
+		[[noreturn]] static void halt();
+
+		/// Measure the core cycles from the timer interrupt to `wfi` returning
+		///
+		/// The timer fires on an mtime edge, which isn't visible to the core. Timing the next edge in cycles places the
+		/// one before it. Returns 0 if calibrate() hasn't run.
+		uint32_t measure_wake_latency();
+
+		inline const Stats& get_stats() const { return stats; }
+
+		/// Time spent asleep since reset_stats() in parts per thousand
+		uint32_t get_residency_permille() const;
+
+		void reset_stats();
+
+	private:
+		/// Machine state changed while a wait is armed
+		struct Saved {
+			uint32_t mstatus;
+			/// Interrupts were enabled, so handlers run during the wait
+			bool handlers;
+			uint32_t mie;
+			uint64_t mtimecmp;
+			uint64_t sources;
+			uint32_t enables[2];
+			uint32_t threshold;
+		};
+
+		/// Disable interrupts globally, then enable the timer and the given PLIC sources so they end `wfi`
+		Saved arm(uint64_t sources);
+
+		/// Enable the wait's interrupts, along with the handlers' if they run during the wait
+		void rearm(const Saved& saved);
+
+		/// Execute `wfi` once with mtimecmp set to the deadline, or to the timer handler's deadline if that's sooner
+		/// @return false without sleeping if the deadline has passed
+		bool sleep(uint64_t deadline, const Saved& saved);
+
+		/// Let the handlers take whatever woke the core, with the wait's own interrupts off, then arm again
+		void run_handlers(Saved& saved);
+
+		/// Claim any requests of the armed sources and restore what arm() changed
+		void disarm(const Saved& saved);
+
+		uint64_t get_timer() const;
+		void set_timer(uint64_t deadline);
+
+		uintptr_t clint;
+		uintptr_t plic;
+		uintptr_t gpio;
+
+		/// Core cycles in CALIBRATION_TICKS ticks of mtime, or 0 if uncalibrated
+		uint32_t calibration_cycles = 0;
+
+		uint64_t stats_start = 0;
+		Stats stats;
+};
+
+}
@@ -0,0 +1,208 @@
+#include <hifive1b_bsp/interrupts.hpp>
+
+#include <hifive1b_bsp/csr.hpp>
+#include <hifive1b_bsp/idle.hpp>
+
+using namespace hifive1b::csr;
+
+// CLINT register offsets
+
+static constexpr uintptr_t MSIP = 0x0000;
+
+// PLIC register offsets for hart 0 in machine mode
+
+static constexpr uintptr_t PLIC_PRIORITY = 0x000000;
+static constexpr uintptr_t PLIC_ENABLE = 0x002000;
+static constexpr uintptr_t PLIC_THRESHOLD = 0x200000;
+static constexpr uintptr_t PLIC_CLAIM = 0x200004;
+
+// The vector entries and everything they call up to the handler run from ITIM, so instruction fetch doesn't wait on
+// the flash
+
+#ifdef NATIVE
+#	define ITIM_FUNCTION
+#else
+#	define ITIM_FUNCTION __attribute__((section(".itim"), noinline))
+#endif
+
+static inline volatile uint32_t& mmio(uintptr_t address) {
+	return *reinterpret_cast<volatile uint32_t*>(address);
+}
+
+static hifive1b::InterruptController* installed = nullptr;
+static hifive1b::InterruptController::Fault fault;
+
+#ifndef NATIVE
+
+// In vectored mode interrupt n jumps to hifive1b_vector_table + 4 * n and exceptions to the table itself. Interrupts
+// 4-6 and 8-10 are for user and supervisor modes, which the E31 doesn't have, so the entries for 3, 7 and 11 run
+// straight on through the slots after them: they stamp mcycle into mscratch without touching memory or any register
+// but t0, then jump to the handler-calling function, which saves registers as a normal interrupt function.
+
+asm (R"(
+	.pushsection .itim.hifive1b_vector_table, "ax", @progbits
+	.balign 64
+	.global hifive1b_vector_table
+hifive1b_vector_table:
+	.option push
+	.option norvc
+	j hifive1b_exception_isr
+	j hifive1b_exception_isr
+	j hifive1b_exception_isr
+
+	csrw mscratch, t0
+	csrr t0, mcycle
+	csrrw t0, mscratch, t0
+	j hifive1b_software_isr
+
+	csrw mscratch, t0
+	csrr t0, mcycle
+	csrrw t0, mscratch, t0
+	j hifive1b_timer_isr
+
+	csrw mscratch, t0
+	csrr t0, mcycle
+	csrrw t0, mscratch, t0
+	j hifive1b_external_isr
+	.option pop
+	.popsection
+)");
+
+extern "C" {
+
+extern char hifive1b_vector_table[];
+
+ITIM_FUNCTION __attribute__((interrupt("machine"), used)) void hifive1b_software_isr() {
+	installed->dispatch_software(read_mscratch());
+}
+
+ITIM_FUNCTION __attribute__((interrupt("machine"), used)) void hifive1b_timer_isr() {
+	installed->dispatch_timer(read_mscratch());
+}
+
+ITIM_FUNCTION __attribute__((interrupt("machine"), used)) void hifive1b_external_isr() {
+	installed->dispatch_external(read_mscratch());
+}
+
+ITIM_FUNCTION __attribute__((interrupt("machine"), used)) void hifive1b_exception_isr() {
+	fault.mcause = read_mcause();
+	fault.mepc = read_mepc();
+	fault.mtval = read_mtval();
+	hifive1b::Idle::halt();
+}
+
+} // extern "C"
+
+#endif // NATIVE
+
+void hifive1b::InterruptController::install() {
+	installed = this;
+
+#ifndef NATIVE
+	swap_mtvec(reinterpret_cast<uintptr_t>(hifive1b_vector_table) | MTVEC_VECTORED);
+#endif
+
+	set_mstatus(MSTATUS_MIE);
+}
+
+void hifive1b::InterruptController::set_timer_handler(Handler handler, void* context) {
+	timer = {handler, context};
+	set_mie(MIE_MTIE);
+}
+
+void hifive1b::InterruptController::set_software_handler(Handler handler, void* context) {
+	software = {handler, context};
+	set_mie(MIE_MSIE);
+}
+
+void hifive1b::InterruptController::trigger_software() {
+	mmio(clint + MSIP) = 1;
+}
+
+bool hifive1b::InterruptController::attach(uint32_t source, uint32_t priority, Handler handler, void* context) {
+	if (source == 0 || source >= SOURCES || priority == 0 || priority > MAX_PRIORITY) {
+		return false;
+	}
+
+	// The handler has to be in place before the source can be claimed
+	uint32_t mstatus = clear_mstatus(MSTATUS_MIE);
+	sources[source] = {handler, context};
+	mmio(plic + PLIC_PRIORITY + 4 * source) = priority;
+	volatile uint32_t& enable = mmio(plic + PLIC_ENABLE + 4 * (source / 32));
+	enable = enable | (1UL << (source % 32));
+	set_mie(MIE_MEIE);
+	set_mstatus(mstatus & MSTATUS_MIE);
+	return true;
+}
+
+void hifive1b::InterruptController::detach(uint32_t source) {
+	if (source == 0 || source >= SOURCES) {
+		return;
+	}
+
+	uint32_t mstatus = clear_mstatus(MSTATUS_MIE);
+	volatile uint32_t& enable = mmio(plic + PLIC_ENABLE + 4 * (source / 32));
+	enable = enable & ~(1UL << (source % 32));
+	mmio(plic + PLIC_PRIORITY + 4 * source) = 0;
+	sources[source] = {};
+	set_mstatus(mstatus & MSTATUS_MIE);
+}
+
+void hifive1b::InterruptController::set_threshold(uint32_t threshold) {
+	mmio(plic + PLIC_THRESHOLD) = threshold;
+}
+
+ITIM_FUNCTION void hifive1b::InterruptController::dispatch_external(uint32_t entry_cycles) {
+	uint32_t id = mmio(plic + PLIC_CLAIM);
+	if (id == 0) {
+		// Nothing left to claim, such as when a source stopped requesting before the claim
+		return;
+	}
+
+	if (id < SOURCES && sources[id].handler) {
+		run(Vector::EXTERNAL, sources[id], entry_cycles);
+	} else {
+		++spurious;
+	}
+
+	mmio(plic + PLIC_CLAIM) = id;
+}
+
+ITIM_FUNCTION void hifive1b::InterruptController::dispatch_software(uint32_t entry_cycles) {
+	mmio(clint + MSIP) = 0;
+	if (software.handler) {
+		run(Vector::SOFTWARE, software, entry_cycles);
+	}
+}
+
+ITIM_FUNCTION void hifive1b::InterruptController::dispatch_timer(uint32_t entry_cycles) {
+	if (timer.handler) {
+		run(Vector::TIMER, timer, entry_cycles);
+	}
+}
+
+const hifive1b::InterruptController::Fault& hifive1b::InterruptController::get_fault() {
+	return fault;
+}
+
+void hifive1b::InterruptController::reset_stats() {
+	stats.fill(Stats());
+	spurious = 0;
+}
+
+ITIM_FUNCTION void hifive1b::InterruptController::run(Vector vector, const Entry& entry, uint32_t entry_cycles) {
+	uint32_t cycles = read_mcycle() - entry_cycles;
+	this->entry_cycles = entry_cycles;
+	entry.handler(entry.context);
+
+	// Counted after the handler so the bookkeeping isn't part of the latency
+	Stats& s = stats[static_cast<std::size_t>(vector)];
+	++s.count;
+	s.last_cycles = cycles;
+	if (cycles < s.min_cycles) {
+		s.min_cycles = cycles;
+	}
+	if (cycles > s.max_cycles) {
+		s.max_cycles = cycles;
+	}
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <embedded_util/safety.hpp>
+#include <hifive1b_bsp/csr.hpp>
+
+namespace hifive1b {
+
+/// Interrupt dispatch for the FE310-G002 without Freedom Metal's handler layers
+///
+/// install() points mtvec at a vector table in ITIM in vectored mode, so the core jumps straight to the entry for the
+/// software, timer or external interrupt. Each entry saves only the registers a C function call may clobber, looks up
+/// one handler and calls it. External interrupts claim a source from the PLIC and index a flat table with it.
+///
+/// Every entry stamps mcycle before anything else (kept in mscratch) and again just before calling the handler, giving
+/// the dispatch latency in core cycles. The core itself takes a few more cycles to reach the entry, which aren't
+/// visible to software.
+///
+/// Handlers run with interrupts disabled. A timer handler must move mtimecmp or disable the timer, and a PLIC device
+/// must stop requesting the interrupt, or the handler runs again as soon as it returns. Exceptions and unexpected
+/// interrupts record their cause and halt.
+///
+/// More information is available in the FE310-G002 Manual Chapters 8 (CLINT) and 9 (PLIC).
+class InterruptController {
+	public:
+		using Handler = void (*)(void* context);
+
+		/// PLIC sources are numbered from 1; 0 means none
+		static constexpr uint32_t SOURCES = 53;
+
+		/// Highest PLIC priority. Sources at priority 0 never interrupt.
+		static constexpr uint32_t MAX_PRIORITY = 7;
+
+		enum class Vector : uint8_t {
+			SOFTWARE,
+			TIMER,
+			EXTERNAL,
+		};
+
+		struct Stats {
+			uint32_t count = 0;
+			/// Cycles from entering the vector to calling the handler
+			uint32_t last_cycles = 0;
+			uint32_t min_cycles = UINT32_MAX;
+			uint32_t max_cycles = 0;
+		};
+
+		/// What an exception left behind
+		struct Fault {
+			uint32_t mcause = 0;
+			uint32_t mepc = 0;
+			uint32_t mtval = 0;
+		};
+
+		constexpr InterruptController(uintptr_t clint = 0x02000000, uintptr_t plic = 0x0C000000) :
+			clint(clint),
+			plic(plic)
+		{}
+
+		DISALLOW_COPY_AND_MOVE(InterruptController);
+
+		/// Take over mtvec and enable interrupts globally. Only one controller may be installed.
+		void install();
+
+		/// Run a handler on the machine timer interrupt and enable it
+		void set_timer_handler(Handler handler, void* context = nullptr);
+
+		/// Run a handler on the machine software interrupt and enable it. msip is cleared before the handler runs.
+		void set_software_handler(Handler handler, void* context = nullptr);
+
+		/// Raise the software interrupt, such as to run work at interrupt level or to measure dispatch latency
+		void trigger_software();
+
+		/// Route a PLIC source to a handler and enable it
+		/// @param priority 1 to MAX_PRIORITY; higher priorities are claimed first
+		/// @return false if the source or priority is out of range
+		bool attach(uint32_t source, uint32_t priority, Handler handler, void* context = nullptr);
+
+		/// Disable a PLIC source and remove its handler
+		void detach(uint32_t source);
+
+		/// Mask PLIC sources whose priority is at or below a threshold
+		void set_threshold(uint32_t threshold);
+
+		/// Claim one PLIC source, run its handler, and complete it. Another pending source interrupts again.
+		/// @param entry_cycles mcycle when the vector was entered
+		void dispatch_external(uint32_t entry_cycles);
+
+		/// Clear msip and run the software handler
+		void dispatch_software(uint32_t entry_cycles);
+
+		/// Run the timer handler
+		void dispatch_timer(uint32_t entry_cycles);
+
+		const Stats& get_stats(Vector vector) const { return stats[static_cast<std::size_t>(vector)]; }
+
+		/// mcycle when the vector of the interrupt being handled was entered, for handlers that timestamp events
+		/// without the jitter of claiming and dispatching
+		uint32_t get_entry_cycles() const { return entry_cycles; }
+
+		/// External interrupts claimed without a handler, which are completed and otherwise ignored
+		uint32_t get_spurious() const { return spurious; }
+
+		/// The last exception, with mcause 0 if there was none
+		static const Fault& get_fault();
+
+		void reset_stats();
+
+		/// Sleep in `wfi` until a condition set by an interrupt handler holds, then return with interrupts enabled
+		///
+		/// The condition is checked with interrupts disabled, so a handler can't make it true between the check and the
+		/// `wfi`. The core still wakes for interrupts enabled in mie while they're disabled, and the handler runs in the
+		/// window where they're briefly enabled again.
+		template<typename Condition>
+		static void sleep_until(Condition&& ready) {
+			csr::clear_mstatus(csr::MSTATUS_MIE);
+			while (!ready()) {
+				csr::wfi();
+				csr::set_mstatus(csr::MSTATUS_MIE);
+				csr::clear_mstatus(csr::MSTATUS_MIE);
+			}
+			csr::set_mstatus(csr::MSTATUS_MIE);
+		}
+
+	private:
+		struct Entry {
+			Handler handler = nullptr;
+			void* context = nullptr;
+		};
+
+		/// Call an entry's handler and count the cycles since entry_cycles
+		void run(Vector vector, const Entry& entry, uint32_t entry_cycles);
+
+		uintptr_t clint;
+		uintptr_t plic;
+
+		Entry software;
+		Entry timer;
+		std::array<Entry, SOURCES> sources {};
+
+		std::array<Stats, 3> stats {};
+		uint32_t spurious = 0;
+		uint32_t entry_cycles = 0;
+};
+
+}
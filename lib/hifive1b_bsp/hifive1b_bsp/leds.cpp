@@ -1,42 +1,153 @@
 #include <hifive1b_bsp/leds.hpp>
 
-#ifndef NATIVE
-extern "C" {
-#	include <metal/led.h>
-}
-#endif
+// Constants for the pwmcfg register
 
-hifive1b::LedDriver::LedDriver(uint8_t r, uint8_t g, uint8_t b) {
-#ifndef NATIVE
-	rgb_led[0] = metal_led_get_rgb("LD0", "red");
-    rgb_led[1] = metal_led_get_rgb("LD0", "green");
-    rgb_led[2] = metal_led_get_rgb("LD0", "blue");
+static constexpr auto PWM_SCALE = BitField<uint32_t>::from_range<3, 0>();
+static constexpr auto PWM_STICKY = BitField<uint32_t>::single_bit<8>();
+static constexpr auto PWM_ZEROCMP = BitField<uint32_t>::single_bit<9>();
+static constexpr auto PWM_DEGLITCH = BitField<uint32_t>::single_bit<10>();
+static constexpr auto PWM_ENALWAYS = BitField<uint32_t>::single_bit<12>();
 
-	for (auto led_ptr : rgb_led) {
-		if (led_ptr != nullptr) {
-			metal_led_enable(led_ptr);
-		}
-	}
+/// Register offsets within the PWM block
+static constexpr uintptr_t PWMCFG_OFFSET = 0x00;
+static constexpr uintptr_t PWMCOUNT_OFFSET = 0x08;
+static constexpr uintptr_t PWMCMP0_OFFSET = 0x20;
+
+/// Width of the PWM1 comparators
+static constexpr uint32_t PWM1_CMP_MAX = 0xFFFF;
+static constexpr uint8_t PWM_SCALE_MAX = 15;
 
+hifive1b::LedDriver::LedDriver(Clock& clock, uint8_t r, uint8_t g, uint8_t b, uintptr_t pwm_address) :
+	clock_hz(static_cast<uint32_t>(clock.get_frequency().count())),
+	pwmcfg(pwm_address + PWMCFG_OFFSET),
+	pwmcount(pwm_address + PWMCOUNT_OFFSET),
+	pwmcmp{
+		ControlRegister<uint32_t>(pwm_address + PWMCMP0_OFFSET),
+		ControlRegister<uint32_t>(pwm_address + PWMCMP0_OFFSET + 0x4),
+		ControlRegister<uint32_t>(pwm_address + PWMCMP0_OFFSET + 0x8),
+		ControlRegister<uint32_t>(pwm_address + PWMCMP0_OFFSET + 0xC)
+	}
+{
+	// Set the color before the pins are handed to the PWM so they don't flash at whatever state PWM1 was left in
 	set(r, g, b);
-#endif
+
+	// Blink timing is derived from the PWM clock, so recalculate it when the clock changes
+	clock.add_frequency_change_listener([this](Frequency new_frequency) {
+		clock_hz = static_cast<uint32_t>(new_frequency.count());
+		apply();
+	});
 }
 
 void hifive1b::LedDriver::set(uint8_t r, uint8_t g, uint8_t b) {
-#ifndef NATIVE
-	// Note that the on and off calls are inverted on the HiFive1 Rev B...
+	set_color({
+		static_cast<uint8_t>(r ? 0xFF : 0),
+		static_cast<uint8_t>(g ? 0xFF : 0),
+		static_cast<uint8_t>(b ? 0xFF : 0)
+	});
+}
+
+void hifive1b::LedDriver::set_color(Color new_color) {
+	pattern = Pattern::SOLID;
+	color = new_color;
+	apply();
+}
+
+void hifive1b::LedDriver::blink(Color new_color, uint32_t new_period_ms) {
+	pattern = Pattern::BLINK;
+	color = new_color;
+	period_ms = new_period_ms;
+	apply();
+}
+
+void hifive1b::LedDriver::breathe(Color new_color, uint32_t new_period_ms) {
+	pattern = Pattern::BREATHE;
+	color = new_color;
+	period_ms = new_period_ms;
+	apply();
+}
+
+void hifive1b::LedDriver::tick(uint32_t now_ms) {
+	if (pattern != Pattern::BREATHE || period_ms == 0) {
+		return;
+	}
 
-	// Default all off
-	for (auto le : rgb_led) {
-		metal_led_on(le);
+	// Triangle wave over the period from 0 to 255 and back
+	uint32_t phase = now_ms % period_ms;
+	uint32_t half = period_ms / 2;
+	uint32_t level = (phase < half) ? (phase * 0xFF) / half : ((period_ms - phase) * 0xFF) / (period_ms - half);
+
+	// Square the level as a cheap gamma correction so the fade looks linear to the eye
+	level = (level * level) >> 8;
+
+	write_compare((color.r * level) >> 8, (color.g * level) >> 8, (color.b * level) >> 8);
+}
+
+void hifive1b::LedDriver::apply() {
+	switch (pattern) {
+		case Pattern::SOLID:
+			configure_counter(0, DIM_PERIOD);
+			write_compare(color.r, color.g, color.b);
+			break;
+
+		case Pattern::BLINK: {
+			// Find the smallest prescaler that fits the whole period in the 16-bit comparator. This keeps the blink
+			// timing as precise as possible. The product is 64 bits since it passes 2^32 for long periods (13.4 s at
+			// 320 MHz), and a wrapped value could fit the comparator.
+			uint8_t scale = 0;
+			uint64_t counts = 0;
+			for (; scale <= PWM_SCALE_MAX; ++scale) {
+				counts = static_cast<uint64_t>((clock_hz >> scale) / 1000) * period_ms;
+				if (counts <= PWM1_CMP_MAX) {
+					break;
+				}
+			}
+
+			// Saturate at the longest period the hardware supports
+			if (scale > PWM_SCALE_MAX) {
+				scale = PWM_SCALE_MAX;
+				counts = PWM1_CMP_MAX;
+			}
+
+			configure_counter(scale, static_cast<uint32_t>(counts));
+
+			// Each channel is either lit for the first half of the period or not at all
+			uint32_t half = static_cast<uint32_t>(counts / 2);
+			write_compare(color.r ? half : 0, color.g ? half : 0, color.b ? half : 0);
+			break;
+		}
+
+		case Pattern::BREATHE:
+			// Start dark; tick() takes over from here
+			configure_counter(0, DIM_PERIOD);
+			write_compare(0, 0, 0);
+			break;
 	}
+}
+
+void hifive1b::LedDriver::configure_counter(uint8_t scale, uint32_t period_counts) {
+	// Stop the counter while changing the period so a shorter period can't leave it running past pwmcmp0
+	pwmcfg.write(0);
+	pwmcount.write(0);
+	pwmcmp[0].write(period_counts);
+
+	auto reg_transact = pwmcfg.start_atomic_transaction();
+	reg_transact.set_field(PWM_SCALE, scale);
+	reg_transact.set_field(PWM_STICKY, false);
+	reg_transact.set_field(PWM_ZEROCMP, true);
+	reg_transact.set_field(PWM_DEGLITCH, true);
+	reg_transact.set_field(PWM_ENALWAYS, true);
+	reg_transact.finalize();
+}
+
+void hifive1b::LedDriver::write_compare(uint32_t r, uint32_t g, uint32_t b) {
+	// The LEDs are active-low and a PWM output is high once the counter reaches its comparator, so the compare value
+	// is the number of counts that the LED is lit. A full-brightness channel is pushed past the end of the period so
+	// that its output never goes high.
+	auto lit_counts = [period = pwmcmp[0].read()](uint32_t value) {
+		return (value >= period) ? PWM1_CMP_MAX : value;
+	};
 
-	// Enable channels that should be on
-	if (r)
-		metal_led_off(rgb_led[0]);
-	if (g)
-		metal_led_off(rgb_led[1]);
-	if (b)
-		metal_led_off(rgb_led[2]);
-#endif
+	pwmcmp[1].write(lit_counts(g));
+	pwmcmp[2].write(lit_counts(b));
+	pwmcmp[3].write(lit_counts(r));
 }
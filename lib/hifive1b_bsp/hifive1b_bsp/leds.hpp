@@ -3,30 +3,92 @@
 #include <array>
 #include <cstdint>
 
+#include <embedded_util/clock.hpp>
+#include <embedded_util/control_register.hpp>
 #include <embedded_util/safety.hpp>
 
-#ifndef NATIVE
-// Forward declarations
-extern "C" {
-	struct metal_led;
-}
-#else
-using metal_led = uint8_t;
-#endif
-
 namespace hifive1b {
 
+/// Driver for the onboard RGB LED (LD0) using the PWM1 peripheral
+///
+/// The red, green, and blue LEDs are wired to GPIO 22, 19, and 21 which are the IOF1 outputs of PWM1 channels 3, 1,
+/// and 2. The board's pin mux (HIFIVE1B_PINS) hands the pins to PWM1 so that brightness and blinking are generated
+/// entirely by hardware. Only the breathing pattern needs software, and that is limited to a few register writes every
+/// time tick() is called.
+///
+/// More information on the PWM peripheral is available in the FE310-G002 Manual Chapter 14
 class LedDriver {
 	public:
-		LedDriver(uint8_t r = 0, uint8_t g = 0, uint8_t b = 0);
+
+		/// Brightness of each channel where 0 is off and 255 is full brightness
+		struct Color {
+			uint8_t r = 0;
+			uint8_t g = 0;
+			uint8_t b = 0;
+		};
+
+		/// Patterns that the driver can display
+		enum class Pattern : uint8_t {
+			/// Constant color
+			SOLID,
+			/// Full-brightness on/off blinking generated by the PWM counter with no software involvement
+			BLINK,
+			/// Smoothly fade in and out, updated by tick()
+			BREATHE,
+		};
+
+		/// Construct the driver and set the initial color. Set it up before the pins are connected so they don't flash.
+		/// @param clock The clock driving the PWM peripheral (hfclk). Blink timing is recalculated when it changes.
+		LedDriver(Clock& clock, uint8_t r = 0, uint8_t g = 0, uint8_t b = 0, uintptr_t pwm_address = 0x10025000);
+
 		DISALLOW_COPY_AND_MOVE(LedDriver);
 
 		/// Set the value of each RGB LED, where 0 is off and non-zero is on
 		void set(uint8_t r, uint8_t g, uint8_t b);
 
+		/// Show a solid, possibly dimmed color
+		void set_color(Color color);
+
+		/// Blink a color on and off with a 50% duty cycle. The brightness of each channel is either off (0) or full.
+		/// @param period_ms Length of one on/off cycle in milliseconds
+		void blink(Color color, uint32_t period_ms);
+
+		/// Fade a color in and out. Requires tick() to be called periodically (every 10-20 ms looks smooth).
+		/// @param period_ms Length of one fade in/out cycle in milliseconds
+		void breathe(Color color, uint32_t period_ms);
+
+		/// Advance software-driven patterns. Does nothing unless the breathing pattern is active.
+		/// @param now_ms A free-running millisecond timestamp
+		void tick(uint32_t now_ms);
+
+		Pattern get_pattern() const { return pattern; }
+
 	private:
-		std::array<metal_led*, 3> rgb_led;
+
+		/// Number of PWM counts in one period when dimming; brightness maps directly onto the compare value
+		static constexpr uint32_t DIM_PERIOD = 0xFF;
+
+		/// Program the PWM counter, using pwmscale to stretch the period to the requested length in counts
+		void configure_counter(uint8_t scale, uint32_t period_counts);
+
+		/// Write the comparators for each channel. The compare value is the number of counts the LED is lit
+		void write_compare(uint32_t r, uint32_t g, uint32_t b);
+
+		/// Apply the current pattern (after a pattern or clock change)
+		void apply();
+
+		/// Frequency of the PWM input clock in hertz
+		uint32_t clock_hz;
+
+		Pattern pattern = Pattern::SOLID;
+		Color color;
+		uint32_t period_ms = 0;
+
+		ControlRegister<uint32_t> pwmcfg;
+		ControlRegister<uint32_t> pwmcount;
+		/// Compare registers for the period (0) and the green (1), blue (2), and red (3) channels
+		std::array<ControlRegister<uint32_t>, 4> pwmcmp;
 
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,98 @@
+#include <hifive1b_bsp/memory_monitor.hpp>
+
+#include <hifive1b_bsp/csr.hpp>
+
+#ifndef NATIVE
+#include <unistd.h>
+
+// Symbols from the linker script
+
+extern "C" {
+extern uint8_t metal_segment_data_target_start[];
+extern uint8_t metal_segment_bss_target_end[];
+extern uint8_t metal_segment_stack_begin[];
+extern uint8_t metal_segment_stack_end[];
+extern uint8_t metal_segment_heap_target_start[];
+extern uint8_t metal_segment_heap_target_end[];
+}
+#endif
+
+/// Stack left unpainted below the boot code's stack pointer, for the frame of paint() itself
+static constexpr uintptr_t PAINT_MARGIN = 128;
+
+static inline volatile uint32_t& word(uintptr_t address) {
+	return *reinterpret_cast<volatile uint32_t*>(address);
+}
+
+#ifndef NATIVE
+
+static hifive1b::MemoryMonitor::Layout linked_layout() {
+	return {
+		{reinterpret_cast<uintptr_t>(metal_segment_data_target_start),
+			reinterpret_cast<uintptr_t>(metal_segment_bss_target_end)},
+		{reinterpret_cast<uintptr_t>(metal_segment_stack_begin), reinterpret_cast<uintptr_t>(metal_segment_stack_end)},
+		{reinterpret_cast<uintptr_t>(metal_segment_heap_target_start),
+			reinterpret_cast<uintptr_t>(metal_segment_heap_target_end)},
+	};
+}
+
+static uintptr_t sbrk_break() {
+	return reinterpret_cast<uintptr_t>(sbrk(0));
+}
+
+hifive1b::MemoryMonitor::MemoryMonitor() :
+	MemoryMonitor(linked_layout(), sbrk_break)
+{}
+
+/// Runs from .preinit_array, before any constructor, while only the C runtime's start code is on the stack
+static void paint_at_boot() {
+	uintptr_t sp;
+	asm volatile ("mv %0, sp" : "=r"(sp));
+	hifive1b::MemoryMonitor().paint(sp - PAINT_MARGIN);
+}
+
+__attribute__((section(".preinit_array"), used)) static void (*paint_at_boot_entry)() = paint_at_boot;
+
+#endif // NATIVE
+
+void hifive1b::MemoryMonitor::paint(uintptr_t top) const {
+	for (uintptr_t p = layout.stack.start; p + sizeof(uint32_t) <= top && p < layout.stack.end; p += sizeof(uint32_t)) {
+		word(p) = PAINT;
+	}
+}
+
+hifive1b::MemoryMonitor::Usage hifive1b::MemoryMonitor::get_usage() const {
+	// The stack grows down, so the lowest word that's been written is the deepest it has been
+	uintptr_t deepest = layout.stack.start;
+	while (deepest < layout.stack.end && word(deepest) == PAINT) {
+		deepest += sizeof(uint32_t);
+	}
+
+	uintptr_t brk = heap_break();
+	brk = (brk < layout.heap.start) ? layout.heap.start : (brk > layout.heap.end) ? layout.heap.end : brk;
+
+	return {
+		layout.statics.size(),
+		layout.stack.size(),
+		static_cast<uint32_t>(layout.stack.end - deepest),
+		layout.heap.size(),
+		static_cast<uint32_t>(brk - layout.heap.start),
+	};
+}
+
+bool hifive1b::MemoryMonitor::check() const {
+	for (uintptr_t p = layout.stack.start; p < layout.stack.start + GUARD_BYTES; p += sizeof(uint32_t)) {
+		if (word(p) != PAINT) {
+			return false;
+		}
+	}
+
+	uintptr_t brk = heap_break();
+	return brk >= layout.heap.start && brk <= layout.heap.end;
+}
+
+void hifive1b::MemoryMonitor::enforce() const {
+	if (!check()) {
+		csr::ebreak();
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+
+namespace hifive1b {
+
+/// How the 16 KB of RAM is used by static data, the stack and the heap
+///
+/// hifive1_revb_custom.ld puts .data and .bss at the bottom of RAM, then the stack (__stack_size, 1 KB by default),
+/// then the heap, which with __heap_max runs to the end of RAM. The stack grows down, so when it overflows it's .bss
+/// that gets overwritten; the heap can't reach the stack, but it can use up the rest of RAM.
+///
+/// The stack is painted with a known word at boot (before constructors run, whenever this file is linked in), so the
+/// deepest word that's no longer painted is the stack's high-water mark. The heap's use is how far sbrk() has moved its
+/// break, which malloc never gives back, so it's also a high-water mark.
+class MemoryMonitor {
+	public:
+		/// Written over the unused stack at boot
+		static constexpr uint32_t PAINT = 0xA5A5A5A5;
+
+		/// Bytes at the bottom of the stack that check() expects to still be painted. A stack that reaches them is one
+		/// call away from overwriting .bss.
+		static constexpr uint32_t GUARD_BYTES = 64;
+
+		/// A range of addresses, start inclusive and end exclusive
+		struct Region {
+			uintptr_t start;
+			uintptr_t end;
+
+			constexpr uint32_t size() const { return static_cast<uint32_t>(end - start); }
+		};
+
+		struct Layout {
+			/// .data, .bss and thread-local data
+			Region statics;
+			Region stack;
+			Region heap;
+		};
+
+		/// Bytes of each region in use. Stack and heap figures are high-water marks.
+		struct Usage {
+			uint32_t static_bytes;
+			uint32_t stack_size;
+			uint32_t stack_peak;
+			uint32_t heap_size;
+			uint32_t heap_used;
+
+			/// Stack never touched so far, which could be given to buffers
+			constexpr uint32_t stack_headroom() const { return stack_size - stack_peak; }
+
+			/// RAM past the heap's break
+			constexpr uint32_t heap_free() const { return heap_size - heap_used; }
+		};
+
+		using HeapBreak = uintptr_t (*)();
+
+		/// Monitor the regions given by the linker script, with the break from sbrk()
+		MemoryMonitor();
+
+		constexpr MemoryMonitor(const Layout& layout, HeapBreak heap_break) :
+			layout(layout),
+			heap_break(heap_break)
+		{}
+
+		/// Fill the stack with PAINT from its bottom up to, not including, top. Nothing at or above top is touched.
+		void paint(uintptr_t top) const;
+
+		/// Scan the stack and the heap break. The stack scan reads every painted word, up to 256 for a 1 KB stack.
+		Usage get_usage() const;
+
+		/// Cheap enough for a periodic timer: checks only the guard words and the heap break
+		/// @return false if the stack has reached its guard or the break is outside the heap
+		bool check() const;
+
+		/// check(), raising a breakpoint exception if it fails so the fault is caught before .bss is overwritten
+		///
+		/// With an InterruptController installed the exception's cause and address are recorded before halting.
+		void enforce() const;
+
+		const Layout& get_layout() const { return layout; }
+
+	private:
+		Layout layout;
+		HeapBreak heap_break;
+};
+
+}
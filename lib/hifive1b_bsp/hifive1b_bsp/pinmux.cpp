@@ -0,0 +1,21 @@
+#include <hifive1b_bsp/pinmux.hpp>
+
+// GPIO register offsets
+
+static constexpr uintptr_t INPUT_EN = 0x04;
+static constexpr uintptr_t OUTPUT_EN = 0x08;
+static constexpr uintptr_t PUE = 0x10;
+static constexpr uintptr_t IOF_EN = 0x38;
+static constexpr uintptr_t IOF_SEL = 0x3C;
+
+static inline volatile uint32_t& mmio(uintptr_t address) {
+	return *reinterpret_cast<volatile uint32_t*>(address);
+}
+
+void hifive1b::PinMux::apply(uintptr_t gpio_address) const {
+	mmio(gpio_address + PUE) = pue;
+	mmio(gpio_address + INPUT_EN) = input_en;
+	mmio(gpio_address + OUTPUT_EN) = output_en;
+	mmio(gpio_address + IOF_SEL) = iof_sel;
+	mmio(gpio_address + IOF_EN) = iof_en;
+}
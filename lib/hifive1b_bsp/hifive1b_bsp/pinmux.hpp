@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace hifive1b {
+
+/// What a GPIO pin is used for
+enum class PinFunction : uint8_t {
+	/// Software-controlled input
+	GPIO_INPUT,
+	/// Software-controlled output. Its output value register isn't changed.
+	GPIO_OUTPUT,
+	/// Hardware I/O function 0: SPI1, SPI2, UART0, UART1 or I2C0 depending on the pin
+	IOF0,
+	/// Hardware I/O function 1: the PWM outputs
+	IOF1,
+};
+
+/// One pin of a board description
+struct PinConfig {
+	uint32_t pin;
+	PinFunction function;
+	/// Enable the internal pull-up, such as for an input nothing drives while a device is in reset
+	bool pull_up = false;
+};
+
+/// GPIO register values for a whole board, worked out at compile time from a list of PinConfig
+///
+/// Building every pin's setting into a single value per register means boot takes a handful of plain writes
+/// instead of a read-modify-write per driver, and no driver can undo another's pins by rewriting a shared register.
+/// Pins that aren't listed are left as plain GPIO with input, output and pull-up disabled.
+///
+/// More information is available in the FE310-G002 Manual Chapter 17 (GPIO)
+class PinMux {
+	public:
+		/// Pins where IOF0 and IOF1 connect to a peripheral
+		static constexpr uint32_t IOF0_PINS = 0xFC8737FC;
+		static constexpr uint32_t IOF1_PINS = 0x00783C0F;
+
+		/// Work out the register values for a board description. Check conflicts, unavailable and invalid afterwards,
+		/// preferably with static_assert.
+		template<std::size_t N>
+		static constexpr PinMux from(const std::array<PinConfig, N>& pins) {
+			PinMux mux;
+			uint32_t seen = 0;
+
+			for (const auto& config : pins) {
+				if (config.pin >= 32) {
+					mux.invalid = true;
+					continue;
+				}
+
+				uint32_t mask = 1UL << config.pin;
+				if (seen & mask) {
+					mux.conflicts |= mask;
+				}
+				seen |= mask;
+
+				switch (config.function) {
+					case PinFunction::GPIO_INPUT:
+						mux.input_en |= mask;
+						break;
+					case PinFunction::GPIO_OUTPUT:
+						mux.output_en |= mask;
+						break;
+					case PinFunction::IOF0:
+						mux.iof_en |= mask;
+						mux.unavailable |= mask & ~IOF0_PINS;
+						break;
+					case PinFunction::IOF1:
+						mux.iof_en |= mask;
+						mux.iof_sel |= mask;
+						mux.unavailable |= mask & ~IOF1_PINS;
+						break;
+				}
+
+				if (config.pull_up) {
+					mux.pue |= mask;
+				}
+			}
+
+			return mux;
+		}
+
+		/// Write the register values to a GPIO block. IOFs are enabled last, once each pin's selection is in place.
+		void apply(uintptr_t gpio_address = 0x10012000) const;
+
+		/// Pins listed more than once
+		uint32_t conflicts = 0;
+
+		/// Pins given an IOF that has no peripheral on that pin
+		uint32_t unavailable = 0;
+
+		/// A pin number was out of range
+		bool invalid = false;
+
+		uint32_t input_en = 0;
+		uint32_t output_en = 0;
+		uint32_t pue = 0;
+		uint32_t iof_en = 0;
+		uint32_t iof_sel = 0;
+};
+
+} // namespace hifive1b
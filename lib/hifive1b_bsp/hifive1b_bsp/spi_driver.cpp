@@ -1,7 +1,194 @@
 #include <hifive1b_bsp/spi_driver.hpp>
 
-#include <cstddef>
+#include <array>
 
-hifive1b::SpiDriver::SpiDriver(uint32_t device_number) {}
+// Register offsets
 
-void hifive1b::SpiDriver::set_baud_rate(uint32_t rate) {}
+static constexpr uintptr_t SCKDIV_OFFSET = 0x00;
+static constexpr uintptr_t SCKMODE_OFFSET = 0x04;
+static constexpr uintptr_t CSID_OFFSET = 0x10;
+static constexpr uintptr_t CSDEF_OFFSET = 0x14;
+static constexpr uintptr_t CSMODE_OFFSET = 0x18;
+static constexpr uintptr_t FMT_OFFSET = 0x40;
+static constexpr uintptr_t TXDATA_OFFSET = 0x48;
+static constexpr uintptr_t RXDATA_OFFSET = 0x4C;
+static constexpr uintptr_t RXMARK_OFFSET = 0x54;
+static constexpr uintptr_t FCTRL_OFFSET = 0x60;
+static constexpr uintptr_t IE_OFFSET = 0x70;
+
+// Constants for the fmt register
+
+static constexpr auto FMT_PROTO = BitField<uint32_t>::from_range<1, 0>();
+static constexpr auto FMT_ENDIAN = BitField<uint32_t>::single_bit<2>();
+static constexpr auto FMT_DIR = BitField<uint32_t>::single_bit<3>();
+static constexpr auto FMT_LEN = BitField<uint32_t>::from_range<19, 16>();
+
+// Status flags in the data registers
+
+static constexpr uint32_t TXDATA_FULL = 1UL << 31;
+static constexpr uint32_t RXDATA_EMPTY = 1UL << 31;
+
+// Interrupt enables
+
+static constexpr uint32_t IE_RXWM = 1UL << 1;
+
+static constexpr std::array<uintptr_t, 3> SPI_BASE_ADDRESSES {0x10014000, 0x10024000, 0x10034000};
+
+hifive1b::SpiDriver::SpiDriver(uint32_t device_number) :
+	SpiDriver(device_number, device_number < SPI_BASE_ADDRESSES.size() ? SPI_BASE_ADDRESSES[device_number] : 0)
+{}
+
+hifive1b::SpiDriver::SpiDriver(uint32_t device_number, uintptr_t base_address) :
+	base(base_address)
+{
+	if (base != 0) {
+		state = State::VALID_UNINITIALIZED;
+	}
+}
+
+void hifive1b::SpiDriver::initialize(Clock& input_clock) {
+	if (state == State::INVALID) {
+		return;
+	}
+
+	// Programmed I/O rather than memory-mapped flash reads
+	ControlRegister<uint32_t>(base + FCTRL_OFFSET).write(0);
+
+	// Single data line, MSB first, 8-bit frames, receiving while transmitting
+	const ControlRegister<uint32_t> fmt(base + FMT_OFFSET);
+	auto fmt_transact = fmt.start_atomic_transaction();
+	fmt_transact.set_field(FMT_PROTO, 0);
+	fmt_transact.set_field(FMT_ENDIAN, 0);
+	fmt_transact.set_field(FMT_DIR, 0);
+	fmt_transact.set_field(FMT_LEN, 8);
+	fmt_transact.finalize();
+
+	// Mode 0 (sample on the leading edge, clock idles low) with active-low chip selects
+	ControlRegister<uint32_t>(base + SCKMODE_OFFSET).write(0);
+	ControlRegister<uint32_t>(base + CSDEF_OFFSET).write(0xFFFFFFFF);
+	set_chip_select_mode(ChipSelectMode::AUTO);
+	select_chip(0);
+
+	input_frequency = static_cast<uint32_t>(input_clock.get_frequency().count());
+	apply_baud_rate();
+
+	// The divider has to be recalculated to keep the same baud rate when the bus clock changes
+	input_clock.add_frequency_change_listener([this](Frequency new_frequency) {
+		input_frequency = static_cast<uint32_t>(new_frequency.count());
+		apply_baud_rate();
+	});
+
+	state = State::INITIALIZED;
+}
+
+void hifive1b::SpiDriver::set_baud_rate(uint32_t rate) {
+	requested_baud_rate = rate;
+	apply_baud_rate();
+}
+
+void hifive1b::SpiDriver::select_chip(uint32_t cs_id) {
+	ControlRegister<uint32_t>(base + CSID_OFFSET).write(cs_id);
+}
+
+void hifive1b::SpiDriver::set_chip_select_mode(ChipSelectMode mode) {
+	ControlRegister<uint32_t>(base + CSMODE_OFFSET).write(static_cast<uint32_t>(mode));
+}
+
+uint8_t hifive1b::SpiDriver::transfer(uint8_t tx) {
+	uint8_t rx = 0;
+	transfer(&tx, &rx, 1);
+	return rx;
+}
+
+void hifive1b::SpiDriver::transfer(const uint8_t* tx, uint8_t* rx, std::size_t len) {
+	const ControlRegister<uint32_t> txdata(base + TXDATA_OFFSET);
+	const ControlRegister<uint32_t> rxdata(base + RXDATA_OFFSET);
+
+	std::size_t sent = 0;
+	std::size_t received = 0;
+
+	while (received < len) {
+		// Queue as many frames as the FIFO allows so the bus never idles between bytes. Limiting the number in flight
+		// to the FIFO depth also guarantees the receive FIFO can't overflow.
+		while (sent < len && sent - received < FIFO_DEPTH) {
+			if (txdata.read() & TXDATA_FULL) {
+				break;
+			}
+			txdata.write(tx ? tx[sent] : 0);
+			++sent;
+		}
+
+		// Read the RX register exactly once per check since reading pops the FIFO
+		uint32_t c = rxdata.read();
+		if (!(c & RXDATA_EMPTY)) {
+			if (rx) {
+				rx[received] = static_cast<uint8_t>(c);
+			}
+			++received;
+		}
+	}
+}
+
+Completion<>& hifive1b::SpiDriver::transfer_async(const uint8_t* tx, uint8_t* rx, std::size_t len) {
+	async_tx = tx;
+	async_rx = rx;
+	async_len = len;
+	async_sent = 0;
+	async_received = 0;
+	async_done.reset();
+
+	// The interrupt is disabled until pump() has set the watermark
+	pump();
+	return async_done;
+}
+
+void hifive1b::SpiDriver::handle_interrupt() {
+	pump();
+}
+
+void hifive1b::SpiDriver::pump() {
+	const ControlRegister<uint32_t> txdata(base + TXDATA_OFFSET);
+	const ControlRegister<uint32_t> rxdata(base + RXDATA_OFFSET);
+	const ControlRegister<uint32_t> ie(base + IE_OFFSET);
+
+	while (async_received < async_sent) {
+		uint32_t c = rxdata.read();
+		if (c & RXDATA_EMPTY) {
+			break;
+		}
+		if (async_rx) {
+			async_rx[async_received] = static_cast<uint8_t>(c);
+		}
+		++async_received;
+	}
+
+	// Same limit on frames in flight as transfer()
+	while (async_sent < async_len && async_sent - async_received < FIFO_DEPTH) {
+		if (txdata.read() & TXDATA_FULL) {
+			break;
+		}
+		txdata.write(async_tx ? async_tx[async_sent] : 0);
+		++async_sent;
+	}
+
+	if (async_received == async_len) {
+		ie.write(0);
+		async_done.complete();
+		return;
+	}
+
+	// rxwm is raised while the receive FIFO holds more than rxmark entries, so this interrupts once every frame in
+	// flight has arrived
+	ControlRegister<uint32_t>(base + RXMARK_OFFSET).write(static_cast<uint32_t>(async_sent - async_received - 1));
+	ie.write(IE_RXWM);
+}
+
+void hifive1b::SpiDriver::apply_baud_rate() {
+	if (requested_baud_rate == 0 || input_frequency == 0) {
+		return;
+	}
+
+	uint32_t div = divider_for(input_frequency, requested_baud_rate);
+	ControlRegister<uint32_t>(base + SCKDIV_OFFSET).write(div);
+	baud_rate = input_frequency / (2 * (div + 1));
+}
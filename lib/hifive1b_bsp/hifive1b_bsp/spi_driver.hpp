@@ -1,12 +1,24 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
+#include <embedded_util/clock.hpp>
+#include <embedded_util/control_register.hpp>
+#include <embedded_util/coroutine.hpp>
 #include <embedded_util/safety.hpp>
 
 namespace hifive1b {
 
-/// Driver for an SPI bus using the Freedom Metal BSP
+/// Driver for one of the SPI controllers of the FE310-G002
+///
+/// The driver uses programmed I/O in single (non-quad) mode, 8 bits per frame, MSB first. SPI0 is connected to the
+/// flash that code executes from, so it should never be initialized through this driver.
+///
+/// Transfers either wait for the last byte, or run in the background from the receive watermark interrupt with a
+/// coroutine awaiting the result.
+///
+/// More information on the SPI controllers is available in the FE310-G002 Manual Chapter 19
 class SpiDriver {
 	public:
 
@@ -20,22 +32,102 @@ class SpiDriver {
 			INITIALIZED,
 		};
 
+		/// Values of the csmode register
+		enum class ChipSelectMode : uint32_t {
+			/// Assert the chip select at the start of each frame and deassert at the end
+			AUTO = 0,
+			/// Keep the chip select asserted after the first frame until the mode is changed
+			HOLD = 2,
+			/// Disable hardware control of the chip select
+			OFF = 3,
+		};
+
+		/// Number of entries in the transmit and receive FIFOs
+		static constexpr std::size_t FIFO_DEPTH = 8;
+
+		/// PLIC source of a controller's interrupt
+		static constexpr uint32_t plic_source(uint32_t device_number) { return 5 + device_number; }
+
+		/// Largest sckdiv value
+		static constexpr uint32_t SCKDIV_MAX = 0xFFF;
+
+		/// sckdiv for the closest baud rate that does not exceed the request
+		static constexpr uint32_t divider_for(uint32_t input_frequency, uint32_t rate) {
+			// f_sck = f_in / (2 * (div + 1)), rounding the divider up so the result never exceeds the requested rate
+			uint32_t div = (input_frequency + 2 * rate - 1) / (2 * rate);
+			div = (div == 0) ? 0 : div - 1;
+			return (div > SCKDIV_MAX) ? SCKDIV_MAX : div;
+		}
+
+		/// The baud rate set_baud_rate() ends up with for a request, such as to search for a rate the divider can hit
+		static constexpr uint32_t baud_rate_for(uint32_t input_frequency, uint32_t rate) {
+			return input_frequency / (2 * (divider_for(input_frequency, rate) + 1));
+		}
+
 		/// Construct an SPI driver and load the device handle. Sets state to VALID if successful
 		/// @param device_number An integer in [0,2] corresponding to one of the 3 SPI devices on the Hifive1
 		explicit SpiDriver(uint32_t device_number);
-		
+
+		/// Construct a driver for a controller at a specific address (ex. mock registers for testing)
+		SpiDriver(uint32_t device_number, uintptr_t base_address);
+
 		DISALLOW_COPY_AND_MOVE(SpiDriver);
 
-		/// Set the baud rate in hertz
+		/// Configure the controller for programmed I/O and select chip select 0
+		/// @param input_clock The clock driving the controller (tlclk). The baud rate is kept when it changes.
+		void initialize(Clock& input_clock);
+
+		/// Set the baud rate in hertz. The closest rate that does not exceed the request is used.
 		void set_baud_rate(uint32_t rate);
 
+		/// Choose which chip select pin is driven (csid)
+		void select_chip(uint32_t cs_id);
+
+		void set_chip_select_mode(ChipSelectMode mode);
+
+		/// Exchange one byte
+		uint8_t transfer(uint8_t tx);
+
+		/// Exchange a buffer, keeping the transmit FIFO filled
+		/// @param tx Bytes to send, or nullptr to send zeros
+		/// @param rx Storage for received bytes, or nullptr to discard them
+		void transfer(const uint8_t* tx, uint8_t* rx, std::size_t len);
+
+		/// Start exchanging a buffer in the background
+		///
+		/// The controller's PLIC source must be routed to handle_interrupt(). The buffers must stay untouched until the
+		/// transfer completes, and only one transfer may run at a time.
+		/// @return Completes once the last byte has been received: `co_await spi.transfer_async(tx, rx, len);`
+		Completion<>& transfer_async(const uint8_t* tx, uint8_t* rx, std::size_t len);
+
+		/// Move bytes between the FIFOs and the buffers of the background transfer. Call from the interrupt handler.
+		void handle_interrupt();
+
 		inline State get_state() const { return state; }
-		inline uint32_t get_baud_rate() const { return baud_rate; } 
+		inline uint32_t get_baud_rate() const { return baud_rate; }
 
 	private:
+		/// Calculate and write sckdiv for the current input frequency and requested rate
+		void apply_baud_rate();
+
+		/// Read what has arrived and refill the transmit FIFO, then wait for the bytes in flight or complete
+		void pump();
+
+		uint32_t requested_baud_rate = 0;
 		uint32_t baud_rate = 0;
+		uint32_t input_frequency = 0;
 		State state = State::INVALID;
 
+		uintptr_t base;
+
+		/// Background transfer
+		const uint8_t* async_tx = nullptr;
+		uint8_t* async_rx = nullptr;
+		std::size_t async_len = 0;
+		std::size_t async_sent = 0;
+		std::size_t async_received = 0;
+		Completion<> async_done;
+
 };
 
 /// Empty driver for devices that shouldn't use SPI
@@ -50,4 +142,4 @@ class EmptySpiDriver {
 
 };
 
-} // namespace hifive1b
\ No newline at end of file
+} // namespace hifive1b
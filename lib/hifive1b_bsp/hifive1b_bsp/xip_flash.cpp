@@ -0,0 +1,15 @@
+#include <hifive1b_bsp/xip_flash.hpp>
+
+#include <cstring>
+
+void hifive1b::XipFlash::read(uint32_t address, uint8_t* data, std::size_t len) {
+	std::memcpy(data, reinterpret_cast<const void*>(FlashController::MEMORY_MAPPED_BASE + address), len);
+}
+
+bool hifive1b::XipFlash::program(uint32_t address, const uint8_t* data, std::size_t len) {
+	return controller.program(address, data, len);
+}
+
+bool hifive1b::XipFlash::erase_sector(uint32_t address) {
+	return controller.erase_sector(address);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <embedded_util/safety.hpp>
+
+#include <storage/flash_device.hpp>
+
+#include <hifive1b_bsp/flash_controller.hpp>
+
+namespace hifive1b {
+
+/// The flash that code executes from, as a storage::FlashDevice
+///
+/// Reads go through the memory-mapped interface. Program and erase block until the flash finishes since no code can be
+/// fetched from it in the meantime, so is_busy() is always false.
+class XipFlash : public storage::FlashDevice {
+	public:
+
+		/// Where the program is linked (the rom region in hifive1_revb_custom.ld), after the 4 KiB boot selector
+		static constexpr uint32_t APP_REGION_OFFSET = 0x11000;
+		static constexpr uint32_t APP_REGION_SIZE = 0x69120;
+
+		/// Slot that firmware updates are staged in before the boot selector installs them (see storage/ota_image.hpp)
+		static constexpr uint32_t OTA_SLOT_OFFSET = 0x80000;
+		static constexpr uint32_t OTA_SLOT_SIZE = 0x80000;
+
+		/// Region set aside for persistent parameters: the last 64 KiB, well past the program image (see the rom region
+		/// in hifive1_revb_custom.ld)
+		static constexpr uint32_t PARAM_REGION_OFFSET = 0x3F0000;
+		static constexpr uint32_t PARAM_REGION_SIZE = 0x10000;
+
+		/// Region set aside for flight recordings: the 1 MiB just below the parameters
+		static constexpr uint32_t BLACKBOX_REGION_OFFSET = 0x2F0000;
+		static constexpr uint32_t BLACKBOX_REGION_SIZE = 0x100000;
+
+		explicit XipFlash(FlashController& controller) :
+			controller(controller)
+		{}
+
+		DISALLOW_COPY_AND_MOVE(XipFlash);
+
+		std::size_t size() const override { return FlashController::FLASH_SIZE; }
+		std::size_t sector_size() const override { return FlashController::SECTOR_SIZE; }
+		std::size_t page_size() const override { return FlashController::PAGE_SIZE; }
+
+		void read(uint32_t address, uint8_t* data, std::size_t len) override;
+		bool program(uint32_t address, const uint8_t* data, std::size_t len) override;
+		bool erase_sector(uint32_t address) override;
+		bool is_busy() override { return false; }
+
+	private:
+		FlashController& controller;
+
+};
+
+} // namespace hifive1b
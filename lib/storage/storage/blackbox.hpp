@@ -0,0 +1,321 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <embedded_util/crc.hpp>
+#include <embedded_util/safety.hpp>
+#include <embedded_util/varint.hpp>
+
+#include <storage/flash_device.hpp>
+
+namespace storage {
+
+/// Marks a page written by BlackboxRecorder
+constexpr uint16_t BLACKBOX_MAGIC = 0xB10C;
+
+/// Bytes before the samples of a black box page
+constexpr std::size_t BLACKBOX_HEADER_SIZE = 8;
+
+/// Most channels decode_blackbox_page() accepts
+constexpr std::size_t BLACKBOX_MAX_CHANNELS = 64;
+
+/// State of the control loop at one time (ex. inputs, estimates and outputs scaled to integers)
+template<std::size_t CHANNELS>
+struct BlackboxSample {
+	uint32_t timestamp_us = 0;
+	std::array<int32_t, CHANNELS> values {};
+};
+
+/// Records control loop samples to a region of flash at the loop rate
+///
+/// Samples are delta encoded as they are recorded, straight into one of two page buffers in RAM. When a page is full
+/// the buffers swap, and poll() programs the full one while the loop keeps filling the other. record() never waits for
+/// the flash; if both buffers are full the sample is dropped and counted.
+///
+/// Page layout (multi-byte fields little-endian):
+/// - uint16 BLACKBOX_MAGIC, uint16 page sequence number, uint8 channel count, uint8 sample count, uint16 bytes of
+///   samples
+/// - for each sample: varint time since the previous sample, then one zigzag varint per channel holding the change
+///   from the previous sample. The first sample of each page is relative to zero, so every page decodes on its own.
+/// - uint16 CRC-16/CCITT of everything above, then 0xFF to the end of the page
+///
+/// The region must be erased before recording, which erase() does in the background a sector at a time. Use
+/// decode_blackbox_page() to read the pages back.
+///
+/// @tparam CHANNELS Number of values in each sample
+/// @tparam PAGE Bytes in each page. The flash's page size must be a multiple of it.
+template<std::size_t CHANNELS, std::size_t PAGE = 256>
+class BlackboxRecorder {
+	public:
+
+		using Sample = BlackboxSample<CHANNELS>;
+
+		/// Largest encoding of one sample
+		static constexpr std::size_t MAX_SAMPLE_BYTES = varint::MAX_BYTES * (CHANNELS + 1);
+
+		enum class State : uint8_t {
+			IDLE,
+			/// erase() was called and the region is still being erased
+			ERASING,
+			RECORDING,
+			/// The region is full; later samples are dropped
+			FULL,
+		};
+
+		struct Stats {
+			uint32_t samples = 0;
+			/// Samples lost because both buffers were full or the region was
+			uint32_t dropped = 0;
+			uint32_t pages = 0;
+			/// Bytes of encoded samples, not counting page headers and padding
+			uint32_t encoded_bytes = 0;
+		};
+
+		/// @param start Offset of the region in the flash, aligned to a sector
+		/// @param length Size of the region, a multiple of the sector size
+		BlackboxRecorder(FlashDevice& flash, uint32_t start, uint32_t length) :
+			flash(flash),
+			start(start),
+			end(start + length)
+		{}
+
+		DISALLOW_COPY_AND_MOVE(BlackboxRecorder);
+
+		/// Start erasing the region. Recording starts once poll() has erased every sector.
+		void erase() {
+			state = State::ERASING;
+			erase_address = start;
+			write_address = start;
+			filling = 0;
+			pending = false;
+			stopping = false;
+			samples = 0;
+			used = BLACKBOX_HEADER_SIZE;
+			sequence = 0;
+			stats = Stats();
+		}
+
+		/// Add a sample to the current page
+		/// @return false if the sample was dropped
+		bool record(const Sample& sample) {
+			if (state != State::RECORDING) {
+				if (state == State::FULL) {
+					++stats.dropped;
+				}
+				return false;
+			}
+
+			if (!fits()) {
+				if (pending) {
+					// The flash is behind; keep the page open and lose this sample rather than wait
+					++stats.dropped;
+					return false;
+				}
+				close_page();
+			}
+
+			uint8_t* out = pages[filling].data() + used;
+			const Sample& base = (samples == 0) ? Sample() : previous;
+			std::size_t n = varint::encode(sample.timestamp_us - base.timestamp_us, out);
+			for (std::size_t i = 0; i < CHANNELS; ++i) {
+				n += varint::encode(varint::zigzag_encode(varint::delta(sample.values[i], base.values[i])), out + n);
+			}
+
+			used += n;
+			previous = sample;
+			++samples;
+			++stats.samples;
+			stats.encoded_bytes += static_cast<uint32_t>(n);
+			return true;
+		}
+
+		/// Program a full page or erase the next sector if the flash is idle
+		void poll() {
+			if (flash.is_busy()) {
+				return;
+			}
+
+			if (state == State::ERASING) {
+				if (erase_address >= end) {
+					state = State::RECORDING;
+				} else if (flash.erase_sector(erase_address)) {
+					erase_address += static_cast<uint32_t>(flash.sector_size());
+				}
+				return;
+			}
+
+			if (!pending) {
+				// A page closed by stop() is written once the other buffer is free
+				if (stopping && samples > 0) {
+					close_page();
+				}
+				stopping = false;
+				return;
+			}
+
+			if (write_address + PAGE > end) {
+				// Count the samples of the page that has nowhere to go
+				state = State::FULL;
+				stats.dropped += pages[1 - filling][5];
+				pending = false;
+				return;
+			}
+
+			if (flash.program(write_address, pages[1 - filling].data(), PAGE)) {
+				write_address += PAGE;
+				++stats.pages;
+				pending = false;
+			}
+		}
+
+		/// Stop recording. poll() still writes the pages recorded so far; see is_flushing().
+		void stop() {
+			if (state != State::RECORDING) {
+				return;
+			}
+			state = State::IDLE;
+
+			if (samples > 0) {
+				if (pending) {
+					stopping = true;
+				} else {
+					close_page();
+				}
+			}
+		}
+
+		/// True while a closed page is still waiting to be written
+		bool is_flushing() const { return pending || stopping; }
+
+		State get_state() const { return state; }
+
+		/// Bytes of the region holding pages
+		uint32_t get_recorded_length() const { return write_address - start; }
+
+		inline const Stats& get_stats() const { return stats; }
+
+	private:
+		static_assert(CHANNELS <= BLACKBOX_MAX_CHANNELS, "BlackboxRecorder: too many channels to decode");
+		static_assert(PAGE >= BLACKBOX_HEADER_SIZE + MAX_SAMPLE_BYTES + 2, "BlackboxRecorder: a page must hold a sample");
+
+		/// True if a worst-case sample and the CRC still fit in the current page
+		bool fits() const {
+			return samples < 0xFF && used + MAX_SAMPLE_BYTES + 2 <= PAGE;
+		}
+
+		/// Finish the current page and hand it to poll()
+		void close_page() {
+			uint8_t* page = pages[filling].data();
+			uint16_t length = static_cast<uint16_t>(used - BLACKBOX_HEADER_SIZE);
+
+			page[0] = static_cast<uint8_t>(BLACKBOX_MAGIC);
+			page[1] = static_cast<uint8_t>(BLACKBOX_MAGIC >> 8);
+			page[2] = static_cast<uint8_t>(sequence);
+			page[3] = static_cast<uint8_t>(sequence >> 8);
+			page[4] = static_cast<uint8_t>(CHANNELS);
+			page[5] = static_cast<uint8_t>(samples);
+			page[6] = static_cast<uint8_t>(length);
+			page[7] = static_cast<uint8_t>(length >> 8);
+
+			uint16_t crc = Crc16::calculate(page, used);
+			page[used] = static_cast<uint8_t>(crc);
+			page[used + 1] = static_cast<uint8_t>(crc >> 8);
+			std::memset(page + used + 2, FlashDevice::ERASED, PAGE - used - 2);
+
+			++sequence;
+			pending = true;
+			filling = 1 - filling;
+			samples = 0;
+			used = BLACKBOX_HEADER_SIZE;
+		}
+
+		FlashDevice& flash;
+		uint32_t start;
+		uint32_t end;
+
+		std::array<std::array<uint8_t, PAGE>, 2> pages;
+		/// Index of the page being filled; the other one is being written if pending is set
+		std::size_t filling = 0;
+		bool pending = false;
+		bool stopping = false;
+
+		/// Samples and bytes in the page being filled
+		std::size_t samples = 0;
+		std::size_t used = BLACKBOX_HEADER_SIZE;
+		Sample previous;
+		uint16_t sequence = 0;
+
+		uint32_t erase_address = 0;
+		uint32_t write_address = 0;
+		State state = State::IDLE;
+
+		Stats stats;
+};
+
+/// Result of decoding one page
+enum class BlackboxPage : uint8_t {
+	OK,
+	/// The page was never written, so the recording ends before it
+	ERASED,
+	/// Bad magic, CRC or encoding
+	CORRUPT,
+};
+
+/// Decode a page written by BlackboxRecorder
+///
+/// @param on_sample Called as on_sample(timestamp_us, values, channels) for each sample, with values holding channels
+///	int32_t values
+/// @param sequence Set to the page's sequence number
+template<typename SampleHandler>
+BlackboxPage decode_blackbox_page(const uint8_t* page, std::size_t len, SampleHandler&& on_sample, uint16_t& sequence) {
+	if (len < BLACKBOX_HEADER_SIZE + 2) {
+		return BlackboxPage::CORRUPT;
+	}
+
+	uint16_t magic = page[0] | (page[1] << 8);
+	if (magic == 0xFFFF) {
+		return BlackboxPage::ERASED;
+	}
+
+	std::size_t channels = page[4];
+	std::size_t samples = page[5];
+	std::size_t end = BLACKBOX_HEADER_SIZE + (page[6] | (page[7] << 8));
+	if (magic != BLACKBOX_MAGIC || channels > BLACKBOX_MAX_CHANNELS || end + 2 > len) {
+		return BlackboxPage::CORRUPT;
+	}
+	if (Crc16::calculate(page, end) != (page[end] | (page[end + 1] << 8))) {
+		return BlackboxPage::CORRUPT;
+	}
+	sequence = page[2] | (page[3] << 8);
+
+	int32_t values[BLACKBOX_MAX_CHANNELS] = {};
+	uint32_t timestamp_us = 0;
+	std::size_t pos = BLACKBOX_HEADER_SIZE;
+	uint32_t value = 0;
+	std::size_t n = 0;
+
+	for (std::size_t s = 0; s < samples; ++s) {
+		if ((n = varint::decode(page + pos, end - pos, value)) == 0) {
+			return BlackboxPage::CORRUPT;
+		}
+		pos += n;
+		timestamp_us += value;
+
+		for (std::size_t i = 0; i < channels; ++i) {
+			if ((n = varint::decode(page + pos, end - pos, value)) == 0) {
+				return BlackboxPage::CORRUPT;
+			}
+			pos += n;
+			values[i] = varint::apply_delta(values[i], varint::zigzag_decode(value));
+		}
+
+		on_sample(timestamp_us, static_cast<const int32_t*>(values), channels);
+	}
+
+	return (pos == end) ? BlackboxPage::OK : BlackboxPage::CORRUPT;
+}
+
+} // namespace storage
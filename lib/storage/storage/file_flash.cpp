@@ -0,0 +1,111 @@
+#include <storage/file_flash.hpp>
+
+storage::FileFlash::FileFlash(const char* path, std::size_t size, std::size_t sector_size, std::size_t page_size) :
+	FileFlash(path, size, sector_size, page_size, Timing())
+{}
+
+storage::FileFlash::FileFlash(const char* path, std::size_t size, std::size_t sector_size, std::size_t page_size,
+		Timing timing) :
+	image_size(size),
+	sector(sector_size),
+	page(page_size),
+	timing(timing),
+	erase_counts(size / sector_size, 0)
+{
+	file = std::fopen(path, "r+b");
+	if (!file) {
+		file = std::fopen(path, "w+b");
+	}
+	if (!file) {
+		return;
+	}
+
+	// Anything past the end of an existing image reads as erased
+	std::fseek(file, 0, SEEK_END);
+	long existing = std::ftell(file);
+	for (long i = existing; i < static_cast<long>(size); ++i) {
+		std::fputc(ERASED, file);
+	}
+	std::fflush(file);
+}
+
+storage::FileFlash::~FileFlash() {
+	if (file) {
+		std::fclose(file);
+	}
+}
+
+void storage::FileFlash::read(uint32_t address, uint8_t* data, std::size_t len) {
+	if (!file || !in_range(address, len)) {
+		++stats.violations;
+		return;
+	}
+
+	// The real part answers with its status register while busy
+	if (now < busy_until) {
+		++stats.violations;
+	}
+
+	std::fseek(file, address, SEEK_SET);
+	if (std::fread(data, 1, len, file) != len) {
+		++stats.violations;
+	}
+}
+
+bool storage::FileFlash::program(uint32_t address, const uint8_t* data, std::size_t len) {
+	if (!file || !in_range(address, len) || now < busy_until || len > page - address % page) {
+		++stats.violations;
+		return false;
+	}
+
+	uint8_t current[256];
+	std::size_t written = (tear_at < len) ? tear_at : len;
+	tear_at = SIZE_MAX;
+
+	for (std::size_t done = 0; done < written; done += sizeof(current)) {
+		std::size_t chunk = (written - done < sizeof(current)) ? written - done : sizeof(current);
+
+		std::fseek(file, address + done, SEEK_SET);
+		std::fread(current, 1, chunk, file);
+
+		// Programming can only clear bits
+		for (std::size_t i = 0; i < chunk; ++i) {
+			if (data[done + i] & ~current[i]) {
+				++stats.violations;
+			}
+			current[i] &= data[done + i];
+		}
+
+		std::fseek(file, address + done, SEEK_SET);
+		std::fwrite(current, 1, chunk, file);
+	}
+	std::fflush(file);
+
+	++stats.programs;
+	busy_until = now + timing.page_program_us;
+	return true;
+}
+
+bool storage::FileFlash::erase_sector(uint32_t address) {
+	if (!file || !in_range(address, 1) || now < busy_until) {
+		++stats.violations;
+		return false;
+	}
+
+	uint32_t first = static_cast<uint32_t>(address - address % sector);
+	std::fseek(file, first, SEEK_SET);
+	for (std::size_t i = 0; i < sector; ++i) {
+		std::fputc(ERASED, file);
+	}
+	std::fflush(file);
+
+	++stats.erases;
+	++erase_counts[first / sector];
+	busy_until = now + timing.sector_erase_us;
+	return true;
+}
+
+bool storage::FileFlash::is_busy() {
+	now += timing.poll_us;
+	return now < busy_until;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include <embedded_util/safety.hpp>
+
+#include <storage/flash_device.hpp>
+
+namespace storage {
+
+/// Flash simulated in a file, for running the storage code in the native build
+///
+/// The image persists between runs like the real part, and the simulation enforces its rules: programming can only
+/// clear bits, a program can't cross a page, and nothing can start while an operation is in progress. Operations take
+/// simulated time. Every call to is_busy() advances the time by a polling interval, so a loop waiting on the flash
+/// finishes and the time it spent is counted.
+class FileFlash : public FlashDevice {
+	public:
+
+		/// Durations in microseconds, defaulting to the typical figures for a serial NOR flash
+		struct Timing {
+			uint32_t page_program_us = 700;
+			uint32_t sector_erase_us = 45000;
+			/// Time that passes with each call to is_busy()
+			uint32_t poll_us = 10;
+		};
+
+		struct Stats {
+			uint32_t programs = 0;
+			uint32_t erases = 0;
+			/// Operations that broke the flash's rules (ex. programming a 0 bit to 1, or starting while busy)
+			uint32_t violations = 0;
+		};
+
+		/// Open an image, creating it erased if it doesn't exist
+		FileFlash(const char* path, std::size_t size, std::size_t sector_size = 4096, std::size_t page_size = 256);
+
+		FileFlash(const char* path, std::size_t size, std::size_t sector_size, std::size_t page_size, Timing timing);
+
+		~FileFlash();
+
+		DISALLOW_COPY_AND_MOVE(FileFlash);
+
+		bool is_open() const { return file != nullptr; }
+
+		std::size_t size() const override { return image_size; }
+		std::size_t sector_size() const override { return sector; }
+		std::size_t page_size() const override { return page; }
+
+		void read(uint32_t address, uint8_t* data, std::size_t len) override;
+		bool program(uint32_t address, const uint8_t* data, std::size_t len) override;
+		bool erase_sector(uint32_t address) override;
+		bool is_busy() override;
+
+		/// Let simulated time pass
+		void advance(uint32_t us) { now += us; }
+
+		/// Simulated time since the image was opened
+		uint64_t now_us() const { return now; }
+
+		/// Cut the power partway through the next program: only its first bytes are written
+		void tear_next_program(std::size_t bytes_written) { tear_at = bytes_written; }
+
+		/// Number of times a sector has been erased since the image was opened
+		uint32_t get_erase_count(std::size_t sector_index) const { return erase_counts[sector_index]; }
+
+		inline const Stats& get_stats() const { return stats; }
+
+	private:
+		bool in_range(uint32_t address, std::size_t len) const { return address + len <= image_size; }
+
+		std::FILE* file = nullptr;
+		std::size_t image_size;
+		std::size_t sector;
+		std::size_t page;
+		Timing timing;
+
+		uint64_t now = 0;
+		uint64_t busy_until = 0;
+
+		/// Bytes of the next program that reach the image, or SIZE_MAX for all of them
+		std::size_t tear_at = SIZE_MAX;
+
+		std::vector<uint32_t> erase_counts;
+		Stats stats;
+
+};
+
+} // namespace storage
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace storage {
+
+/// Interface to a NOR flash (or a region of one) addressed from 0
+///
+/// Programming can only clear bits, so a location has to be erased (set to 0xFF) with the rest of its sector before it
+/// can be written again. Program and erase start an operation that may take a while to finish; wait until is_busy()
+/// returns false before starting the next one or reading.
+class FlashDevice {
+	public:
+		/// Value of every byte after an erase
+		static constexpr uint8_t ERASED = 0xFF;
+
+		virtual std::size_t size() const = 0;
+
+		/// Smallest unit that can be erased
+		virtual std::size_t sector_size() const = 0;
+
+		/// Largest unit that can be programmed at once. A program operation must not cross a page boundary.
+		virtual std::size_t page_size() const = 0;
+
+		virtual void read(uint32_t address, uint8_t* data, std::size_t len) = 0;
+
+		/// Start programming data within one page
+		/// @return false if the operation was rejected (ex. still busy or out of range)
+		virtual bool program(uint32_t address, const uint8_t* data, std::size_t len) = 0;
+
+		/// Start erasing the sector containing address
+		virtual bool erase_sector(uint32_t address) = 0;
+
+		/// True while a program or erase is in progress
+		virtual bool is_busy() = 0;
+
+		/// Wait for the current operation to finish
+		void wait_ready() {
+			while (is_busy()) {}
+		}
+
+};
+
+} // namespace storage
@@ -0,0 +1,165 @@
+/// Layout of a staged firmware update and the routine that installs it
+///
+/// An update is staged in a slot of the flash: the first sector holds an OtaManifest and the image follows from the
+/// next sector. OtaWriter fills the slot and writes the manifest only once the whole image has been checked, so a slot
+/// with a valid manifest always holds a complete image. At boot, install_pending() copies it over the running image.
+///
+/// install_pending() is written for the boot selector, which runs before the C runtime is set up and while the image it
+/// replaces is unreadable: everything is forced inline and no lookup tables or library calls are used.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef ALWAYS_INLINE
+#	define ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace storage {
+
+/// Record at the start of an update slot. Fields are in the byte order of the processor.
+struct OtaManifest {
+	/// "OTA1"
+	static constexpr uint32_t MAGIC = 0x3141544F;
+
+	// Values of status. Each can be programmed over PENDING.
+	static constexpr uint32_t PENDING = 0xFFFFFFFF;
+	static constexpr uint32_t INSTALLED = 0x00000000;
+	/// The image failed its check at boot and was not installed
+	static constexpr uint32_t REJECTED = 0x0000FFFF;
+
+	static constexpr std::size_t PROGRESS_WORDS = 8;
+
+	/// Largest image the progress bits can track, in sectors
+	static constexpr std::size_t MAX_SECTORS = PROGRESS_WORDS * 32;
+
+	uint32_t magic;
+	uint32_t image_size;
+	/// CRC-32 of the image
+	uint32_t image_crc;
+	/// CRC-32 of the three fields above
+	uint32_t header_crc;
+
+	// Written while installing
+
+	uint32_t status;
+	/// One bit per sector of the image, cleared once that sector has been installed. An interrupted install resumes
+	/// from the first sector whose bit is still set.
+	uint32_t progress[PROGRESS_WORDS];
+};
+
+/// Result of install_pending()
+enum class OtaInstall : uint8_t {
+	/// No update is waiting
+	NONE,
+	INSTALLED,
+	/// The update was discarded because the image is damaged or doesn't fit
+	REJECTED,
+};
+
+/// Bytes copied at a time while installing; the flash's page size must be a multiple of it
+constexpr std::size_t OTA_COPY_SIZE = 256;
+
+/// CRC-32 (same as Crc32) computed a bit at a time, so it reads no table
+ALWAYS_INLINE uint32_t ota_crc32_update(uint32_t crc, const uint8_t* data, std::size_t len) {
+	crc = ~crc;
+	for (std::size_t i = 0; i < len; ++i) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; ++bit) {
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+/// Program one word of the manifest in place
+template<typename Flash>
+ALWAYS_INLINE void ota_program_word(Flash& flash, uint32_t address, uint32_t value) {
+	uint8_t bytes[4];
+	for (int i = 0; i < 4; ++i) {
+		bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+	}
+	flash.program(address, bytes, sizeof(bytes));
+	flash.wait_ready();
+}
+
+/// Install the update staged in a slot, if there is one
+///
+/// The staged image is checked against its CRC first, then copied a sector at a time. Each copied sector is marked in
+/// the manifest, so if power is lost the next call carries on where this one stopped. Call it before anything runs
+/// from the target region.
+///
+/// @tparam Flash Provides the members of FlashDevice that are used here: read(), program(), erase_sector(),
+///	wait_ready() and sector_size()
+/// @param slot Offset of the slot holding the manifest
+/// @param target Offset the image is installed at, aligned to a sector
+/// @param target_length Largest image that fits at target
+template<typename Flash>
+ALWAYS_INLINE OtaInstall install_pending(Flash& flash, uint32_t slot, uint32_t target, uint32_t target_length) {
+	OtaManifest manifest;
+	flash.read(slot, reinterpret_cast<uint8_t*>(&manifest), sizeof(manifest));
+
+	if (manifest.magic != OtaManifest::MAGIC || manifest.status != OtaManifest::PENDING) {
+		return OtaInstall::NONE;
+	}
+	if (ota_crc32_update(0, reinterpret_cast<const uint8_t*>(&manifest), 3 * sizeof(uint32_t)) != manifest.header_crc) {
+		return OtaInstall::NONE;
+	}
+
+	const uint32_t sector = static_cast<uint32_t>(flash.sector_size());
+	const uint32_t image = slot + sector;
+	const uint32_t size = manifest.image_size;
+	const uint32_t sectors = (size + sector - 1) / sector;
+	const uint32_t status_address = slot + offsetof(OtaManifest, status);
+	const uint32_t progress_address = slot + offsetof(OtaManifest, progress);
+
+	uint8_t buffer[OTA_COPY_SIZE];
+
+	bool started = false;
+	for (std::size_t i = 0; i < OtaManifest::PROGRESS_WORDS; ++i) {
+		started = started || manifest.progress[i] != 0xFFFFFFFF;
+	}
+
+	bool valid = size > 0 && size <= target_length && sectors <= OtaManifest::MAX_SECTORS;
+	if (valid && !started) {
+		// Once the copy has started the staged image is the only complete copy left, so it is only checked up front
+		uint32_t crc = 0;
+		for (uint32_t offset = 0; offset < size; offset += OTA_COPY_SIZE) {
+			uint32_t n = (size - offset < OTA_COPY_SIZE) ? size - offset : OTA_COPY_SIZE;
+			flash.read(image + offset, buffer, n);
+			crc = ota_crc32_update(crc, buffer, n);
+		}
+		valid = (crc == manifest.image_crc);
+	}
+	if (!valid) {
+		ota_program_word(flash, status_address, OtaManifest::REJECTED);
+		return OtaInstall::REJECTED;
+	}
+
+	for (uint32_t s = 0; s < sectors; ++s) {
+		uint32_t& word = manifest.progress[s / 32];
+		const uint32_t bit = 1UL << (s % 32);
+		if (!(word & bit)) {
+			continue;
+		}
+
+		flash.erase_sector(target + s * sector);
+		flash.wait_ready();
+
+		for (uint32_t offset = s * sector; offset < (s + 1) * sector && offset < size; offset += OTA_COPY_SIZE) {
+			uint32_t n = (size - offset < OTA_COPY_SIZE) ? size - offset : OTA_COPY_SIZE;
+			flash.read(image + offset, buffer, n);
+			flash.program(target + offset, buffer, n);
+			flash.wait_ready();
+		}
+
+		word &= ~bit;
+		ota_program_word(flash, progress_address + (s / 32) * sizeof(uint32_t), word);
+	}
+
+	ota_program_word(flash, status_address, OtaManifest::INSTALLED);
+	return OtaInstall::INSTALLED;
+}
+
+} // namespace storage
@@ -0,0 +1,166 @@
+#include <storage/ota_writer.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+storage::OtaWriter::OtaWriter(FlashDevice& flash, uint32_t slot, uint32_t slot_length) :
+	flash(flash),
+	slot(slot),
+	slot_length(slot_length),
+	sector_size(static_cast<uint32_t>(flash.sector_size()))
+{}
+
+bool storage::OtaWriter::begin(uint32_t image_size, uint32_t image_crc) {
+	if (image_size == 0 || slot_length < sector_size || image_size > get_capacity() ||
+			(image_size + sector_size - 1) / sector_size > OtaManifest::MAX_SECTORS) {
+		return false;
+	}
+
+	this->image_size = image_size;
+	this->image_crc = image_crc;
+	received = 0;
+	crc.reset();
+
+	filling = 0;
+	fill = 0;
+	pending = false;
+	write_address = sector_size;
+	erased_to = 0;
+	verified = 0;
+
+	state = State::RECEIVING;
+	error = Error::NONE;
+	stats = Stats();
+	return true;
+}
+
+std::size_t storage::OtaWriter::write(const uint8_t* data, std::size_t len) {
+	if (state != State::RECEIVING) {
+		return 0;
+	}
+
+	len = std::min<std::size_t>(len, image_size - received);
+	std::size_t taken = 0;
+	while (taken < len) {
+		if (fill == PAGE) {
+			if (pending) {
+				++stats.stalls;
+				break;
+			}
+			close_page();
+		}
+
+		std::size_t n = std::min(PAGE - fill, len - taken);
+		std::memcpy(pages[filling].data() + fill, data + taken, n);
+		crc.update(data + taken, n);
+		fill += n;
+		taken += n;
+	}
+
+	received += static_cast<uint32_t>(taken);
+	return taken;
+}
+
+std::size_t storage::OtaWriter::get_window() const {
+	if (state != State::RECEIVING) {
+		return 0;
+	}
+
+	std::size_t space = (PAGE - fill) + (pending ? 0 : PAGE);
+	return std::min<std::size_t>(space, image_size - received);
+}
+
+void storage::OtaWriter::poll() {
+	if ((state != State::RECEIVING && state != State::VERIFYING) || flash.is_busy()) {
+		return;
+	}
+
+	if (state == State::VERIFYING) {
+		verify_step();
+		return;
+	}
+
+	if (!pending && (fill == PAGE || (fill > 0 && received == image_size))) {
+		close_page();
+	}
+
+	// Programming the next page comes first since the data is waiting on it; erasing ahead fills the gaps
+	if (pending && pending_address < erased_to) {
+		if (!flash.program(slot + pending_address, pages[1 - filling].data(), PAGE)) {
+			fail(Error::FLASH_ERROR);
+			return;
+		}
+		++stats.pages;
+		pending = false;
+		return;
+	}
+
+	if (erased_to < sector_size + image_size) {
+		if (!flash.erase_sector(slot + erased_to)) {
+			fail(Error::FLASH_ERROR);
+			return;
+		}
+		++stats.erases;
+		erased_to += sector_size;
+		return;
+	}
+
+	if (received == image_size && !pending && fill == 0) {
+		if (crc.value() != image_crc) {
+			fail(Error::CRC_MISMATCH);
+			return;
+		}
+		state = State::VERIFYING;
+		crc.reset();
+	}
+}
+
+void storage::OtaWriter::abort() {
+	if (state == State::RECEIVING || state == State::VERIFYING) {
+		state = State::IDLE;
+	}
+}
+
+void storage::OtaWriter::close_page() {
+	// The last page is padded as if erased
+	std::memset(pages[filling].data() + fill, FlashDevice::ERASED, PAGE - fill);
+
+	pending = true;
+	pending_address = write_address;
+	write_address += PAGE;
+	filling = 1 - filling;
+	fill = 0;
+}
+
+void storage::OtaWriter::verify_step() {
+	if (verified < image_size) {
+		uint8_t buffer[PAGE];
+		uint32_t n = std::min<uint32_t>(PAGE, image_size - verified);
+		flash.read(slot + sector_size + verified, buffer, n);
+		crc.update(buffer, n);
+		verified += n;
+		return;
+	}
+
+	if (crc.value() != image_crc) {
+		fail(Error::VERIFY_FAILED);
+		return;
+	}
+	commit();
+}
+
+void storage::OtaWriter::commit() {
+	uint32_t header[4] = {OtaManifest::MAGIC, image_size, image_crc, 0};
+	header[3] = Crc32::calculate(reinterpret_cast<const uint8_t*>(header), 3 * sizeof(uint32_t));
+
+	if (!flash.program(slot, reinterpret_cast<const uint8_t*>(header), sizeof(header))) {
+		fail(Error::FLASH_ERROR);
+		return;
+	}
+	state = State::DONE;
+}
+
+void storage::OtaWriter::fail(Error e) {
+	error = e;
+	state = State::FAILED;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <embedded_util/crc.hpp>
+#include <embedded_util/safety.hpp>
+
+#include <storage/flash_device.hpp>
+#include <storage/ota_image.hpp>
+
+namespace storage {
+
+/// Writes a firmware image into an update slot as it arrives
+///
+/// Received data is copied into one of two page buffers. While one fills, poll() programs the other, and in between it
+/// erases the slot ahead of the data, so the flash works while the network delivers the next chunk. write() never
+/// waits: it takes what fits and the caller holds on to the rest, which applies back-pressure to the sender.
+///
+/// A running CRC is kept over the received data. Once the last byte is programmed the slot is read back and checked
+/// against the expected CRC, and only then is the manifest written, so a partial or damaged image is never installed.
+/// See ota_image.hpp for the slot layout.
+class OtaWriter {
+	public:
+
+		static constexpr std::size_t PAGE = OTA_COPY_SIZE;
+
+		enum class State : uint8_t {
+			IDLE,
+			RECEIVING,
+			/// Every byte has been received and programmed; the slot is being read back
+			VERIFYING,
+			/// The manifest is written and the update installs on the next boot
+			DONE,
+			FAILED,
+		};
+
+		enum class Error : uint8_t {
+			NONE,
+			/// The data received doesn't match the expected CRC
+			CRC_MISMATCH,
+			/// The slot read back differently from what was received
+			VERIFY_FAILED,
+			/// The flash rejected an operation
+			FLASH_ERROR,
+		};
+
+		struct Stats {
+			uint32_t pages = 0;
+			uint32_t erases = 0;
+			/// Calls to write() that couldn't take all of their data because the flash was behind
+			uint32_t stalls = 0;
+		};
+
+		/// @param slot Offset of the slot in the flash, aligned to a sector
+		/// @param slot_length Size of the slot, including the manifest sector
+		OtaWriter(FlashDevice& flash, uint32_t slot, uint32_t slot_length);
+
+		DISALLOW_COPY_AND_MOVE(OtaWriter);
+
+		/// Start receiving an image, abandoning any update in progress. The slot's manifest is erased first, so an
+		/// update staged earlier won't be installed.
+		/// @param image_crc CRC-32 of the whole image
+		/// @return false if the image doesn't fit in the slot
+		bool begin(uint32_t image_size, uint32_t image_crc);
+
+		/// Take the next bytes of the image
+		/// @return The number of bytes taken, which is less than len if the page buffers are full
+		std::size_t write(const uint8_t* data, std::size_t len);
+
+		/// Program a full page, erase ahead, or check the slot, whichever is due. Returns at once if the flash is busy.
+		void poll();
+
+		/// Give up on the image being received. Nothing is installed.
+		void abort();
+
+		/// Bytes write() would take right now
+		std::size_t get_window() const;
+
+		/// Largest image the slot holds
+		uint32_t get_capacity() const { return slot_length - sector_size; }
+
+		State get_state() const { return state; }
+		Error get_error() const { return error; }
+
+		/// Bytes of the image taken by write()
+		uint32_t get_received() const { return received; }
+		uint32_t get_image_size() const { return image_size; }
+
+		inline const Stats& get_stats() const { return stats; }
+
+	private:
+		/// Hand the page being filled to poll() if it's complete, or if it's the last one
+		void close_page();
+
+		/// Read back one page of the slot
+		void verify_step();
+
+		/// Write the manifest that marks the slot ready to install
+		void commit();
+
+		void fail(Error e);
+
+		FlashDevice& flash;
+		uint32_t slot;
+		uint32_t slot_length;
+		uint32_t sector_size;
+
+		State state = State::IDLE;
+		Error error = Error::NONE;
+
+		uint32_t image_size = 0;
+		uint32_t image_crc = 0;
+		uint32_t received = 0;
+		Crc32 crc;
+
+		std::array<std::array<uint8_t, PAGE>, 2> pages;
+		/// Index of the page being filled; the other one is waiting to be programmed if pending is set
+		std::size_t filling = 0;
+		std::size_t fill = 0;
+		bool pending = false;
+		/// Slot offset of the pending page
+		uint32_t pending_address = 0;
+
+		/// Slot offset the next closed page is programmed at
+		uint32_t write_address = 0;
+		/// Everything in the slot below this offset is erased
+		uint32_t erased_to = 0;
+		/// Offset reached while reading back
+		uint32_t verified = 0;
+
+		Stats stats;
+
+};
+
+} // namespace storage
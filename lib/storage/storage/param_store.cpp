@@ -0,0 +1,395 @@
+#include <storage/param_store.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+#include <embedded_util/crc.hpp>
+
+/// "PSv1" little-endian, marking a sector that belongs to the store
+static constexpr uint32_t SECTOR_MAGIC = 0x31765350;
+
+static constexpr std::size_t SECTOR_HEADER_SIZE = 8;
+static constexpr std::size_t RECORD_HEADER_SIZE = 4;
+
+static uint32_t load_u32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static void store_u32(uint8_t* p, uint32_t value) {
+	p[0] = static_cast<uint8_t>(value);
+	p[1] = static_cast<uint8_t>(value >> 8);
+	p[2] = static_cast<uint8_t>(value >> 16);
+	p[3] = static_cast<uint8_t>(value >> 24);
+}
+
+static uint16_t record_crc(uint8_t key, uint8_t length, const uint8_t* data) {
+	Crc16 crc;
+	const uint8_t header[2] = {key, length};
+	crc.update(header, sizeof(header));
+	crc.update(data, length);
+	return crc.value();
+}
+
+storage::ParamStore::ParamStore(FlashDevice& flash, uint32_t start, uint32_t length) :
+	flash(flash),
+	start(start),
+	sector_size(flash.sector_size()),
+	sector_count(length / flash.sector_size())
+{
+	// A region that doesn't divide into whole sectors is rejected by mount()
+	if (length % sector_size != 0 || start % sector_size != 0) {
+		sector_count = 0;
+	}
+}
+
+std::size_t storage::ParamStore::record_size(std::size_t length) {
+	return RECORD_HEADER_SIZE + ((length + 3) & ~static_cast<std::size_t>(3));
+}
+
+storage::ParamStore::Status storage::ParamStore::mount() {
+	mounted = false;
+	compact_state = CompactState::IDLE;
+	index.fill(IndexEntry());
+	live_bytes = 0;
+
+	if (sector_count < 3 || sector_size < SECTOR_HEADER_SIZE + record_size(MAX_VALUE)) {
+		return Status::FLASH_ERROR;
+	}
+
+	// Sort out which sectors hold records from their headers. Sectors are used in ring order, so the oldest and newest
+	// bound the run of sectors in use.
+	used_sectors = 0;
+	std::size_t oldest = 0;
+	std::size_t newest = 0;
+	uint32_t oldest_sequence = 0;
+
+	for (std::size_t s = 0; s < sector_count; ++s) {
+		uint8_t header[SECTOR_HEADER_SIZE];
+		flash.wait_ready();
+		flash.read(start + sector_address(s), header, sizeof(header));
+
+		uint32_t magic = load_u32(header);
+		uint32_t sequence = load_u32(header + 4);
+		if (magic == SECTOR_MAGIC) {
+			if (used_sectors == 0 || sequence < oldest_sequence) {
+				oldest = s;
+				oldest_sequence = sequence;
+			}
+			if (used_sectors == 0 || sequence > head_sequence) {
+				newest = s;
+				head_sequence = sequence;
+			}
+			++used_sectors;
+		} else if (magic != 0xFFFFFFFF || sequence != 0xFFFFFFFF) {
+			// Left over from something else or a torn erase
+			if (!flash.erase_sector(start + sector_address(s))) {
+				return Status::FLASH_ERROR;
+			}
+			flash.wait_ready();
+			++stats.sectors_recovered;
+		}
+	}
+
+	if (used_sectors == 0) {
+		head_sequence = 0;
+		if (!open_sector(0)) {
+			return Status::FLASH_ERROR;
+		}
+		tail = 0;
+		mounted = true;
+		return Status::OK;
+	}
+
+	tail = oldest;
+	head = newest;
+
+	// Replay the log from oldest to newest so later records replace earlier ones
+	for (std::size_t i = 0; i < used_sectors; ++i) {
+		std::size_t s = (tail + i) % sector_count;
+		uint32_t end = scan_sector(s);
+		if (s == head) {
+			write_address = end;
+		}
+	}
+
+	for (const auto& entry : index) {
+		if (entry.address != 0) {
+			live_bytes += record_size(entry.length);
+		}
+	}
+
+	mounted = true;
+	return Status::OK;
+}
+
+uint32_t storage::ParamStore::scan_sector(std::size_t sector) {
+	const uint32_t end = sector_address(sector) + static_cast<uint32_t>(sector_size);
+	uint32_t address = sector_address(sector) + SECTOR_HEADER_SIZE;
+
+	uint8_t key = 0;
+	uint8_t length = 0;
+	while (address + RECORD_HEADER_SIZE <= end) {
+		uint8_t header[RECORD_HEADER_SIZE];
+		flash.read(start + address, header, sizeof(header));
+		if (load_u32(header) == 0xFFFFFFFF) {
+			return address;
+		}
+
+		if (!read_record(address, key, length)) {
+			// Power was lost while this record was written. Whatever follows can't be trusted, so the rest of the
+			// sector is abandoned.
+			return end;
+		}
+
+		index[key] = (length == 0) ? IndexEntry() : IndexEntry{address, length};
+		++stats.records_scanned;
+		address += static_cast<uint32_t>(record_size(length));
+	}
+
+	return end;
+}
+
+bool storage::ParamStore::read_record(uint32_t address, uint8_t& key, uint8_t& length) {
+	const uint32_t end = (address / sector_size + 1) * sector_size;
+
+	uint8_t header[RECORD_HEADER_SIZE];
+	flash.read(start + address, header, sizeof(header));
+	if (header[0] >= MAX_KEYS || header[1] > MAX_VALUE || address + record_size(header[1]) > end) {
+		return false;
+	}
+
+	uint8_t value[MAX_VALUE];
+	flash.read(start + address + RECORD_HEADER_SIZE, value, header[1]);
+	if (record_crc(header[0], header[1], value) != (header[2] | (header[3] << 8))) {
+		return false;
+	}
+
+	key = header[0];
+	length = header[1];
+	return true;
+}
+
+storage::ParamStore::Status storage::ParamStore::get(uint8_t key, uint8_t* data, std::size_t capacity,
+		std::size_t& length) {
+	if (!mounted) {
+		return Status::NOT_MOUNTED;
+	}
+	if (key >= MAX_KEYS) {
+		return Status::BAD_KEY;
+	}
+
+	const IndexEntry& entry = index[key];
+	if (entry.address == 0) {
+		return Status::NOT_FOUND;
+	}
+
+	length = entry.length;
+	if (capacity < length) {
+		return Status::BAD_LENGTH;
+	}
+
+	flash.wait_ready();
+	flash.read(start + entry.address + RECORD_HEADER_SIZE, data, length);
+	return Status::OK;
+}
+
+storage::ParamStore::Status storage::ParamStore::set(uint8_t key, const uint8_t* data, std::size_t length) {
+	if (!mounted) {
+		return Status::NOT_MOUNTED;
+	}
+	if (key >= MAX_KEYS) {
+		return Status::BAD_KEY;
+	}
+	if (length == 0 || length > MAX_VALUE) {
+		return Status::BAD_LENGTH;
+	}
+
+	// Rewriting an unchanged value would only wear the flash
+	const IndexEntry& entry = index[key];
+	if (entry.address != 0 && entry.length == length) {
+		uint8_t current[MAX_VALUE];
+		flash.wait_ready();
+		flash.read(start + entry.address + RECORD_HEADER_SIZE, current, length);
+		if (std::memcmp(current, data, length) == 0) {
+			return Status::OK;
+		}
+	}
+
+	return append(key, data, length, false);
+}
+
+storage::ParamStore::Status storage::ParamStore::remove(uint8_t key) {
+	if (!mounted) {
+		return Status::NOT_MOUNTED;
+	}
+	if (!contains(key)) {
+		return key < MAX_KEYS ? Status::NOT_FOUND : Status::BAD_KEY;
+	}
+
+	return append(key, nullptr, 0, false);
+}
+
+storage::ParamStore::Status storage::ParamStore::append(uint8_t key, const uint8_t* data, std::size_t length,
+		bool allow_reserve) {
+	const std::size_t size = record_size(length);
+	std::size_t free_sectors = sector_count - used_sectors;
+
+	// Once compaction has taken the reserve, the space left in the head is needed for the records it is moving
+	if (!allow_reserve && free_sectors < RESERVE_SECTORS) {
+		return Status::FULL;
+	}
+
+	if (write_address + size > sector_address(head) + sector_size) {
+		if (free_sectors == 0 || (!allow_reserve && free_sectors <= RESERVE_SECTORS)) {
+			return Status::FULL;
+		}
+		if (!open_sector((head + 1) % sector_count)) {
+			return Status::FLASH_ERROR;
+		}
+	}
+
+	uint8_t record[RECORD_HEADER_SIZE + MAX_VALUE + 3];
+	std::memset(record, FlashDevice::ERASED, size);
+	record[0] = key;
+	record[1] = static_cast<uint8_t>(length);
+	uint16_t crc = record_crc(key, record[1], data);
+	record[2] = static_cast<uint8_t>(crc);
+	record[3] = static_cast<uint8_t>(crc >> 8);
+	if (length > 0) {
+		std::memcpy(record + RECORD_HEADER_SIZE, data, length);
+	}
+
+	if (!program(write_address, record, size)) {
+		return Status::FLASH_ERROR;
+	}
+
+	IndexEntry& entry = index[key];
+	if (entry.address != 0) {
+		live_bytes -= record_size(entry.length);
+	}
+	if (length > 0) {
+		entry = IndexEntry{write_address, static_cast<uint8_t>(length)};
+		live_bytes += size;
+	} else {
+		entry = IndexEntry();
+	}
+
+	write_address += static_cast<uint32_t>(size);
+	++stats.records_written;
+	return Status::OK;
+}
+
+bool storage::ParamStore::open_sector(std::size_t sector) {
+	uint8_t header[SECTOR_HEADER_SIZE];
+	store_u32(header, SECTOR_MAGIC);
+	store_u32(header + 4, head_sequence + 1);
+
+	if (!program(sector_address(sector), header, sizeof(header))) {
+		return false;
+	}
+
+	++head_sequence;
+	head = sector;
+	++used_sectors;
+	write_address = sector_address(sector) + SECTOR_HEADER_SIZE;
+	return true;
+}
+
+bool storage::ParamStore::program(uint32_t address, const uint8_t* data, std::size_t len) {
+	const std::size_t page = flash.page_size();
+
+	while (len > 0) {
+		uint32_t absolute = start + address;
+		std::size_t chunk = std::min(len, page - absolute % page);
+
+		flash.wait_ready();
+		if (!flash.program(absolute, data, chunk)) {
+			return false;
+		}
+
+		address += static_cast<uint32_t>(chunk);
+		data += chunk;
+		len -= chunk;
+	}
+
+	return true;
+}
+
+bool storage::ParamStore::needs_compaction() const {
+	if (!mounted || sector_count - used_sectors > RESERVE_SECTORS) {
+		return false;
+	}
+
+	// Only worth it if a sector's worth can be reclaimed; otherwise the live records would just be rotated around the
+	// ring, wearing the flash without freeing anything
+	std::size_t capacity = sector_size - SECTOR_HEADER_SIZE;
+	std::size_t written = (used_sectors - 1) * capacity + (write_address - sector_address(head) - SECTOR_HEADER_SIZE);
+	return written - live_bytes >= capacity;
+}
+
+std::size_t storage::ParamStore::get_free_space() const {
+	if (!mounted) {
+		return 0;
+	}
+
+	std::size_t free_sectors = sector_count - used_sectors;
+	std::size_t space = sector_address(head) + sector_size - write_address;
+	if (free_sectors > RESERVE_SECTORS) {
+		space += (free_sectors - RESERVE_SECTORS) * (sector_size - SECTOR_HEADER_SIZE);
+	}
+	return space;
+}
+
+void storage::ParamStore::poll() {
+	if (!mounted || flash.is_busy()) {
+		return;
+	}
+
+	compact_step();
+}
+
+void storage::ParamStore::compact_step() {
+	switch (compact_state) {
+		case CompactState::IDLE:
+			if (needs_compaction()) {
+				compact_address = sector_address(tail) + SECTOR_HEADER_SIZE;
+				compact_state = CompactState::COPYING;
+			}
+			break;
+
+		case CompactState::COPYING: {
+			uint8_t key = 0;
+			uint8_t length = 0;
+			const uint32_t end = sector_address(tail) + static_cast<uint32_t>(sector_size);
+
+			if (compact_address + RECORD_HEADER_SIZE > end || !read_record(compact_address, key, length)) {
+				// Every live record has been copied forward, so the sector can go
+				if (flash.erase_sector(start + sector_address(tail))) {
+					compact_state = CompactState::ERASING;
+				}
+				break;
+			}
+
+			// Records that were replaced or removed are simply left behind
+			if (length > 0 && index[key].address == compact_address) {
+				uint8_t value[MAX_VALUE];
+				flash.read(start + compact_address + RECORD_HEADER_SIZE, value, length);
+				if (append(key, value, length, true) != Status::OK) {
+					break;
+				}
+				++stats.records_moved;
+			}
+
+			compact_address += static_cast<uint32_t>(record_size(length));
+			break;
+		}
+
+		case CompactState::ERASING:
+			// poll() only gets here once the erase has finished
+			tail = (tail + 1) % sector_count;
+			--used_sectors;
+			++stats.sectors_erased;
+			compact_state = CompactState::IDLE;
+			break;
+	}
+}
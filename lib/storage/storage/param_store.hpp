@@ -0,0 +1,180 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include <embedded_util/safety.hpp>
+
+#include <storage/flash_device.hpp>
+
+namespace storage {
+
+/// Persistent key/value store kept as an append-only log in a region of flash
+///
+/// Every write appends a new record and the newest record for a key wins, so a value is never erased in place. Sectors
+/// are filled in ring order and the oldest is reclaimed first, which spreads erases evenly over the region.
+///
+/// An index in RAM holds the location of each key's newest record. It is rebuilt by mount() in one sequential scan,
+/// after which reads go straight to the record. Reclaiming space is done a step at a time by poll(): the live records
+/// in the oldest sector are copied to the head of the log, then the sector is erased.
+///
+/// Region layout: each sector starts with a header (magic, sequence number) and is followed by records:
+/// - uint8 key, uint8 value length (0 removes the key), uint16 CRC-16/CCITT of the key, length and value
+/// - the value, padded with 0xFF to a multiple of 4 bytes
+///
+/// A record whose CRC fails (ex. power was lost while it was written) ends the scan of its sector, and nothing more is
+/// appended to that sector.
+class ParamStore {
+	public:
+
+		/// Keys are in [0, MAX_KEYS)
+		static constexpr std::size_t MAX_KEYS = 64;
+
+		/// Longest value that can be stored
+		static constexpr std::size_t MAX_VALUE = 128;
+
+		/// Sectors kept erased so the oldest sector can always be compacted
+		static constexpr std::size_t RESERVE_SECTORS = 1;
+
+		enum class Status : uint8_t {
+			OK,
+			NOT_FOUND,
+			/// The value is longer than MAX_VALUE or a buffer is too small for it
+			BAD_LENGTH,
+			BAD_KEY,
+			/// No space until compaction frees a sector; call poll() and try again
+			FULL,
+			/// The region is too small, not sector aligned, or the flash rejected an operation
+			FLASH_ERROR,
+			/// mount() hasn't succeeded
+			NOT_MOUNTED,
+		};
+
+		struct Stats {
+			/// Records read while mounting
+			uint32_t records_scanned = 0;
+			/// Sectors that were unreadable at mount and had to be erased
+			uint32_t sectors_recovered = 0;
+			uint32_t records_written = 0;
+			/// Live records copied forward by compaction
+			uint32_t records_moved = 0;
+			uint32_t sectors_erased = 0;
+		};
+
+		/// @param flash Device holding the region
+		/// @param start Offset of the region in the device, aligned to a sector
+		/// @param length Size of the region, a multiple of the sector size and at least 3 sectors
+		ParamStore(FlashDevice& flash, uint32_t start, uint32_t length);
+
+		DISALLOW_COPY_AND_MOVE(ParamStore);
+
+		/// Find the newest record of each key, erasing sectors that don't belong to the store
+		Status mount();
+
+		/// Copy a value
+		/// @param length Set to the length of the value
+		Status get(uint8_t key, uint8_t* data, std::size_t capacity, std::size_t& length);
+
+		/// Read a value that was stored with set(key, const T&). The stored length must match.
+		template<typename T>
+		Status get(uint8_t key, T& value) {
+			static_assert(std::is_trivially_copyable_v<T>, "ParamStore: values must be trivially copyable");
+			std::size_t length = 0;
+			Status status = get(key, reinterpret_cast<uint8_t*>(&value), sizeof(T), length);
+			return (status == Status::OK && length != sizeof(T)) ? Status::BAD_LENGTH : status;
+		}
+
+		/// Append a new value for key. Waits for any flash operation in progress.
+		Status set(uint8_t key, const uint8_t* data, std::size_t length);
+
+		template<typename T>
+		Status set(uint8_t key, const T& value) {
+			static_assert(std::is_trivially_copyable_v<T>, "ParamStore: values must be trivially copyable");
+			return set(key, reinterpret_cast<const uint8_t*>(&value), sizeof(T));
+		}
+
+		Status remove(uint8_t key);
+
+		bool contains(uint8_t key) const { return key < MAX_KEYS && index[key].address != 0; }
+
+		/// Do one step of compaction if it's needed and the flash is idle. Each step programs one record or starts one
+		/// sector erase, so it's cheap enough to call from a main loop.
+		void poll();
+
+		/// True if the store is running low on erased sectors and poll() has work to do
+		bool needs_compaction() const;
+
+		/// Bytes that can still be appended without compaction, not counting the reserve
+		std::size_t get_free_space() const;
+
+		inline const Stats& get_stats() const { return stats; }
+
+	private:
+		struct IndexEntry {
+			/// Region offset of the record, or 0 if the key is absent (offset 0 is always a sector header)
+			uint32_t address = 0;
+			uint8_t length = 0;
+		};
+
+		enum class CompactState : uint8_t {
+			IDLE,
+			COPYING,
+			ERASING,
+		};
+
+		/// Space taken by a record with a value of the given length
+		static std::size_t record_size(std::size_t length);
+
+		uint32_t sector_address(std::size_t sector) const { return static_cast<uint32_t>(sector * sector_size); }
+
+		/// Scan the records of one sector into the index and return the offset after the last valid one
+		uint32_t scan_sector(std::size_t sector);
+
+		/// Read the record header at address
+		/// @return false if there is no valid record there
+		bool read_record(uint32_t address, uint8_t& key, uint8_t& length);
+
+		/// Write a record at the head of the log, moving to the next sector if it doesn't fit
+		/// @param allow_reserve Let the record use the reserved sector (only for compaction)
+		Status append(uint8_t key, const uint8_t* data, std::size_t length, bool allow_reserve);
+
+		/// Start a new head sector
+		bool open_sector(std::size_t sector);
+
+		/// Program a buffer, splitting it at page boundaries
+		bool program(uint32_t address, const uint8_t* data, std::size_t len);
+
+		/// Advance the compaction state machine by one step
+		void compact_step();
+
+		FlashDevice& flash;
+		uint32_t start;
+		std::size_t sector_size;
+		std::size_t sector_count;
+
+		std::array<IndexEntry, MAX_KEYS> index;
+
+		bool mounted = false;
+
+		/// Oldest and newest sectors in use
+		std::size_t tail = 0;
+		std::size_t head = 0;
+		std::size_t used_sectors = 0;
+		/// Sequence number of the head sector
+		uint32_t head_sequence = 0;
+		/// Region offset where the next record goes
+		uint32_t write_address = 0;
+		/// Space taken by the newest record of each key, the rest of the log being reclaimable
+		std::size_t live_bytes = 0;
+
+		CompactState compact_state = CompactState::IDLE;
+		/// Region offset of the next record of the tail sector to consider for copying
+		uint32_t compact_address = 0;
+
+		Stats stats;
+
+};
+
+} // namespace storage
@@ -1,20 +1,55 @@
 #include "cpu.hpp"
 
+#include <hifive1b_bsp/idle.hpp>
+
 #define CPU_FREQ 320000000
 #define PLLR_2 1
 #define PLLQ_2 1
 
+// Sleeps on mtime for the functions below, which have no board driver
+static hifive1b::Idle idle;
+
 uint32_t cpu_freq(void)
 {
     return CPU_FREQ;
 }
 
-void delay(uint32_t counter)
+void delay_us(uint32_t us)
+{
+    idle.delay_us(us);
+}
+
+void wait_for_input(uint32_t pin)
+{
+    idle.wait_for_pin(pin, true);
+}
+
+// The CLINT's mtime counts the 32.768 kHz real-time clock
+#define MTIME_LO        *(volatile uint32_t*)0x0200BFF8
+#define MTIME_HI        *(volatile uint32_t*)0x0200BFFC
+
+uint64_t mtime(void)
+{
+    uint32_t hi, lo;
+
+    // Re-read if the low word rolled over between the two reads
+    do {
+        hi = MTIME_HI;
+        lo = MTIME_LO;
+    } while (hi != MTIME_HI);
+
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint32_t millis(void)
 {
-    volatile uint32_t i = 0;
-    while (i < counter) {
-        i++;
-    }
+    return (uint32_t)((mtime() * 1000U) >> 15);
+}
+
+uint32_t micros(void)
+{
+    // mtime counts at 32768 Hz, and 1000000 / 32768 = 15625 / 512
+    return (uint32_t)((mtime() * 15625U) >> 9);
 }
 
 // METAL_SIFIVE_FE310_G000_PRCI_10008000_BASE_ADDRESS is defined in
@@ -46,8 +81,10 @@ void cpu_clock_init(void)
     // PLLBYPASS_I = 0 : Enables PLL
     PLLCFG = cfg_temp;
 
-    delay(1000);
+    delay_us(100);                        // The lock signal isn't stable for up to 100 us
 
     while ( PLLCFG & BITS(PLLLOCK_I, 1) == 0) {} // Wait until PLL locks
-    PLLCFG |= BITS(PLLSEL_I, 1);          // Let PLL drive hfclk
+    PLLCFG = PLLCFG | BITS(PLLSEL_I, 1);          // Let PLL drive hfclk
+
+    idle.calibrate();                     // Short delays count cycles of the new clock
 }
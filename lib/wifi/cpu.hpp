@@ -5,7 +5,11 @@
 #include <embedded_util/clock.hpp>
 
 uint32_t cpu_freq(void);
-void delay(uint32_t counter);
+void delay_us(uint32_t us);
+void wait_for_input(uint32_t pin);
+uint64_t mtime(void);
+uint32_t millis(void);
+uint32_t micros(void);
 void cpu_clock_init(void);
 
 class FixedCoreClock : public Clock {
@@ -0,0 +1,89 @@
+#include "esp32_spi_port.hpp"
+
+#include "cpu.hpp"
+
+#define INPUT_VAL   *(volatile uint32_t*)0x10012000
+#define HIGH_IE     *(volatile uint32_t*)0x10012028
+#define HIGH_IP     *(volatile uint32_t*)0x1001202C
+
+#define BIT_MASK(bit) (1UL<<(bit))
+
+#define HS_PIN HANDSHAKE_PIN
+
+Esp32SpiPort::Esp32SpiPort(hifive1b::SpiDriver& spi) :
+    spi(spi)
+{
+    // The SPI1 pins and the handshake input are set up by the board's pin
+    // mux (HIFIVE1B_PINS)
+    spi.select_chip(2);
+}
+
+void Esp32SpiPort::transfer(const uint8_t* tx, uint8_t* rx, std::size_t len)
+{
+    // Each protocol phase is one chip select assertion; leaving HOLD mode releases it
+    spi.set_chip_select_mode(hifive1b::SpiDriver::ChipSelectMode::HOLD);
+    spi.transfer(tx, rx, len);
+    spi.set_chip_select_mode(hifive1b::SpiDriver::ChipSelectMode::AUTO);
+}
+
+void Esp32SpiPort::transfer_partial(const uint8_t* tx, uint8_t* rx, std::size_t len)
+{
+    // Stays in HOLD mode until transfer() finishes the phase
+    spi.set_chip_select_mode(hifive1b::SpiDriver::ChipSelectMode::HOLD);
+    spi.transfer(tx, rx, len);
+}
+
+bool Esp32SpiPort::handshake()
+{
+    return (INPUT_VAL & BIT_MASK(HS_PIN)) != 0;
+}
+
+uint32_t Esp32SpiPort::set_clock(uint32_t hz)
+{
+    spi.set_baud_rate(hz);
+    return spi.get_baud_rate();
+}
+
+uint32_t Esp32SpiPort::now_us()
+{
+    return micros();
+}
+
+void Esp32SpiPort::set_handshake_interrupt(bool enable)
+{
+    if (enable) {
+        HIGH_IE = HIGH_IE | BIT_MASK(HS_PIN);
+    } else {
+        // The pending bit latches, so clear it or the next sleep would end at once
+        HIGH_IE = HIGH_IE & ~BIT_MASK(HS_PIN);
+        HIGH_IP = BIT_MASK(HS_PIN);
+    }
+}
+
+Task<> Esp32SpiPort::transfer_async(const uint8_t* tx, uint8_t* rx, std::size_t len)
+{
+    spi.set_chip_select_mode(hifive1b::SpiDriver::ChipSelectMode::HOLD);
+    co_await spi.transfer_async(tx, rx, len);
+    spi.set_chip_select_mode(hifive1b::SpiDriver::ChipSelectMode::AUTO);
+}
+
+Task<bool> Esp32SpiPort::handshake_async(uint32_t timeout)
+{
+    // The pending bit follows the level, so if the handshake is already
+    // high the interrupt is taken as soon as it's enabled
+    handshake_done.reset();
+    HIGH_IP = BIT_MASK(HS_PIN);
+    HIGH_IE = HIGH_IE | BIT_MASK(HS_PIN);
+
+    bool raised = co_await handshake_done.wait_for(timeout);
+    if (!raised) {
+        set_handshake_interrupt(false);
+    }
+    co_return raised;
+}
+
+void Esp32SpiPort::handle_handshake_interrupt()
+{
+    set_handshake_interrupt(false);
+    handshake_done.complete();
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <embedded_util/coroutine.hpp>
+#include <esp32_at/spi_port.hpp>
+
+#include <hifive1b_bsp/idle.hpp>
+#include <hifive1b_bsp/spi_driver.hpp>
+
+/// Connection to the onboard ESP32: SPI1 with chip select 2, and the handshake on GPIO 10
+///
+/// GPIO 3 = SPI1 MOSI, GPIO 4 = SPI1 MISO, GPIO 5 = SPI1 SCK, GPIO 9 = SPI1 CS2, GPIO 10 = WF INT (handshake)
+class Esp32SpiPort : public esp32::SpiPort {
+	public:
+		/// @param spi Driver for SPI1, which must already be initialized
+		explicit Esp32SpiPort(hifive1b::SpiDriver& spi);
+
+		void transfer(const uint8_t* tx, uint8_t* rx, std::size_t len) override;
+		void transfer_partial(const uint8_t* tx, uint8_t* rx, std::size_t len) override;
+		bool handshake() override;
+		uint32_t set_clock(uint32_t hz) override;
+		uint32_t now_us() override;
+
+		/// Sleep until the ESP32 raises the handshake, something else being waited for happens, or the deadline
+		/// @param also Returns true once the other event has happened
+		/// @param sources PLIC sources that signal the other event (see Idle::wait())
+		/// @return false if the deadline passed first
+		template<typename Condition>
+		bool sleep_until(hifive1b::Idle& idle, uint64_t deadline, Condition&& also, uint64_t sources) {
+			set_handshake_interrupt(true);
+			bool woke = idle.wait([this, &also] { return handshake() || also(); },
+				sources | hifive1b::Idle::gpio_source(HANDSHAKE_PIN), deadline);
+			set_handshake_interrupt(false);
+			return woke;
+		}
+
+		/// Exchange one phase in the background. SPI1's PLIC source must be routed to SpiDriver::handle_interrupt().
+		Task<> transfer_async(const uint8_t* tx, uint8_t* rx, std::size_t len);
+
+		/// Wait for the ESP32 to raise the handshake. Its PLIC source must be routed to handle_handshake_interrupt().
+		/// @param timeout In ticks of the executor's timestamp
+		/// @return false if the timeout passed first
+		Task<bool> handshake_async(uint32_t timeout);
+
+		/// Finish handshake_async(). Call from the GPIO interrupt handler.
+		void handle_handshake_interrupt();
+
+		/// PLIC source of the handshake pin's interrupt. GPIO pin n is source 8 + n.
+		static constexpr uint32_t HANDSHAKE_SOURCE = 8 + 10;
+
+	private:
+		static constexpr uint32_t HANDSHAKE_PIN = 10;
+
+		/// Enable or disable the GPIO interrupt for the handshake being high, clearing it when disabled
+		void set_handshake_interrupt(bool enable);
+
+		hifive1b::SpiDriver& spi;
+		Completion<> handshake_done;
+};
@@ -6,12 +6,12 @@
 
 void LED_on(led_t led)
 {
-    GPIO_OUTPUT_EN |= (uint32_t)led;
+    GPIO_OUTPUT_EN = GPIO_OUTPUT_EN | (uint32_t)led;
 }
 
 void LED_off(led_t led)
 {
-    GPIO_OUTPUT_EN &= ~(uint32_t)led;
+    GPIO_OUTPUT_EN = GPIO_OUTPUT_EN & ~(uint32_t)led;
 }
 
 void LED_toggle(led_t led)
@@ -24,15 +24,14 @@ https://www.espressif.com/sites/default/files/documentation/esp32_technical_refe
 
 #include <cstdint>
 #include <cstring>
-#include <cstdio>
+
+#include <embedded_util/format.hpp>
+#include <hifive1b_bsp/freedom_logger.hpp>
 
 #include "cpu.hpp"
 
 
-#define IOF_EN      *(volatile uint32_t*)0x10012038
-#define IOF_SEL     *(volatile uint32_t*)0x1001203C
 #define INPUT_VAL   *(volatile uint32_t*)0x10012000
-#define INPUT_EN    *(volatile uint32_t*)0x10012004
 
 #define SPI1_FMT    *(volatile uint32_t*)0x10024040
 #define PROTO_I     0U
@@ -51,24 +50,20 @@ https://www.espressif.com/sites/default/files/documentation/esp32_technical_refe
 #define BITS(idx, val)  ((val) << (idx))
 
 #define BIT_MASK(bit) (1UL<<(bit))
-#define SPI_DELAY 100
-#define SPI_DELAY_LONG 10000
+#define SPI_DELAY_US 5
+#define SPI_DELAY_LONG_US 200
 
 #define HS_PIN 10
-#define SPI1_DQ0_MOSI 3
-#define SPI1_DQ1_MISO 4
-#define SPI1_SCK 5
-#define SPI1_CS2 9
 
 #define CS_AUTO 0
 #define CS_HOLD 2
 #define CS_OFF  3
 
-#define IOF_SPI_ENABLE (BIT_MASK(SPI1_DQ0_MOSI) | BIT_MASK(SPI1_DQ1_MISO) | BIT_MASK(SPI1_SCK)| BIT_MASK(SPI1_CS2))
+// Per-phase logging of SPI transfers, which can be turned off with spi_trace(). The format string is checked at
+// compile time (see format::write), and the console is unbuffered so each line is out before the wait that follows.
+#define SPI_TRACE(FORMAT, ...) do { if (trace) { format::write<FORMAT>(console __VA_OPT__(,) __VA_ARGS__); } } while (0)
 
-#ifdef __ICCRISCV__
-#define fflush(a)
-#endif
+static MetalUartStream console;
 
 static uint32_t handshake_ready(void);
 static uint8_t spi_rxdata_read(void);
@@ -77,13 +72,13 @@ static void spi_xfer_recv_header(void);
 static void spi_xfer_recv_length(uint32_t len);
 
 static trans_t transparent;    // 0: Disabled, 1: Enabled, 2: Ending
+static bool trace = true;
 
 //----------------------------------------------------------------------
 void spi_init(uint32_t spi_clock)
 {
-    IOF_EN &= ~BIT_MASK(HS_PIN);    // Make sure Handshake pin is GPIO
-    INPUT_EN |= BIT_MASK(HS_PIN);   // Handshake pin is input on master
-    
+    // The SPI1 pins and the handshake input are set up by the board's pin
+    // mux (HIFIVE1B_PINS)
     SPI1_FCTRL = 0;                 // 1:SPI flash mode, 0:programmed I/O mode
 
     // PROTO_I = 0  : SPI single mode
@@ -97,25 +92,13 @@ void spi_init(uint32_t spi_clock)
 
     // Set SPI clock
     SPI1_SCKDIV = (cpu_freq() / (2UL * spi_clock)) - 1UL;
-    delay(SPI_DELAY);
-    
-    // Select HW I/O function 0 (IOF0) for all pins. 
-    // IOF0 means SPI mode for GPIO pins 2-10.
-    IOF_SEL = 0;
-    
-    printf("[+] Enabling IOF/SPI pins...");
-    delay(SPI_DELAY);
-
-    // Enable IOF for pin 3,4,5,9 (don't touch other pins)
-    IOF_EN |= IOF_SPI_ENABLE;
-    
-    printf("DONE\r\n");
+    delay_us(SPI_DELAY_US);
 }
 
 //----------------------------------------------------------------------
 static void cs_deassert(void)
 {
-    delay(SPI_DELAY_LONG);          // Wait for CS to AUTO deassert
+    delay_us(SPI_DELAY_LONG_US);    // Wait for CS to AUTO deassert
 }
 
 //----------------------------------------------------------------------
@@ -149,7 +132,7 @@ static void spi_xfer_recv_header(void)
 {
     const uint8_t at_flag_buf[] = {0x02, 0x00, 0x00, 0x00};
 
-    printf(" | spi_xfer_recv_header: sending: %02x %02x %02x %02x\r\n",
+    SPI_TRACE(" | spi_xfer_recv_header: sending: {:02x} {:02x} {:02x} {:02x}\r\n",
            at_flag_buf[0], at_flag_buf[1], at_flag_buf[2], at_flag_buf[3]);
     
     for (uint32_t i = 0; i < 4; i++) {
@@ -159,10 +142,9 @@ static void spi_xfer_recv_header(void)
     }
     
     cs_deassert();
-    printf(" | Waiting for handshake pin ready...");
-    fflush(stdout);
-    while (!handshake_ready()) {}
-    printf("DONE\r\n");
+    SPI_TRACE(" | Waiting for handshake pin ready...");
+    wait_for_input(HS_PIN);
+    SPI_TRACE("DONE\r\n");
 }
 
 //----------------------------------------------------------------------
@@ -176,7 +158,7 @@ static void spi_xfer_recv_length(uint32_t len)
     len_buf[0] = len & 127;
     len_buf[1] = len >> 7;
     
-    printf(" | spi_send length: sending: (%u) %02x %02x %02x %02x\r\n",
+    SPI_TRACE(" | spi_send length: sending: ({}) {:02x} {:02x} {:02x} {:02x}\r\n",
            (len_buf[1] << 7) + len_buf[0], len_buf[0], len_buf[1], len_buf[2], len_buf[3]);
 
     for (uint32_t i = 0; i < 4; i++) {
@@ -186,10 +168,9 @@ static void spi_xfer_recv_length(uint32_t len)
     }
 
     cs_deassert();    
-    printf(" | Waiting for handshake pin ready...");
-    fflush(stdout);
-    while (!handshake_ready()) {}
-    printf("DONE\r\n");
+    SPI_TRACE(" | Waiting for handshake pin ready...");
+    wait_for_input(HS_PIN);
+    SPI_TRACE("DONE\r\n");
 }
 
 //----------------------------------------------------------------------
@@ -205,13 +186,13 @@ void spi_send(const char *str_p)
         transparent = TRANS_OFF;
     }
 
-    printf("[+] spi_send: %s", str_p);
+    SPI_TRACE("[+] spi_send: {}", str_p);
     
     if (strcmp(str_p, "AT+CIPSEND\r\n") == 0) {
-        printf(" | -- Transparent mode ENABLED. End with \"+++\"\r\n");
+        SPI_TRACE(" | -- Transparent mode ENABLED. End with \"+++\"\r\n");
         transparent = TRANS_ON;
     } else if (strcmp(str_p, "+++\r\n") == 0) {
-        printf(" | -- Transparent mode DISABLED --\r\n");
+        SPI_TRACE(" | -- Transparent mode DISABLED --\r\n");
         transparent = TRANS_ENDING; // End transparent mode next transfer
         len = 3; // CR+LF bytes must not be sent with +++
     }
@@ -223,14 +204,14 @@ void spi_send(const char *str_p)
     spi_xfer_recv_length(len);
 
     // 3. Send the actual data
-    printf(" | spi_send data: sending:\r\n");
+    SPI_TRACE(" | spi_send data: sending:\r\n");
     for (uint32_t i = 0; i < len; i++) {
         if (i && (i%8==0)) {
-            printf("\r\n");
+            SPI_TRACE("\r\n");
         }
-        printf(" %02x", str_p[i]);
+        SPI_TRACE(" {:02x}", static_cast<uint8_t>(str_p[i]));
     }
-    printf("\r\n");
+    SPI_TRACE("\r\n");
     
     for (uint32_t i = 0; i < len; i++) {
         while (SPI1_TXDATA > 0xFF) {} // full bit set, wait
@@ -241,10 +222,9 @@ void spi_send(const char *str_p)
     cs_deassert();
 
     if (transparent == TRANS_OFF) {
-        printf(" | Waiting for handshake pin ready...");
-        fflush(stdout);
-        while (!handshake_ready()) {}
-        printf("DONE\r\n");
+        SPI_TRACE(" | Waiting for handshake pin ready...");
+            wait_for_input(HS_PIN);
+        SPI_TRACE("DONE\r\n");
     }
 }
 
@@ -256,7 +236,7 @@ static void spi_xfer_send_header(void)
 {
     const uint8_t at_flag_buf[] = {0x01, 0x00, 0x00, 0x00};
 
-    printf("[+] spi_xfer_send_header: sending: %02x %02x %02x %02x\r\n", 
+    SPI_TRACE("[+] spi_xfer_send_header: sending: {:02x} {:02x} {:02x} {:02x}\r\n",
            at_flag_buf[0], at_flag_buf[1], at_flag_buf[2], at_flag_buf[3]);
     
     for (uint32_t i = 0; i < 4; i++) {
@@ -266,10 +246,9 @@ static void spi_xfer_send_header(void)
     }
     
     cs_deassert();
-    printf(" | Waiting for handshake pin ready...");
-    fflush(stdout);
-    while (!handshake_ready()) {}
-    printf("DONE\r\n");
+    SPI_TRACE(" | Waiting for handshake pin ready...");
+    wait_for_input(HS_PIN);
+    SPI_TRACE("DONE\r\n");
 }
 
 //----------------------------------------------------------------------
@@ -294,11 +273,10 @@ void spi_recv(char *str_p, uint32_t len)
 
         data_len = (len_buf[1] << 7) + len_buf[0];
         cs_deassert();
-        printf(" | spi_recv length: %u, %c\r\n", data_len, len_buf[3]);
-        printf(" | Waiting for handshake pin ready...");
-        fflush(stdout);
-        while (!handshake_ready()) {}
-        printf("DONE\r\n");
+        SPI_TRACE(" | spi_recv length: {}, {:c}\r\n", data_len, len_buf[3]);
+        SPI_TRACE(" | Waiting for handshake pin ready...");
+            wait_for_input(HS_PIN);
+        SPI_TRACE("DONE\r\n");
        
         // 3. Get the actual data
         for (uint32_t i = 0; i < data_len && i < len; i++) {
@@ -320,11 +298,82 @@ void spi_recv(char *str_p, uint32_t len)
         }
         
         cs_deassert();
-        printf(" | -- ESP32 ----> %s", (data_len > 2) ? str_p : "\r\n");
+        SPI_TRACE(" | -- ESP32 ----> {}", (data_len > 2) ? str_p : "\r\n");
         // Read data until handshake is not ready anymore
     } while (handshake_ready()); 
 }
 
+//----------------------------------------------------------------------
+// Send a buffer of known length to the ESP32 (no string handling)
+//----------------------------------------------------------------------
+void spi_send_data(const char *data_p, uint32_t len)
+{
+    spi_xfer_recv_header();
+    spi_xfer_recv_length(len);
+
+    for (uint32_t i = 0; i < len; i++) {
+        while (SPI1_TXDATA > 0xFF) {} // full bit set, wait
+        SPI1_TXDATA = data_p[i];
+        spi_rxdata_read();
+    }
+
+    cs_deassert();
+}
+
+//----------------------------------------------------------------------
+// Returns 1 if the ESP32 is signalling that it is ready for a transfer
+//----------------------------------------------------------------------
+uint32_t spi_ready(void)
+{
+    return handshake_ready();
+}
+
+//----------------------------------------------------------------------
+// Receive one data phase from the ESP32 without modifying it.
+// Returns the number of bytes stored in str_p, which may be 0.
+//----------------------------------------------------------------------
+uint32_t spi_recv_chunk(char *str_p, uint32_t len)
+{
+    uint8_t len_buf[] = {0x00, 0x00, 0x00, 0x00};
+    uint32_t data_len = 0;
+
+    spi_xfer_send_header();
+
+    for (uint32_t i = 0; i < 4; i++) {
+        while (SPI1_TXDATA > 0xFF) {} // full bit set, wait
+        SPI1_TXDATA = 0x00;
+        len_buf[i] = spi_rxdata_read();
+    }
+
+    data_len = (len_buf[1] << 7) + len_buf[0];
+    cs_deassert();
+
+    if (data_len == 0) {
+        return 0;
+    }
+    wait_for_input(HS_PIN);
+
+    for (uint32_t i = 0; i < data_len; i++) {
+        while (SPI1_TXDATA > 0xFF) {} // full bit set, wait
+        SPI1_TXDATA = 0x00;
+        uint8_t c = spi_rxdata_read();
+        if (i < len) {
+            str_p[i] = c;
+        }
+    }
+
+    cs_deassert();
+    return (data_len < len) ? data_len : len;
+}
+
+//----------------------------------------------------------------------
+// Enable or disable logging of every transfer phase
+//----------------------------------------------------------------------
+void spi_trace(bool enable)
+{
+    trace = enable;
+}
+
 //----------------------------------------------------------------------
 // Returns 1 if transparent transmission is enabled. 0 if not.
 //----------------------------------------------------------------------
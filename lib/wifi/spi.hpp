@@ -12,4 +12,8 @@ typedef enum trans_e
 void spi_init(uint32_t spi_clock);
 void spi_send(const char *str_p);
 void spi_recv(char *str_p, uint32_t len);
+void spi_send_data(const char *data_p, uint32_t len);
+uint32_t spi_recv_chunk(char *str_p, uint32_t len);
+uint32_t spi_ready(void);
+void spi_trace(bool enable);
 trans_t spi_transparent(void);
@@ -5,35 +5,33 @@
 
 #include <embedded_util/clock.hpp>
 
-#define IOF_EN          *(volatile uint32_t*)0x10012038
-#define IOF_SEL         *(volatile uint32_t*)0x1001203C
-
 #define UART0_TXDATA    *(volatile uint32_t*)0x10013000
 #define UART0_RXDATA    *(volatile uint32_t*)0x10013004
 #define UART0_TXCTRL    *(volatile uint32_t*)0x10013008
 #define UART0_RXCTRL    *(volatile uint32_t*)0x1001300C
+#define UART0_IE        *(volatile uint32_t*)0x10013010
+#define UART0_IP        *(volatile uint32_t*)0x10013014
 #define UART0_DIV       *(volatile uint32_t*)0x10013018
 
 #define UART_TXEN_I     0U
 #define UART_RXEN_I     0U
+#define UART_RXWM_I     1U
 
 #define BIT_MASK(bit) (1UL<<(bit))
-#define UART0_RX    16
-#define UART0_TX    17
-#define IOF_UART_ENABLE (BIT_MASK(UART0_RX) | BIT_MASK(UART0_TX))
 
 void uart_init(uint32_t baudrate, Clock& bus_clock)
 {
-    // Select HW I/O function 0 (IOF0) for all pins. 
-    // IOF0 means UART mode for GPIO pins 16-17.
-    IOF_SEL = 0;
-
-    IOF_EN |= IOF_UART_ENABLE;
+    // Pins 16-17 are connected to UART0 by the board's pin mux (HIFIVE1B_PINS)
     UART0_TXCTRL = 0;
     UART0_RXCTRL = 0;
     UART0_DIV = bus_clock.get_frequency().count() / baudrate - 1UL;
     UART0_TXCTRL = BIT_MASK(UART_TXEN_I);
     UART0_RXCTRL = BIT_MASK(UART_RXEN_I);
+
+    // Raise the receive watermark interrupt whenever a character is waiting
+    // (rxcnt = 0) so a sleeping core wakes up for typed input. It only
+    // reaches the core while a wait has it enabled in the PLIC.
+    UART0_IE = BIT_MASK(UART_RXWM_I);
 }
 
 void uart_send(const char *str_p)
@@ -64,3 +62,14 @@ int uart_getchar(void)
         }
     } // Loop as long empty bit is set
 }
+
+int uart_rx_ready(void)
+{
+    return (UART0_IP & BIT_MASK(UART_RXWM_I)) != 0;
+}
+
+int uart_poll_char(void)
+{
+    uint32_t c = UART0_RXDATA;  // Read the RX register EXACTLY once
+    return (c <= 0xFF) ? (int)c : -1;
+}
@@ -2,36 +2,76 @@
 #include <cstdint>
 #include <cstring>
 
+#include <embedded_util/format.hpp>
 #include <hifive1b_bsp/device_driver.hpp>
+#include <hifive1b_bsp/xip_flash.hpp>
 
+#include <esp32_at/at_client.hpp>
+#include <esp32_at/control_uplink.hpp>
+#include <esp32_at/link_supervisor.hpp>
+#include <esp32_at/ota_session.hpp>
+#include <esp32_at/socket_layer.hpp>
+#include <esp32_at/spi_link.hpp>
+#include <esp32_at/telemetry.hpp>
+#include <esp32_at/telemetry_downlink.hpp>
+
+#include <storage/blackbox.hpp>
+#include <storage/ota_writer.hpp>
+#include <storage/param_store.hpp>
+
+#include "esp32_spi_port.hpp"
 #include "uart.hpp"
 #include "cpu.hpp"
-#include "spi.hpp"
 #include "led.hpp"
 
 #define DELAY           20000000
 #define BAUDRATE_115200 115200
-#define SPICLOCK_80KHZ  80000
-#define STR_LEN         256
-#define BUF_LEN         2048
-#ifdef __ICCRISCV__
-#define fflush(a)
-#endif
 
 static char *tty_gets(char *str_p, uint32_t size);
 static void get_ssid_pwd(char *ssid, char *pwd, uint32_t size);
+static bool tty_poll_line(char *str_p, uint32_t size);
+static void submit_interactive_command(esp32::AtClient& client, PbufRef cmd);
+static void print_link_stats(const esp32::SpiLink& link, const esp32::LinkSupervisor& supervisor);
+static void sample_telemetry(esp32::TelemetryDownlink& downlink, const esp32::SpiLink& link);
+static void print_telemetry_stats(const esp32::TelemetryDownlink& downlink);
+static void submit_control_listen(esp32::AtClient& client, const char *host, unsigned port);
+static void print_control_stats(const esp32::ControlUplink& uplink);
+static bool load_string(storage::ParamStore& params, uint8_t key, char *str, std::size_t size);
+static void submit_join(esp32::AtClient& client, const char *ssid, const char *pwd);
+
+// Control channels recorded to flash once per millisecond while the black box is on
+using Blackbox = storage::BlackboxRecorder<esp32::ControlUplink::CHANNELS>;
+static void record_control(Blackbox& blackbox, const esp32::ControlUplink& uplink, uint32_t now_us);
+static void print_blackbox_stats(const Blackbox& blackbox);
+static void print_ota_progress(const esp32::OtaSession& ota);
+static void sleep_until_next_ms(hifive1b::Idle& idle, Esp32SpiPort& port);
+static void print_idle_stats(hifive1b::Idle& idle);
+
+// Keys of the values kept in the parameter store
+enum : uint8_t {
+    PARAM_WIFI_SSID = 0,
+    PARAM_WIFI_PWD = 1,
+};
+
+// Shared by SPI receive, the AT parser and typed commands so data is used where it lands instead of being copied
+// between dedicated buffers
+static StaticPbufPool<128, 16> pbuf_pool;
 
-static const uint32_t interactive = 1; // Set to 0 to use hardcoded SSID and pwd
-static char wifi_ssid[STR_LEN] = "AndroidAPDE9B";
-static char wifi_pwd[STR_LEN] = "isll3425";
-static char at_cmd[STR_LEN*2];
-static char recv_str[BUF_LEN];
+// Set while the ESP32 is in transparent transmission mode (after AT+CIPSEND with AT+CIPMODE=1)
+static bool transparent = false;
+
+// Link health channels: SPI clock (kHz), goodput (bytes/s), transactions, errors
+static esp32::TelemetryBatcher<4> telemetry;
+
+// Output goes through the compile-time checked formatter, and commands are parsed with sscanf, so newlib's
+// vfprintf stays out of the image
+static MetalUartStream console;
 
 void* operator new(size_t size) noexcept {
     auto new_region = malloc(size);
     if (!new_region) {
         // Halt and catch fire
-        for (;;) {}
+        hifive1b::Idle::halt();
     }
     return new_region;
 }
@@ -42,8 +82,7 @@ void operator delete(void* mem) noexcept {
 
 int wifi_main()
 {
-    // Create board driver without SPI drivers since they are managed manually by this app
-    hifive1b::Hifive1B<MetalUartStream, hifive1b::EmptySpiDriver> board_driver;
+    hifive1b::Hifive1B<MetalUartStream> board_driver;
 
     auto& status_led = board_driver.get_led_driver();
     status_led.set(1, 0, 0);
@@ -54,43 +93,481 @@ int wifi_main()
 
     hfclk.add_frequency_change_listener([&board_driver](Frequency new_frequency) {
         uart_init(BAUDRATE_115200, board_driver.get_clock_driver());
-        printf("---- CPU Frequency Update: %i MHz\r\n", static_cast<int>(std::chrono::duration_cast<frequency::MHz>(new_frequency).count()));
+        format::write<"---- CPU Frequency Update: {} MHz\r\n">(console, frequency::cast<frequency::MHz>(new_frequency).count());
     });
 
-    printf("---- HiFive1 Rev B WiFi Demo --------\r\n");
-    printf("* UART: 115200 bps\r\n");
-    printf("* SPI: 80 KHz\r\n");
-    printf("* CPU: %i MHz\r\n", static_cast<int>(std::chrono::duration_cast<frequency::MHz>(hfclk.get_frequency()).count()));
-    fflush(stdout);
+    console << "---- HiFive1 Rev B WiFi Demo --------\r\n";
+    console << "* UART: 115200 bps\r\n";
+    format::write<"* CPU: {} MHz\r\n">(console, frequency::cast<frequency::MHz>(hfclk.get_frequency()).count());
+
+    // Settings persist in a reserved region at the end of the flash
+    hifive1b::XipFlash flash(board_driver.get_flash_controller());
+    storage::ParamStore params(flash, hifive1b::XipFlash::PARAM_REGION_OFFSET, hifive1b::XipFlash::PARAM_REGION_SIZE);
+    if (params.mount() != storage::ParamStore::Status::OK) {
+        console << "* Parameter store unavailable\r\n";
+    }
+    Blackbox blackbox(flash, hifive1b::XipFlash::BLACKBOX_REGION_OFFSET, hifive1b::XipFlash::BLACKBOX_REGION_SIZE);
+    storage::OtaWriter ota_writer(flash, hifive1b::XipFlash::OTA_SLOT_OFFSET, hifive1b::XipFlash::OTA_SLOT_SIZE);
 
-    spi_init(SPICLOCK_80KHZ);
+    auto& spi = board_driver.get_spi(1);
+    spi.initialize(hfclk);
+    Esp32SpiPort esp32_port(spi);
+    esp32::SpiLink link(esp32_port, pbuf_pool);
 
     status_led.set(0, 0, 1);
 
-    printf("[+] ESP32 reset\r\n");
-    spi_send("AT+RST\r\n");
+    // Start at the slowest rate and work up to the fastest one that passes the integrity checks
+    format::write<"* SPI: {} Hz\r\n">(console, link.negotiate());
+
+    esp32::AtClient at_client(link);
+
+    // Sockets are only used for updates, which switch the ESP32 to multiple connection mode
+    esp32::SocketLayer sockets(at_client, pbuf_pool);
+    esp32::OtaSession ota(sockets, ota_writer);
+
+    at_client.set_urc_handler([&sockets](std::string_view line) {
+        if (!sockets.on_urc(line)) {
+            format::write<" | -- ESP32 ----> {}\r\n">(console, line);
+        }
+    });
+
+    console << "[+] ESP32 reset\r\n";
+    at_client.submit({.text = "AT+RST\r\n", .timeout_ms = 3000});
 
     // Set WiFi Station Mode
-    spi_send("AT+CWMODE=1\r\n");
+    at_client.submit({.text = "AT+CWMODE=1\r\n", .timeout_ms = 1000, .on_complete = [&status_led](esp32::AtClient::Result) {
+        status_led.set(0, 1, 0);
+    }});
+
+    // Rejoin the network saved with WIFI=
+    char ssid[33];
+    char pwd[65];
+    if (load_string(params, PARAM_WIFI_SSID, ssid, sizeof(ssid)) && load_string(params, PARAM_WIFI_PWD, pwd, sizeof(pwd))) {
+        format::write<"[+] Joining {}\r\n">(console, ssid);
+        submit_join(at_client, ssid, pwd);
+    }
+
+    // Bring the link back without a full reset where possible
+    esp32::LinkSupervisor supervisor(link, at_client);
+    supervisor.set_recovery_handler([&at_client, &supervisor](esp32::LinkSupervisor::Level level) {
+        static const char *const names[] = {"resync", "slow clock", "reset"};
+        format::write<" | -- SPI link recovered by {} in {} us\r\n">(console, names[static_cast<int>(level)],
+                                                                   supervisor.get_stats().last_recovery_us);
 
-    status_led.set(0, 1, 0);
+        if (level == esp32::LinkSupervisor::Level::RESET) {
+            transparent = false;
+            at_client.submit({.text = "AT+CWMODE=1\r\n"});
+        }
+    });
+
+    console << "* Optional: Enter AT commands (see \"ESP32 AT Instruction Set and Examples\")\r\n";
+    console << "* Enter LINK? to show SPI link statistics\r\n";
+    console << "* Enter WIFI=<ssid>,<password> to join a network and remember it\r\n";
+    console << "* Enter TELEM=<host>,<port> to stream telemetry over UDP, and +++ to stop\r\n";
+    console << "* Enter CTRL=<host>,<port> to receive control packets over UDP, and CTRL? for latency statistics\r\n";
+    console << "* Enter BB=1 to record control packets to flash, BB=0 to stop and BB? for recorder statistics\r\n";
+    console << "* Enter OTA=<host>,<port> to download a firmware update over TCP, and OTA? for its progress\r\n";
+    console << "* Enter IDLE? to show how long the core has been asleep\r\n";
+
+    esp32::TelemetryDownlink downlink(at_client, link);
+
+    // Control packets are parsed as they arrive rather than printed
+    esp32::ControlUplink uplink;
+    bool control_active = false;
+    bool showing_failsafe = false;
+    at_client.set_data_handler([&uplink, &sockets](const esp32::AtParser::IpdFragment& fragment) {
+        // Link IDs only appear in multiple connection mode
+        if (fragment.link_id >= 0) {
+            sockets.on_ipd(fragment);
+        } else {
+            uplink.on_ipd(fragment, micros());
+        }
+    });
+
+    // Server to download from once multiple connection mode is on
+    char ota_host[64] = "";
+    unsigned ota_port = 0;
+    auto ota_state = esp32::OtaSession::State::IDLE;
 
-    printf("* Optional: Enter AT commands (see \"ESP32 AT Instruction Set and Examples\")\r\n");
+    bool prompted = false;
+    PbufRef line;
     while(1) {
-        if (TRANS_ON == spi_transparent()) {
-            printf("* ----> ");
+        if (!supervisor.poll()) {
+            continue;
+        }
+        at_client.poll(millis());
+        params.poll();
+
+        record_control(blackbox, uplink, micros());
+        blackbox.poll();
+
+        if (ota_host[0] != '\0' && sockets.is_ready()) {
+            if (!ota.start(ota_host, static_cast<uint16_t>(ota_port))) {
+                console << "* Could not connect to the update server\r\n";
+            }
+            ota_host[0] = '\0';
+        }
+        ota.poll();
+        if (ota.get_state() != ota_state) {
+            ota_state = ota.get_state();
+            print_ota_progress(ota);
+        }
+
+        if (downlink.get_state() == esp32::TelemetryDownlink::State::STREAMING) {
+            sample_telemetry(downlink, link);
+        }
+
+        // Signal loss of control on the status LED
+        if (control_active && uplink.poll(micros()) != showing_failsafe) {
+            showing_failsafe = uplink.in_failsafe();
+            if (showing_failsafe) {
+                status_led.blink({0xFF, 0, 0}, 250);
+            } else {
+                status_led.set(0, 1, 0);
+            }
+        }
+
+        // Wait for the previous command to finish before prompting for the next
+        if (at_client.pending() > 0) {
+            continue;
+        }
+
+        if (!prompted) {
+            if (transparent) {
+                console << "* ----> ";
+            } else {
+                console << "* Enter AT command: ";
+            }
+            prompted = true;
+        }
+
+        // Typed characters go straight into a pool segment, leaving room to add CR LF in place
+        if (!line) {
+            line = PbufRef(pbuf_pool.allocate());
+            if (!line) {
+                continue;
+            }
+        }
+        char *text = reinterpret_cast<char *>(line.get()->storage);
+        if (!tty_poll_line(text, line.get()->capacity - 2)) {
+            // Nothing in flight: sleep until there's input or the next millisecond's work is due
+            sleep_until_next_ms(board_driver.get_idle(), esp32_port);
+            continue;
+        }
+        console << "\r\n";
+        prompted = false;
+
+        std::size_t text_len = strlen(text);
+        text[text_len] = '\r';
+        text[text_len + 1] = '\n';
+        line.get()->length = static_cast<uint16_t>(text_len + 2);
+        text[text_len + 2] = '\0';
+
+        char host[64];
+        unsigned port = 0;
+        if (strcmp(text, "LINK?\r\n") == 0) {
+            print_link_stats(link, supervisor);
+        } else if (downlink.get_state() == esp32::TelemetryDownlink::State::STREAMING) {
+            if (strcmp(text, "+++\r\n") == 0) {
+                uint16_t samples = telemetry.sample_count();
+                downlink.send(telemetry.finish(), samples);
+                downlink.stop();
+                print_telemetry_stats(downlink);
+            }
+        } else if (sscanf(text, "WIFI=%32[^,],%64[^\r]", ssid, pwd) == 2) {
+            using Status = storage::ParamStore::Status;
+            if (params.set(PARAM_WIFI_SSID, reinterpret_cast<const uint8_t *>(ssid), strlen(ssid)) != Status::OK ||
+                params.set(PARAM_WIFI_PWD, reinterpret_cast<const uint8_t *>(pwd), strlen(pwd)) != Status::OK) {
+                console << "* Could not save the network\r\n";
+            }
+            submit_join(at_client, ssid, pwd);
+        } else if (strcmp(text, "BB=1\r\n") == 0) {
+            // The region is erased a sector at a time in the loop before recording starts
+            blackbox.erase();
+        } else if (strcmp(text, "BB=0\r\n") == 0) {
+            blackbox.stop();
+        } else if (strcmp(text, "BB?\r\n") == 0) {
+            print_blackbox_stats(blackbox);
+        } else if (sscanf(text, "OTA=%63[^,],%u", host, &port) == 2) {
+            // Started from the loop once AT+CIPMUX=1 has gone through. Only a complete command is taken, since
+            // sscanf fills the host even when the port is missing.
+            strcpy(ota_host, host);
+            ota_port = port;
+            if (!sockets.is_ready()) {
+                sockets.initialize();
+            }
+        } else if (strcmp(text, "OTA?\r\n") == 0) {
+            print_ota_progress(ota);
+        } else if (strcmp(text, "IDLE?\r\n") == 0) {
+            print_idle_stats(board_driver.get_idle());
+        } else if (strcmp(text, "CTRL?\r\n") == 0) {
+            print_control_stats(uplink);
+        } else if (sscanf(text, "CTRL=%63[^,],%u", host, &port) == 2) {
+            submit_control_listen(at_client, host, port);
+            control_active = true;
+        } else if (sscanf(text, "TELEM=%63[^,],%u", host, &port) == 2) {
+            if (!downlink.start(host, static_cast<uint16_t>(port))) {
+                console << "* Could not start telemetry\r\n";
+            }
+        } else if (transparent) {
+            // Transparent transmission bypasses the AT parser. "+++" ends it and must be sent without CR LF.
+            if (strcmp(text, "+++\r\n") == 0) {
+                link.send("+++");
+                transparent = false;
+            } else {
+                link.send(line.get()->chars());
+            }
+        } else {
+            // The segment is held by the command until it completes
+            submit_interactive_command(at_client, std::move(line));
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// Print the negotiated clock, error counts and measured goodput
+//----------------------------------------------------------------------
+static void print_link_stats(const esp32::SpiLink& link, const esp32::LinkSupervisor& supervisor)
+{
+    const auto& stats = link.get_stats();
+    format::write<"* SPI clock: {} Hz\r\n">(console, link.get_clock());
+    format::write<"* Transactions: {}, errors: {}, fallbacks: {}\r\n">(console, stats.transactions, stats.errors,
+                                                                      stats.fallbacks);
+    format::write<"* Payload: {} bytes sent, {} bytes received\r\n">(console, stats.tx_bytes, stats.rx_bytes);
+    format::write<"* Goodput: {} bytes/s\r\n">(console, link.get_goodput());
+
+    const auto& recovery = supervisor.get_stats();
+    format::write<"* Recoveries: {} resync, {} slow clock, {} reset ({} reset timeouts)\r\n">(console,
+        recovery.recoveries[0], recovery.recoveries[1], recovery.recoveries[2], recovery.reset_timeouts);
+    format::write<"* Recovery time: last {} us, max {} us, total {} us\r\n">(console, recovery.last_recovery_us,
+        recovery.max_recovery_us, recovery.total_recovery_us);
+}
+
+//----------------------------------------------------------------------
+// Record one sample per millisecond and send each datagram once full
+//----------------------------------------------------------------------
+static void sample_telemetry(esp32::TelemetryDownlink& downlink, const esp32::SpiLink& link)
+{
+    static uint32_t last_ms = 0;
+    uint32_t now_ms = millis();
+    if (now_ms == last_ms) {
+        return;
+    }
+    last_ms = now_ms;
+
+    if (!telemetry.has_room()) {
+        uint16_t samples = telemetry.sample_count();
+        downlink.send(telemetry.finish(), samples);
+    }
+
+    const auto& stats = link.get_stats();
+    telemetry.add({micros(), {
+        static_cast<int32_t>(link.get_clock() / 1000), static_cast<int32_t>(link.get_goodput()),
+        static_cast<int32_t>(stats.transactions), static_cast<int32_t>(stats.errors)
+    }});
+}
+
+//----------------------------------------------------------------------
+// Print how well samples were packed into datagrams
+//----------------------------------------------------------------------
+static void print_telemetry_stats(const esp32::TelemetryDownlink& downlink)
+{
+    const auto& stats = downlink.get_stats();
+    format::write<"* Telemetry: {} samples in {} datagrams ({} bytes), {} dropped\r\n">(console, stats.samples,
+        stats.datagrams, stats.bytes, stats.dropped);
+}
+
+//----------------------------------------------------------------------
+// Open a UDP connection that accepts control packets on the given local
+// port from any sender (mode 2 lets the remote end change)
+//----------------------------------------------------------------------
+static void submit_control_listen(esp32::AtClient& client, const char *host, unsigned port)
+{
+    static char command[96];
+    format::to_buffer<"AT+CIPSTART=\"UDP\",\"{}\",{},{},2\r\n">(command, sizeof(command), host, port, port);
+
+    client.submit({.text = "AT+CIPMUX=0\r\n"});
+    client.submit({.text = command, .timeout_ms = 5000, .on_complete = [](esp32::AtClient::Result result) {
+        format::write<" | -- Control uplink {}\r\n">(console, result == esp32::AtClient::Result::OK ? "listening" : "failed");
+    }});
+}
+
+//----------------------------------------------------------------------
+// Print control packet counts and the one-way latency histogram
+//----------------------------------------------------------------------
+static void print_control_stats(const esp32::ControlUplink& uplink)
+{
+    const auto& stats = uplink.get_stats();
+    format::write<"* Control: {} received, {} lost, {} stale, {} corrupt, {} failsafes{}\r\n">(console, stats.received,
+        stats.lost, stats.stale, stats.corrupt, stats.failsafes, uplink.in_failsafe() ? " (in failsafe)" : "");
+    format::write<"* Jitter: {} us, max latency: {} us\r\n">(console, stats.jitter_us, stats.max_latency_us);
+
+    // Latency is relative to the fastest packet since the clocks aren't synchronized
+    const auto& bounds = esp32::ControlUplink::HISTOGRAM_BOUNDS_US;
+    for (std::size_t i = 0; i < stats.latency_histogram.size(); ++i) {
+        if (i < bounds.size()) {
+            format::write<"*   < {:6} us: {}\r\n">(console, bounds[i], stats.latency_histogram[i]);
         } else {
-            printf("* Enter AT command: ");
+            format::write<"*  >= {:6} us: {}\r\n">(console, bounds.back(), stats.latency_histogram[i]);
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// Record the latest control command at 1 kHz. Channels hold the last
+// valid values and are zeroed in failsafe.
+//----------------------------------------------------------------------
+static void record_control(Blackbox& blackbox, const esp32::ControlUplink& uplink, uint32_t now_us)
+{
+    static uint32_t next_us = 0;
+
+    if (blackbox.get_state() != Blackbox::State::RECORDING || static_cast<int32_t>(now_us - next_us) < 0) {
+        return;
+    }
+    next_us = now_us + 1000;
+
+    Blackbox::Sample sample;
+    sample.timestamp_us = now_us;
+    if (!uplink.in_failsafe()) {
+        const auto& channels = uplink.latest().channels;
+        for (std::size_t i = 0; i < channels.size(); ++i) {
+            sample.values[i] = channels[i];
+        }
+    }
+    blackbox.record(sample);
+}
+
+//----------------------------------------------------------------------
+// Print the recorder state, sample counts and compression
+//----------------------------------------------------------------------
+static void print_blackbox_stats(const Blackbox& blackbox)
+{
+    static const char *const states[] = {"idle", "erasing", "recording", "full"};
+    const auto& stats = blackbox.get_stats();
+    format::write<"* Black box {}: {} samples, {} dropped, {} pages, {} bytes recorded\r\n">(console,
+        states[static_cast<int>(blackbox.get_state())], stats.samples, stats.dropped, stats.pages,
+        blackbox.get_recorded_length());
+    if (stats.samples > 0) {
+        format::write<"* {} encoded bytes per 100 samples\r\n">(console,
+            static_cast<uint32_t>(stats.encoded_bytes * 100ULL / stats.samples));
+    }
+}
+
+//----------------------------------------------------------------------
+// Print the state of a firmware update and how much has arrived
+//----------------------------------------------------------------------
+static void print_ota_progress(const esp32::OtaSession& ota)
+{
+    static const char *const states[] = {"idle", "connecting", "receiving", "verifying", "stored", "failed"};
+    format::write<" | -- Update {}: {} of {} bytes\r\n">(console, states[static_cast<int>(ota.get_state())],
+                                                          ota.get_received(), ota.get_image_size());
+    if (ota.get_state() == esp32::OtaSession::State::DONE) {
+        console << " | -- Reset the board to install it\r\n";
+    }
+}
+
+//----------------------------------------------------------------------
+// Sleep until a character is typed, the ESP32 raises its handshake, or
+// millis() moves on, so work done once per millisecond still is
+//----------------------------------------------------------------------
+static void sleep_until_next_ms(hifive1b::Idle& idle, Esp32SpiPort& port)
+{
+    // First mtime tick of the next millisecond, rounding like millis()
+    uint64_t ms = (idle.now() * 1000U) >> 15;
+    uint64_t deadline = (((ms + 1) << 15) + 999U) / 1000U;
+
+    port.sleep_until(idle, deadline, [] { return uart_rx_ready() != 0; }, hifive1b::Idle::UART0_SOURCE);
+}
+
+//----------------------------------------------------------------------
+// Print the share of time spent asleep and how quickly the core wakes
+//----------------------------------------------------------------------
+static void print_idle_stats(hifive1b::Idle& idle)
+{
+    const auto& stats = idle.get_stats();
+    uint32_t residency = idle.get_residency_permille();
+    format::write<"* Idle: {:.1}% asleep in {} sleeps\r\n">(console, residency, stats.sleeps);
+    format::write<"* Late wakes: {}, at most {} us late\r\n">(console, stats.late_wakes,
+                                                               hifive1b::Idle::us_from_ticks(stats.max_late_ticks));
+    format::write<"* Wake-up latency: {} cycles\r\n">(console, idle.measure_wake_latency());
+    idle.reset_stats();
+}
+
+//----------------------------------------------------------------------
+// Read a string saved in the parameter store and terminate it
+//----------------------------------------------------------------------
+static bool load_string(storage::ParamStore& params, uint8_t key, char *str, std::size_t size)
+{
+    std::size_t length = 0;
+    if (params.get(key, reinterpret_cast<uint8_t *>(str), size - 1, length) != storage::ParamStore::Status::OK) {
+        return false;
+    }
+    str[length] = '\0';
+    return true;
+}
+
+//----------------------------------------------------------------------
+// Join an access point
+//----------------------------------------------------------------------
+static void submit_join(esp32::AtClient& client, const char *ssid, const char *pwd)
+{
+    static char command[128];
+    format::to_buffer<"AT+CWJAP=\"{}\",\"{}\"\r\n">(command, sizeof(command), ssid, pwd);
+
+    client.submit({.text = command, .timeout_ms = 20000, .on_complete = [](esp32::AtClient::Result result) {
+        format::write<" | -- WiFi {}\r\n">(console, result == esp32::AtClient::Result::OK ? "connected" : "join failed");
+    }});
+}
+
+//----------------------------------------------------------------------
+// Queue a typed command and print its response as it arrives
+//----------------------------------------------------------------------
+static void submit_interactive_command(esp32::AtClient& client, PbufRef cmd)
+{
+    using Result = esp32::AtClient::Result;
+
+    std::string_view text = cmd.get()->chars();
+    client.submit({.text = text, .timeout_ms = 10000,
+        .on_line = [](std::string_view line) {
+            format::write<" | -- ESP32 ----> {}\r\n">(console, line);
+        },
+        .on_complete = [cmd, text](Result result) {
+            static const char *const names[] = {"OK", "ERROR", "FAIL", "TIMEOUT", "ABORTED"};
+            format::write<" | -- ESP32 ----> {}\r\n">(console, names[static_cast<int>(result)]);
+
+            // With AT+CIPMODE=1, a bare AT+CIPSEND switches to transparent transmission
+            if (result == Result::OK && text == "AT+CIPSEND\r\n") {
+                console << " | -- Transparent mode ENABLED. End with \"+++\"\r\n";
+                transparent = true;
+            }
+        }
+    });
+}
+
+//----------------------------------------------------------------------
+// Collect typed characters without blocking. Returns true once a full
+// line (ended by \n or \r) is stored in str_p.
+//----------------------------------------------------------------------
+static bool tty_poll_line(char *str_p, uint32_t size)
+{
+    static uint32_t i = 0;
+    int c;
+
+    while ((c = uart_poll_char()) >= 0) {
+        if (c == '\n' || c == '\r') {
+            // Ignore the second half of CR LF
+            if (i == 0) {
+                continue;
+            }
+            str_p[i] = '\0';
+            i = 0;
+            return true;
         }
-        fflush(stdout);
-        while (NULL == tty_gets(wifi_ssid, sizeof(wifi_ssid))) {}
-        printf("\r\n");
-        snprintf(at_cmd, sizeof(at_cmd), "%s\r\n", wifi_ssid);
-        spi_send(at_cmd);
-        if (TRANS_OFF == spi_transparent()) {
-            spi_recv(recv_str, sizeof(recv_str));
+        if (i < size - 1) {
+            str_p[i++] = c;
         }
     }
+    return false;
 }
 
 //----------------------------------------------------------------------
@@ -124,14 +601,12 @@ static char *tty_gets(char *str_p, uint32_t size)
 //----------------------------------------------------------------------
 static void get_ssid_pwd(char *ssid, char *pwd, uint32_t size)
 {
-    printf("Greetings!\r\n");
-    printf("Enter SSID: ");
-    fflush(stdout);
+    console << "Greetings!\r\n";
+    console << "Enter SSID: ";
     while (NULL == tty_gets(ssid, size)) {}
-    printf("\r\n");
+    console << "\r\n";
 
-    printf("Enter Password: ");
-    fflush(stdout);
+    console << "Enter Password: ";
     while (NULL == tty_gets(pwd, size)) {}
-    printf("\r\n");
+    console << "\r\n";
 }
@@ -0,0 +1,72 @@
+#include "bench_app.hpp"
+
+#include <cstdint>
+#include <cstdio>
+
+#include <bench/kernels.hpp>
+#include <hifive1b_bsp/csr.hpp>
+#include <hifive1b_bsp/device_driver.hpp>
+
+/// Operations per timed run. Small enough that mcycle's low word can't wrap during a run.
+static constexpr uint32_t ITERATIONS = 256;
+
+/// Timed runs per kernel; the fastest is reported since anything slower was disturbed (ex. a cache refill)
+static constexpr uint32_t REPEATS = 5;
+
+/// Cycles taken by reading mcycle twice with nothing between, subtracted from every measurement
+static uint32_t timer_overhead() {
+	uint32_t best = UINT32_MAX;
+	for (uint32_t i = 0; i < REPEATS; ++i) {
+		uint32_t start = hifive1b::csr::read_mcycle();
+		uint32_t cycles = hifive1b::csr::read_mcycle() - start;
+		best = (cycles < best) ? cycles : best;
+	}
+	return best;
+}
+
+/// Time a kernel, returning the cycles of its fastest run
+static uint32_t measure(const bench::Kernel& kernel, uint32_t overhead, uint32_t& checksum) {
+	// Warm up the instruction cache so the first run isn't a flash fetch benchmark
+	checksum = kernel.run(ITERATIONS);
+
+	uint32_t best = UINT32_MAX;
+	for (uint32_t i = 0; i < REPEATS; ++i) {
+		uint32_t start = hifive1b::csr::read_mcycle();
+		checksum = kernel.run(ITERATIONS);
+		uint32_t cycles = hifive1b::csr::read_mcycle() - start - overhead;
+		best = (cycles < best) ? cycles : best;
+	}
+	return best;
+}
+
+int bench_main() {
+
+	hifive1b::Hifive1B driver;
+	auto& clock = driver.get_clock_driver();
+
+	// The report is CSV between the "# bench" and "# end" lines so a script can pull it out of the serial log. Cycles
+	// per iteration is scaled by 100 to print two decimals without floats.
+	printf("# bench core_hz=%lu iterations=%lu repeats=%lu\n",
+		static_cast<unsigned long>(clock.get_frequency().count()), static_cast<unsigned long>(ITERATIONS),
+		static_cast<unsigned long>(REPEATS));
+	printf("kernel,cycles,cycles_per_iteration,checksum\n");
+
+	uint32_t overhead = timer_overhead();
+	for (const auto& kernel : bench::kernels()) {
+		uint32_t checksum = 0;
+		uint32_t cycles = measure(kernel, overhead, checksum);
+		uint32_t per_iteration = static_cast<uint32_t>(100ULL * cycles / ITERATIONS);
+
+		printf("%s,%lu,%lu.%02lu,0x%08lx\n", kernel.name, static_cast<unsigned long>(cycles),
+			static_cast<unsigned long>(per_iteration / 100), static_cast<unsigned long>(per_iteration % 100),
+			static_cast<unsigned long>(checksum));
+	}
+	printf("# end\n");
+
+	for (;;) {
+
+	}
+
+	// Return non-OK status if exit is reached
+	return 1;
+}
@@ -1,44 +1,212 @@
 #include "esp32_at_app.hpp"
 
-#include <array>
+#include <cstdio>
+#include <optional>
+#include <string_view>
 
-#include "hifive1b_bsp/device_driver.hpp"
+#include <embedded_util/control_register.hpp>
+#include <embedded_util/coroutine.hpp>
+#include <embedded_util/line_reader.hpp>
+#include <esp32_at/spi_link.hpp>
+#include <hifive1b_bsp/device_driver.hpp>
+#include <hifive1b_bsp/interrupts.hpp>
+
+#include "esp32_spi_port.hpp"
 
 extern "C" {
 
-#	include "metal/led.h"
-#	include "metal/shutdown.h"
-#	include "metal/spi.h"
 #	include "metal/cpu.h"
-#	include "metal/clock.h"
 
 }
 
-static std::array<metal_spi*, 3> spi_d {nullptr};
+// Executor time is the low word of mtime
+
+static constexpr uint32_t TICKS_PER_SECOND = 32768;
+static constexpr uint32_t HANDSHAKE_TIMEOUT = TICKS_PER_SECOND / 20;
+static constexpr uint32_t RESPONSE_TIMEOUT = TICKS_PER_SECOND;
+
+// UART0 receive registers, read directly since the Freedom Metal driver only polls
+
+static constexpr uintptr_t UART0_RXDATA = 0x10013004;
+static constexpr uintptr_t UART0_IE = 0x10013010;
+static constexpr uint32_t UART_RXDATA_EMPTY = 1UL << 31;
+static constexpr uint32_t UART_IE_RXWM = 1UL << 1;
+static constexpr uint32_t UART0_SOURCE = 3;
+
+// SPI AT protocol phases, as in esp32::SpiLink
+
+static constexpr uint8_t HEADER_MASTER_WRITE = 0x02;
+static constexpr uint8_t HEADER_MASTER_READ = 0x01;
+static constexpr uint8_t LENGTH_MARKER_WRITE = 'A';
+static constexpr uint8_t LENGTH_MARKER_READ = 'B';
+
+static metal_cpu* cpu = nullptr;
+static hifive1b::InterruptController interrupts;
+static volatile bool timer_fired = false;
+
+static uint32_t mtime_now() {
+	return static_cast<uint32_t>(metal_cpu_get_mtime(cpu));
+}
+
+static Executor executor(mtime_now);
+static LineReader<64> console;
 
-static bool get_spi_devices() {
-	for (size_t i = 0; i < spi_d.size(); ++i) {
-		auto device_n = metal_spi_get_device(i);
-		if (!device_n) {
-			printf("Error getting SPI device %u (does not exist)\n", i);
-			return false;
+static void uart_isr(void*) {
+	const ControlRegister<uint32_t> rxdata(UART0_RXDATA);
+	for (uint32_t c = rxdata.read(); !(c & UART_RXDATA_EMPTY); c = rxdata.read()) {
+		console.push(static_cast<char>(c));
+	}
+}
+
+static void timer_isr(void*) {
+	metal_cpu_set_mtimecmp(cpu, UINT64_MAX);
+	timer_fired = true;
+}
+
+/// Sleep until a coroutine is ready to resume or the earliest timer is due
+template<typename Condition>
+static void sleep_until_ready(Condition&& ready, std::optional<uint32_t> deadline) {
+	timer_fired = false;
+	if (deadline) {
+		// Extend the 32-bit deadline to the full mtime
+		uint64_t now = metal_cpu_get_mtime(cpu);
+		int32_t remaining = static_cast<int32_t>(*deadline - static_cast<uint32_t>(now));
+		if (remaining <= 0) {
+			return;
 		}
-		spi_d[i] = device_n;
+		metal_cpu_set_mtimecmp(cpu, now + static_cast<uint32_t>(remaining));
 	}
-	return true;
+
+	hifive1b::InterruptController::sleep_until([&ready] { return timer_fired || ready(); });
 }
 
-int esp32_at_main() {
+/// Blink the blue LED once a second, showing the executor is alive while other coroutines wait on the ESP32
+static Task<> heartbeat(hifive1b::LedDriver& leds) {
+	for (;;) {
+		leds.set(0, 0, 1);
+		co_await sleep_for(TICKS_PER_SECOND / 20);
+		leds.set(0, 0, 0);
+		co_await sleep_for(TICKS_PER_SECOND - TICKS_PER_SECOND / 20);
+	}
+}
 
-	hifive1b::Hifive1B driver;
+/// Run the three phases of a message to the ESP32
+static Task<bool> write_message(Esp32SpiPort& port, const uint8_t* data, std::size_t len) {
+	const uint8_t header[4] = {HEADER_MASTER_WRITE, 0x00, 0x00, 0x00};
+	co_await port.transfer_async(header, nullptr, sizeof(header));
+	if (!co_await port.handshake_async(HANDSHAKE_TIMEOUT)) {
+		co_return false;
+	}
+
+	// The length is split into two 7-bit halves
+	const uint8_t length[4] = {
+		static_cast<uint8_t>(len & 0x7F), static_cast<uint8_t>(len >> 7), 0x00, LENGTH_MARKER_WRITE
+	};
+	co_await port.transfer_async(length, nullptr, sizeof(length));
+	if (!co_await port.handshake_async(HANDSHAKE_TIMEOUT)) {
+		co_return false;
+	}
+
+	co_await port.transfer_async(data, nullptr, len);
+	co_return true;
+}
+
+/// Run the three phases of a message from the ESP32, keeping what fits in dest
+/// @return The number of bytes stored
+static Task<std::size_t> read_message(Esp32SpiPort& port, uint8_t* dest, std::size_t capacity) {
+	const uint8_t header[4] = {HEADER_MASTER_READ, 0x00, 0x00, 0x00};
+	co_await port.transfer_async(header, nullptr, sizeof(header));
+	if (!co_await port.handshake_async(HANDSHAKE_TIMEOUT)) {
+		co_return 0;
+	}
+
+	uint8_t length[4] = {0};
+	co_await port.transfer_async(nullptr, length, sizeof(length));
+	std::size_t len = (static_cast<std::size_t>(length[1]) << 7) + length[0];
+	if (length[3] != LENGTH_MARKER_READ || (length[0] & 0x80) || (length[1] & 0x80) ||
+		len > esp32::SpiLink::MAX_TRANSFER || len == 0) {
+		co_return 0;
+	}
+
+	if (!co_await port.handshake_async(HANDSHAKE_TIMEOUT)) {
+		co_return 0;
+	}
+
+	// The whole phase must be clocked out even if it doesn't fit
+	std::size_t kept = (len < capacity) ? len : capacity;
+	co_await port.transfer_async(nullptr, dest, kept);
+	if (kept < len) {
+		co_await port.transfer_async(nullptr, nullptr, len - kept);
+	}
+	co_return kept;
+}
+
+/// Send an AT command and print the responses until "OK" or "ERROR", or until the ESP32 goes quiet
+static Task<> at_command(Esp32SpiPort& port, std::string_view command) {
+	static uint8_t response[256];
+
+	if (!co_await write_message(port, reinterpret_cast<const uint8_t*>(command.data()), command.size())) {
+		printf("ESP32 did not take the command\n");
+		co_return;
+	}
 
-//	MetalUartStream basicLogger;
-//	basicLogger << "Application esp32_at_main; Entering main loop.\n";
+	// The ESP32 raises the handshake when it has something to send
+	while (co_await port.handshake_async(RESPONSE_TIMEOUT)) {
+		std::size_t len = co_await read_message(port, response, sizeof(response));
+		std::string_view received(reinterpret_cast<const char*>(response), len);
+		printf("%.*s", static_cast<int>(received.size()), received.data());
+
+		if (received.find("OK\r\n") != std::string_view::npos || received.find("ERROR\r\n") != std::string_view::npos) {
+			co_return;
+		}
+	}
+	printf("No response from the ESP32\n");
+}
+
+/// Pass each line typed at the console to the ESP32 as an AT command
+static Task<> console_loop(Esp32SpiPort& port) {
+	static char line[64 + 2];
 
 	for (;;) {
+		printf("> ");
+		fflush(stdout);
 
+		std::size_t len = co_await console.read_line(line, sizeof(line) - 2);
+		line[len++] = '\r';
+		line[len++] = '\n';
+		co_await at_command(port, std::string_view(line, len));
 	}
+}
+
+int esp32_at_main() {
+
+	hifive1b::Hifive1B driver;
 
-	// Return non-OK status if exit is reached
-	return 1;
-}
\ No newline at end of file
+	cpu = metal_cpu_get(metal_cpu_get_current_hartid());
+
+	auto& spi = driver.get_spi(1);
+	spi.initialize(driver.get_clock_driver());
+	spi.set_baud_rate(esp32::SpiLink::CLOCK_LADDER.front());
+	static Esp32SpiPort port(spi);
+
+	// Nothing may interrupt before its handler is in place
+	metal_cpu_set_mtimecmp(cpu, UINT64_MAX);
+	interrupts.install();
+	interrupts.set_timer_handler(timer_isr);
+	interrupts.attach(hifive1b::SpiDriver::plic_source(1), 2, [](void* context) {
+		static_cast<hifive1b::SpiDriver*>(context)->handle_interrupt();
+	}, &spi);
+	interrupts.attach(Esp32SpiPort::HANDSHAKE_SOURCE, 2, [](void* context) {
+		static_cast<Esp32SpiPort*>(context)->handle_handshake_interrupt();
+	}, &port);
+	interrupts.attach(UART0_SOURCE, 1, uart_isr);
+
+	// Interrupt as soon as a character is waiting (rxcnt = 0)
+	ControlRegister<uint32_t>(UART0_IE).write(UART_IE_RXWM);
+
+	printf("Type AT commands for the ESP32\n");
+
+	executor.spawn(heartbeat(driver.get_led_driver()));
+	executor.spawn(console_loop(port));
+	executor.run([](auto ready, std::optional<uint32_t> deadline) { sleep_until_ready(ready, deadline); });
+}
@@ -0,0 +1,106 @@
+#include "flash_bench.hpp"
+
+#include <cstdint>
+#include <cstdio>
+
+#include "hifive1b_bsp/device_driver.hpp"
+
+/// Bytes of straight-line code in fetch_bound_kernel(), larger than the 16 KiB instruction cache
+static constexpr uint32_t KERNEL_BYTES = 24 * 1024;
+
+/// Bytes read from flash by data_bound_kernel()
+static constexpr uint32_t DATA_BYTES = 16 * 1024;
+
+/// Any address in the memory-mapped flash, past the bootloader
+static constexpr uintptr_t FLASH_DATA_ADDRESS = 0x20010000;
+
+static constexpr uint32_t PASSES = 16;
+
+static uint32_t cycles() {
+	uint32_t c;
+	asm volatile ("csrr %0, mcycle" : "=r"(c));
+	return c;
+}
+
+/// Run straight-line code too big to stay cached, so each pass refills every cache line from flash
+static void __attribute__((noinline)) fetch_bound_kernel() {
+	// 4-byte nops; compressed instructions would halve the footprint
+	asm volatile (
+		".option push\n"
+		".option norvc\n"
+		".rept 6144\n"
+		"addi x0, x0, 0\n"
+		".endr\n"
+		".option pop\n"
+		::: "memory"
+	);
+}
+
+/// Load words from flash. Data reads aren't cached, so each one is a flash transaction.
+static uint32_t __attribute__((noinline)) data_bound_kernel() {
+	const volatile uint32_t* flash = reinterpret_cast<const volatile uint32_t*>(FLASH_DATA_ADDRESS);
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < DATA_BYTES / sizeof(uint32_t); ++i) {
+		sum += flash[i];
+	}
+	return sum;
+}
+
+static void run(const char* name, hifive1b::FlashController& flash, const hifive1b::FlashController::ReadFormat& format,
+		uint32_t core_mhz) {
+	flash.set_read_format(format);
+
+	// Warm up anything that isn't the kernel (ex. the loop below) so it doesn't count
+	fetch_bound_kernel();
+
+	uint32_t start = cycles();
+	for (uint32_t i = 0; i < PASSES; ++i) {
+		fetch_bound_kernel();
+	}
+	uint32_t fetch = (cycles() - start) / PASSES;
+
+	start = cycles();
+	volatile uint32_t sum = 0;
+	for (uint32_t i = 0; i < PASSES; ++i) {
+		sum = sum + data_bound_kernel();
+	}
+	uint32_t data = (cycles() - start) / PASSES;
+
+	// Bytes per cycle times cycles per microsecond gives MB/s; scaled by 100 to print two decimals without floats
+	uint32_t fetch_rate = static_cast<uint32_t>(100ULL * KERNEL_BYTES * core_mhz / fetch);
+	uint32_t data_rate = static_cast<uint32_t>(100ULL * DATA_BYTES * core_mhz / data);
+
+	printf("%-10s sck %lu Hz: fetch %lu cycles (%lu.%02lu MB/s), data %lu cycles (%lu.%02lu MB/s)\n", name,
+		static_cast<unsigned long>(flash.get_sck()),
+		static_cast<unsigned long>(fetch), static_cast<unsigned long>(fetch_rate / 100),
+		static_cast<unsigned long>(fetch_rate % 100),
+		static_cast<unsigned long>(data), static_cast<unsigned long>(data_rate / 100),
+		static_cast<unsigned long>(data_rate % 100));
+}
+
+int flash_bench_main() {
+
+	hifive1b::Hifive1B driver;
+	auto& flash = driver.get_flash_controller();
+	auto& clock = driver.get_clock_driver();
+
+	uint32_t core_mhz = frequency::cast<frequency::MHz>(clock.get_frequency()).count();
+	printf("Flash fetch benchmark at %lu MHz, %lu-byte kernel\n", static_cast<unsigned long>(core_mhz),
+		static_cast<unsigned long>(KERNEL_BYTES));
+
+	if (!flash.enable_quad_mode()) {
+		printf("Flash did not enable quad mode\n");
+		run("single", flash, hifive1b::FlashController::SINGLE_READ, core_mhz);
+		return 1;
+	}
+
+	run("single", flash, hifive1b::FlashController::SINGLE_READ, core_mhz);
+	run("quad i/o", flash, hifive1b::FlashController::QUAD_IO_READ, core_mhz);
+
+	for (;;) {
+
+	}
+
+	// Return non-OK status if exit is reached
+	return 1;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+int flash_bench_main();
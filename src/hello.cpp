@@ -1,9 +1,11 @@
 /* Copyright 2019 SiFive, Inc */
 /* SPDX-License-Identifier: Apache-2.0 */
 
+#include <cstddef>
+#include <cstdint>
+
 extern "C" {
 
-#include <stdio.h>
 #include <metal/cpu.h>
 #include <metal/led.h>
 #include <metal/button.h>
@@ -11,83 +13,135 @@ extern "C" {
 
 }
 
-#define RTC_FREQ    32768
+#include <embedded_util/active_object.hpp>
+#include <embedded_util/format.hpp>
+#include <hifive1b_bsp/csr.hpp>
+#include <hifive1b_bsp/freedom_logger.hpp>
+#include <hifive1b_bsp/interrupts.hpp>
+#include <hifive1b_bsp/memory_monitor.hpp>
 
-static struct metal_cpu *cpu;
-static struct metal_interrupt *cpu_intr, *tmr_intr;
-static int tmr_id;
-static volatile uint32_t timer_isr_flag;
+#define RTC_FREQ    32768
 
-static void display_banner (void) {
+enum class HelloEvent : uint8_t {
+    TICK,
+};
 
-    printf("\n");
-    printf("\n");
-    printf("                  SIFIVE, INC.\n");
-    printf("\n");
-    printf("           5555555555555555555555555\n");
-    printf("          5555                   5555\n");
-    printf("         5555                     5555\n");
-    printf("        5555                       5555\n");
-    printf("       5555       5555555555555555555555\n");
-    printf("      5555       555555555555555555555555\n");
-    printf("     5555                             5555\n");
-    printf("    5555                               5555\n");
-    printf("   5555                                 5555\n");
-    printf("  5555555555555555555555555555          55555\n");
-    printf("   55555           555555555           55555\n");
-    printf("     55555           55555           55555\n");
-    printf("       55555           5           55555\n");
-    printf("         55555                   55555\n");
-    printf("           55555               55555\n");
-    printf("             55555           55555\n");
-    printf("               55555       55555\n");
-    printf("                 55555   55555\n");
-    printf("                   555555555\n");
-    printf("                     55555\n");
-    printf("                       5\n");
-    printf("\n");
-
-    printf("\n");
-    printf("               Welcome to SiFive!\n");
+static struct metal_cpu *cpu;
 
-}
+// Printing goes through the formatter rather than printf, which keeps newlib's
+// vfprintf out of the image
+static MetalUartStream console;
+static hifive1b::InterruptController interrupts;
+static hifive1b::MemoryMonitor memory;
 
-static void timer_isr (int id, void *data) {
+// Events wait here from the timer isr until the main loop hands them over,
+// stamped with the cycle counter so the wait can be measured
+static Dispatcher<HelloEvent, 8> dispatcher(hifive1b::csr::read_mcycle);
 
-    // Disable Timer interrupt
-    metal_interrupt_disable(tmr_intr, tmr_id);
+static void display_banner (void) {
+    console << "\n";
+    console << "\n";
+    console << "                  SIFIVE, INC.\n";
+    console << "\n";
+    console << "           5555555555555555555555555\n";
+    console << "          5555                   5555\n";
+    console << "         5555                     5555\n";
+    console << "        5555                       5555\n";
+    console << "       5555       5555555555555555555555\n";
+    console << "      5555       555555555555555555555555\n";
+    console << "     5555                             5555\n";
+    console << "    5555                               5555\n";
+    console << "   5555                                 5555\n";
+    console << "  5555555555555555555555555555          55555\n";
+    console << "   55555           555555555           55555\n";
+    console << "     55555           55555           55555\n";
+    console << "       55555           5           55555\n";
+    console << "         55555                   55555\n";
+    console << "           55555               55555\n";
+    console << "             55555           55555\n";
+    console << "               55555       55555\n";
+    console << "                 55555   55555\n";
+    console << "                   555555555\n";
+    console << "                     55555\n";
+    console << "                       5\n";
+    console << "\n";
+
+    console << "\n";
+    console << "               Welcome to SiFive!\n";
 
-    // Flag showing we hit timer isr
-    timer_isr_flag = 1;
 }
 
-static void wait_for_timer(struct metal_led *which_led) {
-
-    // clear global timer isr flag
-    timer_isr_flag = 0;
-
-    // Turn on desired LED
-    metal_led_on(which_led);
-
-    // Set timer
-    metal_cpu_set_mtimecmp(cpu, metal_cpu_get_mtime(cpu) + RTC_FREQ);
-
-    // Enable Timer interrupt
-    metal_interrupt_enable(tmr_intr, tmr_id);
-
-    // wait till timer triggers and isr is hit
-    while (timer_isr_flag == 0){};
-
-    timer_isr_flag = 0;
-
-    // Turn off this LED
-    metal_led_off(which_led);
+// Red -> Green -> Blue, repeat, moving on each second
+class LedCycler : public ActiveObject<HelloEvent> {
+    public:
+        LedCycler(struct metal_led *red, struct metal_led *green, struct metal_led *blue) :
+            leds{red, green, blue}
+        {}
+
+        void start() {
+            metal_led_on(leds[current]);
+            arm_timer();
+        }
+
+        void on_event(const HelloEvent& event) override {
+            if (event != HelloEvent::TICK) {
+                return;
+            }
+
+            metal_led_off(leds[current]);
+            current = (current + 1) % 3;
+            metal_led_on(leds[current]);
+            arm_timer();
+
+            if (current == 0) {
+                print_stats();
+            }
+        }
+
+    private:
+        void arm_timer() {
+            metal_cpu_set_mtimecmp(cpu, metal_cpu_get_mtime(cpu) + RTC_FREQ);
+        }
+
+        void print_stats() {
+            // Cycles from entering the vector to calling timer_isr
+            const auto& irq = interrupts.get_stats(hifive1b::InterruptController::Vector::TIMER);
+            format::write<"Timer interrupt dispatch: {} cycles (min {}, max {})\n">(
+                console, irq.last_cycles, irq.min_cycles, irq.max_cycles);
+
+            // Cycles from the isr posting the tick to this object handling it
+            const auto& events = dispatcher.get_stats();
+            format::write<"Event dispatch: {} cycles (max {}), queue high water {}, dropped {}\n">(
+                console, events.last_latency, events.max_latency,
+                dispatcher.get_high_water(), dispatcher.get_dropped());
+
+            // High-water marks, to see how much RAM is left for buffers
+            auto usage = memory.get_usage();
+            format::write<"RAM: static {} B, stack peak {}/{} B, heap {}/{} B\n">(
+                console, usage.static_bytes, usage.stack_peak, usage.stack_size, usage.heap_used, usage.heap_size);
+        }
+
+        struct metal_led *leds[3];
+        unsigned current = 0;
+};
+
+static LedCycler *cycler;
+
+static void timer_isr (void *data) {
+
+    // Move the deadline out of reach so the interrupt stops
+    metal_cpu_set_mtimecmp(cpu, UINT64_MAX);
+
+    // Fault while the stack is still clear of .bss
+    memory.enforce();
+
+    // Leave the work to the main loop
+    dispatcher.post(*cycler, HelloEvent::TICK);
 }
 
 int hello_main (void)
 {
 
-    int rc;
     struct metal_led *led0_red, *led0_green, *led0_blue;
 
     // This demo will toggle LEDs colors so we define them here
@@ -95,7 +149,7 @@ int hello_main (void)
     led0_green = metal_led_get_rgb("LD0", "green");
     led0_blue = metal_led_get_rgb("LD0", "blue");
     if ((led0_red == NULL) || (led0_green == NULL) || (led0_blue == NULL)) {
-        printf("At least one of LEDs is null.\n");
+        console << "At least one of LEDs is null.\n";
         return 1;
     }
 
@@ -109,55 +163,27 @@ int hello_main (void)
     metal_led_off(led0_green);
     metal_led_off(led0_blue);
 
-    // Lets get the CPU and and its interrupt
+    // Lets get the CPU for its timer
     cpu = metal_cpu_get(metal_cpu_get_current_hartid());
     if (cpu == NULL) {
-        printf("CPU null.\n");
+        console << "CPU null.\n";
         return 2;
     }
-    cpu_intr = metal_cpu_interrupt_controller(cpu);
-    if (cpu_intr == NULL) {
-        printf("CPU interrupt controller is null.\n");
-        return 3;
-    }
-    metal_interrupt_init(cpu_intr);
 
     // display welcome banner
     display_banner();
 
-    // Setup Timer and its interrupt so we can toggle LEDs on 1s cadence
-    tmr_intr = metal_cpu_timer_interrupt_controller(cpu);
-    if (tmr_intr == NULL) {
-        printf("TIMER interrupt controller is  null.\n");
-        return 4;
-    }
-    metal_interrupt_init(tmr_intr);
-    tmr_id = metal_cpu_timer_get_interrupt_id(cpu);
-    rc = metal_interrupt_register_handler(tmr_intr, tmr_id, timer_isr, cpu);
-    if (rc < 0) {
-        printf("TIMER interrupt handler registration failed\n");
-        return (rc * -1);
-    }
-
-    // Lastly CPU interrupt
-    if (metal_interrupt_enable(cpu_intr, 0) == -1) {
-        printf("CPU interrupt enable failed\n");
-        return 6;
-    }
-
-    // Red -> Green -> Blue, repeat
-    while (1) {
+    static LedCycler led_cycler(led0_red, led0_green, led0_blue);
+    cycler = &led_cycler;
 
-        // Turn on RED
-        wait_for_timer(led0_red);
+    // Setup Timer and its interrupt so we can toggle LEDs on 1s cadence.
+    // The timer must not fire before the first deadline is set.
+    metal_cpu_set_mtimecmp(cpu, UINT64_MAX);
+    interrupts.install();
+    interrupts.set_timer_handler(timer_isr);
 
-        // Turn on Green
-        wait_for_timer(led0_green);
+    led_cycler.start();
 
-        // Turn on Blue
-        wait_for_timer(led0_blue);
-    }
-
-    // return
-    return 0;
-}
\ No newline at end of file
+    // Handle events as they're posted, sleeping in wfi while there are none
+    dispatcher.run([](auto ready) { hifive1b::InterruptController::sleep_until(ready); });
+}
@@ -4,6 +4,8 @@
  * 	HELLO_APP	- SiFive Hello World application
  *  WIFI_APP	- WiFi demo application
  *  ESP32_AT_APP	- ESP32 AT command set testing
+ *  FLASH_BENCH_APP	- Instruction fetch speed of the XIP flash formats
+ *  BENCH_APP	- Cycle counts of the shared microbenchmark kernels (lib/bench)
  */
 #define WIFI_APP 1
 
@@ -24,6 +26,16 @@ static main_fn_ptr app_entry {&wifi_main};
 #include "esp32_at_app.hpp"
 static main_fn_ptr app_entry {&esp32_at_main};
 
+#elif defined FLASH_BENCH_APP
+
+#include "flash_bench.hpp"
+static main_fn_ptr app_entry {&flash_bench_main};
+
+#elif defined BENCH_APP
+
+#include "bench_app.hpp"
+static main_fn_ptr app_entry {&bench_main};
+
 #else
 
 #	error Please select a startup app.
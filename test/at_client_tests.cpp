@@ -0,0 +1,307 @@
+/// Tests for the ESP32 AT response parser and command client
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <esp32_at/at_client.hpp>
+
+#include "scripted_esp32.hpp"
+
+using esp32::AtClient;
+using esp32::AtParser;
+
+/// Records everything the parser reports
+class RecordingListener : public AtParser::Listener {
+	public:
+		void on_line(AtParser::LineType type, std::string_view line) override {
+			lines.emplace_back(type, std::string(line));
+		}
+
+		void on_prompt() override {
+			++prompts;
+		}
+
+		void on_ipd(const AtParser::IpdFragment& fragment) override {
+			link_id = fragment.link_id;
+			length = fragment.length;
+			payload += fragment.data;
+			fragments += 1;
+		}
+
+		std::vector<std::pair<AtParser::LineType, std::string>> lines;
+		int prompts = 0;
+		int link_id = 0;
+		int length = 0;
+		int fragments = 0;
+		std::string payload;
+};
+
+TEST(AtParserTests, LinesSplitAcrossChunks) {
+	RecordingListener listener;
+	AtParser parser(listener);
+
+	parser.feed("\r\n+CIFSR:STAIP,\"192.16");
+	parser.feed("8.4.1\"\r\n\r\nO");
+	parser.feed("K\r\nWIFI CONNECTED\r");
+	parser.feed("\n");
+
+	ASSERT_EQ(listener.lines.size(), 3u);
+	EXPECT_EQ(listener.lines[0].first, AtParser::LineType::INFO);
+	EXPECT_EQ(listener.lines[0].second, "+CIFSR:STAIP,\"192.168.4.1\"");
+	EXPECT_EQ(listener.lines[1].first, AtParser::LineType::OK);
+	EXPECT_EQ(listener.lines[2].first, AtParser::LineType::URC);
+}
+
+TEST(AtParserTests, IpdPayloadIsStreamed) {
+	RecordingListener listener;
+	AtParser parser(listener);
+
+	// The payload contains a line terminator and the header is split across chunks
+	parser.feed("\r\n+IP");
+	parser.feed("D,2,10:abc\r\n");
+	parser.feed("defgh1,CLOSED\r\n");
+
+	EXPECT_EQ(listener.link_id, 2);
+	EXPECT_EQ(listener.length, 10);
+	EXPECT_EQ(listener.payload, "abc\r\ndefgh");
+	EXPECT_EQ(listener.fragments, 2);
+
+	ASSERT_EQ(listener.lines.size(), 1u);
+	EXPECT_EQ(listener.lines[0].first, AtParser::LineType::URC);
+	EXPECT_EQ(listener.lines[0].second, "1,CLOSED");
+}
+
+TEST(AtParserTests, SingleConnectionIpdWithRemoteInfo) {
+	RecordingListener listener;
+	AtParser parser(listener);
+
+	parser.feed("+IPD,3,\"10.0.0.2\",5000:xyz");
+
+	EXPECT_EQ(listener.link_id, -1);
+	EXPECT_EQ(listener.payload, "xyz");
+}
+
+TEST(AtClientTests, CommandCompletesWithInfoLines) {
+	ScriptedEsp32 esp;
+	AtClient client(esp);
+
+	esp.expect("AT+CIFSR\r\n", {"+CIFSR:STAIP,\"10.0.0.2\"\r\n", "\r\nOK\r\n"});
+
+	std::vector<std::string> lines;
+	bool done = false;
+	client.submit({.text = "AT+CIFSR\r\n", .timeout_ms = 100,
+		.on_line = [&lines](std::string_view line) { lines.emplace_back(line); },
+		.on_complete = [&done](AtClient::Result result) {
+			EXPECT_EQ(result, AtClient::Result::OK);
+			done = true;
+		}
+	});
+
+	client.poll(0);
+	client.poll(1);
+
+	EXPECT_TRUE(done);
+	ASSERT_EQ(lines.size(), 1u);
+	EXPECT_EQ(lines[0], "+CIFSR:STAIP,\"10.0.0.2\"");
+	EXPECT_EQ(client.pending(), 0u);
+}
+
+TEST(AtClientTests, CommandsArePipelined) {
+	ScriptedEsp32 esp;
+	AtClient client(esp, 3);
+
+	esp.hold_replies(true);
+	esp.expect("ATE0\r\n", {"\r\nOK\r\n"});
+	esp.expect("AT+CWMODE=1\r\n", {"\r\nOK", "\r\n"});
+	esp.expect("AT+CWJAP=\"x\",\"y\"\r\n", {"\r\nERROR\r\n"});
+
+	std::vector<AtClient::Result> results;
+	auto record = [&results](AtClient::Result result) { results.push_back(result); };
+
+	client.submit({.text = "ATE0\r\n", .timeout_ms = 100, .on_complete = record});
+	client.submit({.text = "AT+CWMODE=1\r\n", .timeout_ms = 100, .on_complete = record});
+	client.submit({.text = "AT+CWJAP=\"x\",\"y\"\r\n", .timeout_ms = 100, .on_complete = record});
+
+	// All three go out before any response
+	client.poll(0);
+	EXPECT_EQ(esp.sent.size(), 3u);
+	EXPECT_EQ(client.in_flight(), 3u);
+	EXPECT_TRUE(results.empty());
+
+	esp.release_replies();
+	client.poll(1);
+
+	ASSERT_EQ(results.size(), 3u);
+	EXPECT_EQ(results[0], AtClient::Result::OK);
+	EXPECT_EQ(results[1], AtClient::Result::OK);
+	EXPECT_EQ(results[2], AtClient::Result::ERROR);
+	EXPECT_TRUE(esp.unexpected.empty());
+}
+
+TEST(AtClientTests, PipelineDepthIsLimited) {
+	ScriptedEsp32 esp;
+	AtClient client(esp, 2);
+
+	esp.hold_replies(true);
+	for (int i = 0; i < 3; ++i) {
+		esp.expect("AT\r\n", {"OK\r\n"});
+		client.submit({.text = "AT\r\n"});
+	}
+
+	client.poll(0);
+	EXPECT_EQ(esp.sent.size(), 2u);
+
+	esp.release_replies();
+	client.poll(1);
+	EXPECT_EQ(esp.sent.size(), 3u);
+}
+
+TEST(AtClientTests, TimeoutCompletesOldestCommand) {
+	ScriptedEsp32 esp;
+	AtClient client(esp);
+
+	AtClient::Result result = AtClient::Result::OK;
+	client.submit({.text = "AT+CWLAP\r\n", .timeout_ms = 50,
+		.on_complete = [&result](AtClient::Result r) { result = r; }});
+
+	client.poll(1000);
+	client.poll(1049);
+	EXPECT_EQ(client.pending(), 1u);
+
+	client.poll(1050);
+	EXPECT_EQ(client.pending(), 0u);
+	EXPECT_EQ(result, AtClient::Result::TIMEOUT);
+}
+
+TEST(AtClientTests, LateReplyIsNotTakenForTheNextCommand) {
+	ScriptedEsp32 esp;
+	AtClient client(esp, 2);
+
+	esp.hold_replies(true);
+	esp.expect("AT+CWLAP\r\n", {"\r\nOK\r\n"});
+	esp.expect("AT+CIFSR\r\n", {"\r\nERROR\r\n"});
+	esp.expect("AT\r\n", {"\r\nOK\r\n"});
+	esp.expect("AT+GMR\r\n", {"\r\nERROR\r\n"});
+
+	std::vector<AtClient::Result> results;
+	auto record = [&results](AtClient::Result result) { results.push_back(result); };
+
+	client.submit({.text = "AT+CWLAP\r\n", .timeout_ms = 50, .on_complete = record});
+	client.submit({.text = "AT+CIFSR\r\n", .timeout_ms = 50, .on_complete = record});
+	client.submit({.text = "AT+GMR\r\n", .timeout_ms = 50, .on_complete = record});
+	client.poll(0);
+	EXPECT_EQ(esp.sent.size(), 2u);
+
+	// The command behind the timed out one can't be told apart from the late answer, so it's given up on too
+	client.poll(50);
+	ASSERT_EQ(results.size(), 2u);
+	EXPECT_EQ(results[0], AtClient::Result::TIMEOUT);
+	EXPECT_EQ(results[1], AtClient::Result::ABORTED);
+	EXPECT_EQ(esp.sent.back(), "AT\r\n");
+
+	// The late answers and the marker's answer are all discarded before the next command is sent
+	esp.release_replies();
+	client.poll(60);
+	EXPECT_EQ(results.size(), 2u);
+	EXPECT_EQ(esp.sent.back(), "AT+GMR\r\n");
+
+	esp.release_replies();
+	client.poll(61);
+	ASSERT_EQ(results.size(), 3u);
+	EXPECT_EQ(results[2], AtClient::Result::ERROR);
+	EXPECT_TRUE(esp.script_done());
+	EXPECT_TRUE(esp.unexpected.empty());
+}
+
+TEST(AtClientTests, LostReplyIsGivenUpAtTheMarkerDeadline) {
+	ScriptedEsp32 esp;
+	AtClient client(esp, 1);
+
+	esp.expect("AT+CWLAP\r\n", {});
+	esp.expect("AT\r\n", {"\r\nOK\r\n"});
+	esp.expect("AT+GMR\r\n", {"\r\nOK\r\n"});
+
+	AtClient::Result result = AtClient::Result::ERROR;
+	client.submit({.text = "AT+CWLAP\r\n", .timeout_ms = 50});
+	client.submit({.text = "AT+GMR\r\n", .on_complete = [&result](AtClient::Result r) { result = r; }});
+	client.poll(0);
+	client.poll(50);
+
+	// The marker's answer could still be the late one, so nothing is sent until the marker's own deadline
+	client.poll(51);
+	client.poll(50 + AtClient::DEFAULT_TIMEOUT_MS - 1);
+	EXPECT_EQ(esp.sent.back(), "AT\r\n");
+
+	client.poll(50 + AtClient::DEFAULT_TIMEOUT_MS);
+	client.poll(50 + AtClient::DEFAULT_TIMEOUT_MS + 1);
+	EXPECT_EQ(result, AtClient::Result::OK);
+	EXPECT_TRUE(esp.script_done());
+}
+
+TEST(AtClientTests, BusyCommandIsResent) {
+	ScriptedEsp32 esp;
+	AtClient client(esp, 2);
+
+	esp.hold_replies(true);
+	esp.expect("AT+RST\r\n", {"\r\nOK\r\n"});
+	esp.expect("ATE0\r\n", {});
+	esp.expect("ATE0\r\n", {"\r\nOK\r\n"});
+
+	int completed = 0;
+	client.submit({.text = "AT+RST\r\n", .timeout_ms = 100,
+		.on_complete = [&completed](AtClient::Result) { ++completed; }});
+	client.submit({.text = "ATE0\r\n", .timeout_ms = 100,
+		.on_complete = [&completed](AtClient::Result) { ++completed; }});
+
+	// The second command arrives while the ESP32 is still handling the first
+	client.poll(0);
+	esp.inject("busy p...\r\n");
+	client.poll(1);
+	EXPECT_EQ(client.in_flight(), 1u);
+
+	esp.release_replies();
+	client.poll(2);
+	esp.release_replies();
+	client.poll(3);
+
+	EXPECT_EQ(completed, 2);
+	EXPECT_EQ(esp.sent.size(), 3u);
+	EXPECT_TRUE(esp.script_done());
+}
+
+TEST(AtClientTests, SendWaitsForPrompt) {
+	ScriptedEsp32 esp;
+	AtClient client(esp);
+
+	esp.expect("AT+CIPSEND=5\r\n", {"\r\nOK\r\n", ">"});
+	esp.expect("hello", {"\r\nRecv 5 bytes\r\n", "\r\nSEND OK\r\n"});
+
+	AtClient::Result result = AtClient::Result::ERROR;
+	client.submit({.text = "AT+CIPSEND=5\r\n", .timeout_ms = 100,
+		.on_complete = [&result](AtClient::Result r) { result = r; }, .payload = "hello"});
+
+	client.poll(0);
+	client.poll(1);
+
+	EXPECT_EQ(result, AtClient::Result::OK);
+	EXPECT_TRUE(esp.script_done());
+}
+
+TEST(AtClientTests, NotificationsAndDataAreRouted) {
+	ScriptedEsp32 esp;
+	AtClient client(esp);
+
+	std::vector<std::string> notifications;
+	std::string data;
+	client.set_urc_handler([&notifications](std::string_view line) { notifications.emplace_back(line); });
+	client.set_data_handler([&data](const AtParser::IpdFragment& fragment) { data += fragment.data; });
+
+	esp.inject("WIFI CONNECTED\r\nWIFI GOT IP\r\n+IPD,4:ping");
+	client.poll(0);
+
+	ASSERT_EQ(notifications.size(), 2u);
+	EXPECT_EQ(notifications[1], "WIFI GOT IP");
+	EXPECT_EQ(data, "ping");
+}
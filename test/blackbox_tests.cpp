@@ -0,0 +1,218 @@
+/// Tests for the black box recorder
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <storage/blackbox.hpp>
+#include <storage/file_flash.hpp>
+
+using storage::BlackboxPage;
+using storage::FileFlash;
+
+/// Eight 32-bit channels: 32 bytes per sample before compression
+using Recorder = storage::BlackboxRecorder<8>;
+
+class BlackboxTests : public ::testing::Test {
+	protected:
+		static constexpr std::size_t FLASH_SIZE = 512 * 1024;
+
+		BlackboxTests() :
+			path(::testing::TempDir() + "blackbox_tests.bin")
+		{
+			std::remove(path.c_str());
+		}
+
+		~BlackboxTests() override {
+			std::remove(path.c_str());
+		}
+
+		/// Something like a control loop: slowly varying signals with a little noise
+		static Recorder::Sample make_sample(uint32_t i, uint32_t timestamp_us) {
+			Recorder::Sample sample;
+			sample.timestamp_us = timestamp_us;
+			for (std::size_t c = 0; c < sample.values.size(); ++c) {
+				double phase = (i + c * 100) * 0.002 * (c + 1);
+				sample.values[c] = static_cast<int32_t>(std::sin(phase) * 20000 * (c + 1)) + static_cast<int32_t>((i * 7919 + c * 31) % 17);
+			}
+			return sample;
+		}
+
+		/// Read the pages back in order and return every sample
+		static std::vector<Recorder::Sample> read_back(FileFlash& flash, uint32_t length) {
+			std::vector<Recorder::Sample> samples;
+			uint8_t page[256];
+			uint16_t expected_sequence = 0;
+
+			for (uint32_t address = 0; address < length; address += sizeof(page)) {
+				flash.read(address, page, sizeof(page));
+				uint16_t sequence = 0;
+				BlackboxPage result = storage::decode_blackbox_page(page, sizeof(page),
+					[&](uint32_t t, const int32_t* values, std::size_t channels) {
+						Recorder::Sample sample;
+						sample.timestamp_us = t;
+						for (std::size_t c = 0; c < channels; ++c) {
+							sample.values[c] = values[c];
+						}
+						samples.push_back(sample);
+					}, sequence);
+
+				if (result == BlackboxPage::ERASED) {
+					break;
+				}
+				EXPECT_EQ(result, BlackboxPage::OK);
+				EXPECT_EQ(sequence, expected_sequence++);
+			}
+			return samples;
+		}
+
+		std::string path;
+};
+
+TEST_F(BlackboxTests, SustainsOneKilohertz) {
+	FileFlash flash(path.c_str(), FLASH_SIZE);
+	Recorder recorder(flash, 0, FLASH_SIZE);
+
+	recorder.erase();
+	while (recorder.get_state() == Recorder::State::ERASING) {
+		recorder.poll();
+		flash.advance(1000);
+	}
+	ASSERT_EQ(recorder.get_state(), Recorder::State::RECORDING);
+
+	// Ten seconds of a 1 kHz loop. Each iteration records, polls, then idles until the next millisecond.
+	constexpr uint32_t SAMPLES = 10000;
+	uint64_t loop_start = flash.now_us();
+	uint64_t worst_iteration = 0;
+	for (uint32_t i = 0; i < SAMPLES; ++i) {
+		uint64_t iteration_start = loop_start + i * 1000ULL;
+		if (flash.now_us() < iteration_start) {
+			flash.advance(static_cast<uint32_t>(iteration_start - flash.now_us()));
+		}
+
+		EXPECT_TRUE(recorder.record(make_sample(i, static_cast<uint32_t>(flash.now_us()))));
+		recorder.poll();
+
+		worst_iteration = std::max(worst_iteration, flash.now_us() - iteration_start);
+	}
+
+	recorder.stop();
+	EXPECT_FALSE(recorder.record(make_sample(SAMPLES, 0)));
+	while (recorder.is_flushing()) {
+		recorder.poll();
+	}
+
+	const auto& stats = recorder.get_stats();
+	EXPECT_EQ(stats.dropped, 0UL);
+	EXPECT_EQ(flash.get_stats().violations, 0UL);
+
+	// Neither recording nor polling waits for the flash
+	EXPECT_LT(worst_iteration, 100ULL);
+
+	// Smaller than the 32 bytes of each raw sample
+	EXPECT_LT(stats.encoded_bytes / SAMPLES, 24UL);
+
+	auto samples = read_back(flash, recorder.get_recorded_length());
+	ASSERT_EQ(samples.size(), SAMPLES);
+	for (uint32_t i = 0; i < SAMPLES; ++i) {
+		auto expected = make_sample(i, 0);
+		ASSERT_EQ(samples[i].values, expected.values) << "sample " << i;
+	}
+	EXPECT_EQ(samples.back().timestamp_us - samples.front().timestamp_us, (SAMPLES - 1) * 1000UL);
+}
+
+TEST_F(BlackboxTests, SlowFlashDropsInsteadOfBlocking) {
+	FileFlash::Timing slow;
+	slow.page_program_us = 50000;
+	FileFlash flash(path.c_str(), FLASH_SIZE, 4096, 256, slow);
+	Recorder recorder(flash, 0, 8192);
+
+	recorder.erase();
+	while (recorder.get_state() == Recorder::State::ERASING) {
+		recorder.poll();
+		flash.advance(1000);
+	}
+
+	uint32_t dropped_before_full = 0;
+	for (uint32_t i = 0; i < 2000; ++i) {
+		uint64_t before = flash.now_us();
+		recorder.record(make_sample(i, static_cast<uint32_t>(before)));
+		recorder.poll();
+		EXPECT_LT(flash.now_us() - before, 100ULL);
+		flash.advance(1000);
+
+		if (recorder.get_state() == Recorder::State::RECORDING) {
+			dropped_before_full = recorder.get_stats().dropped;
+		}
+	}
+
+	// The flash couldn't keep up, then the region filled
+	EXPECT_GT(dropped_before_full, 0UL);
+	EXPECT_EQ(recorder.get_state(), Recorder::State::FULL);
+	EXPECT_EQ(recorder.get_recorded_length(), 8192UL);
+	EXPECT_EQ(flash.get_stats().violations, 0UL);
+}
+
+TEST_F(BlackboxTests, ExtremeChangesRoundTrip) {
+	FileFlash flash(path.c_str(), FLASH_SIZE);
+	Recorder recorder(flash, 0, 4096);
+
+	recorder.erase();
+	while (recorder.get_state() == Recorder::State::ERASING) {
+		recorder.poll();
+	}
+
+	// Jumps between the ends of the range are larger than an int32_t can hold, so the deltas wrap around
+	std::vector<Recorder::Sample> expected;
+	for (uint32_t i = 0; i < 6; ++i) {
+		Recorder::Sample sample;
+		sample.timestamp_us = i * 1000;
+		for (std::size_t c = 0; c < sample.values.size(); ++c) {
+			sample.values[c] = ((i + c) % 2 == 0) ? INT32_MAX : INT32_MIN;
+		}
+		expected.push_back(sample);
+		recorder.record(sample);
+	}
+	recorder.stop();
+	while (recorder.is_flushing()) {
+		recorder.poll();
+	}
+
+	auto samples = read_back(flash, recorder.get_recorded_length());
+	ASSERT_EQ(samples.size(), expected.size());
+	for (std::size_t i = 0; i < samples.size(); ++i) {
+		EXPECT_EQ(samples[i].values, expected[i].values) << "sample " << i;
+	}
+}
+
+TEST_F(BlackboxTests, CorruptPagesAreRejected) {
+	FileFlash flash(path.c_str(), FLASH_SIZE);
+	Recorder recorder(flash, 0, 4096);
+
+	recorder.erase();
+	while (recorder.get_state() == Recorder::State::ERASING) {
+		recorder.poll();
+	}
+	for (uint32_t i = 0; i < 10; ++i) {
+		recorder.record(make_sample(i, i * 1000));
+	}
+	recorder.stop();
+	while (recorder.is_flushing()) {
+		recorder.poll();
+	}
+
+	uint8_t page[256];
+	flash.read(0, page, sizeof(page));
+	uint16_t sequence = 0;
+	auto ignore = [](uint32_t, const int32_t*, std::size_t) {};
+	EXPECT_EQ(storage::decode_blackbox_page(page, sizeof(page), ignore, sequence), BlackboxPage::OK);
+
+	page[12] ^= 0x01;
+	EXPECT_EQ(storage::decode_blackbox_page(page, sizeof(page), ignore, sequence), BlackboxPage::CORRUPT);
+
+	flash.read(256, page, sizeof(page));
+	EXPECT_EQ(storage::decode_blackbox_page(page, sizeof(page), ignore, sequence), BlackboxPage::ERASED);
+}
@@ -0,0 +1,175 @@
+/// Tests for the low-latency control uplink
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <embedded_util/crc.hpp>
+
+#include <esp32_at/at_client.hpp>
+#include <esp32_at/control_uplink.hpp>
+
+#include "scripted_esp32.hpp"
+
+using esp32::AtClient;
+using esp32::ControlUplink;
+
+/// Build a +IPD notification carrying one control packet
+static std::string control_packet(uint16_t sequence, uint32_t sent_us, int16_t first_channel) {
+	std::string packet;
+	auto put16 = [&](uint16_t v) {
+		packet += static_cast<char>(v & 0xFF);
+		packet += static_cast<char>(v >> 8);
+	};
+
+	packet += static_cast<char>(ControlUplink::VERSION);
+	put16(sequence);
+	put16(static_cast<uint16_t>(sent_us));
+	put16(static_cast<uint16_t>(sent_us >> 16));
+	put16(static_cast<uint16_t>(first_channel));
+	for (std::size_t i = 1; i < ControlUplink::CHANNELS; ++i) {
+		put16(static_cast<uint16_t>(-static_cast<int16_t>(i)));
+	}
+	put16(Crc16::calculate(reinterpret_cast<const uint8_t*>(packet.data()), packet.size()));
+
+	return "\r\n+IPD," + std::to_string(packet.size()) + ":" + packet;
+}
+
+/// Simulated ESP32 delivering control packets with a chosen network delay
+class ControlUplinkTests : public ::testing::Test {
+	protected:
+		ControlUplinkTests() :
+			client(esp)
+		{
+			client.set_data_handler([this](const esp32::AtParser::IpdFragment& fragment) {
+				uplink.on_ipd(fragment, now_us);
+			});
+		}
+
+		/// The sender's clock runs well ahead of ours; only differences in transit time matter
+		void send(uint16_t sequence, uint32_t sent_local_us, uint32_t delay_us, int16_t value = 0) {
+			esp.inject_at(sent_local_us + delay_us, control_packet(sequence, sent_local_us + SENDER_OFFSET_US, value));
+		}
+
+		/// Step simulated time in 100 us ticks, polling like the main loop
+		void run_until(uint32_t end_us) {
+			for (; static_cast<int32_t>(end_us - now_us) > 0; now_us += 100) {
+				esp.set_time(now_us);
+				client.poll(now_us / 1000);
+				uplink.poll(now_us);
+			}
+		}
+
+		static constexpr uint32_t SENDER_OFFSET_US = 5'000'000;
+
+		ScriptedEsp32 esp;
+		AtClient client;
+		ControlUplink uplink;
+		uint32_t now_us = 0;
+};
+
+TEST_F(ControlUplinkTests, LatestValueWins) {
+	EXPECT_TRUE(uplink.in_failsafe());
+
+	send(1, 1000, 2000, 100);
+	run_until(3500);
+	ASSERT_TRUE(uplink.take_update());
+	EXPECT_FALSE(uplink.take_update());
+	EXPECT_FALSE(uplink.in_failsafe());
+	EXPECT_EQ(uplink.latest().sequence, 1);
+	EXPECT_EQ(uplink.latest().channels[0], 100);
+	EXPECT_EQ(uplink.latest().channels[3], -3);
+	EXPECT_EQ(uplink.latest().received_us, 3000u);
+
+	// Packet 3 overtakes packet 2, which is then dropped as stale
+	send(2, 10'000, 8000, 200);
+	send(3, 12'000, 2000, 300);
+	run_until(20'000);
+	EXPECT_EQ(uplink.latest().sequence, 3);
+	EXPECT_EQ(uplink.latest().channels[0], 300);
+
+	const auto& stats = uplink.get_stats();
+	EXPECT_EQ(stats.received, 2u);
+	EXPECT_EQ(stats.stale, 1u);
+	EXPECT_EQ(stats.lost, 1u);
+}
+
+TEST_F(ControlUplinkTests, LatencyHistogramAndJitter) {
+	// Alternate between 1 ms and 3 ms of delay: a constant 2 ms change in transit time
+	for (uint16_t i = 0; i < 100; ++i) {
+		send(i, i * 10'000, (i % 2) ? 3000 : 1000);
+	}
+	run_until(100 * 10'000 + 5000);
+
+	const auto& stats = uplink.get_stats();
+	EXPECT_EQ(stats.received, 100u);
+	EXPECT_EQ(stats.failsafes, 0u);
+
+	// Half the packets are at the minimum, half are 2 ms behind it. Arrival is only resolved to a 100 us tick.
+	EXPECT_EQ(stats.latency_histogram[0], 50u);
+	EXPECT_EQ(stats.latency_histogram[4], 50u);
+	EXPECT_EQ(stats.max_latency_us, 2000u);
+	EXPECT_NEAR(stats.jitter_us, 2000, 100);
+}
+
+TEST_F(ControlUplinkTests, FailsafeWhenPacketsStop) {
+	for (uint16_t i = 0; i < 10; ++i) {
+		send(i, i * 20'000, 1500);
+	}
+	run_until(200'000);
+	EXPECT_FALSE(uplink.in_failsafe());
+
+	// The last packet arrived at 181.5 ms, so failsafe engages just after 431.5 ms
+	run_until(431'000);
+	EXPECT_FALSE(uplink.in_failsafe());
+	run_until(432'000);
+	EXPECT_TRUE(uplink.in_failsafe());
+	EXPECT_EQ(uplink.get_stats().failsafes, 1u);
+
+	// A fresh packet recovers
+	send(10, 500'000, 1500);
+	run_until(510'000);
+	EXPECT_FALSE(uplink.in_failsafe());
+	EXPECT_EQ(uplink.get_stats().lost, 0u);
+}
+
+TEST_F(ControlUplinkTests, SenderRestartIsFollowed) {
+	for (uint16_t i = 0; i < 10; ++i) {
+		send(1000 + i, i * 20'000, 1500);
+	}
+	run_until(200'000);
+
+	// Right after the last packet, a lower sequence number is stale
+	send(5, 200'000, 1500);
+	run_until(210'000);
+	EXPECT_EQ(uplink.get_stats().stale, 1u);
+	EXPECT_EQ(uplink.latest().sequence, 1009);
+
+	// The sender restarts from 0 after the failsafe time, and is followed from its first packet
+	run_until(500'000);
+	EXPECT_TRUE(uplink.in_failsafe());
+	for (uint16_t i = 0; i < 5; ++i) {
+		send(i, 500'000 + i * 20'000, 1500, static_cast<int16_t>(i));
+	}
+	run_until(600'000);
+	EXPECT_FALSE(uplink.in_failsafe());
+	EXPECT_EQ(uplink.latest().sequence, 4);
+	EXPECT_EQ(uplink.latest().channels[0], 4);
+	EXPECT_EQ(uplink.get_stats().stale, 1u);
+	EXPECT_EQ(uplink.get_stats().lost, 0u);
+}
+
+TEST_F(ControlUplinkTests, CorruptPacketsAreIgnored) {
+	std::string bad = control_packet(1, 0, 55);
+	bad[bad.size() - 5] ^= 0x01;
+	esp.inject_at(1000, bad);
+	esp.inject_at(2000, "\r\n+IPD,3:abc");
+
+	// Other connections are not control traffic
+	esp.inject_at(3000, "\r\n+IPD,1,4:abcd");
+
+	run_until(5000);
+	EXPECT_TRUE(uplink.in_failsafe());
+	EXPECT_EQ(uplink.get_stats().corrupt, 2u);
+	EXPECT_EQ(uplink.get_stats().received, 0u);
+}
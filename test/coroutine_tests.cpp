@@ -0,0 +1,219 @@
+/// Tests for the coroutine tasks, executor, completions and line reader
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <embedded_util/coroutine.hpp>
+#include <embedded_util/line_reader.hpp>
+
+static uint32_t fake_ticks = 0;
+static uint32_t read_fake_ticks() {
+	return fake_ticks;
+}
+
+/// Every test has to let its coroutines finish, or their frames stay taken for the tests after it
+class CoroutineTests : public ::testing::Test {
+	protected:
+		CoroutineTests() {
+			fake_ticks = 0;
+		}
+
+		~CoroutineTests() override {
+			EXPECT_EQ(coroutine_frames.get_stats().in_use, 0UL);
+		}
+
+		Executor executor {read_fake_ticks};
+};
+
+static Task<int> add(int a, int b) {
+	co_return a + b;
+}
+
+static Task<> sum_into(int& result) {
+	int first = co_await add(1, 2);
+	result = co_await add(first, 10);
+}
+
+TEST_F(CoroutineTests, AwaitedTasksReturnValues) {
+	int result = 0;
+	EXPECT_TRUE(executor.spawn(sum_into(result)));
+	// Nothing waited, so it all ran inside spawn()
+	EXPECT_EQ(result, 13);
+}
+
+static Task<> wait_on(Completion<int>& completion, std::vector<int>& log) {
+	log.push_back(0);
+	log.push_back(co_await completion);
+}
+
+TEST_F(CoroutineTests, CompletionResumesOnlyFromPoll) {
+	Completion<int> completion;
+	std::vector<int> log;
+	executor.spawn(wait_on(completion, log));
+	EXPECT_EQ(log, std::vector<int>{0});
+
+	// As an interrupt handler would: the coroutine is queued, not resumed in the handler
+	completion.complete(7);
+	EXPECT_EQ(log, std::vector<int>{0});
+
+	EXPECT_EQ(executor.poll(), 1UL);
+	EXPECT_EQ(log, (std::vector<int>{0, 7}));
+}
+
+TEST_F(CoroutineTests, CompletionBeforeAwaitDoesNotSuspend) {
+	Completion<int> completion;
+	std::vector<int> log;
+	completion.complete(3);
+	executor.spawn(wait_on(completion, log));
+	EXPECT_EQ(log, (std::vector<int>{0, 3}));
+	EXPECT_EQ(executor.poll(), 0UL);
+}
+
+static Task<> wait_for(Completion<>& completion, uint32_t ticks, int& result) {
+	result = (co_await completion.wait_for(ticks)) ? 1 : 0;
+}
+
+TEST_F(CoroutineTests, TimedWaitEndsEitherWay) {
+	Completion<> completion;
+	int result = -1;
+
+	executor.spawn(wait_for(completion, 100, result));
+	fake_ticks = 99;
+	executor.poll();
+	EXPECT_EQ(result, -1);
+	fake_ticks = 100;
+	executor.poll();
+	EXPECT_EQ(result, 0);
+
+	// A late completion is ignored
+	completion.complete();
+	EXPECT_EQ(executor.poll(), 0UL);
+
+	completion.reset();
+	executor.spawn(wait_for(completion, 100, result));
+	completion.complete();
+	executor.poll();
+	EXPECT_EQ(result, 1);
+	EXPECT_FALSE(executor.next_deadline().has_value());
+
+	// Nothing happens when the timeout would have passed
+	fake_ticks = 300;
+	EXPECT_EQ(executor.poll(), 0UL);
+}
+
+static Task<> sleeper(uint32_t ticks, int id, std::vector<int>& woken) {
+	co_await sleep_for(ticks);
+	woken.push_back(id);
+}
+
+TEST_F(CoroutineTests, SleepersWakeInDeadlineOrderAcrossWrap) {
+	fake_ticks = UINT32_MAX - 10;
+	std::vector<int> woken;
+	executor.spawn(sleeper(30, 3, woken));
+	executor.spawn(sleeper(5, 1, woken));
+	executor.spawn(sleeper(20, 2, woken));
+	executor.spawn(sleeper(0, 0, woken));
+	EXPECT_EQ(woken, std::vector<int>{0});
+	EXPECT_EQ(executor.next_deadline(), UINT32_MAX - 5);
+
+	fake_ticks += 20;
+	EXPECT_EQ(executor.poll(), 2UL);
+	EXPECT_EQ(woken, (std::vector<int>{0, 1, 2}));
+
+	fake_ticks += 10;
+	executor.poll();
+	EXPECT_EQ(woken, (std::vector<int>{0, 1, 2, 3}));
+	EXPECT_FALSE(executor.next_deadline().has_value());
+}
+
+TEST_F(CoroutineTests, SpawnFailsWhenFramesRunOut) {
+	std::vector<Completion<int>> completions(COROUTINE_FRAMES);
+	std::vector<int> log;
+	for (auto& c : completions) {
+		EXPECT_TRUE(executor.spawn(wait_on(c, log)));
+	}
+	EXPECT_EQ(coroutine_frames.get_stats().in_use, static_cast<uint32_t>(COROUTINE_FRAMES));
+
+	uint32_t failures = coroutine_frames.get_stats().failures;
+	EXPECT_FALSE(executor.spawn(wait_on(completions[0], log)));
+	EXPECT_EQ(coroutine_frames.get_stats().failures, failures + 1);
+
+	// Completing them all frees the frames
+	for (auto& c : completions) {
+		c.complete(1);
+	}
+	executor.poll();
+	EXPECT_EQ(executor.get_ready_high_water(), static_cast<uint32_t>(COROUTINE_FRAMES));
+}
+
+static Task<> count_completions(Completion<>& completion, int rounds, int& count) {
+	for (int i = 0; i < rounds; ++i) {
+		co_await completion;
+		completion.reset();
+		++count;
+	}
+}
+
+TEST_F(CoroutineTests, CompletionsFromAnotherThread) {
+	// The thread stands in for an interrupt handler, which can complete at any point relative to the await
+	constexpr int ROUNDS = 1000;
+	Completion<> completion;
+	int count = 0;
+	executor.spawn(count_completions(completion, ROUNDS, count));
+
+	std::atomic<int> handled {0};
+	std::thread handler([&] {
+		for (int i = 0; i < ROUNDS; ++i) {
+			// Wait for the coroutine to be ready for the next operation
+			while (completion.done()) {
+				std::this_thread::yield();
+			}
+			completion.complete();
+			++handled;
+		}
+	});
+
+	// Yielding lets the handler run on a single core instead of waiting out a time slice
+	while (count < ROUNDS) {
+		executor.poll();
+		std::this_thread::yield();
+	}
+	handler.join();
+	EXPECT_EQ(handled.load(), ROUNDS);
+}
+
+static Task<> read_lines(LineReader<16>& reader, std::vector<std::string>& lines, int count) {
+	char buffer[8];
+	for (int i = 0; i < count; ++i) {
+		std::size_t len = co_await reader.read_line(buffer, sizeof(buffer));
+		lines.emplace_back(buffer, len);
+	}
+}
+
+TEST_F(CoroutineTests, LineReaderWaitsForWholeLines) {
+	LineReader<16> reader;
+	std::vector<std::string> lines;
+	executor.spawn(read_lines(reader, lines, 3));
+
+	for (char c : std::string("AT+G")) {
+		reader.push(c);
+	}
+	EXPECT_EQ(executor.poll(), 0UL);
+
+	for (char c : std::string("MR\r\n\nAT\r")) {
+		reader.push(c);
+	}
+	executor.poll();
+	EXPECT_EQ(lines, (std::vector<std::string>{"AT+GMR", "AT"}));
+
+	// Longer than the buffer, so it is cut short
+	for (char c : std::string("0123456789\n")) {
+		reader.push(c);
+	}
+	executor.poll();
+	EXPECT_EQ(lines.back(), "01234567");
+	EXPECT_EQ(reader.get_dropped(), 0UL);
+}
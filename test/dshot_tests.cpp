@@ -0,0 +1,146 @@
+/// Tests for DShot output, decoding the SPI bitstream back into frames
+
+#include <optional>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <hifive1b_bsp/dshot.hpp>
+
+#include "fake_registers.hpp"
+#include "mock_clock.hpp"
+
+using hifive1b::DshotOutput;
+using hifive1b::SpiDriver;
+
+/// Read an encoded frame back as an ESC would: each bit is a 1 if it's high for more than half its length
+static std::optional<uint16_t> decode(const std::vector<uint8_t>& bytes, uint32_t samples_per_bit) {
+	auto sample = [&bytes](std::size_t i) { return (bytes[i / 8] >> (7 - i % 8)) & 1; };
+	if (bytes.size() != 2 * samples_per_bit + 1 || bytes.back() != 0) {
+		return std::nullopt;
+	}
+
+	uint16_t frame = 0;
+	for (std::size_t bit = 0; bit < 16; ++bit) {
+		// Every bit must be one high pulse followed by low
+		std::size_t start = bit * samples_per_bit;
+		uint32_t high = 0;
+		while (high < samples_per_bit && sample(start + high)) {
+			++high;
+		}
+		for (std::size_t i = high; i < samples_per_bit; ++i) {
+			if (sample(start + i)) {
+				return std::nullopt;
+			}
+		}
+		if (high == 0) {
+			return std::nullopt;
+		}
+		frame = static_cast<uint16_t>((frame << 1) | ((2 * high > samples_per_bit) ? 1 : 0));
+	}
+
+	// The checksum covers the value and telemetry bit
+	uint16_t data = frame >> 4;
+	if (((data ^ (data >> 4) ^ (data >> 8)) & 0xF) != (frame & 0xF)) {
+		return std::nullopt;
+	}
+	return frame;
+}
+
+static std::vector<uint8_t> encode(uint16_t frame, const DshotOutput::Timing& timing) {
+	std::vector<uint8_t> bytes(DshotOutput::MAX_FRAME_BYTES);
+	bytes.resize(DshotOutput::encode(frame, timing, bytes.data()));
+	return bytes;
+}
+
+TEST(DshotTests, FrameChecksum) {
+	// Throttle value 1046 without telemetry, as in the protocol's description
+	static_assert(DshotOutput::make_frame(1046, false) == 0b1000001011000110);
+	static_assert(DshotOutput::make_frame(0, false) == 0);
+	static_assert(DshotOutput::make_frame(0, true) == 0x0011);
+}
+
+TEST(DshotTests, EightSamplesGiveExactPulses) {
+	auto timing = DshotOutput::choose_timing(320'000'000, DshotOutput::Speed::DSHOT600);
+	timing.samples_per_bit = 8;
+	timing.one_high = 6;
+	timing.zero_high = 3;
+
+	// 1 is 0b11111100 and 0 is 0b11100000
+	auto bytes = encode(0b1010000000000000, timing);
+	EXPECT_EQ(bytes[0], 0xFC);
+	EXPECT_EQ(bytes[1], 0xE0);
+	EXPECT_EQ(bytes[2], 0xFC);
+	EXPECT_EQ(bytes[3], 0xE0);
+	EXPECT_EQ(bytes.size(), 17u);
+}
+
+TEST(DshotTests, EveryTimingDecodes) {
+	for (uint32_t n = DshotOutput::MIN_SAMPLES; n <= DshotOutput::MAX_SAMPLES; ++n) {
+		DshotOutput::Timing timing {n, (6 * n + 4) / 8, (3 * n + 4) / 8};
+		for (uint32_t value = 0; value <= DshotOutput::MAX_VALUE; value += 7) {
+			for (bool telemetry : {false, true}) {
+				uint16_t frame = DshotOutput::make_frame(static_cast<uint16_t>(value), telemetry);
+				EXPECT_EQ(decode(encode(frame, timing), n), frame) << "samples " << n << " value " << value;
+			}
+		}
+	}
+}
+
+TEST(DshotTests, TimingFollowsTheInputClock) {
+	for (auto speed : {DshotOutput::Speed::DSHOT150, DshotOutput::Speed::DSHOT300, DshotOutput::Speed::DSHOT600}) {
+		for (uint32_t f : {320'000'000u, 256'000'000u, 64'000'000u}) {
+			auto timing = DshotOutput::choose_timing(f, speed);
+			EXPECT_GE(timing.samples_per_bit, DshotOutput::MIN_SAMPLES);
+			EXPECT_LE(timing.samples_per_bit, DshotOutput::MAX_SAMPLES);
+			EXPECT_EQ(timing.sck_rate, SpiDriver::baud_rate_for(f, timing.samples_per_bit * static_cast<uint32_t>(speed)));
+			EXPECT_EQ(timing.bit_rate, timing.sck_rate / timing.samples_per_bit);
+			EXPECT_LE(timing.error_ppm, DshotOutput::MAX_RATE_ERROR_PPM) << "input " << f;
+		}
+	}
+
+	// The external oscillator alone can't reach DShot600 closely enough
+	EXPECT_GT(DshotOutput::choose_timing(16'000'000, DshotOutput::Speed::DSHOT600).error_ppm,
+		DshotOutput::MAX_RATE_ERROR_PPM);
+}
+
+class DshotOutputTests : public ::testing::Test {
+	protected:
+		// Register offsets
+		static constexpr uintptr_t SCKDIV = 0x00;
+		static constexpr uintptr_t CSMODE = 0x18;
+		static constexpr uintptr_t TXDATA = 0x48;
+
+		DshotOutputTests() :
+			clock(frequency::MHz(320))
+		{
+			spi.initialize(clock);
+		}
+
+		FakeRegisters registers {0x80};
+		MockClock clock;
+		SpiDriver spi {1, registers.base()};
+};
+
+TEST_F(DshotOutputTests, ProgramsTheController) {
+	DshotOutput dshot(spi, clock, DshotOutput::Speed::DSHOT300);
+	const auto& timing = dshot.get_timing();
+	EXPECT_TRUE(dshot.in_tolerance());
+	EXPECT_EQ(registers[CSMODE], 3u);
+	EXPECT_EQ(registers[SCKDIV], SpiDriver::divider_for(320'000'000, timing.samples_per_bit * 300'000));
+	EXPECT_EQ(spi.get_baud_rate(), timing.sck_rate);
+
+	// Frames end with the line low
+	dshot.set_throttle(1000);
+	EXPECT_EQ(registers[TXDATA], 0u);
+}
+
+TEST_F(DshotOutputTests, RetimesWhenTheClockChanges) {
+	DshotOutput dshot(spi, clock, DshotOutput::Speed::DSHOT600);
+
+	clock.change(frequency::MHz(64));
+	auto expected = DshotOutput::choose_timing(64'000'000, DshotOutput::Speed::DSHOT600);
+	EXPECT_EQ(dshot.get_timing().samples_per_bit, expected.samples_per_bit);
+	EXPECT_EQ(spi.get_baud_rate(), expected.sck_rate);
+	EXPECT_EQ(registers[SCKDIV], SpiDriver::divider_for(64'000'000, expected.samples_per_bit * 600'000));
+}
@@ -0,0 +1,167 @@
+/// Tests for GPIO edge capture, against fake GPIO, CLINT and PLIC registers
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <hifive1b_bsp/csr.hpp>
+#include <hifive1b_bsp/edge_capture.hpp>
+#include <hifive1b_bsp/idle.hpp>
+
+#include "fake_registers.hpp"
+
+using hifive1b::EdgeCapture;
+using hifive1b::Idle;
+using hifive1b::InterruptController;
+namespace csr = hifive1b::csr;
+
+class EdgeCaptureTests : public ::testing::Test {
+	protected:
+		// GPIO register offsets
+		static constexpr uintptr_t INPUT_VAL = 0x00;
+		static constexpr uintptr_t INPUT_EN = 0x04;
+		static constexpr uintptr_t PUE = 0x10;
+		static constexpr uintptr_t RISE_IE = 0x18;
+		static constexpr uintptr_t RISE_IP = 0x1C;
+		static constexpr uintptr_t FALL_IE = 0x20;
+		static constexpr uintptr_t FALL_IP = 0x24;
+
+		static constexpr uint32_t PIN = 9;
+		static constexpr uint32_t MASK = 1UL << PIN;
+
+		EdgeCaptureTests() {
+			csr::native::reset();
+		}
+
+		~EdgeCaptureTests() override {
+			csr::native::reset();
+		}
+
+		/// Pending bits read as set until written; the fake can't clear on write, so tests set them per interrupt
+		void edge(bool rose, bool fell, bool level, uint32_t timestamp) {
+			gpio[RISE_IP] = rose ? MASK : 0;
+			gpio[FALL_IP] = fell ? MASK : 0;
+			gpio[INPUT_VAL] = level ? MASK : 0;
+			capture.handle_interrupt(timestamp);
+		}
+
+		std::vector<EdgeCapture::Edge> take_all() {
+			std::vector<EdgeCapture::Edge> edges;
+			EdgeCapture::Edge e;
+			while (capture.take(e)) {
+				edges.push_back(e);
+			}
+			return edges;
+		}
+
+		FakeClint clint;
+		FakePlic plic;
+		FakeRegisters gpio {0x40};
+		InterruptController interrupts {clint.base(), plic.base()};
+		EdgeCapture capture {PIN, gpio.base()};
+};
+
+TEST_F(EdgeCaptureTests, StartEnablesThePin) {
+	ASSERT_TRUE(capture.start(interrupts, 3, true));
+	EXPECT_EQ(gpio[INPUT_EN], MASK);
+	EXPECT_EQ(gpio[PUE], MASK);
+	EXPECT_EQ(gpio[RISE_IE], MASK);
+	EXPECT_EQ(gpio[FALL_IE], MASK);
+	EXPECT_EQ(plic[FakePlic::priority(8 + PIN)], 3u);
+
+	capture.stop();
+	EXPECT_EQ(gpio[RISE_IE], 0u);
+	EXPECT_EQ(gpio[FALL_IE], 0u);
+	EXPECT_EQ(plic[FakePlic::priority(8 + PIN)], 0u);
+}
+
+TEST_F(EdgeCaptureTests, TimestampsEdges) {
+	edge(true, false, true, 1000);
+	edge(false, true, false, 2003);
+	edge(false, false, false, 2500);
+
+	auto edges = take_all();
+	ASSERT_EQ(edges.size(), 2u);
+	EXPECT_EQ(edges[0].cycles, 1000u);
+	EXPECT_TRUE(edges[0].rising);
+	EXPECT_EQ(edges[1].cycles, 2000u);
+	EXPECT_FALSE(edges[1].rising);
+	EXPECT_FALSE(edges[1].after_gap);
+	EXPECT_EQ(capture.get_edge_count(), 2u);
+}
+
+TEST_F(EdgeCaptureTests, LevelOrdersBothEdges) {
+	// High now, so it fell and then rose again
+	edge(true, true, true, 100);
+	// Low now, so it rose and then fell
+	edge(true, true, false, 200);
+
+	auto edges = take_all();
+	ASSERT_EQ(edges.size(), 4u);
+	EXPECT_FALSE(edges[0].rising);
+	EXPECT_TRUE(edges[1].rising);
+	EXPECT_TRUE(edges[2].rising);
+	EXPECT_FALSE(edges[3].rising);
+}
+
+TEST_F(EdgeCaptureTests, OverflowIsCountedAndMarked) {
+	for (uint32_t i = 0; i < EdgeCapture::CAPACITY + 10; ++i) {
+		edge(i % 2 == 0, i % 2 == 1, i % 2 == 0, i * 4);
+	}
+	EXPECT_EQ(capture.get_edge_count(), EdgeCapture::CAPACITY + 10);
+	EXPECT_EQ(capture.get_dropped(), 10u);
+	EXPECT_EQ(take_all().size(), EdgeCapture::CAPACITY);
+
+	edge(true, false, true, 9000);
+	auto edges = take_all();
+	ASSERT_EQ(edges.size(), 1u);
+	EXPECT_TRUE(edges[0].after_gap);
+
+	edge(false, true, false, 9100);
+	EXPECT_FALSE(take_all()[0].after_gap);
+}
+
+TEST_F(EdgeCaptureTests, EdgeDuringIdleWaitIsStampedOnArrival) {
+	constexpr uint32_t SOURCE = 8 + PIN;
+
+	// Cycles per mtime tick at 320 MHz
+	constexpr uint32_t CYCLES_PER_TICK = 9765;
+
+	interrupts.install();
+	ASSERT_TRUE(capture.start(interrupts, 3));
+	gpio[RISE_IP] = 0;
+	gpio[FALL_IP] = 0;
+	Idle idle(clint.base(), plic.base(), gpio.base());
+
+	// The edge wakes the first sleep at tick 20, and the second sleeps to the end of the wait
+	int sleeps = 0;
+	csr::native::on_wfi = [&] {
+		if (++sleeps == 1) {
+			clint[FakeClint::MTIME_LO] = 20;
+			gpio[RISE_IP] = MASK;
+			gpio[INPUT_VAL] = MASK;
+			plic[FakePlic::CLAIM] = SOURCE;
+		} else {
+			clint[FakeClint::MTIME_LO] = clint[FakeClint::MTIMECMP_LO];
+		}
+		csr::native::mcycle = clint[FakeClint::MTIME_LO] * CYCLES_PER_TICK;
+	};
+
+	// Stand in for the core taking the external interrupt
+	csr::native::on_interrupts_enabled = [&] {
+		if ((csr::native::mie & csr::MIE_MEIE) && plic[FakePlic::CLAIM] == SOURCE) {
+			interrupts.dispatch_external(csr::native::mcycle);
+			gpio[RISE_IP] = 0;
+			gpio[FALL_IP] = 0;
+			plic[FakePlic::CLAIM] = 0;
+		}
+	};
+
+	idle.sleep_until(100);
+	EXPECT_EQ(sleeps, 2);
+
+	auto edges = take_all();
+	ASSERT_EQ(edges.size(), 1u);
+	EXPECT_TRUE(edges[0].rising);
+	EXPECT_EQ(edges[0].cycles, (20 * CYCLES_PER_TICK) & ~3u);
+}
@@ -0,0 +1,420 @@
+/// Host-side emulator of the ESP32 SPI AT slave, bridging its sockets to real ones on the loopback interface
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <esp32_at/spi_port.hpp>
+
+/// ESP32 running the SPI AT firmware, as seen from the host's SPI1 and handshake pin
+///
+/// Every phase is checked the way the slave would: the header must be 0x02 or 0x01, the length phase must carry 'A' and
+/// two 7-bit halves, and the data phase must be as long as announced and clocked within one chip select frame, though
+/// the host may spread that frame over several buffers with transfer_partial(). A phase that breaks the protocol is
+/// counted and dropped without raising the handshake, so the host sees the timeout it would on hardware.
+/// The handshake rises handshake_delay_us after each phase, and time passes with the SPI clock rate, so the link's
+/// throughput and latency can be measured in simulated microseconds.
+///
+/// Enough of the AT command set is implemented to run the socket layer end to end. AT+CIPSTART opens a real TCP or UDP
+/// socket (IPv4 addresses only), AT+CIPSEND writes to it, and data it receives comes back as +IPD.
+class Esp32Emulator : public esp32::SpiPort {
+	public:
+		struct Stats {
+			uint32_t phases = 0;
+			/// Phases that broke the protocol and were dropped
+			uint32_t protocol_errors = 0;
+			uint32_t commands = 0;
+			/// Data phase bytes in each direction
+			uint32_t bytes_from_host = 0;
+			uint32_t bytes_to_host = 0;
+		};
+
+		/// Most bytes per +IPD, as with the firmware's default TCP segment size
+		static constexpr std::size_t MAX_IPD = 1460;
+
+		/// Largest data phase the firmware sends or accepts
+		static constexpr std::size_t MAX_TRANSFER = 4092;
+
+		explicit Esp32Emulator(uint32_t handshake_delay_us = 20) :
+			handshake_delay_us(handshake_delay_us)
+		{
+			links.fill(-1);
+		}
+
+		~Esp32Emulator() {
+			for (int fd : links) {
+				if (fd >= 0) {
+					::close(fd);
+				}
+			}
+		}
+
+		void transfer(const uint8_t* tx, uint8_t* rx, std::size_t len) override {
+			exchange(tx, rx, len, true);
+		}
+
+		void transfer_partial(const uint8_t* tx, uint8_t* rx, std::size_t len) override {
+			exchange(tx, rx, len, false);
+		}
+
+		bool handshake() override {
+			++now;
+			if (phase == Phase::HEADER) {
+				poll_links();
+				// With a message waiting the slave asks to be read
+				if (!outgoing.empty() && !raised && !raise_pending) {
+					raise_after_delay();
+				}
+			}
+			if (raise_pending && static_cast<int32_t>(now - raise_at) >= 0) {
+				raise_pending = false;
+				raised = true;
+			}
+			return raised;
+		}
+
+		uint32_t set_clock(uint32_t hz) override {
+			clock = (hz > 0) ? hz : 1;
+			return clock;
+		}
+
+		uint32_t now_us() override {
+			return now;
+		}
+
+		/// Let time pass without any bus activity
+		void advance(uint32_t us) {
+			now += us;
+		}
+
+		const Stats& get_stats() const { return stats; }
+
+		/// Time from the end of a phase until the slave raises the handshake for the next
+		uint32_t handshake_delay_us;
+
+	private:
+		enum class Phase { HEADER, WRITE_LENGTH, WRITE_DATA, READ_LENGTH, READ_DATA };
+
+		static constexpr uint8_t HEADER_MASTER_WRITE = 0x02;
+		static constexpr uint8_t HEADER_MASTER_READ = 0x01;
+		static constexpr uint8_t LENGTH_MARKER_WRITE = 'A';
+		static constexpr uint8_t LENGTH_MARKER_READ = 'B';
+
+		static constexpr std::size_t MAX_LINKS = 5;
+
+		/// Clock one call's worth of a phase. The phase ends when a transfer() releases the chip select, and only a data
+		/// phase may be spread over several calls within that frame.
+		void exchange(const uint8_t* tx, uint8_t* rx, std::size_t len, bool last) {
+			now += 1 + static_cast<uint32_t>(len * 8'000'000ULL / clock);
+			raised = false;
+			raise_pending = false;
+			if (last) {
+				++stats.phases;
+			}
+
+			switch (phase) {
+				case Phase::HEADER:
+					if (!last || len != 4 || !tx || (tx[0] != HEADER_MASTER_WRITE && tx[0] != HEADER_MASTER_READ)) {
+						protocol_error();
+						break;
+					}
+					phase = (tx[0] == HEADER_MASTER_WRITE) ? Phase::WRITE_LENGTH : Phase::READ_LENGTH;
+					raise_after_delay();
+					break;
+
+				case Phase::WRITE_LENGTH: {
+					if (!last || len != 4 || !tx || tx[3] != LENGTH_MARKER_WRITE || (tx[0] & 0x80) || (tx[1] & 0x80)) {
+						protocol_error();
+						break;
+					}
+					write_remaining = (static_cast<std::size_t>(tx[1]) << 7) + tx[0];
+					if (write_remaining == 0 || write_remaining > MAX_TRANSFER) {
+						protocol_error();
+						break;
+					}
+					incoming.clear();
+					phase = Phase::WRITE_DATA;
+					raise_after_delay();
+					break;
+				}
+
+				case Phase::WRITE_DATA:
+					if (len > write_remaining) {
+						protocol_error();
+						break;
+					}
+					if (tx) {
+						incoming.append(reinterpret_cast<const char*>(tx), len);
+					} else {
+						incoming.append(len, '\0');
+					}
+					write_remaining -= len;
+					stats.bytes_from_host += len;
+					if (!last) {
+						break;
+					}
+					// The chip select going up ends the data, so a phase split over several frames is cut short
+					if (write_remaining > 0) {
+						protocol_error();
+						break;
+					}
+					phase = Phase::HEADER;
+					receive(incoming);
+					break;
+
+				case Phase::READ_LENGTH: {
+					if (!last || len != 4) {
+						protocol_error();
+						break;
+					}
+					std::size_t out_len = outgoing.empty() ? 0 : outgoing.front().size();
+					const uint8_t length[4] = {
+						static_cast<uint8_t>(out_len & 0x7F), static_cast<uint8_t>(out_len >> 7), 0, LENGTH_MARKER_READ
+					};
+					if (rx) {
+						std::copy_n(length, len, rx);
+					}
+					phase = (out_len == 0) ? Phase::HEADER : Phase::READ_DATA;
+					if (out_len > 0) {
+						raise_after_delay();
+					}
+					break;
+				}
+
+				case Phase::READ_DATA: {
+					std::string& out = outgoing.front();
+					std::size_t n = std::min(len, out.size());
+					if (rx) {
+						std::copy_n(out.data(), n, rx);
+						std::fill(rx + n, rx + len, 0);
+					}
+					out.erase(0, n);
+					stats.bytes_to_host += n;
+					if (!last) {
+						break;
+					}
+					// Whatever is left when the chip select goes up is lost along with the rest of the message
+					bool complete = out.empty();
+					outgoing.pop_front();
+					phase = Phase::HEADER;
+					if (!complete) {
+						protocol_error();
+					}
+					break;
+				}
+			}
+		}
+
+		void raise_after_delay() {
+			raise_pending = true;
+			raise_at = now + handshake_delay_us;
+		}
+
+		void protocol_error() {
+			++stats.protocol_errors;
+			phase = Phase::HEADER;
+		}
+
+		void reply(std::string text) {
+			outgoing.push_back(std::move(text));
+		}
+
+		/// Handle a complete data phase: payload for a pending AT+CIPSEND, otherwise a command
+		void receive(const std::string& data) {
+			if (send_remaining > 0) {
+				send_buffer += data;
+				send_remaining -= std::min(send_remaining, data.size());
+				if (send_remaining == 0) {
+					finish_send();
+				}
+				return;
+			}
+
+			++stats.commands;
+			if (echo) {
+				reply(data);
+			}
+			if (data.size() < 2 || data.compare(data.size() - 2, 2, "\r\n") != 0) {
+				reply("\r\nERROR\r\n");
+				return;
+			}
+			command(std::string_view(data).substr(0, data.size() - 2));
+		}
+
+		void command(std::string_view line) {
+			if (line == "AT") {
+				reply("\r\nOK\r\n");
+			} else if (line == "ATE0" || line == "ATE1") {
+				echo = (line == "ATE1");
+				reply("\r\nOK\r\n");
+			} else if (line == "AT+CIPMUX=0" || line == "AT+CIPMUX=1") {
+				mux = (line == "AT+CIPMUX=1");
+				reply("\r\nOK\r\n");
+			} else if (line.rfind("AT+CIPSTART=", 0) == 0) {
+				start(std::string(line.substr(12)));
+			} else if (line.rfind("AT+CIPSEND=", 0) == 0) {
+				begin_send(std::string(line.substr(11)));
+			} else if (line.rfind("AT+CIPCLOSE", 0) == 0) {
+				int id = 0;
+				if (mux && std::sscanf(std::string(line).c_str(), "AT+CIPCLOSE=%d", &id) != 1) {
+					reply("\r\nERROR\r\n");
+					return;
+				}
+				if (!valid(id) || links[id] < 0) {
+					reply("\r\nERROR\r\n");
+					return;
+				}
+				close_link(id);
+				reply("\r\nOK\r\n");
+			} else {
+				// Includes AT+LINKTEST, so echoed negotiation probes end with ERROR as they do on the firmware
+				reply("\r\nERROR\r\n");
+			}
+		}
+
+		/// AT+CIPSTART=[<id>,]"TCP"|"UDP","<address>",<port>[,<local port>,<mode>]
+		void start(const std::string& args) {
+			int id = 0;
+			const char* rest = args.c_str();
+			if (mux) {
+				int consumed = 0;
+				if (std::sscanf(rest, "%d,%n", &id, &consumed) != 1) {
+					reply("\r\nERROR\r\n");
+					return;
+				}
+				rest += consumed;
+			}
+
+			char type[4] = {0};
+			char host[64] = {0};
+			unsigned remote_port = 0;
+			unsigned local_port = 0;
+			int fields = std::sscanf(rest, "\"%3[A-Z]\",\"%63[^\"]\",%u,%u", type, host, &remote_port, &local_port);
+			bool udp = std::strcmp(type, "UDP") == 0;
+			if (fields < 3 || !valid(id) || links[id] >= 0 || (!udp && std::strcmp(type, "TCP") != 0)) {
+				reply("\r\nERROR\r\n");
+				return;
+			}
+
+			int fd = ::socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+			sockaddr_in remote {};
+			remote.sin_family = AF_INET;
+			remote.sin_port = htons(static_cast<uint16_t>(remote_port));
+			bool ok = fd >= 0 && ::inet_pton(AF_INET, host, &remote.sin_addr) == 1;
+
+			if (ok && udp && fields == 4 && local_port != 0) {
+				sockaddr_in local {};
+				local.sin_family = AF_INET;
+				local.sin_port = htons(static_cast<uint16_t>(local_port));
+				local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+				ok = ::bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) == 0;
+			}
+
+			// A UDP link with remote port 0 only listens
+			if (ok && (!udp || remote_port != 0)) {
+				ok = ::connect(fd, reinterpret_cast<sockaddr*>(&remote), sizeof(remote)) == 0;
+			}
+
+			if (!ok) {
+				if (fd >= 0) {
+					::close(fd);
+				}
+				reply("\r\nERROR\r\n");
+				return;
+			}
+
+			links[id] = fd;
+			reply(mux ? std::to_string(id) + ",CONNECT\r\n" : std::string("CONNECT\r\n"));
+			reply("\r\nOK\r\n");
+		}
+
+		/// AT+CIPSEND=[<id>,]<length>
+		void begin_send(const std::string& args) {
+			int id = 0;
+			unsigned length = 0;
+			bool parsed = mux ? std::sscanf(args.c_str(), "%d,%u", &id, &length) == 2 :
+				std::sscanf(args.c_str(), "%u", &length) == 1;
+			if (!parsed || !valid(id) || links[id] < 0 || length == 0 || length > 2048) {
+				reply("\r\nERROR\r\n");
+				return;
+			}
+
+			send_link = id;
+			send_remaining = length;
+			send_buffer.clear();
+			reply("\r\nOK\r\n");
+			reply("\r\n>");
+		}
+
+		void finish_send() {
+			ssize_t sent = ::send(links[send_link], send_buffer.data(), send_buffer.size(), MSG_NOSIGNAL);
+			reply("\r\nRecv " + std::to_string(send_buffer.size()) + " bytes\r\n");
+			reply((sent == static_cast<ssize_t>(send_buffer.size())) ? "\r\nSEND OK\r\n" : "\r\nSEND FAIL\r\n");
+		}
+
+		/// Pass on data and hangups from the sockets, keeping only a few messages queued as the firmware would
+		void poll_links() {
+			if (send_remaining > 0) {
+				return;
+			}
+
+			std::array<char, MAX_IPD> buffer;
+			for (std::size_t id = 0; id < MAX_LINKS && outgoing.size() < 4; ++id) {
+				if (links[id] < 0) {
+					continue;
+				}
+
+				ssize_t n = ::recv(links[id], buffer.data(), buffer.size(), MSG_DONTWAIT);
+				if (n > 0) {
+					std::string header = mux ? "\r\n+IPD," + std::to_string(id) + "," : std::string("\r\n+IPD,");
+					reply(header + std::to_string(n) + ":" + std::string(buffer.data(), n));
+				} else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+					close_link(static_cast<int>(id));
+				}
+			}
+		}
+
+		void close_link(int id) {
+			::close(links[id]);
+			links[id] = -1;
+			reply(mux ? std::to_string(id) + ",CLOSED\r\n" : std::string("CLOSED\r\n"));
+		}
+
+		static bool valid(int id) {
+			return id >= 0 && static_cast<std::size_t>(id) < MAX_LINKS;
+		}
+
+		Phase phase = Phase::HEADER;
+		uint32_t clock = 1;
+		uint32_t now = 0;
+
+		bool raised = false;
+		bool raise_pending = false;
+		uint32_t raise_at = 0;
+
+		std::size_t write_remaining = 0;
+		std::string incoming;
+		std::deque<std::string> outgoing;
+
+		bool echo = false;
+		bool mux = false;
+		std::array<int, MAX_LINKS> links;
+
+		int send_link = 0;
+		std::size_t send_remaining = 0;
+		std::string send_buffer;
+
+		Stats stats;
+};
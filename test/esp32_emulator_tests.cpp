@@ -0,0 +1,272 @@
+/// Tests for the SPI link and socket layer against the ESP32 SPI slave emulator
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <esp32_at/at_client.hpp>
+#include <esp32_at/socket_layer.hpp>
+#include <esp32_at/spi_link.hpp>
+
+#include "esp32_emulator.hpp"
+
+using esp32::SocketLayer;
+
+/// TCP server on 127.0.0.1 that sends back whatever it receives
+class LoopbackEchoServer {
+	public:
+		LoopbackEchoServer() {
+			listener = ::socket(AF_INET, SOCK_STREAM, 0);
+			sockaddr_in address {};
+			address.sin_family = AF_INET;
+			address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			socklen_t length = sizeof(address);
+			::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+			::listen(listener, 1);
+			::getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+			port = ntohs(address.sin_port);
+
+			thread = std::thread([this] { serve(); });
+		}
+
+		~LoopbackEchoServer() {
+			stop = true;
+			thread.join();
+			::close(listener);
+		}
+
+		uint16_t port = 0;
+
+	private:
+		void serve() {
+			int connection = -1;
+			char buffer[2048];
+			while (!stop) {
+				pollfd fd {connection >= 0 ? connection : listener, POLLIN, 0};
+				if (::poll(&fd, 1, 10) <= 0) {
+					continue;
+				}
+
+				if (connection < 0) {
+					connection = ::accept(listener, nullptr, nullptr);
+					continue;
+				}
+
+				ssize_t n = ::recv(connection, buffer, sizeof(buffer), 0);
+				if (n <= 0) {
+					::close(connection);
+					connection = -1;
+					continue;
+				}
+				::send(connection, buffer, n, MSG_NOSIGNAL);
+			}
+			if (connection >= 0) {
+				::close(connection);
+			}
+		}
+
+		int listener = -1;
+		std::atomic<bool> stop {false};
+		std::thread thread;
+};
+
+TEST(Esp32EmulatorTests, HandshakeFollowsTheDelay) {
+	Esp32Emulator esp(100);
+	esp.set_clock(1'000'000);
+
+	const uint8_t header[4] = {0x02, 0, 0, 0};
+	esp.transfer(header, nullptr, sizeof(header));
+	uint32_t start = esp.now_us();
+	while (!esp.handshake()) {}
+	EXPECT_EQ(esp.now_us() - start, 100u);
+}
+
+TEST(Esp32EmulatorTests, BrokenPhasesAreDropped) {
+	StaticPbufPool<128, 8> pool;
+	Esp32Emulator esp;
+	esp32::SpiLink link(esp, pool);
+
+	// A length phase without its 'A' marker never gets the handshake for the data phase
+	const uint8_t header[4] = {0x02, 0, 0, 0};
+	const uint8_t length[4] = {4, 0, 0, 'X'};
+	esp.transfer(header, nullptr, sizeof(header));
+	while (!esp.handshake()) {}
+	esp.transfer(length, nullptr, sizeof(length));
+	for (int i = 0; i < 1000; ++i) {
+		EXPECT_FALSE(esp.handshake());
+	}
+	EXPECT_EQ(esp.get_stats().protocol_errors, 1u);
+
+	// The slave is back waiting for a header, so the link carries on
+	EXPECT_TRUE(link.ping());
+	EXPECT_EQ(esp.get_stats().protocol_errors, 1u);
+}
+
+TEST(Esp32EmulatorTests, SplitDataPhasesAreDropped) {
+	Esp32Emulator esp;
+	esp.set_clock(1'000'000);
+
+	const uint8_t write_header[4] = {0x02, 0, 0, 0};
+	const uint8_t write_length[4] = {4, 0, 0, 'A'};
+	esp.transfer(write_header, nullptr, sizeof(write_header));
+	while (!esp.handshake()) {}
+	esp.transfer(write_length, nullptr, sizeof(write_length));
+	while (!esp.handshake()) {}
+	esp.transfer(reinterpret_cast<const uint8_t*>("AT\r\n"), nullptr, 4);
+
+	// The "\r\nOK\r\n" response read in two chip select frames: the first ends the phase short and loses the message,
+	// and the second is taken as a bad header
+	const uint8_t read_header[4] = {0x01, 0, 0, 0};
+	uint8_t length[4] = {0};
+	uint8_t data[3] = {0};
+	while (!esp.handshake()) {}
+	esp.transfer(read_header, nullptr, sizeof(read_header));
+	while (!esp.handshake()) {}
+	esp.transfer(nullptr, length, sizeof(length));
+	EXPECT_EQ(length[0], 6);
+	while (!esp.handshake()) {}
+	esp.transfer(nullptr, data, sizeof(data));
+	esp.transfer(nullptr, data, sizeof(data));
+	EXPECT_EQ(esp.get_stats().protocol_errors, 2u);
+	EXPECT_FALSE(esp.handshake());
+}
+
+TEST(Esp32EmulatorTests, LongMessagesArriveInOnePhase) {
+	StaticPbufPool<128, 8> pool;
+	Esp32Emulator esp;
+	esp32::SpiLink link(esp, pool);
+
+	// The echo of a command longer than a pool segment fills several, and still has to come in one data phase
+	std::string long_command = "AT+" + std::string(295, 'x') + "\r\n";
+	ASSERT_TRUE(link.send("ATE1\r\n"));
+	ASSERT_TRUE(link.send(long_command));
+
+	std::string expected = "\r\nOK\r\n" + long_command;
+	std::string received;
+	for (int i = 0; i < 10'000 && received.size() < expected.size(); ++i) {
+		received += link.receive();
+	}
+	EXPECT_EQ(received, expected);
+	EXPECT_EQ(link.get_stats().errors, 0u);
+	EXPECT_EQ(esp.get_stats().protocol_errors, 0u);
+}
+
+TEST(Esp32EmulatorTests, NegotiatesTheFastestClock) {
+	StaticPbufPool<128, 8> pool;
+	Esp32Emulator esp;
+	esp32::SpiLink link(esp, pool);
+
+	EXPECT_EQ(link.negotiate(), esp32::SpiLink::CLOCK_LADDER.back());
+	EXPECT_EQ(link.get_stats().errors, 0u);
+	EXPECT_EQ(esp.get_stats().protocol_errors, 0u);
+}
+
+/// The WiFi app's stack: sockets over the AT client over the SPI link, with the emulator in place of the ESP32
+class Esp32EmulatorSocketTests : public ::testing::Test {
+	protected:
+		Esp32EmulatorSocketTests() :
+			link(esp, pool),
+			client(link),
+			sockets(client, pool)
+		{
+			client.set_data_handler([this](const esp32::AtParser::IpdFragment& fragment) {
+				sockets.on_ipd(fragment);
+			});
+			client.set_urc_handler([this](std::string_view line) {
+				sockets.on_urc(line);
+			});
+
+			link.negotiate();
+			sockets.initialize();
+			run_until([this] { return sockets.is_ready(); });
+		}
+
+		/// Poll the stack until done() is true, giving up after a second of real time for the loopback sockets
+		template<typename Condition>
+		bool run_until(Condition&& done) {
+			auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+			while (!done()) {
+				if (std::chrono::steady_clock::now() > give_up) {
+					return false;
+				}
+				client.poll(esp.now_us() / 1000);
+			}
+			return true;
+		}
+
+		/// Read from a socket until expected_size bytes have arrived
+		std::string receive(int socket, std::size_t expected_size) {
+			std::string data;
+			run_until([&] {
+				for (auto chunk = sockets.peek(socket); !chunk.empty(); chunk = sockets.peek(socket)) {
+					data.append(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+					sockets.consume(socket, chunk.size());
+				}
+				return data.size() >= expected_size;
+			});
+			return data;
+		}
+
+		StaticPbufPool<256, 32> pool;
+		Esp32Emulator esp;
+		esp32::SpiLink link;
+		esp32::AtClient client;
+		SocketLayer sockets;
+		LoopbackEchoServer server;
+};
+
+TEST_F(Esp32EmulatorSocketTests, EchoesThroughLoopback) {
+	ASSERT_TRUE(sockets.is_ready());
+	int s = sockets.open(SocketLayer::Protocol::TCP, "127.0.0.1", server.port);
+	ASSERT_GE(s, 0);
+	ASSERT_TRUE(run_until([&] { return sockets.get_state(s) == SocketLayer::SocketState::OPEN; }));
+
+	ASSERT_TRUE(sockets.send(s, "hello, esp32"));
+	EXPECT_EQ(receive(s, 12), "hello, esp32");
+
+	sockets.close(s);
+	EXPECT_TRUE(run_until([&] { return sockets.get_state(s) == SocketLayer::SocketState::CLOSED; }));
+	EXPECT_EQ(esp.get_stats().protocol_errors, 0u);
+}
+
+TEST_F(Esp32EmulatorSocketTests, MeasuresThroughputAndLatency) {
+	// Each echo fits within a socket's receive quota
+	constexpr std::size_t MESSAGE_SIZE = SocketLayer::RX_QUOTA;
+	constexpr int MESSAGES = 16;
+
+	int s = sockets.open(SocketLayer::Protocol::TCP, "127.0.0.1", server.port);
+	ASSERT_TRUE(run_until([&] { return sockets.get_state(s) == SocketLayer::SocketState::OPEN; }));
+
+	std::string message(MESSAGE_SIZE, '\0');
+	uint32_t start = esp.now_us();
+	uint32_t worst_latency = 0;
+	for (int i = 0; i < MESSAGES; ++i) {
+		for (std::size_t j = 0; j < MESSAGE_SIZE; ++j) {
+			message[j] = static_cast<char>('a' + (i + j) % 26);
+		}
+
+		uint32_t sent = esp.now_us();
+		ASSERT_TRUE(sockets.send(s, message));
+		ASSERT_EQ(receive(s, MESSAGE_SIZE), message);
+		worst_latency = std::max(worst_latency, esp.now_us() - sent);
+	}
+	uint32_t elapsed = esp.now_us() - start;
+
+	// Payload both ways over simulated time; the link can't beat its clock
+	uint64_t bytes_per_second = 2ULL * MESSAGE_SIZE * MESSAGES * 1'000'000 / elapsed;
+	EXPECT_LT(bytes_per_second, link.get_clock() / 8);
+	EXPECT_EQ(link.get_stats().errors, 0u);
+
+	RecordProperty("clock_hz", std::to_string(link.get_clock()));
+	RecordProperty("bytes_per_second", std::to_string(bytes_per_second));
+	RecordProperty("worst_round_trip_us", std::to_string(worst_latency));
+}
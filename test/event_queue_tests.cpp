@@ -0,0 +1,173 @@
+/// Tests for the lock-free event queue and the active object dispatcher
+
+#include <array>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <embedded_util/active_object.hpp>
+#include <embedded_util/event_queue.hpp>
+
+TEST(EventQueueTests, KeepsOrderAcrossLaps) {
+	EventQueue<uint32_t, 4> queue;
+	uint32_t value = 0;
+	EXPECT_TRUE(queue.empty());
+	EXPECT_FALSE(queue.take(value));
+
+	// Wrap around the slots many times
+	uint32_t expected = 0;
+	for (uint32_t i = 0; i < 100; ++i) {
+		EXPECT_TRUE(queue.post(2 * i));
+		EXPECT_TRUE(queue.post(2 * i + 1));
+		for (int j = 0; j < 2; ++j) {
+			ASSERT_TRUE(queue.take(value));
+			EXPECT_EQ(value, expected++);
+		}
+	}
+	EXPECT_TRUE(queue.empty());
+	EXPECT_EQ(queue.get_high_water(), 2UL);
+}
+
+TEST(EventQueueTests, FullQueueDropsAndCounts) {
+	EventQueue<uint8_t, 4> queue;
+	for (uint8_t i = 0; i < 4; ++i) {
+		EXPECT_TRUE(queue.post(i));
+	}
+	EXPECT_FALSE(queue.post(4));
+	EXPECT_EQ(queue.get_dropped(), 1UL);
+	EXPECT_EQ(queue.get_high_water(), 4UL);
+
+	// Taking one frees exactly one slot
+	uint8_t value = 0;
+	ASSERT_TRUE(queue.take(value));
+	EXPECT_EQ(value, 0);
+	EXPECT_TRUE(queue.post(5));
+	EXPECT_FALSE(queue.post(6));
+}
+
+TEST(EventQueueTests, ConcurrentProducersLoseNothing) {
+	// Threads stand in for interrupt handlers that preempt each other at arbitrary points
+	constexpr uint32_t PRODUCERS = 4;
+	constexpr uint32_t EVENTS = 20000;
+
+	struct Event {
+		uint32_t producer;
+		uint32_t sequence;
+	};
+	EventQueue<Event, 64> queue;
+
+	std::vector<std::thread> producers;
+	for (uint32_t p = 0; p < PRODUCERS; ++p) {
+		producers.emplace_back([&queue, p] {
+			for (uint32_t i = 0; i < EVENTS; ++i) {
+				while (!queue.post({p, i})) {
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	// Each producer's events arrive in the order it posted them
+	std::array<uint32_t, PRODUCERS> next {};
+	uint32_t received = 0;
+	while (received < PRODUCERS * EVENTS) {
+		Event event {};
+		if (!queue.take(event)) {
+			std::this_thread::yield();
+			continue;
+		}
+		ASSERT_LT(event.producer, PRODUCERS);
+		ASSERT_EQ(event.sequence, next[event.producer]);
+		++next[event.producer];
+		++received;
+	}
+
+	for (auto& t : producers) {
+		t.join();
+	}
+	EXPECT_TRUE(queue.empty());
+	EXPECT_LE(queue.get_high_water(), 64UL);
+}
+
+enum class Signal : uint8_t {
+	TICK,
+	BUTTON,
+};
+
+/// Fake time that moves on each time it is read
+static uint32_t fake_time = 0;
+static uint32_t read_fake_time() {
+	return fake_time++;
+}
+
+/// Records events, and posts a follow-up to another object on BUTTON
+class Recorder : public ActiveObject<Signal> {
+	public:
+		explicit Recorder(Dispatcher<Signal, 8>& dispatcher, Recorder* forward = nullptr) :
+			dispatcher(dispatcher),
+			forward(forward)
+		{}
+
+		void on_event(const Signal& signal) override {
+			received.push_back(signal);
+			if (signal == Signal::BUTTON && forward) {
+				dispatcher.post(*forward, Signal::TICK);
+			}
+		}
+
+		std::vector<Signal> received;
+
+	private:
+		Dispatcher<Signal, 8>& dispatcher;
+		Recorder* forward;
+};
+
+TEST(DispatcherTests, DeliversToTargetsInOrder) {
+	Dispatcher<Signal, 8> dispatcher(read_fake_time);
+	Recorder display(dispatcher);
+	Recorder buttons(dispatcher, &display);
+
+	EXPECT_TRUE(dispatcher.post(display, Signal::TICK));
+	EXPECT_TRUE(dispatcher.post(buttons, Signal::BUTTON));
+	EXPECT_TRUE(dispatcher.post(display, Signal::BUTTON));
+
+	// Includes the event posted by a handler
+	EXPECT_EQ(dispatcher.dispatch_all(), 4UL);
+	EXPECT_TRUE(dispatcher.empty());
+
+	EXPECT_EQ(display.received, (std::vector<Signal>{Signal::TICK, Signal::BUTTON, Signal::TICK}));
+	EXPECT_EQ(buttons.received, (std::vector<Signal>{Signal::BUTTON}));
+	EXPECT_EQ(dispatcher.get_stats().dispatched, 4UL);
+	EXPECT_EQ(dispatcher.get_high_water(), 3UL);
+}
+
+TEST(DispatcherTests, MeasuresPostToDispatchLatency) {
+	Dispatcher<Signal, 8> dispatcher(read_fake_time);
+	Recorder target(dispatcher);
+
+	fake_time = 100;
+	dispatcher.post(target, Signal::TICK);   // stamped 100
+	fake_time = 150;
+	dispatcher.post(target, Signal::TICK);   // stamped 150
+	fake_time = 400;
+
+	EXPECT_TRUE(dispatcher.dispatch_one());  // read at 400
+	EXPECT_EQ(dispatcher.get_stats().last_latency, 300UL);
+	EXPECT_TRUE(dispatcher.dispatch_one());  // read at 401
+	EXPECT_EQ(dispatcher.get_stats().last_latency, 251UL);
+	EXPECT_EQ(dispatcher.get_stats().max_latency, 300UL);
+	EXPECT_FALSE(dispatcher.dispatch_one());
+}
+
+TEST(DispatcherTests, FullQueueDropsEvents) {
+	Dispatcher<Signal, 8> dispatcher(read_fake_time);
+	Recorder target(dispatcher);
+
+	for (int i = 0; i < 8; ++i) {
+		EXPECT_TRUE(dispatcher.post(target, Signal::TICK));
+	}
+	EXPECT_FALSE(dispatcher.post(target, Signal::BUTTON));
+	EXPECT_EQ(dispatcher.get_dropped(), 1UL);
+	EXPECT_EQ(dispatcher.dispatch_all(), 8UL);
+}
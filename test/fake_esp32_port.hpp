@@ -0,0 +1,191 @@
+/// Bus-level stand-in for the ESP32 SPI AT slave used by the native tests
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <string>
+
+#include <esp32_at/spi_port.hpp>
+
+/// Minimal ESP32 SPI slave that echoes commands and corrupts transfers above a maximum reliable clock
+///
+/// Each phase has to fit in one chip select frame. A data phase that ends before all of it has been clocked is counted
+/// in split_phases and the rest of it is lost, as the slave would treat it.
+///
+/// It can also be hung, as if its SPI state machine were wedged: the handshake line stays high, every length phase is
+/// garbage, and only AT+RST gets through, after which it takes boot_us to come back.
+class FakeEsp32Port : public esp32::SpiPort {
+	public:
+		explicit FakeEsp32Port(uint32_t max_reliable_hz) :
+			max_reliable_hz(max_reliable_hz)
+		{}
+
+		void transfer(const uint8_t* tx, uint8_t* rx, std::size_t len) override {
+			exchange(tx, rx, len, true);
+		}
+
+		void transfer_partial(const uint8_t* tx, uint8_t* rx, std::size_t len) override {
+			exchange(tx, rx, len, false);
+		}
+
+		bool handshake() override {
+			++now;
+			boot_if_due();
+			return hung || phase != Phase::HEADER || !outgoing.empty();
+		}
+
+		uint32_t set_clock(uint32_t hz) override {
+			clock = hz;
+			return hz;
+		}
+
+		uint32_t now_us() override {
+			return now;
+		}
+
+		/// Let time pass without any bus activity
+		void advance(uint32_t us) {
+			now += us;
+		}
+
+		/// Number of length phases to send with a bad marker
+		int bad_markers = 0;
+
+		/// Clock rate above which written data is corrupted
+		uint32_t max_reliable_hz;
+
+		/// Wedged until reset with AT+RST
+		bool hung = false;
+		uint32_t boot_us = 1'000'000;
+		int resets = 0;
+		/// Number of AT+RST commands to ignore while hung
+		int lost_resets = 0;
+
+		/// Phases cut short by the chip select going up, such as a data phase split over several frames
+		int split_phases = 0;
+
+		std::deque<std::string> outgoing;
+
+	private:
+		enum class Phase { HEADER, WRITE_LENGTH, WRITE_DATA, READ_LENGTH, READ_DATA };
+
+		void respond() {
+			if (command == "ATE1\r\n") {
+				echo = true;
+			} else if (command == "ATE0\r\n") {
+				echo = false;
+			}
+
+			if (echo) {
+				outgoing.push_back(command);
+			}
+			outgoing.push_back(command.rfind("AT+LINKTEST", 0) == 0 ? "\r\nERROR\r\n" : "\r\nOK\r\n");
+		}
+
+		/// Run one call's worth of a phase. A phase ends when the chip select is released at the end of a transfer().
+		void exchange(const uint8_t* tx, uint8_t* rx, std::size_t len, bool last) {
+			now += 1 + len * 8'000'000 / clock;
+			bool corrupt = clock > max_reliable_hz;
+			boot_if_due();
+
+			switch (phase) {
+				case Phase::HEADER:
+					phase = (tx && tx[0] == 0x02) ? Phase::WRITE_LENGTH : Phase::READ_LENGTH;
+					break;
+
+				case Phase::WRITE_LENGTH:
+					write_len = (tx[1] << 7) + tx[0];
+					command.clear();
+					phase = Phase::WRITE_DATA;
+					break;
+
+				case Phase::WRITE_DATA:
+					command.append(reinterpret_cast<const char*>(tx), len);
+					if (!last) {
+						return;
+					}
+					phase = Phase::HEADER;
+					if (command.size() < write_len) {
+						// The slave takes the chip select going up as the end of the data
+						++split_phases;
+						return;
+					}
+					if (corrupt) {
+						command[command.size() / 2] ^= 0x10;
+					}
+					if (!hung) {
+						respond();
+					} else if (command == "AT+RST\r\n" && lost_resets > 0) {
+						--lost_resets;
+					} else if (command == "AT+RST\r\n") {
+						rebooting = true;
+						boot_at = now + boot_us;
+					}
+					return;
+
+				case Phase::READ_LENGTH: {
+					std::size_t out_len = outgoing.empty() ? 0 : outgoing.front().size();
+					uint8_t marker = bad_markers > 0 ? (--bad_markers, 'X') : 'B';
+					if (hung || corrupt) {
+						marker = 'X';
+					}
+					const uint8_t length[4] = {
+						static_cast<uint8_t>(out_len & 0x7F), static_cast<uint8_t>(out_len >> 7), 0, marker
+					};
+					std::copy_n(length, len, rx);
+					sent = 0;
+					phase = (out_len == 0 || marker != 'B') ? Phase::HEADER : Phase::READ_DATA;
+					break;
+				}
+
+				case Phase::READ_DATA: {
+					const std::string& out = outgoing.front();
+					std::size_t n = (sent < out.size()) ? std::min(len, out.size() - sent) : 0;
+					if (rx) {
+						std::copy_n(out.data() + sent, n, rx);
+					}
+					sent += len;
+					if (!last) {
+						return;
+					}
+					// Whatever wasn't clocked out before the chip select went up is lost
+					if (sent < out.size()) {
+						++split_phases;
+					}
+					outgoing.pop_front();
+					phase = Phase::HEADER;
+					return;
+				}
+			}
+
+			// Header and length phases are 4 bytes in a frame of their own
+			if (!last) {
+				++split_phases;
+			}
+		}
+
+		/// Finish a reset once the boot time has passed
+		void boot_if_due() {
+			if (rebooting && static_cast<int32_t>(now - boot_at) >= 0) {
+				rebooting = false;
+				hung = false;
+				echo = false;
+				phase = Phase::HEADER;
+				outgoing.clear();
+				outgoing.push_back("\r\nready\r\n");
+				++resets;
+			}
+		}
+
+		bool rebooting = false;
+		uint32_t boot_at = 0;
+		uint32_t clock = 0;
+		uint32_t now = 0;
+		Phase phase = Phase::HEADER;
+		std::size_t write_len = 0;
+		/// Bytes of the current read data phase clocked out so far
+		std::size_t sent = 0;
+		bool echo = false;
+		std::string command;
+};
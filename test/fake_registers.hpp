@@ -0,0 +1,60 @@
+/// Plain memory standing in for peripheral registers, for the tests of drivers that take a base address
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// A peripheral's register block, indexed by byte offset as in the manual
+///
+/// Registers are plain words that read back what was last written. Nothing is cleared on write or set by hardware, so
+/// tests set status and pending bits themselves.
+class FakeRegisters {
+	public:
+		/// @param size Bytes up to the end of the last register the driver uses
+		explicit FakeRegisters(std::size_t size, uint32_t value = 0) :
+			words(size / 4, value)
+		{}
+
+		uint32_t& operator[](uintptr_t offset) { return words.at(offset / 4); }
+		uint32_t operator[](uintptr_t offset) const { return words.at(offset / 4); }
+
+		/// Address to give the driver
+		uintptr_t base() { return reinterpret_cast<uintptr_t>(words.data()); }
+
+		void fill(uint32_t value) { std::fill(words.begin(), words.end(), value); }
+
+	private:
+		std::vector<uint32_t> words;
+};
+
+/// CLINT, for the interrupt controller and Idle
+class FakeClint : public FakeRegisters {
+	public:
+		static constexpr uintptr_t MSIP = 0x0000;
+		static constexpr uintptr_t MTIMECMP_LO = 0x4000;
+		static constexpr uintptr_t MTIMECMP_HI = 0x4004;
+		static constexpr uintptr_t MTIME_LO = 0xBFF8;
+		static constexpr uintptr_t MTIME_HI = 0xBFFC;
+
+		FakeClint() :
+			FakeRegisters(0xC000)
+		{}
+};
+
+/// PLIC, for the interrupt controller and Idle
+class FakePlic : public FakeRegisters {
+	public:
+		/// Enables of sources 0 to 31; sources 32 to 52 are in the next word
+		static constexpr uintptr_t ENABLE = 0x2000;
+		static constexpr uintptr_t THRESHOLD = 0x200000;
+		static constexpr uintptr_t CLAIM = 0x200004;
+
+		static constexpr uintptr_t priority(uint32_t source) { return 4 * source; }
+
+		FakePlic() :
+			FakeRegisters(0x200008)
+		{}
+};
@@ -0,0 +1,121 @@
+/// Tests for the XIP flash controller driver
+
+#include <gtest/gtest.h>
+
+#include <hifive1b_bsp/flash_controller.hpp>
+
+#include "fake_registers.hpp"
+#include "mock_clock.hpp"
+
+using hifive1b::FlashController;
+
+/// Values of ffmt and fmt after the SiFive bootloader
+constexpr uint32_t DEFAULT_FFMT = 0x00030007;
+constexpr uint32_t DEFAULT_FMT = 0x00080008;
+
+constexpr uint32_t STATUS_QE = 0x40;
+
+class FlashControllerTests : public ::testing::Test {
+	protected:
+		// Register offsets
+		static constexpr uintptr_t SCKDIV = 0x00;
+		static constexpr uintptr_t CSMODE = 0x18;
+		static constexpr uintptr_t FMT = 0x40;
+		static constexpr uintptr_t RXDATA = 0x4C;
+		static constexpr uintptr_t FCTRL = 0x60;
+		static constexpr uintptr_t FFMT = 0x64;
+
+		FlashControllerTests() {
+			regs[SCKDIV] = 3;
+			regs[FMT] = DEFAULT_FMT;
+			regs[FCTRL] = 1;
+			regs[FFMT] = DEFAULT_FFMT;
+		}
+
+		FakeRegisters regs {0x68};
+		FlashController flash {regs.base()};
+};
+
+TEST(FlashControllerEncodingTests, ResetFormat) {
+	EXPECT_EQ(FlashController::encode_read_format(FlashController::SINGLE_READ), DEFAULT_FFMT);
+}
+
+TEST(FlashControllerEncodingTests, QuadIoRead) {
+	// cmd_en, 3 address bytes, 6 dummy cycles, quad address and data, command 0xEB, pad code 0x00
+	EXPECT_EQ(FlashController::encode_read_format(FlashController::QUAD_IO_READ), 0x00EB2867UL);
+}
+
+TEST(FlashControllerEncodingTests, DividerNeverExceedsMaxSck) {
+	constexpr uint32_t MAX_SCK = FlashController::DEFAULT_MAX_SCK;
+
+	EXPECT_EQ(FlashController::divider_for(320000000, MAX_SCK), 3UL);
+	EXPECT_EQ(FlashController::divider_for(100000000, MAX_SCK), 0UL);
+	EXPECT_EQ(FlashController::divider_for(100000001, MAX_SCK), 1UL);
+	EXPECT_EQ(FlashController::divider_for(16000000, MAX_SCK), 0UL);
+	EXPECT_EQ(FlashController::divider_for(320000000, 1000), 0xFFFUL);
+}
+
+TEST_F(FlashControllerTests, InitializeSwitchesToQuadIo) {
+	// The flash reports quad mode already enabled
+	regs[RXDATA] = STATUS_QE;
+	MockClock clock(frequency::MHz(320));
+
+	EXPECT_TRUE(flash.initialize(clock));
+
+	EXPECT_EQ(regs[FFMT], 0x00EB2867UL);
+	EXPECT_EQ(regs[SCKDIV], 3UL);
+	EXPECT_EQ(flash.get_sck(), 40000000UL);
+
+	// Memory-mapped reads are back on and the programmed I/O settings are restored
+	EXPECT_EQ(regs[FCTRL], 1UL);
+	EXPECT_EQ(regs[FMT], DEFAULT_FMT);
+	EXPECT_EQ(regs[CSMODE], 0UL);
+}
+
+TEST_F(FlashControllerTests, KeepsResetFormatWithoutQuadMode) {
+	// QE never reads back as set
+	regs[RXDATA] = 0;
+	MockClock clock(frequency::MHz(16));
+
+	EXPECT_FALSE(flash.initialize(clock));
+
+	EXPECT_EQ(regs[FFMT], DEFAULT_FFMT);
+	EXPECT_EQ(regs[FCTRL], 1UL);
+	EXPECT_EQ(regs[SCKDIV], 0UL);
+}
+
+TEST_F(FlashControllerTests, RaisesDividerBeforeClockSpeedsUp) {
+	regs[RXDATA] = STATUS_QE;
+	MockClock clock(frequency::MHz(16));
+	flash.initialize(clock);
+	EXPECT_EQ(regs[SCKDIV], 0UL);
+
+	// Registered after the controller, so this sees the divider it chose for the pending change
+	uint32_t divider_before_change = 0xFFFFFFFF;
+	clock.add_frequency_pending_listener([&](Frequency) { divider_before_change = regs[SCKDIV]; });
+
+	clock.change(frequency::MHz(320));
+	EXPECT_EQ(divider_before_change, 3UL);
+	EXPECT_EQ(regs[SCKDIV], 3UL);
+
+	// Slowing down keeps the safe divider until the new frequency is in effect
+	clock.change(frequency::MHz(16));
+	EXPECT_EQ(divider_before_change, 3UL);
+	EXPECT_EQ(regs[SCKDIV], 0UL);
+	EXPECT_EQ(flash.get_sck(), 8000000UL);
+}
+
+TEST_F(FlashControllerTests, ProgramStaysWithinOnePage) {
+	// Status reads back idle so the wait for the write to finish ends at once
+	regs[RXDATA] = 0;
+	const uint8_t data[4] = {1, 2, 3, 4};
+
+	EXPECT_TRUE(flash.program(0x3F00FC, data, sizeof(data)));
+	EXPECT_FALSE(flash.program(0x3F00FE, data, sizeof(data)));
+	EXPECT_FALSE(flash.program(FlashController::FLASH_SIZE, data, 1));
+
+	// Memory-mapped reads resume afterwards
+	EXPECT_EQ(regs[FCTRL], 1UL);
+	EXPECT_EQ(regs[FMT], DEFAULT_FMT);
+	EXPECT_EQ(regs[CSMODE], 0UL);
+}
@@ -0,0 +1,93 @@
+/// Tests for the compile-time checked formatter
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include <gtest/gtest.h>
+
+#include <embedded_util/format.hpp>
+#include <embedded_util/logger.hpp>
+
+/// Collects everything written, along with how many writes it took
+class StringStream : public BasicOutStream<uint8_t> {
+	public:
+		void write(std::basic_string_view<uint8_t> data) override {
+			text.append(reinterpret_cast<const char*>(data.data()), data.size());
+			++writes;
+		}
+
+		std::string text;
+		int writes = 0;
+};
+
+template<format::Literal FORMAT, typename... Args>
+static std::string formatted(const Args&... args) {
+	char buffer[128];
+	format::to_buffer<FORMAT>(buffer, sizeof(buffer), args...);
+	return buffer;
+}
+
+TEST(FormatTests, ParsesAtCompileTime) {
+	constexpr auto& parsed = format::detail::PARSED<"a{{{:>08.3}}}b{:x}">;
+	static_assert(parsed.pieces.size() == 2);
+	static_assert(parsed.pieces[0].spec.align == format::Align::RIGHT);
+	static_assert(parsed.pieces[0].spec.zero_pad);
+	static_assert(parsed.pieces[0].spec.width == 8);
+	static_assert(parsed.pieces[0].spec.precision == 3);
+	static_assert(parsed.pieces[1].spec.type == format::Type::HEX);
+
+	EXPECT_EQ((formatted<"{{}} {{{}}}">(7)), "{} {7}");
+}
+
+TEST(FormatTests, Integers) {
+	EXPECT_EQ((formatted<"{} {} {} {}">(0, 42u, -17, INT32_MIN)), "0 42 -17 -2147483648");
+	EXPECT_EQ((formatted<"{} {}">(UINT64_MAX, INT64_MIN)), "18446744073709551615 -9223372036854775808");
+	EXPECT_EQ((formatted<"{:x} {:X} {:08x} {:b}">(0xbeefu, 0xbeefu, 0xa5u, 5u)), "beef BEEF 000000a5 101");
+	EXPECT_EQ((formatted<"{:x}">(uint8_t {0xff})), "ff");
+	EXPECT_EQ((formatted<"{:c}{}">(65, 'B')), "AB");
+}
+
+TEST(FormatTests, FixedPoint) {
+	EXPECT_EQ((formatted<"{:.2}">(1234)), "12.34");
+	EXPECT_EQ((formatted<"{:.2}">(5)), "0.05");
+	EXPECT_EQ((formatted<"{:.3}">(-1500)), "-1.500");
+	EXPECT_EQ((formatted<"{:8.1}|{:<8.1}|">(25, 25)), "     2.5|2.5     |");
+}
+
+TEST(FormatTests, Padding) {
+	EXPECT_EQ((formatted<"[{:5}][{:<5}][{:*>5}]">(42, 42, 42)), "[   42][42   ][***42]");
+	EXPECT_EQ((formatted<"[{:06}][{:06}]">(42, -42)), "[000042][-00042]");
+	EXPECT_EQ((formatted<"[{:6}][{:>6}][{:_<7}]">("ok", std::string_view("ok"), true)), "[ok    ][    ok][true___]");
+	EXPECT_EQ((formatted<"[{:2}]">(12345)), "[12345]");
+}
+
+TEST(FormatTests, MatchesSnprintf) {
+	for (int32_t value : {0, 1, -1, 9, 10, 65535, -65536, INT32_MAX, INT32_MIN}) {
+		char expected[64];
+		snprintf(expected, sizeof(expected), "%d|%8d|%-8d|%08x", value, value, value, static_cast<unsigned>(value));
+		EXPECT_EQ((formatted<"{}|{:8}|{:<8}|{:08x}">(value, value, value, static_cast<uint32_t>(value))), expected);
+	}
+}
+
+TEST(FormatTests, BufferTruncatesLikeSnprintf) {
+	char buffer[8];
+	EXPECT_EQ((format::to_buffer<"value {}">(buffer, sizeof(buffer), 12345)), 11u);
+	EXPECT_STREQ(buffer, "value 1");
+
+	EXPECT_EQ((format::to_buffer<"{}">(buffer, 0, 1)), 1u);
+}
+
+TEST(FormatTests, StreamWritesInFewPieces) {
+	StringStream stream;
+	format::write<"sck {} Hz, status 0x{:08x}\n">(stream, 8'000'000u, 0x1234u);
+	EXPECT_EQ(stream.text, "sck 8000000 Hz, status 0x00001234\n");
+	EXPECT_EQ(stream.writes, 1);
+
+	// Text longer than the buffer goes straight through
+	std::string long_text(200, 'x');
+	stream.text.clear();
+	format::write<"{}{}">(stream, std::string_view(long_text), 1);
+	EXPECT_EQ(stream.text, long_text + "1");
+}
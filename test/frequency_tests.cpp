@@ -0,0 +1,38 @@
+/// Tests for the frequency types and conversions
+
+#include <gtest/gtest.h>
+
+#include <embedded_util/frequency.hpp>
+
+using frequency::GHz;
+using frequency::Hz;
+using frequency::KHz;
+using frequency::MHz;
+using frequency::WideHz;
+
+TEST(FrequencyTests, CountsAreThirtyTwoBits) {
+	static_assert(sizeof(Frequency::rep) == 4);
+	static_assert(sizeof(MHz::rep) == 4);
+
+	// Implicit conversion to a finer unit still works, and the largest board clock fits
+	Frequency core = MHz(320);
+	EXPECT_EQ(core.count(), 320'000'000u);
+}
+
+TEST(FrequencyTests, CastMatchesDurationCast) {
+	static_assert(frequency::cast<MHz>(Hz(320'000'000)) == MHz(320));
+	static_assert(frequency::cast<Hz>(KHz(13'800)) == Hz(13'800'000));
+
+	for (uint32_t hz : {0u, 1u, 999'999u, 1'000'000u, 13'800'000u, 319'999'999u, 4'294'967'295u}) {
+		EXPECT_EQ(frequency::cast<MHz>(Hz(hz)).count(), std::chrono::duration_cast<MHz>(Hz(hz)).count());
+		EXPECT_EQ(frequency::cast<KHz>(Hz(hz)).count(), std::chrono::duration_cast<KHz>(Hz(hz)).count());
+		EXPECT_EQ(frequency::cast<GHz>(Hz(hz)).count(), std::chrono::duration_cast<GHz>(Hz(hz)).count());
+	}
+}
+
+TEST(FrequencyTests, WideValuesNarrowAfterDividing) {
+	// Beyond 32 bits in Hz, but not once converted
+	WideHz vco(16'000'000ULL * 400);
+	EXPECT_EQ(frequency::cast<MHz>(vco), MHz(6'400));
+	EXPECT_EQ(frequency::cast<Hz>(WideHz(320'000'000)), MHz(320));
+}
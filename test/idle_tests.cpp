@@ -0,0 +1,218 @@
+/// Tests for the low-power waits, against fake CLINT, PLIC and GPIO registers
+///
+/// Natively time only passes when a test moves mtime, which the tests do from the `wfi` hook.
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <hifive1b_bsp/csr.hpp>
+#include <hifive1b_bsp/idle.hpp>
+
+#include "fake_registers.hpp"
+
+using hifive1b::Idle;
+namespace csr = hifive1b::csr;
+
+class IdleTests : public ::testing::Test {
+	protected:
+		// GPIO register offsets
+		static constexpr uintptr_t GPIO_INPUT_VAL = 0x00;
+		static constexpr uintptr_t GPIO_HIGH_IE = 0x28;
+		static constexpr uintptr_t GPIO_HIGH_IP = 0x2C;
+
+		static constexpr uint32_t HANDSHAKE_PIN = 10;
+		static constexpr std::size_t HANDSHAKE_SOURCE = 8 + HANDSHAKE_PIN;
+
+		IdleTests() {
+			csr::native::reset();
+		}
+
+		~IdleTests() override {
+			csr::native::reset();
+		}
+
+		void set_mtime(uint64_t ticks) {
+			clint[FakeClint::MTIME_LO] = static_cast<uint32_t>(ticks);
+			clint[FakeClint::MTIME_HI] = static_cast<uint32_t>(ticks >> 32);
+		}
+
+		uint64_t get_mtimecmp() const {
+			return (static_cast<uint64_t>(clint[FakeClint::MTIMECMP_HI]) << 32) | clint[FakeClint::MTIMECMP_LO];
+		}
+
+		void set_mtimecmp(uint64_t ticks) {
+			clint[FakeClint::MTIMECMP_LO] = static_cast<uint32_t>(ticks);
+			clint[FakeClint::MTIMECMP_HI] = static_cast<uint32_t>(ticks >> 32);
+		}
+
+		FakeClint clint;
+		FakePlic plic;
+		FakeRegisters gpio {0x40};
+		Idle idle {clint.base(), plic.base(), gpio.base()};
+};
+
+TEST(IdleConversionTests, TicksRoundUp) {
+	EXPECT_EQ(Idle::ticks_from_us(0), 0ULL);
+	EXPECT_EQ(Idle::ticks_from_us(1), 1ULL);
+	EXPECT_EQ(Idle::ticks_from_us(30), 1ULL);
+	EXPECT_EQ(Idle::ticks_from_us(31), 2ULL);
+	EXPECT_EQ(Idle::ticks_from_us(1000), 33ULL);
+	EXPECT_EQ(Idle::ticks_from_us(1000000), 32768ULL);
+
+	EXPECT_EQ(Idle::us_from_ticks(1), 30ULL);
+	EXPECT_EQ(Idle::us_from_ticks(32768), 1000000ULL);
+}
+
+TEST_F(IdleTests, ReadsMtimeAcrossWords) {
+	set_mtime(0x123456789ULL);
+	EXPECT_EQ(idle.now(), 0x123456789ULL);
+}
+
+TEST_F(IdleTests, PassedDeadlineDoesNotSleep) {
+	set_mtime(1000);
+	clint[FakeClint::MTIMECMP_LO] = 5;
+
+	idle.sleep_until(999);
+	idle.sleep_until(1000);
+
+	EXPECT_EQ(idle.get_stats().sleeps, 0UL);
+	// The timer is left as it was
+	EXPECT_EQ(get_mtimecmp(), 5ULL);
+}
+
+TEST_F(IdleTests, PinAlreadyAtLevelIsNotArmed) {
+	gpio[GPIO_INPUT_VAL] = 1UL << HANDSHAKE_PIN;
+
+	EXPECT_TRUE(idle.wait_for_pin(HANDSHAKE_PIN, true, 0));
+	EXPECT_EQ(gpio[GPIO_HIGH_IE], 0UL);
+	EXPECT_EQ(plic[FakePlic::ENABLE], 0UL);
+}
+
+TEST_F(IdleTests, PinTimeoutRestoresInterruptState) {
+	set_mtime(100);
+	plic[FakePlic::ENABLE] = 0x8;
+	plic[FakePlic::THRESHOLD] = 7;
+	gpio[GPIO_HIGH_IE] = 1UL << 2;
+	// The level interrupt was already pending when the wait ended
+	plic[FakePlic::CLAIM] = HANDSHAKE_SOURCE;
+
+	EXPECT_FALSE(idle.wait_for_pin(HANDSHAKE_PIN, true, 100));
+
+	// The handshake pin's interrupt is off and cleared; other pins are untouched
+	EXPECT_EQ(gpio[GPIO_HIGH_IE], 1UL << 2);
+	EXPECT_EQ(gpio[GPIO_HIGH_IP], 1UL << HANDSHAKE_PIN);
+
+	// The threshold masked everything, so the source was given the top priority for the wait, then claimed and
+	// completed
+	EXPECT_EQ(plic[FakePlic::priority(HANDSHAKE_SOURCE)], 7UL);
+	EXPECT_EQ(plic[FakePlic::CLAIM], HANDSHAKE_SOURCE);
+
+	EXPECT_EQ(plic[FakePlic::ENABLE], 0x8UL);
+	EXPECT_EQ(plic[FakePlic::THRESHOLD], 7UL);
+	EXPECT_EQ(get_mtimecmp(), 0ULL);
+}
+
+TEST_F(IdleTests, ConditionIsCheckedBeforeSleeping) {
+	set_mtime(100);
+	int checks = 0;
+
+	EXPECT_TRUE(idle.wait([&checks] { return ++checks > 0; }, Idle::UART0_SOURCE, Idle::FOREVER));
+	EXPECT_EQ(checks, 1);
+	EXPECT_EQ(idle.get_stats().sleeps, 0UL);
+
+	// A wait that times out still checks once
+	checks = -10;
+	EXPECT_FALSE(idle.wait([&checks] { return ++checks > 0; }, 0, 50));
+	EXPECT_EQ(checks, -9);
+}
+
+TEST_F(IdleTests, ResidencyIsZeroWithoutSleeping) {
+	set_mtime(0);
+	idle.reset_stats();
+	set_mtime(32768);
+	EXPECT_EQ(idle.get_residency_permille(), 0UL);
+}
+
+TEST_F(IdleTests, WaitWithInterruptsDisabledOnlyWakesForItsOwn) {
+	set_mtime(0);
+	csr::native::mie = csr::MIE_MSIE;
+	plic[FakePlic::ENABLE] = 1UL << HANDSHAKE_SOURCE;
+
+	int sleeps = 0;
+	csr::native::on_wfi = [&] {
+		++sleeps;
+		EXPECT_EQ(plic[FakePlic::ENABLE], static_cast<uint32_t>(Idle::UART0_SOURCE));
+		EXPECT_EQ(csr::native::mie, csr::MIE_MTIE | csr::MIE_MEIE);
+		set_mtime(get_mtimecmp());
+	};
+	csr::native::on_interrupts_enabled = [] { ADD_FAILURE() << "interrupts enabled during the wait"; };
+
+	EXPECT_FALSE(idle.wait([] { return false; }, Idle::UART0_SOURCE, 100));
+	EXPECT_EQ(sleeps, 1);
+	EXPECT_EQ(plic[FakePlic::ENABLE], 1UL << HANDSHAKE_SOURCE);
+	EXPECT_EQ(csr::native::mie, csr::MIE_MSIE);
+}
+
+TEST_F(IdleTests, HandlersRunDuringWaits) {
+	constexpr uint32_t EDGE_SOURCE = 8 + 20;
+	constexpr uint64_t TIMER_HANDLER_DEADLINE = 50;
+
+	// As an InterruptController leaves things: interrupts on, a timer handler and an attached GPIO source
+	set_mtime(0);
+	set_mtimecmp(TIMER_HANDLER_DEADLINE);
+	plic[FakePlic::ENABLE] = 1UL << EDGE_SOURCE;
+	plic[FakePlic::priority(EDGE_SOURCE)] = 5;
+	csr::native::mstatus = csr::MSTATUS_MIE;
+	csr::native::mie = csr::MIE_MTIE | csr::MIE_MEIE;
+
+	// The edge arrives during the first sleep, then each sleep lasts until the timer
+	bool edge_pending = false;
+	std::vector<uint64_t> sleeps;
+	csr::native::on_wfi = [&] {
+		EXPECT_EQ(plic[FakePlic::ENABLE], (1UL << EDGE_SOURCE) | static_cast<uint32_t>(Idle::UART0_SOURCE));
+		EXPECT_EQ(csr::native::mie, csr::MIE_MTIE | csr::MIE_MEIE);
+		sleeps.push_back(get_mtimecmp());
+		if (sleeps.size() == 1) {
+			set_mtime(20);
+			edge_pending = true;
+		} else {
+			set_mtime(get_mtimecmp());
+		}
+	};
+
+	// Stand in for the controller taking whatever is pending and enabled
+	std::vector<std::pair<const char*, uint64_t>> handled;
+	csr::native::on_interrupts_enabled = [&] {
+		EXPECT_EQ(plic[FakePlic::ENABLE] & Idle::UART0_SOURCE, 0ULL) << "the wait's source reached the controller";
+		uint64_t now = idle.now();
+		if ((csr::native::mie & csr::MIE_MEIE) && (plic[FakePlic::ENABLE] & (1UL << EDGE_SOURCE)) && edge_pending) {
+			handled.emplace_back("edge", now);
+			edge_pending = false;
+		}
+		if ((csr::native::mie & csr::MIE_MTIE) && now >= get_mtimecmp()) {
+			handled.emplace_back("timer", now);
+			set_mtimecmp(1000);
+		}
+	};
+
+	EXPECT_FALSE(idle.wait([] { return false; }, Idle::UART0_SOURCE, 100));
+
+	// Each handler ran as its interrupt arrived, not when the wait ended
+	ASSERT_EQ(handled.size(), 2u);
+	EXPECT_STREQ(handled[0].first, "edge");
+	EXPECT_EQ(handled[0].second, 20ULL);
+	EXPECT_STREQ(handled[1].first, "timer");
+	EXPECT_EQ(handled[1].second, TIMER_HANDLER_DEADLINE);
+
+	// The timer handler's deadline ended the second sleep, and its new one is kept
+	ASSERT_EQ(sleeps.size(), 3u);
+	EXPECT_EQ(sleeps[0], TIMER_HANDLER_DEADLINE);
+	EXPECT_EQ(sleeps[1], TIMER_HANDLER_DEADLINE);
+	EXPECT_EQ(sleeps[2], 100ULL);
+	EXPECT_EQ(get_mtimecmp(), 1000ULL);
+
+	EXPECT_EQ(plic[FakePlic::ENABLE], 1UL << EDGE_SOURCE);
+	EXPECT_EQ(csr::native::mie, csr::MIE_MTIE | csr::MIE_MEIE);
+	EXPECT_EQ(csr::native::mstatus, csr::MSTATUS_MIE);
+}
@@ -0,0 +1,112 @@
+/// Tests for the interrupt dispatch tables, against fake CLINT and PLIC registers
+
+#include <gtest/gtest.h>
+
+#include <hifive1b_bsp/interrupts.hpp>
+
+#include "fake_registers.hpp"
+
+using hifive1b::InterruptController;
+using Vector = InterruptController::Vector;
+
+class InterruptTests : public ::testing::Test {
+	protected:
+		static constexpr uint32_t UART0 = 3;
+		static constexpr uint32_t GPIO10 = 18;
+		static constexpr uint32_t PWM2_0 = 48;
+
+		/// Counts calls, and on each one clears the claim register so the test sees dispatch complete the source
+		static void count(void* context) {
+			auto* self = static_cast<InterruptTests*>(context);
+			++self->calls;
+			self->plic[FakePlic::CLAIM] = 0;
+		}
+
+		FakeClint clint;
+		FakePlic plic;
+		InterruptController interrupts {clint.base(), plic.base()};
+		int calls = 0;
+};
+
+TEST_F(InterruptTests, AttachSetsPriorityAndEnable) {
+	EXPECT_TRUE(interrupts.attach(GPIO10, 5, count, this));
+	EXPECT_TRUE(interrupts.attach(PWM2_0, 1, count, this));
+
+	EXPECT_EQ(plic[FakePlic::priority(GPIO10)], 5UL);
+	EXPECT_EQ(plic[FakePlic::priority(PWM2_0)], 1UL);
+	EXPECT_EQ(plic[FakePlic::ENABLE], 1UL << GPIO10);
+	EXPECT_EQ(plic[FakePlic::ENABLE + 4], 1UL << (PWM2_0 - 32));
+
+	interrupts.detach(GPIO10);
+	EXPECT_EQ(plic[FakePlic::priority(GPIO10)], 0UL);
+	EXPECT_EQ(plic[FakePlic::ENABLE], 0UL);
+	EXPECT_EQ(plic[FakePlic::ENABLE + 4], 1UL << (PWM2_0 - 32));
+
+	interrupts.set_threshold(4);
+	EXPECT_EQ(plic[FakePlic::THRESHOLD], 4UL);
+}
+
+TEST_F(InterruptTests, RejectsInvalidSourcesAndPriorities) {
+	EXPECT_FALSE(interrupts.attach(0, 1, count, this));
+	EXPECT_FALSE(interrupts.attach(InterruptController::SOURCES, 1, count, this));
+	EXPECT_FALSE(interrupts.attach(UART0, 0, count, this));
+	EXPECT_FALSE(interrupts.attach(UART0, InterruptController::MAX_PRIORITY + 1, count, this));
+	EXPECT_EQ(plic[FakePlic::ENABLE], 0UL);
+}
+
+TEST_F(InterruptTests, ExternalRunsClaimedHandlerAndCompletes) {
+	int uart_calls = 0;
+	interrupts.attach(GPIO10, 1, count, this);
+	interrupts.attach(UART0, 1, [](void* context) { ++*static_cast<int*>(context); }, &uart_calls);
+
+	plic[FakePlic::CLAIM] = GPIO10;
+	interrupts.dispatch_external(0);
+
+	EXPECT_EQ(calls, 1);
+	EXPECT_EQ(uart_calls, 0);
+	// Completed by writing the ID back
+	EXPECT_EQ(plic[FakePlic::CLAIM], GPIO10);
+	EXPECT_EQ(interrupts.get_stats(Vector::EXTERNAL).count, 1UL);
+
+	// Nothing to claim
+	plic[FakePlic::CLAIM] = 0;
+	interrupts.dispatch_external(0);
+	EXPECT_EQ(calls, 1);
+	EXPECT_EQ(interrupts.get_stats(Vector::EXTERNAL).count, 1UL);
+}
+
+TEST_F(InterruptTests, UnhandledSourceIsCompleted) {
+	plic[FakePlic::CLAIM] = UART0;
+	interrupts.dispatch_external(0);
+
+	EXPECT_EQ(interrupts.get_spurious(), 1UL);
+	EXPECT_EQ(plic[FakePlic::CLAIM], UART0);
+	EXPECT_EQ(interrupts.get_stats(Vector::EXTERNAL).count, 0UL);
+}
+
+TEST_F(InterruptTests, SoftwareInterruptIsCleared) {
+	interrupts.set_software_handler(count, this);
+
+	interrupts.trigger_software();
+	EXPECT_EQ(clint[FakeClint::MSIP], 1UL);
+
+	interrupts.dispatch_software(0);
+	EXPECT_EQ(clint[FakeClint::MSIP], 0UL);
+	EXPECT_EQ(calls, 1);
+	EXPECT_EQ(interrupts.get_stats(Vector::SOFTWARE).count, 1UL);
+	EXPECT_EQ(interrupts.get_stats(Vector::TIMER).count, 0UL);
+}
+
+TEST_F(InterruptTests, TimerWithoutHandlerIsIgnored) {
+	interrupts.dispatch_timer(0);
+	EXPECT_EQ(interrupts.get_stats(Vector::TIMER).count, 0UL);
+
+	interrupts.set_timer_handler(count, this);
+	interrupts.dispatch_timer(0);
+	interrupts.dispatch_timer(0);
+	EXPECT_EQ(interrupts.get_stats(Vector::TIMER).count, 2UL);
+
+	interrupts.reset_stats();
+	EXPECT_EQ(interrupts.get_stats(Vector::TIMER).count, 0UL);
+	EXPECT_EQ(interrupts.get_stats(Vector::TIMER).min_cycles, UINT32_MAX);
+}
@@ -0,0 +1,110 @@
+/// Tests for the RGB LED driver against fake PWM1 registers
+
+#include <gtest/gtest.h>
+
+#include <hifive1b_bsp/leds.hpp>
+
+#include "fake_registers.hpp"
+#include "mock_clock.hpp"
+
+using hifive1b::LedDriver;
+
+class LedDriverTests : public ::testing::Test {
+	protected:
+		// Offsets of pwmcfg, pwmcmp0 (the period) and the channel comparators
+		static constexpr uintptr_t CFG = 0x00;
+		static constexpr uintptr_t PERIOD = 0x20;
+		static constexpr uintptr_t GREEN = 0x24;
+		static constexpr uintptr_t BLUE = 0x28;
+		static constexpr uintptr_t RED = 0x2C;
+
+		uint32_t scale() const { return registers[CFG] & 0xF; }
+
+		FakeRegisters registers {0x30};
+		uintptr_t pwm = registers.base();
+};
+
+TEST_F(LedDriverTests, SolidColorsDim) {
+	MockClock clock(Frequency(16'000'000));
+	LedDriver leds(clock, 1, 0, 0, pwm);
+
+	// Full brightness is pushed past the end of the period so the LED never turns off
+	EXPECT_EQ(registers[PERIOD], 0xFFu);
+	EXPECT_EQ(registers[RED], 0xFFFFu);
+	EXPECT_EQ(registers[GREEN], 0u);
+
+	leds.set_color({10, 20, 30});
+	EXPECT_EQ(scale(), 0u);
+	EXPECT_EQ(registers[RED], 10u);
+	EXPECT_EQ(registers[GREEN], 20u);
+	EXPECT_EQ(registers[BLUE], 30u);
+}
+
+TEST_F(LedDriverTests, BlinkPicksTheSmallestPrescaler) {
+	MockClock clock(Frequency(16'000'000));
+	LedDriver leds(clock, 0, 0, 0, pwm);
+
+	// 16000 counts per ms at scale 0; 62 per ms at scale 8 is the first to fit a second in 16 bits
+	leds.blink({255, 0, 255}, 1000);
+	EXPECT_EQ(scale(), 8u);
+	EXPECT_EQ(registers[PERIOD], 62'000u);
+	EXPECT_EQ(registers[RED], 31'000u);
+	EXPECT_EQ(registers[GREEN], 0u);
+	EXPECT_EQ(registers[BLUE], 31'000u);
+
+	leds.blink({255, 0, 0}, 2);
+	EXPECT_EQ(scale(), 0u);
+	EXPECT_EQ(registers[PERIOD], 32'000u);
+
+	// A clock change keeps the period
+	clock.change(Frequency(320'000'000));
+	EXPECT_EQ(scale(), 4u);
+	EXPECT_EQ(registers[PERIOD], 40'000u);
+}
+
+TEST_F(LedDriverTests, LongBlinksSaturate) {
+	MockClock clock(Frequency(320'000'000));
+	LedDriver leds(clock, 0, 0, 0, pwm);
+
+	leds.blink({255, 255, 255}, 20'000);
+	EXPECT_EQ(scale(), 15u);
+	EXPECT_EQ(registers[PERIOD], 0xFFFFu);
+
+	// 320000 counts per ms times this period is just past 2^32, which wrapped to a count that fit at scale 0
+	leds.blink({255, 255, 255}, 67'109);
+	EXPECT_EQ(scale(), 15u);
+	EXPECT_EQ(registers[PERIOD], 0xFFFFu);
+	EXPECT_EQ(registers[GREEN], 0x7FFFu);
+}
+
+TEST_F(LedDriverTests, BreatheRampsUpAndDown) {
+	MockClock clock(Frequency(16'000'000));
+	LedDriver leds(clock, 0, 0, 0, pwm);
+
+	leds.breathe({255, 128, 0}, 1000);
+	EXPECT_EQ(registers[PERIOD], 0xFFu);
+	EXPECT_EQ(registers[RED], 0u);
+
+	// Brighter every step up to the middle of the period, then back down the same way
+	uint32_t previous = 0;
+	for (uint32_t t = 0; t <= 500; t += 50) {
+		leds.tick(t);
+		EXPECT_GE(registers[RED], previous) << "at " << t << " ms";
+		previous = registers[RED];
+
+		leds.tick(1000 - t);
+		EXPECT_EQ(registers[RED], previous) << "at " << 1000 - t << " ms";
+	}
+	EXPECT_EQ(previous, 253u);
+
+	// Gamma corrected, so a quarter of the way through is much less than half brightness
+	leds.tick(250);
+	EXPECT_EQ(registers[RED], 62u);
+	EXPECT_EQ(registers[GREEN], 31u);
+	EXPECT_EQ(registers[BLUE], 0u);
+
+	// Only the breathing pattern is driven by tick()
+	leds.set_color({5, 5, 5});
+	leds.tick(500);
+	EXPECT_EQ(registers[RED], 5u);
+}
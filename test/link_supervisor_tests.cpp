@@ -0,0 +1,133 @@
+/// Tests for recovering the ESP32 SPI link
+
+#include <gtest/gtest.h>
+
+#include <esp32_at/at_client.hpp>
+#include <esp32_at/link_supervisor.hpp>
+#include <esp32_at/spi_link.hpp>
+
+#include "fake_esp32_port.hpp"
+
+using esp32::LinkSupervisor;
+using Level = LinkSupervisor::Level;
+
+class LinkSupervisorTests : public ::testing::Test {
+	protected:
+		LinkSupervisorTests() :
+			port(100'000'000),
+			link(port, pool),
+			client(link),
+			supervisor(link, client)
+		{
+			link.negotiate();
+			supervisor.set_recovery_handler([this](Level level) {
+				recovered.push_back(level);
+			});
+		}
+
+		/// Fail enough transfers in a row to trigger a recovery
+		void break_link() {
+			for (uint32_t i = 0; i < LinkSupervisor::TRIGGER_ERRORS; ++i) {
+				port.outgoing.push_back("\r\nOK\r\n");
+				link.receive();
+				port.outgoing.clear();
+			}
+		}
+
+		/// Poll like the main loop until the link is usable or the time runs out
+		bool poll_for(uint32_t us) {
+			uint32_t start = port.now_us();
+			while (port.now_us() - start < us) {
+				if (supervisor.poll()) {
+					return true;
+				}
+				port.advance(1000);
+			}
+			return false;
+		}
+
+		StaticPbufPool<128, 8> pool;
+		FakeEsp32Port port;
+		esp32::SpiLink link;
+		esp32::AtClient client;
+		LinkSupervisor supervisor;
+		std::vector<Level> recovered;
+};
+
+TEST_F(LinkSupervisorTests, HealthyLinkIsLeftAlone) {
+	EXPECT_TRUE(supervisor.poll());
+	EXPECT_TRUE(recovered.empty());
+}
+
+TEST_F(LinkSupervisorTests, BadLengthPhasesResync) {
+	bool aborted = false;
+	client.submit({.text = "AT+CWMODE=1\r\n", .timeout_ms = 1000,
+		.on_complete = [&aborted](esp32::AtClient::Result result) {
+			aborted = (result == esp32::AtClient::Result::ABORTED);
+		}
+	});
+
+	uint32_t clock = link.get_clock();
+	port.bad_markers = LinkSupervisor::TRIGGER_ERRORS;
+	break_link();
+
+	EXPECT_TRUE(supervisor.poll());
+	ASSERT_EQ(recovered.size(), 1u);
+	EXPECT_EQ(recovered[0], Level::RESYNC);
+	EXPECT_TRUE(aborted);
+
+	// The only fallback is the link's own step down, not a renegotiation
+	EXPECT_GE(link.get_clock(), esp32::SpiLink::CLOCK_LADDER[esp32::SpiLink::CLOCK_LADDER.size() - 2]);
+	EXPECT_LE(link.get_clock(), clock);
+	EXPECT_EQ(supervisor.get_stats().recoveries[0], 1u);
+	EXPECT_GT(supervisor.get_stats().last_recovery_us, 0u);
+	EXPECT_LT(supervisor.get_stats().last_recovery_us, 10'000u);
+}
+
+TEST_F(LinkSupervisorTests, ClockProblemsRenegotiate) {
+	port.max_reliable_hz = 1'000'000;
+	break_link();
+
+	EXPECT_TRUE(supervisor.poll());
+	ASSERT_EQ(recovered.size(), 1u);
+	EXPECT_EQ(recovered[0], Level::SLOW_CLOCK);
+	EXPECT_EQ(link.get_clock(), 1'000'000u);
+	EXPECT_EQ(port.resets, 0);
+}
+
+TEST_F(LinkSupervisorTests, HungEsp32IsReset) {
+	port.hung = true;
+	port.boot_us = 800'000;
+	break_link();
+
+	EXPECT_FALSE(supervisor.poll());
+	EXPECT_TRUE(supervisor.is_recovering());
+
+	EXPECT_TRUE(poll_for(2'000'000));
+	EXPECT_EQ(port.resets, 1);
+	ASSERT_EQ(recovered.size(), 1u);
+	EXPECT_EQ(recovered[0], Level::RESET);
+	EXPECT_EQ(link.get_clock(), esp32::SpiLink::CLOCK_LADDER.back());
+
+	const auto& stats = supervisor.get_stats();
+	EXPECT_EQ(stats.recoveries[2], 1u);
+	EXPECT_GE(stats.last_recovery_us, 800'000u);
+	EXPECT_LT(stats.last_recovery_us, 1'000'000u);
+	EXPECT_EQ(stats.max_recovery_us, stats.last_recovery_us);
+}
+
+TEST_F(LinkSupervisorTests, ResetIsRetried) {
+	port.hung = true;
+	port.lost_resets = 1;
+	port.boot_us = 800'000;
+	break_link();
+
+	EXPECT_FALSE(poll_for(LinkSupervisor::RESET_TIMEOUT_US));
+	EXPECT_TRUE(poll_for(2'000'000));
+
+	const auto& stats = supervisor.get_stats();
+	EXPECT_EQ(stats.reset_timeouts, 1u);
+	EXPECT_EQ(stats.recoveries[2], 1u);
+	EXPECT_GT(stats.last_recovery_us, LinkSupervisor::RESET_TIMEOUT_US);
+	EXPECT_EQ(port.resets, 1);
+}
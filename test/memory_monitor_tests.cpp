@@ -0,0 +1,108 @@
+/// Tests for the stack and heap monitor, against arrays standing in for the RAM regions
+
+#include <array>
+
+#include <gtest/gtest.h>
+
+#include <hifive1b_bsp/memory_monitor.hpp>
+
+using hifive1b::MemoryMonitor;
+
+static uintptr_t fake_break = 0;
+
+static uintptr_t get_fake_break() {
+	return fake_break;
+}
+
+class MemoryMonitorTests : public ::testing::Test {
+	protected:
+		MemoryMonitorTests() :
+			monitor(layout(), get_fake_break)
+		{
+			stack.fill(0);
+			heap.fill(0);
+			fake_break = address(heap.data());
+		}
+
+		static uintptr_t address(const void* p) {
+			return reinterpret_cast<uintptr_t>(p);
+		}
+
+		MemoryMonitor::Layout layout() {
+			return {
+				{address(statics.data()), address(statics.data() + statics.size())},
+				{address(stack.data()), address(stack.data() + stack.size())},
+				{address(heap.data()), address(heap.data() + heap.size())},
+			};
+		}
+
+		/// Pretend the stack reached down to a word index, as a call chain would leave it
+		void use_stack_down_to(std::size_t index) {
+			for (std::size_t i = index; i < stack.size(); ++i) {
+				stack[i] = static_cast<uint32_t>(i);
+			}
+		}
+
+		std::array<uint32_t, 64> statics {};
+		std::array<uint32_t, 256> stack;
+		std::array<uint8_t, 2048> heap;
+		MemoryMonitor monitor;
+};
+
+TEST_F(MemoryMonitorTests, PaintStopsBelowTop) {
+	monitor.paint(address(&stack[200]));
+	EXPECT_EQ(stack[0], MemoryMonitor::PAINT);
+	EXPECT_EQ(stack[199], MemoryMonitor::PAINT);
+	EXPECT_EQ(stack[200], 0u);
+
+	// A top past the stack is clipped to it
+	monitor.paint(address(stack.data()) + 4096);
+	EXPECT_EQ(stack.back(), MemoryMonitor::PAINT);
+}
+
+TEST_F(MemoryMonitorTests, ReportsHighWaterMarks) {
+	// What was on the stack while painting counts as used
+	monitor.paint(address(&stack[240]));
+	auto usage = monitor.get_usage();
+	EXPECT_EQ(usage.static_bytes, 256u);
+	EXPECT_EQ(usage.stack_size, 1024u);
+	EXPECT_EQ(usage.stack_peak, 16 * 4u);
+	EXPECT_EQ(usage.heap_used, 0u);
+	EXPECT_EQ(usage.heap_free(), 2048u);
+
+	use_stack_down_to(100);
+	fake_break += 300;
+	usage = monitor.get_usage();
+	EXPECT_EQ(usage.stack_peak, 156 * 4u);
+	EXPECT_EQ(usage.stack_headroom(), 100 * 4u);
+	EXPECT_EQ(usage.heap_used, 300u);
+	EXPECT_EQ(usage.heap_free(), 1748u);
+
+	// Frames can leave some of their words untouched; only the deepest written word counts
+	stack.fill(MemoryMonitor::PAINT);
+	stack[150] = 0;
+	EXPECT_EQ(monitor.get_usage().stack_peak, 106 * 4u);
+}
+
+TEST_F(MemoryMonitorTests, CheckWatchesTheGuard) {
+	monitor.paint(address(&stack[240]));
+	EXPECT_TRUE(monitor.check());
+
+	// Deep, but still above the guard
+	constexpr std::size_t GUARD_WORDS = MemoryMonitor::GUARD_BYTES / 4;
+	use_stack_down_to(GUARD_WORDS);
+	EXPECT_TRUE(monitor.check());
+
+	stack[GUARD_WORDS - 1] = 0;
+	EXPECT_FALSE(monitor.check());
+}
+
+TEST_F(MemoryMonitorTests, CheckWatchesTheHeapBreak) {
+	monitor.paint(address(&stack[240]));
+
+	fake_break = address(heap.data() + heap.size());
+	EXPECT_TRUE(monitor.check());
+	fake_break += 1;
+	EXPECT_FALSE(monitor.check());
+	EXPECT_EQ(monitor.get_usage().heap_used, 2048u);
+}
@@ -0,0 +1,92 @@
+/// Tests for the compile-time mixer, checked against the run-time one and against the expo formula
+
+#include <cmath>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <embedded_util/mixer.hpp>
+
+using mixer::percent;
+
+/// Tank steering and a trimmed, rate limited servo with some odd weights
+static constexpr mixer::Topology<3, 3, 6> TANK {
+	.expo = {0, 40, 100},
+	.rules = {{
+		{0, 0, percent(100)},
+		{1, 0, percent(100)},
+		{0, 1, percent(100)},
+		{1, 1, percent(-100)},
+		{2, 2, percent(73)},
+		{0, 2, percent(0)},
+	}},
+	.outputs = {{
+		{},
+		{},
+		{1000, -20000, 20000, 500},
+	}},
+};
+
+TEST(MixerTests, ExpoTableFollowsTheCurve) {
+	constexpr auto& linear = mixer::EXPO_TABLE<0>;
+	static_assert(linear[8] == 16384);
+
+	for (int e : {0, 30, 70, 100}) {
+		auto table = mixer::make_expo_table(static_cast<uint8_t>(e));
+		for (int32_t x = -32767; x <= 32767; x += 97) {
+			double u = x / 32768.0;
+			double expected = ((100 - e) * u + e * u * u * u) / 100 * 32768.0;
+			// Linear interpolation over 16 segments bends a cubic by at most about 0.6%
+			EXPECT_NEAR(mixer::shape(table, x), expected, 200) << "expo " << e << " x " << x;
+		}
+	}
+}
+
+TEST(MixerTests, TankMix) {
+	mixer::Mixer<TANK> tank;
+	auto& out = tank.mix({10000, 0, 0});
+	EXPECT_EQ(out[0], 10000);
+	EXPECT_EQ(out[1], 10000);
+
+	// Turning in place; full steer isn't bent by expo
+	tank.mix({0, 32767, 0});
+	EXPECT_EQ(out[0], 32767);
+	EXPECT_EQ(out[1], -32767);
+
+	// Sums are clamped rather than wrapping
+	tank.mix({32767, 32767, 0});
+	EXPECT_EQ(out[0], 32767);
+	EXPECT_EQ(out[1], 0);
+}
+
+TEST(MixerTests, TrimClampAndRateLimit) {
+	mixer::Mixer<TANK> mix;
+
+	// From 0, the servo moves at most 500 per mix towards trim + 73% of full, clamped to 20000
+	for (int i = 1; i <= 10; ++i) {
+		EXPECT_EQ(mix.mix({0, 0, 32767})[2], 500 * i);
+	}
+	for (int i = 0; i < 100; ++i) {
+		mix.mix({0, 0, 32767});
+	}
+	EXPECT_EQ(mix.get_outputs()[2], 20000);
+
+	mix.reset({0, 0, 1000});
+	EXPECT_EQ(mix.mix({0, 0, 0})[2], 1000);
+}
+
+TEST(MixerTests, MatchesRuntimeMixer) {
+	mixer::Mixer<TANK> compiled;
+	mixer::RuntimeMixer runtime(TANK);
+
+	std::mt19937 random(7);
+	std::uniform_int_distribution<int> value(-32767, 32767);
+	for (int i = 0; i < 10000; ++i) {
+		mixer::Mixer<TANK>::Inputs in {
+			static_cast<mixer::Value>(value(random)),
+			static_cast<mixer::Value>(value(random)),
+			static_cast<mixer::Value>(value(random)),
+		};
+		ASSERT_EQ(compiled.mix(in), runtime.mix(in));
+	}
+}
@@ -0,0 +1,25 @@
+/// Clock stand-in for the tests of drivers that follow frequency changes
+
+#pragma once
+
+#include <embedded_util/clock.hpp>
+
+/// Clock whose frequency is changed by the test
+class MockClock : public Clock {
+	public:
+		explicit MockClock(Frequency f) :
+			current(f)
+		{}
+
+		Frequency get_frequency() override { return current; }
+
+		/// Notify listeners of a change to f, before and after switching to it, as a PLL change would
+		void change(Frequency f) {
+			emit_frequency_pending(f);
+			current = f;
+			emit_frequency_change(f);
+		}
+
+	private:
+		Frequency current;
+};
@@ -0,0 +1,406 @@
+/// Tests for firmware updates: staging, the download session and the installer
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <embedded_util/crc.hpp>
+#include <embedded_util/pbuf.hpp>
+
+#include <esp32_at/at_client.hpp>
+#include <esp32_at/at_transport.hpp>
+#include <esp32_at/ota_session.hpp>
+#include <esp32_at/socket_layer.hpp>
+
+#include <storage/file_flash.hpp>
+#include <storage/ota_image.hpp>
+#include <storage/ota_writer.hpp>
+
+using esp32::OtaSession;
+using storage::FileFlash;
+using storage::OtaInstall;
+using storage::OtaWriter;
+
+/// Flash layout for the tests: the running image and an update slot
+static constexpr std::size_t FLASH_SIZE = 1024 * 1024;
+static constexpr uint32_t TARGET = 0x10000;
+static constexpr uint32_t TARGET_LENGTH = 0x60000;
+static constexpr uint32_t SLOT = 0x80000;
+static constexpr uint32_t SLOT_LENGTH = 0x40000;
+
+static std::vector<uint8_t> make_image(std::size_t size) {
+	std::mt19937 rng(static_cast<uint32_t>(size));
+	std::vector<uint8_t> image(size);
+	for (auto& b : image) {
+		b = static_cast<uint8_t>(rng());
+	}
+	return image;
+}
+
+static void store_u32(std::string& s, uint32_t value) {
+	for (int i = 0; i < 4; ++i) {
+		s.push_back(static_cast<char>(value >> (8 * i)));
+	}
+}
+
+/// Stands in for the ESP32 and an update server behind it on TCP link 0
+///
+/// Answers the socket layer's commands, sends the header and image as +IPD packets at a fixed rate, and keeps to the
+/// window using the acknowledgements it receives.
+class UpdateServerEsp32 : public esp32::AtTransport {
+	public:
+		UpdateServerEsp32(std::vector<uint8_t> image, uint32_t bytes_per_ms) :
+			image(std::move(image)),
+			bytes_per_ms(bytes_per_ms)
+		{
+			store_u32(header, OtaSession::STREAM_MAGIC);
+			store_u32(header, static_cast<uint32_t>(this->image.size()));
+			store_u32(header, Crc32::calculate(this->image.data(), this->image.size()));
+		}
+
+		/// Advance the simulated time, which lets the server send more
+		void set_time(uint64_t us) { now_us = us; }
+
+		bool send(std::string_view data) override {
+			if (payload_expected > 0) {
+				// An acknowledgement
+				if (data.size() == OtaSession::ACK_SIZE) {
+					auto p = reinterpret_cast<const uint8_t*>(data.data());
+					acked = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+					final_status = p[4];
+					++acks;
+				}
+				payload_expected = 0;
+				ready.push_back("\r\nRecv 5 bytes\r\n\r\nSEND OK\r\n");
+			} else if (data == "AT+CIPMUX=1\r\n") {
+				ready.push_back("\r\nOK\r\n");
+			} else if (data.substr(0, 20) == "AT+CIPSTART=0,\"TCP\",") {
+				connected = true;
+				connect_us = now_us;
+				ready.push_back("0,CONNECT\r\n\r\nOK\r\n");
+			} else if (data.substr(0, 13) == "AT+CIPSEND=0,") {
+				payload_expected = std::stoul(std::string(data.substr(13)));
+				ready.push_back("\r\nOK\r\n\r\n>");
+			} else if (data == "AT+CIPCLOSE=0\r\n") {
+				connected = false;
+				ready.push_back("0,CLOSED\r\n\r\nOK\r\n");
+			} else {
+				ready.push_back("\r\nERROR\r\n");
+			}
+			return true;
+		}
+
+		std::string_view receive() override {
+			stream();
+			if (ready.empty()) {
+				return {};
+			}
+			current = std::move(ready.front());
+			ready.pop_front();
+			return current;
+		}
+
+		/// Header sent in place of the real one
+		std::string header;
+
+		std::vector<uint8_t> image;
+		uint32_t acked = 0;
+		uint8_t final_status = 0xFF;
+		uint32_t acks = 0;
+		bool connected = false;
+		uint64_t connect_us = 0;
+		/// Largest number of image bytes in flight past the acknowledged count
+		std::size_t max_outstanding = 0;
+
+	private:
+		/// Send whatever the rate and window allow, in packets of 128 to 256 bytes
+		void stream() {
+			if (!connected) {
+				return;
+			}
+
+			std::size_t total = header.size() + image.size();
+			while (sent < total) {
+				std::size_t budget = static_cast<std::size_t>((now_us - connect_us) * bytes_per_ms / 1000);
+				std::size_t image_sent = (sent > header.size()) ? sent - header.size() : 0;
+				std::size_t window = acked + OtaSession::WINDOW - image_sent;
+				std::size_t n = std::min({total - sent, window, std::size_t(256)});
+
+				// Like a TCP sender, hold off rather than trickle out tiny segments
+				if (n < std::min(total - sent, std::size_t(128)) || budget < sent + n) {
+					return;
+				}
+
+				std::string packet = "+IPD,0," + std::to_string(n) + ":";
+				for (std::size_t i = sent; i < sent + n; ++i) {
+					packet.push_back(i < header.size() ? header[i] : static_cast<char>(image[i - header.size()]));
+				}
+				ready.push_back(std::move(packet));
+				sent += n;
+				max_outstanding = std::max(max_outstanding, sent - std::min(sent, header.size()) - acked);
+			}
+		}
+
+		uint32_t bytes_per_ms;
+		uint64_t now_us = 0;
+		std::size_t sent = 0;
+		std::size_t payload_expected = 0;
+
+		std::deque<std::string> ready;
+		std::string current;
+};
+
+/// Passes operations through until the power is cut, then silently drops them
+class PowerCutFlash : public storage::FlashDevice {
+	public:
+		PowerCutFlash(storage::FlashDevice& flash, uint32_t erases_before_cut) :
+			flash(flash),
+			erases_left(erases_before_cut)
+		{}
+
+		std::size_t size() const override { return flash.size(); }
+		std::size_t sector_size() const override { return flash.sector_size(); }
+		std::size_t page_size() const override { return flash.page_size(); }
+		void read(uint32_t address, uint8_t* data, std::size_t len) override { flash.read(address, data, len); }
+		bool is_busy() override { return flash.is_busy(); }
+
+		bool program(uint32_t address, const uint8_t* data, std::size_t len) override {
+			return powered() ? flash.program(address, data, len) : true;
+		}
+
+		bool erase_sector(uint32_t address) override {
+			if (erases_left > 0) {
+				--erases_left;
+				return flash.erase_sector(address);
+			}
+			cut = true;
+			return true;
+		}
+
+	private:
+		bool powered() const { return !cut; }
+
+		storage::FlashDevice& flash;
+		uint32_t erases_left;
+		bool cut = false;
+};
+
+class OtaTests : public ::testing::Test {
+	protected:
+		OtaTests() :
+			path(::testing::TempDir() + "ota_tests.bin")
+		{
+			std::remove(path.c_str());
+			flash = std::make_unique<FileFlash>(path.c_str(), FLASH_SIZE);
+		}
+
+		~OtaTests() override {
+			flash.reset();
+			std::remove(path.c_str());
+		}
+
+		/// Write an image straight into the slot
+		void stage(const std::vector<uint8_t>& image) {
+			OtaWriter writer(*flash, SLOT, SLOT_LENGTH);
+			ASSERT_TRUE(writer.begin(static_cast<uint32_t>(image.size()), Crc32::calculate(image.data(), image.size())));
+
+			std::size_t offset = 0;
+			while (writer.get_state() == OtaWriter::State::RECEIVING || writer.get_state() == OtaWriter::State::VERIFYING) {
+				offset += writer.write(image.data() + offset, image.size() - offset);
+				writer.poll();
+			}
+			ASSERT_EQ(writer.get_state(), OtaWriter::State::DONE);
+			flash->wait_ready();
+		}
+
+		std::vector<uint8_t> read_target(std::size_t size) {
+			std::vector<uint8_t> data(size);
+			flash->read(TARGET, data.data(), size);
+			return data;
+		}
+
+		std::string path;
+		std::unique_ptr<FileFlash> flash;
+};
+
+TEST(OtaCrcTests, MatchesCrc32CheckValue) {
+	const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+	EXPECT_EQ(Crc32::calculate(check, sizeof(check)), 0xCBF43926UL);
+	EXPECT_EQ(storage::ota_crc32_update(0, check, sizeof(check)), 0xCBF43926UL);
+
+	// Computing in pieces gives the same result
+	uint32_t crc = storage::ota_crc32_update(0, check, 4);
+	EXPECT_EQ(storage::ota_crc32_update(crc, check + 4, 5), 0xCBF43926UL);
+}
+
+TEST_F(OtaTests, DownloadIsPacedByTheNetwork) {
+	// 40 kB/s, slower than the flash can erase and program but not by much
+	constexpr uint32_t BYTES_PER_MS = 40;
+	auto image = make_image(64 * 1024 + 100);
+
+	StaticPbufPool<128, 16> pool;
+	UpdateServerEsp32 esp(image, BYTES_PER_MS);
+	esp32::AtClient client(esp);
+	esp32::SocketLayer sockets(client, pool);
+	client.set_data_handler([&](const esp32::AtParser::IpdFragment& fragment) { sockets.on_ipd(fragment); });
+	client.set_urc_handler([&](std::string_view line) { sockets.on_urc(line); });
+
+	OtaWriter writer(*flash, SLOT, SLOT_LENGTH);
+	OtaSession session(sockets, writer);
+
+	auto run = [&] {
+		esp.set_time(flash->now_us());
+		client.poll(static_cast<uint32_t>(flash->now_us() / 1000));
+		session.poll();
+		flash->advance(100);
+	};
+
+	sockets.initialize();
+	while (!sockets.is_ready()) {
+		run();
+	}
+	ASSERT_TRUE(session.start("10.0.0.2", 9000));
+
+	while (session.get_state() != OtaSession::State::DONE && session.get_state() != OtaSession::State::FAILED &&
+			flash->now_us() < 10000000) {
+		run();
+	}
+	ASSERT_EQ(session.get_state(), OtaSession::State::DONE);
+	for (int i = 0; i < 100; ++i) {
+		run();
+	}
+
+	EXPECT_EQ(esp.acked, image.size());
+	EXPECT_EQ(esp.final_status, static_cast<uint8_t>(OtaSession::Status::DONE));
+	EXPECT_FALSE(esp.connected);
+	EXPECT_LE(esp.max_outstanding, OtaSession::WINDOW);
+	EXPECT_EQ(sockets.get_stats(0).rx_dropped, 0UL);
+	EXPECT_EQ(flash->get_stats().violations, 0UL);
+
+	// Erasing and programming overlap the transfer instead of adding to it. Done one after the other they would take
+	// about as long again.
+	double network_ms = double(image.size()) / BYTES_PER_MS;
+	double elapsed_ms = (flash->now_us() - esp.connect_us) / 1000.0;
+	EXPECT_LT(elapsed_ms, network_ms * 1.15);
+
+	// The boot selector installs it once
+	EXPECT_EQ(storage::install_pending(*flash, SLOT, TARGET, TARGET_LENGTH), OtaInstall::INSTALLED);
+	EXPECT_EQ(read_target(image.size()), image);
+	EXPECT_EQ(storage::install_pending(*flash, SLOT, TARGET, TARGET_LENGTH), OtaInstall::NONE);
+	EXPECT_EQ(flash->get_stats().violations, 0UL);
+}
+
+TEST_F(OtaTests, FailedConnectLeavesTheSocketsAlone) {
+	auto image = make_image(1024);
+
+	StaticPbufPool<128, 16> pool;
+	UpdateServerEsp32 esp(image, 40);
+	esp32::AtClient client(esp);
+	esp32::SocketLayer sockets(client, pool);
+	OtaWriter writer(*flash, SLOT, SLOT_LENGTH);
+	OtaSession session(sockets, writer);
+
+	// The socket layer isn't ready, so no socket can be opened
+	EXPECT_FALSE(session.start("10.0.0.2", 9000));
+	EXPECT_EQ(session.get_state(), OtaSession::State::FAILED);
+
+	for (int i = 0; i < 100; ++i) {
+		client.poll(i);
+		session.poll();
+	}
+	EXPECT_EQ(session.get_state(), OtaSession::State::FAILED);
+	EXPECT_EQ(esp.acks, 0u);
+	EXPECT_FALSE(esp.connected);
+}
+
+TEST_F(OtaTests, CorruptDownloadIsNotStaged) {
+	auto image = make_image(10000);
+
+	StaticPbufPool<128, 16> pool;
+	UpdateServerEsp32 esp(image, 100);
+	esp.header[8] ^= 0x01;
+	esp32::AtClient client(esp);
+	esp32::SocketLayer sockets(client, pool);
+	client.set_data_handler([&](const esp32::AtParser::IpdFragment& fragment) { sockets.on_ipd(fragment); });
+	client.set_urc_handler([&](std::string_view line) { sockets.on_urc(line); });
+
+	OtaWriter writer(*flash, SLOT, SLOT_LENGTH);
+	OtaSession session(sockets, writer);
+
+	auto run = [&] {
+		esp.set_time(flash->now_us());
+		client.poll(static_cast<uint32_t>(flash->now_us() / 1000));
+		session.poll();
+		flash->advance(100);
+	};
+
+	sockets.initialize();
+	while (!sockets.is_ready()) {
+		run();
+	}
+	ASSERT_TRUE(session.start("10.0.0.2", 9000));
+	while (session.get_state() != OtaSession::State::DONE && session.get_state() != OtaSession::State::FAILED &&
+			flash->now_us() < 10000000) {
+		run();
+	}
+	for (int i = 0; i < 100; ++i) {
+		run();
+	}
+
+	EXPECT_EQ(session.get_state(), OtaSession::State::FAILED);
+	EXPECT_EQ(writer.get_error(), OtaWriter::Error::CRC_MISMATCH);
+	EXPECT_EQ(esp.final_status, static_cast<uint8_t>(OtaSession::Status::FAILED));
+	EXPECT_EQ(storage::install_pending(*flash, SLOT, TARGET, TARGET_LENGTH), OtaInstall::NONE);
+}
+
+TEST_F(OtaTests, InterruptedInstallResumes) {
+	auto old_image = make_image(30000);
+	stage(old_image);
+	ASSERT_EQ(storage::install_pending(*flash, SLOT, TARGET, TARGET_LENGTH), OtaInstall::INSTALLED);
+
+	auto image = make_image(50000);
+	stage(image);
+
+	// Power is lost during the fifth sector
+	PowerCutFlash unreliable(*flash, 4);
+	storage::install_pending(unreliable, SLOT, TARGET, TARGET_LENGTH);
+	flash->wait_ready();
+	EXPECT_NE(read_target(image.size()), image);
+
+	// The next boot carries on from the fifth sector
+	uint32_t first_erases = flash->get_erase_count(TARGET / 4096);
+	uint32_t fifth_erases = flash->get_erase_count(TARGET / 4096 + 4);
+	EXPECT_EQ(storage::install_pending(*flash, SLOT, TARGET, TARGET_LENGTH), OtaInstall::INSTALLED);
+	EXPECT_EQ(flash->get_erase_count(TARGET / 4096), first_erases);
+	EXPECT_EQ(flash->get_erase_count(TARGET / 4096 + 4), fifth_erases + 1);
+	EXPECT_EQ(read_target(image.size()), image);
+	EXPECT_EQ(flash->get_stats().violations, 0UL);
+}
+
+TEST_F(OtaTests, DamagedSlotIsRejected) {
+	auto image = make_image(20000);
+	stage(image);
+
+	// A bit in the staged image flips after it was checked
+	const uint8_t zero = 0;
+	uint32_t damaged = SLOT + 4096 + 1234;
+	ASSERT_NE(image[1234], 0);
+	flash->program(damaged, &zero, 1);
+	flash->wait_ready();
+
+	EXPECT_EQ(storage::install_pending(*flash, SLOT, TARGET, TARGET_LENGTH), OtaInstall::REJECTED);
+	EXPECT_EQ(flash->get_erase_count(TARGET / 4096), 0UL);
+	EXPECT_EQ(storage::install_pending(*flash, SLOT, TARGET, TARGET_LENGTH), OtaInstall::NONE);
+
+	// Images that don't fit the slot are refused up front
+	OtaWriter writer(*flash, SLOT, SLOT_LENGTH);
+	EXPECT_FALSE(writer.begin(SLOT_LENGTH, 0));
+	EXPECT_TRUE(writer.begin(SLOT_LENGTH - 4096, 0));
+}
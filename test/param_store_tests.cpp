@@ -0,0 +1,184 @@
+/// Tests for the log-structured parameter store
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <storage/file_flash.hpp>
+#include <storage/param_store.hpp>
+
+using storage::FileFlash;
+using storage::ParamStore;
+using Status = ParamStore::Status;
+
+struct Gains {
+	float p;
+	float i;
+	float d;
+};
+
+class ParamStoreTests : public ::testing::Test {
+	protected:
+		static constexpr std::size_t FLASH_SIZE = 64 * 1024;
+		static constexpr uint32_t REGION_START = 16 * 1024;
+		static constexpr uint32_t REGION_LENGTH = 4 * 4096;
+
+		ParamStoreTests() :
+			path(::testing::TempDir() + "param_store_tests.bin")
+		{
+			std::remove(path.c_str());
+			reopen();
+		}
+
+		~ParamStoreTests() override {
+			store.reset();
+			flash.reset();
+			std::remove(path.c_str());
+		}
+
+		/// Simulate a reboot: the image is all that survives
+		void reopen() {
+			store.reset();
+			flash.reset();
+			flash = std::make_unique<FileFlash>(path.c_str(), FLASH_SIZE);
+			store = std::make_unique<ParamStore>(*flash, REGION_START, REGION_LENGTH);
+		}
+
+		std::string path;
+		std::unique_ptr<FileFlash> flash;
+		std::unique_ptr<ParamStore> store;
+};
+
+TEST_F(ParamStoreTests, ValuesSurviveRemount) {
+	ASSERT_EQ(store->mount(), Status::OK);
+
+	const char ssid[] = "rc-field";
+	EXPECT_EQ(store->set(1, reinterpret_cast<const uint8_t*>(ssid), sizeof(ssid)), Status::OK);
+	EXPECT_EQ(store->set(2, Gains{1.5f, 0.25f, 0.125f}), Status::OK);
+	EXPECT_EQ(store->set(2, Gains{2.0f, 0.25f, 0.125f}), Status::OK);
+	EXPECT_EQ(store->remove(1), Status::OK);
+	EXPECT_EQ(store->set(3, uint32_t(42)), Status::OK);
+
+	reopen();
+	ASSERT_EQ(store->mount(), Status::OK);
+	EXPECT_EQ(store->get_stats().records_scanned, 5UL);
+
+	uint8_t buffer[32];
+	std::size_t length = 0;
+	EXPECT_EQ(store->get(1, buffer, sizeof(buffer), length), Status::NOT_FOUND);
+
+	Gains gains {};
+	EXPECT_EQ(store->get(2, gains), Status::OK);
+	EXPECT_EQ(gains.p, 2.0f);
+	EXPECT_EQ(gains.d, 0.125f);
+
+	uint32_t value = 0;
+	EXPECT_EQ(store->get(3, value), Status::OK);
+	EXPECT_EQ(value, 42UL);
+
+	uint16_t wrong_size = 0;
+	EXPECT_EQ(store->get(3, wrong_size), Status::BAD_LENGTH);
+	EXPECT_EQ(flash->get_stats().violations, 0UL);
+}
+
+TEST_F(ParamStoreTests, UnchangedValuesAreNotRewritten) {
+	ASSERT_EQ(store->mount(), Status::OK);
+
+	EXPECT_EQ(store->set(5, uint32_t(7)), Status::OK);
+	uint32_t programs = flash->get_stats().programs;
+	EXPECT_EQ(store->set(5, uint32_t(7)), Status::OK);
+	EXPECT_EQ(flash->get_stats().programs, programs);
+	EXPECT_EQ(store->get_stats().records_written, 1UL);
+}
+
+TEST_F(ParamStoreTests, CompactionReclaimsSpaceAndSpreadsWear) {
+	ASSERT_EQ(store->mount(), Status::OK);
+
+	// A few long-lived keys and one that changes constantly, as with calibration next to a live tuning value
+	for (uint8_t key = 10; key < 14; ++key) {
+		ASSERT_EQ(store->set(key, uint32_t(key) * 100), Status::OK);
+	}
+
+	for (uint32_t i = 0; i < 3000; ++i) {
+		Status status = store->set(0, Gains{static_cast<float>(i), 0, 0});
+		while (status == Status::FULL) {
+			// The erase runs in the background: each poll returns at once while the flash is busy
+			uint64_t before = flash->now_us();
+			store->poll();
+			EXPECT_LT(flash->now_us() - before, 1000ULL);
+			flash->advance(500);
+			status = store->set(0, Gains{static_cast<float>(i), 0, 0});
+		}
+		ASSERT_EQ(status, Status::OK);
+		store->poll();
+	}
+
+	EXPECT_GE(store->get_stats().sectors_erased, 8UL);
+	EXPECT_GT(store->get_stats().records_moved, 0UL);
+	EXPECT_EQ(flash->get_stats().violations, 0UL);
+
+	// The ring wears every sector of the region about equally
+	uint32_t least = UINT32_MAX;
+	uint32_t most = 0;
+	for (std::size_t s = REGION_START / 4096; s < (REGION_START + REGION_LENGTH) / 4096; ++s) {
+		least = std::min(least, flash->get_erase_count(s));
+		most = std::max(most, flash->get_erase_count(s));
+	}
+	EXPECT_LE(most - least, 1UL);
+
+	reopen();
+	ASSERT_EQ(store->mount(), Status::OK);
+
+	Gains gains {};
+	EXPECT_EQ(store->get(0, gains), Status::OK);
+	EXPECT_EQ(gains.p, 2999.0f);
+	for (uint8_t key = 10; key < 14; ++key) {
+		uint32_t value = 0;
+		EXPECT_EQ(store->get(key, value), Status::OK);
+		EXPECT_EQ(value, uint32_t(key) * 100);
+	}
+}
+
+TEST_F(ParamStoreTests, TornRecordKeepsPreviousValue) {
+	ASSERT_EQ(store->mount(), Status::OK);
+	ASSERT_EQ(store->set(4, uint32_t(1)), Status::OK);
+
+	// Power is lost halfway through the next record
+	flash->tear_next_program(5);
+	store->set(4, uint32_t(2));
+
+	reopen();
+	ASSERT_EQ(store->mount(), Status::OK);
+
+	uint32_t value = 0;
+	EXPECT_EQ(store->get(4, value), Status::OK);
+	EXPECT_EQ(value, 1UL);
+
+	// Appending resumes in a fresh sector past the damage
+	EXPECT_EQ(store->set(4, uint32_t(3)), Status::OK);
+	reopen();
+	ASSERT_EQ(store->mount(), Status::OK);
+	EXPECT_EQ(store->get(4, value), Status::OK);
+	EXPECT_EQ(value, 3UL);
+	EXPECT_EQ(flash->get_stats().violations, 0UL);
+}
+
+TEST_F(ParamStoreTests, ForeignDataIsErased) {
+	// Leftovers from some other use of the region
+	for (uint32_t s = 0; s < 2; ++s) {
+		const uint8_t junk[16] = {0x12, 0x34, 0x56, 0x78};
+		flash->program(REGION_START + s * 4096, junk, sizeof(junk));
+		flash->wait_ready();
+	}
+
+	ASSERT_EQ(store->mount(), Status::OK);
+	EXPECT_EQ(store->get_stats().sectors_recovered, 2UL);
+	EXPECT_EQ(store->set(0, uint8_t(1)), Status::OK);
+
+	// Regions that aren't whole sectors are rejected
+	ParamStore misaligned(*flash, REGION_START + 100, REGION_LENGTH);
+	EXPECT_EQ(misaligned.mount(), Status::FLASH_ERROR);
+}
@@ -0,0 +1,82 @@
+/// Tests for the reference counted packet buffer pool
+
+#include <cstring>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <embedded_util/pbuf.hpp>
+
+TEST(PbufTests, AllocateAndRelease) {
+	StaticPbufPool<32, 4> pool;
+	EXPECT_EQ(pool.available(), 4u);
+
+	Pbuf* a = pool.allocate();
+	Pbuf* b = pool.allocate();
+	ASSERT_NE(a, nullptr);
+	ASSERT_NE(b, nullptr);
+	EXPECT_NE(a->storage, b->storage);
+	EXPECT_EQ(a->capacity, 32u);
+	EXPECT_EQ(pool.available(), 2u);
+
+	// A second reference keeps the segment out of the pool
+	PbufPool::retain(a);
+	PbufPool::release(a);
+	EXPECT_EQ(pool.available(), 2u);
+	PbufPool::release(a);
+	PbufPool::release(b);
+	EXPECT_EQ(pool.available(), 4u);
+	EXPECT_EQ(pool.get_stats().low_water, 2u);
+}
+
+TEST(PbufTests, ChainsAreAllOrNothing) {
+	StaticPbufPool<32, 4> pool;
+
+	PbufRef chain(pool.allocate_chain(70));
+	ASSERT_TRUE(chain);
+	EXPECT_EQ(chain.size(), 70u);
+	EXPECT_EQ(chain.get()->length, 32u);
+	EXPECT_EQ(chain.get()->next->next->length, 6u);
+	EXPECT_EQ(pool.available(), 1u);
+
+	EXPECT_EQ(pool.allocate_chain(33), nullptr);
+	EXPECT_EQ(pool.available(), 1u);
+	EXPECT_EQ(pool.get_stats().failures, 1u);
+}
+
+TEST(PbufTests, ScatterGather) {
+	StaticPbufPool<8, 4> pool;
+	PbufRef chain(pool.allocate_chain(20));
+
+	const char* text = "abcdefghijklmnopqrst";
+	std::size_t pos = 0;
+	for (Pbuf* p = chain.get(); p != nullptr; p = p->next) {
+		std::memcpy(p->storage, text + pos, p->length);
+		pos += p->length;
+	}
+
+	char out[12] = {0};
+	EXPECT_EQ(chain.copy_out(reinterpret_cast<uint8_t*>(out), 6, 11), 11u);
+	EXPECT_EQ(std::string(out), "ghijklmnopq");
+	EXPECT_EQ(chain.copy_out(reinterpret_cast<uint8_t*>(out), 18, 10), 2u);
+}
+
+TEST(PbufTests, SharedReferences) {
+	StaticPbufPool<16, 3> pool;
+	{
+		PbufRef chain(pool.allocate_chain(40));
+		Pbuf* middle = chain.get()->next;
+
+		// Keeping the middle segment keeps it and the rest of the chain, but the first segment is freed
+		PbufPool::retain(middle);
+		PbufRef kept(middle);
+		chain = PbufRef();
+		EXPECT_EQ(pool.available(), 1u);
+
+		PbufRef copy = kept;
+		kept = PbufRef();
+		EXPECT_EQ(pool.available(), 1u);
+		EXPECT_EQ(copy.size(), 24u);
+	}
+	EXPECT_EQ(pool.available(), 3u);
+}
@@ -0,0 +1,72 @@
+/// Tests for the compile-time pin mux, against fake GPIO registers
+
+#include <array>
+
+#include <gtest/gtest.h>
+
+#include <hifive1b_bsp/device_driver.hpp>
+#include <hifive1b_bsp/pinmux.hpp>
+
+#include "fake_registers.hpp"
+
+using hifive1b::PinConfig;
+using hifive1b::PinFunction;
+using hifive1b::PinMux;
+
+TEST(PinMuxTests, BoardDescriptionBuildsRegisterValues) {
+	constexpr auto& mux = hifive1b::HIFIVE1B_PINMUX;
+
+	// UART0 and SPI1 on IOF0, the LED on IOF1
+	constexpr uint32_t UART0 = (1UL << 16) | (1UL << 17);
+	constexpr uint32_t SPI1 = (1UL << 3) | (1UL << 4) | (1UL << 5) | (1UL << 9);
+	constexpr uint32_t LED = (1UL << 19) | (1UL << 21) | (1UL << 22);
+	static_assert(mux.iof_en == (UART0 | SPI1 | LED));
+	static_assert(mux.iof_sel == LED);
+
+	EXPECT_EQ(mux.input_en, 1UL << 10);
+	EXPECT_EQ(mux.output_en, 0UL);
+	EXPECT_EQ(mux.pue, 1UL << 16);
+}
+
+TEST(PinMuxTests, FindsConflictsAndMissingFunctions) {
+	constexpr auto mux = PinMux::from(std::array<PinConfig, 5> {{
+		{2, PinFunction::IOF0},
+		{2, PinFunction::GPIO_OUTPUT},
+		// No IOF0 on pin 0, and no IOF1 on pin 16
+		{0, PinFunction::IOF0},
+		{16, PinFunction::IOF1},
+		{32, PinFunction::GPIO_INPUT},
+	}});
+
+	static_assert(mux.conflicts == (1UL << 2));
+	static_assert(mux.unavailable == ((1UL << 0) | (1UL << 16)));
+	static_assert(mux.invalid);
+	EXPECT_EQ(mux.output_en, 1UL << 2);
+}
+
+TEST(PinMuxTests, ApplyWritesEachRegisterOnce) {
+	// Register offsets
+	constexpr uintptr_t INPUT_EN = 0x04;
+	constexpr uintptr_t OUTPUT_EN = 0x08;
+	constexpr uintptr_t PUE = 0x10;
+	constexpr uintptr_t IOF_EN = 0x38;
+	constexpr uintptr_t IOF_SEL = 0x3C;
+
+	// Leftovers from an earlier program are overwritten, not merged
+	FakeRegisters gpio {0x44, 0xFFFFFFFF};
+
+	constexpr auto mux = PinMux::from(std::array<PinConfig, 3> {{
+		{1, PinFunction::IOF1},
+		{7, PinFunction::GPIO_OUTPUT},
+		{8, PinFunction::GPIO_INPUT, true},
+	}});
+	mux.apply(gpio.base());
+
+	EXPECT_EQ(gpio[INPUT_EN], 1UL << 8);
+	EXPECT_EQ(gpio[OUTPUT_EN], 1UL << 7);
+	EXPECT_EQ(gpio[PUE], 1UL << 8);
+	EXPECT_EQ(gpio[IOF_EN], 1UL << 1);
+	EXPECT_EQ(gpio[IOF_SEL], 1UL << 1);
+	// The output value register isn't touched
+	EXPECT_EQ(gpio[0x0C], 0xFFFFFFFFUL);
+}
@@ -44,7 +44,7 @@ TEST(PllDriverTests, WaitLockTest) {
 	// Wait 150 ms to send a mock lock signal
 	std::thread t1([&mock_pllcfg_reg]() {
 		std::this_thread::sleep_for(std::chrono::milliseconds(150));
-		mock_pllcfg_reg |= LOCK_MASK;
+		mock_pllcfg_reg = mock_pllcfg_reg | LOCK_MASK;
 	});
 
 	// Make sure the set function waits for the lock signal
@@ -59,3 +59,24 @@ TEST(PllDriverTests, WaitLockTest) {
 	EXPECT_GE(duration_ms, 150);
 
 }
+
+TEST(PllDriverTests, OutputFrequencyForEveryDivider) {
+	hifive1b::Pll::ConfigStatus cfg = get_320mhz_config();
+	EXPECT_EQ(hifive1b::Pll::get_output_frequency(cfg), frequency::MHz(320));
+
+	// Same result as dividing in 64 bits for every setting the register can hold
+	for (uint8_t r = 1; r <= 8; ++r) {
+		for (uint8_t f = 2; f <= 128; f += 2) {
+			for (uint8_t q : {2, 4, 8}) {
+				cfg.R = r;
+				cfg.F = f;
+				cfg.Q = q;
+				uint64_t expected = 16'000'000ULL / r * f / q;
+				EXPECT_EQ(hifive1b::Pll::get_output_frequency(cfg).count(), expected);
+			}
+		}
+	}
+
+	cfg.bypass = true;
+	EXPECT_EQ(hifive1b::Pll::get_output_frequency(cfg), hifive1b::Pll::HFXOSC_FREQUENCY);
+}
@@ -0,0 +1,104 @@
+/// Scripted stand-in for the ESP32 AT firmware used by the native tests
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <esp32_at/at_transport.hpp>
+
+/// Replies to each expected command with a canned response
+///
+/// Each response is a list of chunks so tests can split lines and payloads at arbitrary points. Replies can be held back
+/// to check that several commands are sent before any response arrives.
+class ScriptedEsp32 : public esp32::AtTransport {
+	public:
+
+		/// Reply with response_chunks when command (including CR LF) is received next
+		void expect(std::string command, std::vector<std::string> response_chunks) {
+			script.push_back({std::move(command), std::move(response_chunks)});
+		}
+
+		/// Queue data that the ESP32 sends on its own (notifications, +IPD)
+		void inject(std::string chunk) {
+			ready.push_back(std::move(chunk));
+		}
+
+		/// Queue data that arrives once the simulated time reaches time. Chunks due at the same time keep their order.
+		void inject_at(uint32_t time, std::string chunk) {
+			auto it = timed.begin();
+			while (it != timed.end() && it->first <= time) {
+				++it;
+			}
+			timed.insert(it, {time, std::move(chunk)});
+		}
+
+		/// Advance the simulated time, releasing chunks queued with inject_at()
+		void set_time(uint32_t time) {
+			while (!timed.empty() && static_cast<int32_t>(time - timed.front().first) >= 0) {
+				ready.push_back(std::move(timed.front().second));
+				timed.pop_front();
+			}
+		}
+
+		/// While holding, replies are kept until release_replies()
+		void hold_replies(bool hold) { holding = hold; }
+
+		void release_replies() {
+			for (auto& c : held) {
+				ready.push_back(std::move(c));
+			}
+			held.clear();
+		}
+
+		bool send(std::string_view data) override {
+			sent.emplace_back(data);
+
+			// Data that isn't a command (ex. CIPSEND payload) is matched against the script the same way
+			if (script.empty() || script.front().command != data) {
+				unexpected.emplace_back(data);
+				return true;
+			}
+
+			for (auto& c : script.front().response) {
+				(holding ? held : ready).push_back(std::move(c));
+			}
+			script.pop_front();
+			return true;
+		}
+
+		std::string_view receive() override {
+			if (ready.empty()) {
+				return {};
+			}
+			current = std::move(ready.front());
+			ready.pop_front();
+			return current;
+		}
+
+		/// Everything sent by the host in order
+		std::vector<std::string> sent;
+
+		/// Messages that did not match the script
+		std::vector<std::string> unexpected;
+
+		bool script_done() const { return script.empty(); }
+
+	private:
+		struct Step {
+			std::string command;
+			std::vector<std::string> response;
+		};
+
+		std::deque<Step> script;
+		std::deque<std::string> ready;
+		std::deque<std::string> held;
+		std::deque<std::pair<uint32_t, std::string>> timed;
+		bool holding = false;
+
+		/// Backing storage for the view returned by receive()
+		std::string current;
+};
@@ -0,0 +1,170 @@
+/// Tests for the multiple connection socket layer
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <embedded_util/pbuf.hpp>
+
+#include <esp32_at/at_client.hpp>
+#include <esp32_at/socket_layer.hpp>
+
+#include "scripted_esp32.hpp"
+
+using esp32::AtClient;
+using esp32::SocketLayer;
+using Protocol = SocketLayer::Protocol;
+using SocketState = SocketLayer::SocketState;
+
+/// Routes the client's handlers to the socket layer the way an application would
+class SocketLayerTests : public ::testing::Test {
+	protected:
+		SocketLayerTests() :
+			client(esp),
+			sockets(client, pool)
+		{
+			client.set_data_handler([this](const esp32::AtParser::IpdFragment& fragment) {
+				sockets.on_ipd(fragment);
+			});
+			client.set_urc_handler([this](std::string_view line) {
+				if (!sockets.on_urc(line)) {
+					urcs.emplace_back(line);
+				}
+			});
+
+			esp.expect("AT+CIPMUX=1\r\n", {"\r\nOK\r\n"});
+			sockets.initialize();
+			run();
+		}
+
+		void run() {
+			for (int i = 0; i < 5; ++i) {
+				client.poll(++now_ms);
+			}
+		}
+
+		std::string read_all(int socket) {
+			std::string data;
+			for (auto chunk = sockets.peek(socket); !chunk.empty(); chunk = sockets.peek(socket)) {
+				data.append(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+				sockets.consume(socket, chunk.size());
+			}
+			return data;
+		}
+
+		StaticPbufPool<128, 16> pool;
+		ScriptedEsp32 esp;
+		AtClient client;
+		SocketLayer sockets;
+		std::vector<std::string> urcs;
+		uint32_t now_ms = 0;
+};
+
+TEST_F(SocketLayerTests, IndependentStreams) {
+	ASSERT_TRUE(sockets.is_ready());
+
+	esp.expect("AT+CIPSTART=0,\"TCP\",\"10.0.0.2\",7000\r\n", {"0,CONNECT\r\n\r\nOK\r\n"});
+	esp.expect("AT+CIPSTART=1,\"UDP\",\"0.0.0.0\",0,6000,2\r\n", {"1,CONNECT\r\n\r\nOK\r\n"});
+	esp.expect("AT+CIPSTART=2,\"TCP\",\"10.0.0.2\",7001\r\n", {"2,CONNECT\r\n\r\nOK\r\n"});
+
+	int telemetry = sockets.open(Protocol::TCP, "10.0.0.2", 7000);
+	int control = sockets.open(Protocol::UDP, "0.0.0.0", 0, 6000);
+	int log = sockets.open(Protocol::TCP, "10.0.0.2", 7001);
+	EXPECT_EQ(telemetry, 0);
+	EXPECT_EQ(control, 1);
+	EXPECT_EQ(log, 2);
+	EXPECT_EQ(sockets.get_state(control), SocketState::CONNECTING);
+
+	run();
+	EXPECT_TRUE(esp.script_done());
+	EXPECT_TRUE(urcs.empty());
+	for (int s : {telemetry, control, log}) {
+		EXPECT_EQ(sockets.get_state(s), SocketState::OPEN);
+		EXPECT_EQ(sockets.poll(s), SocketLayer::WRITABLE);
+	}
+
+	// Interleaved payloads, one split across chunks
+	esp.inject("\r\n+IPD,1,4:ctrl");
+	esp.inject("\r\n+IPD,2,7:log");
+	esp.inject(" 1\r\n\r\n+IPD,1,5:ctrl2");
+	run();
+
+	EXPECT_EQ(sockets.poll(control), SocketLayer::WRITABLE | SocketLayer::READABLE);
+	EXPECT_EQ(sockets.poll(telemetry), SocketLayer::WRITABLE);
+	EXPECT_EQ(read_all(control), "ctrlctrl2");
+	EXPECT_EQ(read_all(log), "log 1\r\n");
+	EXPECT_EQ(sockets.get_stats(control).rx_bytes, 9u);
+}
+
+TEST_F(SocketLayerTests, FullSocketOnlyAffectsItself) {
+	esp.expect("AT+CIPSTART=0,\"TCP\",\"h\",1\r\n", {"\r\nOK\r\n"});
+	esp.expect("AT+CIPSTART=1,\"UDP\",\"h\",2\r\n", {"\r\nOK\r\n"});
+	int tcp = sockets.open(Protocol::TCP, "h", 1);
+	int udp = sockets.open(Protocol::UDP, "h", 2);
+	run();
+
+	// The TCP socket is never read and overflows
+	std::string big(SocketLayer::RX_QUOTA + 10, 'x');
+	esp.inject("+IPD,0," + std::to_string(big.size()) + ":" + big);
+
+	// Datagrams stay whole: the second one doesn't fit and is dropped entirely
+	std::string datagram(SocketLayer::RX_QUOTA - 100, 'd');
+	esp.inject("+IPD,1," + std::to_string(datagram.size()) + ":" + datagram);
+	esp.inject("+IPD,1,200:" + std::string(200, 'e'));
+	esp.inject("+IPD,1,3:abc");
+	run();
+
+	EXPECT_EQ(sockets.get_stats(tcp).rx_bytes, SocketLayer::RX_QUOTA);
+	EXPECT_EQ(sockets.get_stats(tcp).rx_dropped, 10u);
+	EXPECT_EQ(sockets.get_stats(udp).rx_dropped, 200u);
+	EXPECT_EQ(read_all(udp), datagram + "abc");
+	EXPECT_EQ(read_all(tcp), std::string(SocketLayer::RX_QUOTA, 'x'));
+
+	// Everything read has gone back to the pool
+	EXPECT_EQ(pool.available(), 16u);
+}
+
+TEST_F(SocketLayerTests, SendWaitsForPrompt) {
+	esp.expect("AT+CIPSTART=0,\"TCP\",\"h\",1\r\n", {"\r\nOK\r\n"});
+	int s = sockets.open(Protocol::TCP, "h", 1);
+	run();
+
+	esp.expect("AT+CIPSEND=0,5\r\n", {"\r\nOK\r\n", "\r\n>"});
+	esp.expect("hello", {"\r\nRecv 5 bytes\r\n", "\r\nSEND OK\r\n"});
+
+	ASSERT_TRUE(sockets.send(s, "hello"));
+	EXPECT_FALSE(sockets.send(s, "again"));
+	EXPECT_EQ(sockets.poll(s), 0);
+
+	run();
+	EXPECT_TRUE(esp.script_done());
+	EXPECT_TRUE(esp.unexpected.empty());
+	EXPECT_EQ(sockets.poll(s), SocketLayer::WRITABLE);
+	EXPECT_EQ(sockets.get_stats(s).tx_bytes, 5u);
+}
+
+TEST_F(SocketLayerTests, ClosedAndFailedSockets) {
+	esp.expect("AT+CIPSTART=0,\"TCP\",\"h\",1\r\n", {"\r\nOK\r\n"});
+	esp.expect("AT+CIPSTART=1,\"TCP\",\"nowhere\",1\r\n", {"\r\nERROR\r\n", "1,CLOSED\r\n"});
+	int s = sockets.open(Protocol::TCP, "h", 1);
+	int bad = sockets.open(Protocol::TCP, "nowhere", 1);
+	run();
+
+	EXPECT_EQ(sockets.poll(bad), SocketLayer::ERROR);
+	EXPECT_FALSE(sockets.send(bad, "x"));
+
+	// The remote end closes; data received before that can still be read
+	esp.inject("+IPD,0,3:bye0,CLOSED\r\n");
+	run();
+	EXPECT_EQ(sockets.poll(s), SocketLayer::READABLE | SocketLayer::HANGUP);
+	EXPECT_EQ(read_all(s), "bye");
+
+	// The failed socket is freed without a command, then the lowest free number is reused
+	sockets.close(bad);
+	EXPECT_EQ(sockets.get_state(bad), SocketState::CLOSED);
+	esp.expect("AT+CIPSTART=0,\"TCP\",\"h\",2\r\n", {"\r\nOK\r\n"});
+	EXPECT_EQ(sockets.open(Protocol::TCP, "h", 2), 0);
+	EXPECT_EQ(sockets.peek(0).size(), 0u);
+	run();
+	EXPECT_TRUE(esp.script_done());
+}
@@ -0,0 +1,115 @@
+/// Tests for the encoder speed estimator, with edges generated at known rates
+
+#include <gtest/gtest.h>
+
+#include <embedded_util/speed_estimator.hpp>
+
+/// 320 MHz timestamps, counting above 20 kHz and back below 15 kHz, stopped below 1 Hz
+static constexpr SpeedEstimator::Config CONFIG {320'000'000, 20'000'000, 15'000'000, 1'000};
+
+/// Square wave edges fed to an estimator, updated every 10 ms
+class EdgeSource {
+	public:
+		explicit EdgeSource(SpeedEstimator& estimator) :
+			estimator(estimator)
+		{}
+
+		/// Run for some updates with edges every half_period cycles
+		uint32_t run(uint32_t half_period, int updates, bool feed_edges = true) {
+			uint32_t rate = 0;
+			for (int i = 0; i < updates; ++i) {
+				uint32_t end = now + WINDOW;
+				while (static_cast<int32_t>(next_edge - end) <= 0) {
+					rising = !rising;
+					++edge_count;
+					if (feed_edges) {
+						estimator.on_edge(next_edge, rising);
+					}
+					next_edge += half_period;
+				}
+				now = end;
+				rate = estimator.update(now, edge_count);
+			}
+			return rate;
+		}
+
+		/// Let time pass with no edges
+		uint32_t stop(int updates) {
+			uint32_t rate = 0;
+			for (int i = 0; i < updates; ++i) {
+				now += WINDOW;
+				rate = estimator.update(now, edge_count);
+			}
+			next_edge = now + 1;
+			return rate;
+		}
+
+		static constexpr uint32_t WINDOW = 3'200'000;
+
+		SpeedEstimator& estimator;
+		uint32_t now = 0;
+		uint32_t next_edge = 1;
+		uint32_t edge_count = 0;
+		bool rising = false;
+};
+
+TEST(SpeedEstimatorTests, MeasuresPeriodsAtLowRates) {
+	SpeedEstimator estimator(CONFIG);
+	EdgeSource source(estimator);
+
+	// 100 Hz edges: two per 32 ms period
+	EXPECT_EQ(source.run(3'200'000, 10), 100'000u);
+	EXPECT_EQ(estimator.get_mode(), SpeedEstimator::Mode::PERIOD);
+
+	// An odd half period still gives the exact rate, since periods go between edges of the same polarity
+	EXPECT_EQ(source.run(123'457, 10), 640'000'000'000ULL / (2 * 123'457));
+}
+
+TEST(SpeedEstimatorTests, CountsEdgesAtHighRates) {
+	SpeedEstimator estimator(CONFIG);
+	EdgeSource source(estimator);
+
+	// 40 kHz of edges; the ring buffer has overflowed, so only the count is known
+	source.run(8'000, 1);
+	EXPECT_EQ(estimator.get_mode(), SpeedEstimator::Mode::COUNT);
+	EXPECT_EQ(source.run(8'000, 5, false), 40'000'000u);
+
+	// Back to periods only once below 15 kHz
+	source.run(320'000'000 / 18'000, 3);
+	EXPECT_EQ(estimator.get_mode(), SpeedEstimator::Mode::COUNT);
+	source.run(320'000'000 / 10'000, 3);
+	EXPECT_EQ(estimator.get_mode(), SpeedEstimator::Mode::PERIOD);
+	EXPECT_NEAR(source.run(320'000'000 / 10'000, 3), 10'000'000u, 1);
+}
+
+TEST(SpeedEstimatorTests, DecaysToZeroWhenEdgesStop) {
+	SpeedEstimator estimator(CONFIG);
+	EdgeSource source(estimator);
+
+	source.run(1'600'000, 10);
+	EXPECT_EQ(estimator.get_rate_mhz(), 200'000u);
+
+	// The rate can't be more than the time since the last edges allows, and is 0 once it's below 1 Hz
+	uint32_t previous = estimator.get_rate_mhz();
+	for (int i = 0; i < 20; ++i) {
+		uint32_t rate = source.stop(1);
+		EXPECT_LE(rate, previous);
+		previous = rate;
+	}
+	EXPECT_GT(previous, 0u);
+	EXPECT_EQ(source.stop(200), 0u);
+
+	// Long enough for the timestamps to wrap, and it stays stopped
+	EXPECT_EQ(source.stop(2000), 0u);
+}
+
+TEST(SpeedEstimatorTests, GapsDontMakePeriods) {
+	SpeedEstimator estimator(CONFIG);
+	estimator.on_edge(1'000, true);
+	estimator.on_edge(2'000, false, true);
+	EXPECT_EQ(estimator.update(2'500, 2), 0u);
+
+	estimator.on_edge(3'000, true);
+	estimator.on_edge(4'000, false);
+	EXPECT_EQ(estimator.update(4'500, 4), 320'000'000u);
+}
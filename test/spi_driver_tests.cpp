@@ -0,0 +1,77 @@
+/// Tests for background SPI transfers, against fake controller registers
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <hifive1b_bsp/spi_driver.hpp>
+
+#include "fake_registers.hpp"
+
+using hifive1b::SpiDriver;
+
+static uint32_t no_time() {
+	return 0;
+}
+
+static Task<> exchange(SpiDriver& spi, const uint8_t* tx, uint8_t* rx, std::size_t len, bool& done) {
+	co_await spi.transfer_async(tx, rx, len);
+	done = true;
+}
+
+class SpiDriverTests : public ::testing::Test {
+	protected:
+		// Register offsets
+		static constexpr uintptr_t TXDATA = 0x48;
+		static constexpr uintptr_t RXDATA = 0x4C;
+		static constexpr uintptr_t RXMARK = 0x54;
+		static constexpr uintptr_t IE = 0x70;
+
+		/// Reads of plain memory never show a full transmit FIFO, and the receive FIFO always holds this byte
+		void set_received_byte(uint8_t value) {
+			registers[RXDATA] = value;
+		}
+
+		FakeRegisters registers {0x80};
+		SpiDriver spi {1, registers.base()};
+		Executor executor {no_time};
+};
+
+TEST_F(SpiDriverTests, BackgroundTransferRunsFromTheInterrupt) {
+	std::vector<uint8_t> tx(20);
+	for (std::size_t i = 0; i < tx.size(); ++i) {
+		tx[i] = static_cast<uint8_t>(i + 1);
+	}
+	std::vector<uint8_t> rx(tx.size(), 0);
+	bool done = false;
+
+	executor.spawn(exchange(spi, tx.data(), rx.data(), tx.size(), done));
+
+	// The first FIFO's worth is queued, interrupting once all of it has come back
+	EXPECT_EQ(registers[TXDATA], 8UL);
+	EXPECT_EQ(registers[RXMARK], 7UL);
+	EXPECT_EQ(registers[IE], 2UL);
+
+	set_received_byte(0xA5);
+	spi.handle_interrupt();
+	EXPECT_EQ(registers[TXDATA], 16UL);
+	spi.handle_interrupt();
+	EXPECT_EQ(registers[TXDATA], 20UL);
+	EXPECT_EQ(registers[RXMARK], 3UL);
+	EXPECT_FALSE(done);
+
+	// The last interrupt completes the transfer, and the coroutine carries on in the executor
+	spi.handle_interrupt();
+	EXPECT_EQ(registers[IE], 0UL);
+	EXPECT_FALSE(done);
+	executor.poll();
+	EXPECT_TRUE(done);
+	EXPECT_EQ(rx, std::vector<uint8_t>(tx.size(), 0xA5));
+}
+
+TEST_F(SpiDriverTests, EmptyTransferCompletesAtOnce) {
+	bool done = false;
+	executor.spawn(exchange(spi, nullptr, nullptr, 0, done));
+	EXPECT_TRUE(done);
+	EXPECT_EQ(registers[IE], 0UL);
+}
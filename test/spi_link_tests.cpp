@@ -0,0 +1,167 @@
+/// Tests for the ESP32 SPI link layer
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <esp32_at/at_client.hpp>
+#include <esp32_at/socket_layer.hpp>
+#include <esp32_at/spi_link.hpp>
+
+#include "fake_esp32_port.hpp"
+
+TEST(SpiLinkTests, NegotiatesFastestReliableClock) {
+	StaticPbufPool<128, 8> pool;
+	FakeEsp32Port port(4'000'000);
+	esp32::SpiLink link(port, pool);
+
+	EXPECT_EQ(link.get_clock(), 80'000u);
+	EXPECT_EQ(link.negotiate(), 4'000'000u);
+	EXPECT_EQ(link.get_clock(), 4'000'000u);
+}
+
+TEST(SpiLinkTests, NegotiationRespectsMaximumRate) {
+	StaticPbufPool<128, 8> pool;
+	FakeEsp32Port port(100'000'000);
+	esp32::SpiLink link(port, pool);
+
+	EXPECT_EQ(link.negotiate(3), esp32::SpiLink::CLOCK_LADDER[3]);
+}
+
+TEST(SpiLinkTests, BadLengthMarkerIsRejected) {
+	StaticPbufPool<128, 8> pool;
+	FakeEsp32Port port(100'000'000);
+	esp32::SpiLink link(port, pool);
+
+	port.outgoing.push_back("\r\nOK\r\n");
+	port.bad_markers = 1;
+
+	EXPECT_TRUE(link.receive().empty());
+	EXPECT_EQ(link.get_last_status(), esp32::SpiLink::Status::BAD_MARKER);
+	EXPECT_EQ(link.get_stats().errors, 1u);
+
+	// The message is still waiting and arrives intact on the next try
+	EXPECT_EQ(link.receive(), "\r\nOK\r\n");
+	EXPECT_EQ(link.get_last_status(), esp32::SpiLink::Status::OK);
+}
+
+TEST(SpiLinkTests, FallsBackWhenErrorsRise) {
+	StaticPbufPool<128, 8> pool;
+	FakeEsp32Port port(100'000'000);
+	esp32::SpiLink link(port, pool);
+	link.negotiate();
+	uint32_t negotiated = link.get_clock();
+
+	port.bad_markers = esp32::SpiLink::MAX_CONSECUTIVE_ERRORS;
+	for (int i = 0; i < esp32::SpiLink::MAX_CONSECUTIVE_ERRORS; ++i) {
+		port.outgoing.push_back("x");
+		link.receive();
+	}
+
+	EXPECT_LT(link.get_clock(), negotiated);
+	EXPECT_EQ(link.get_stats().fallbacks, 1u);
+}
+
+TEST(SpiLinkTests, GoodputIsMeasured) {
+	StaticPbufPool<128, 8> pool;
+	FakeEsp32Port port(100'000'000);
+	esp32::SpiLink link(port, pool);
+	link.negotiate();
+
+	std::string message(1000, 'x');
+	while (port.now_us() < 3'000'000) {
+		link.send(message);
+		port.outgoing.clear();
+	}
+
+	// Bounded above by the raw bit rate
+	EXPECT_GT(link.get_goodput(), 0u);
+	EXPECT_LT(link.get_goodput(), link.get_clock() / 8);
+}
+
+TEST(SpiLinkTests, LongMessagesArriveInSegments) {
+	StaticPbufPool<128, 8> pool;
+	FakeEsp32Port port(100'000'000);
+	esp32::SpiLink link(port, pool);
+
+	std::string message(300, 'm');
+	message[128] = 'n';
+	port.outgoing.push_back(message);
+
+	std::string received;
+	for (auto chunk = link.receive(); !chunk.empty(); chunk = link.receive()) {
+		EXPECT_LE(chunk.size(), 128u);
+		EXPECT_EQ(chunk.data(), reinterpret_cast<const char*>(link.receive_buffer()->storage));
+		received += chunk;
+	}
+	EXPECT_EQ(received, message);
+
+	// The whole message came in one data phase, however many segments it filled
+	EXPECT_EQ(port.split_phases, 0);
+
+	// Each segment returns to the pool once the next is handed out
+	EXPECT_EQ(pool.available(), 8u);
+}
+
+TEST(SpiLinkTests, OverrunIsClockedOutInOnePhase) {
+	StaticPbufPool<128, 8> pool;
+	FakeEsp32Port port(100'000'000);
+	esp32::SpiLink link(port, pool);
+
+	// Too long for the ping's response buffer, so the rest of the phase is discarded
+	port.outgoing.push_back(std::string(100, 'x'));
+	EXPECT_FALSE(link.ping());
+	EXPECT_EQ(port.split_phases, 0);
+
+	// The ping's own response is next, so nothing was lost
+	EXPECT_EQ(link.receive(), "\r\nOK\r\n");
+}
+
+TEST(SpiLinkTests, EmptyPoolDropsWithoutFallback) {
+	StaticPbufPool<128, 2> pool;
+	FakeEsp32Port port(100'000'000);
+	esp32::SpiLink link(port, pool);
+	link.negotiate();
+	uint32_t negotiated = link.get_clock();
+
+	for (int i = 0; i < 5; ++i) {
+		port.outgoing.push_back(std::string(300, 'x'));
+		EXPECT_TRUE(link.receive().empty());
+		EXPECT_EQ(link.get_last_status(), esp32::SpiLink::Status::NO_BUFFER);
+	}
+	EXPECT_EQ(link.get_stats().dropped, 5u);
+	EXPECT_EQ(link.get_clock(), negotiated);
+
+	// The link is still in step with the ESP32
+	port.outgoing.push_back("\r\nOK\r\n");
+	EXPECT_EQ(link.receive(), "\r\nOK\r\n");
+}
+
+TEST(SpiLinkTests, SocketsReadFromLinkBuffers) {
+	StaticPbufPool<128, 8> pool;
+	FakeEsp32Port port(100'000'000);
+	esp32::SpiLink link(port, pool);
+	esp32::AtClient client(link);
+	esp32::SocketLayer sockets(client, pool);
+
+	client.set_data_handler([&sockets](const esp32::AtParser::IpdFragment& fragment) {
+		sockets.on_ipd(fragment);
+	});
+
+	// No socket has to be open for data to be queued
+	port.outgoing.push_back("+IPD,3,5:hello+IPD,4,5:world");
+	client.poll(0);
+
+	// Both payloads are read in place from the single segment the link received into
+	auto hello = sockets.peek(3);
+	auto world = sockets.peek(4);
+	ASSERT_EQ(hello.size(), 5u);
+	ASSERT_EQ(world.size(), 5u);
+	EXPECT_EQ(world.data(), hello.data() + 14);
+	EXPECT_EQ(pool.available(), 7u);
+
+	sockets.consume(3, 5);
+	EXPECT_EQ(pool.available(), 7u);
+	sockets.consume(4, 5);
+	EXPECT_EQ(pool.available(), 8u);
+}
@@ -0,0 +1,241 @@
+/// Tests for the telemetry encoding and UDP downlink
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <embedded_util/cobs.hpp>
+#include <embedded_util/crc.hpp>
+#include <embedded_util/varint.hpp>
+
+#include <esp32_at/telemetry.hpp>
+#include <esp32_at/telemetry_downlink.hpp>
+
+#include "scripted_esp32.hpp"
+
+using esp32::AtClient;
+using esp32::TelemetryDownlink;
+
+TEST(TelemetryTests, CrcCheckValue) {
+	const char* check = "123456789";
+	EXPECT_EQ(Crc16::calculate(reinterpret_cast<const uint8_t*>(check), 9), 0x29B1);
+}
+
+TEST(TelemetryTests, VarintRoundTrip) {
+	const int32_t values[] = {0, 1, -1, 63, -64, 64, 300, -300, INT32_MAX, INT32_MIN};
+	for (int32_t v : values) {
+		uint8_t bytes[varint::MAX_BYTES];
+		std::size_t n = varint::encode(varint::zigzag_encode(v), bytes);
+
+		uint32_t decoded = 0;
+		ASSERT_EQ(varint::decode(bytes, n, decoded), n);
+		EXPECT_EQ(varint::zigzag_decode(decoded), v);
+	}
+
+	// Small changes of either sign take a single byte
+	uint8_t bytes[varint::MAX_BYTES];
+	EXPECT_EQ(varint::encode(varint::zigzag_encode(-64), bytes), 1u);
+	EXPECT_EQ(varint::encode(300, bytes), 2u);
+	EXPECT_EQ(bytes[0], 0xAC);
+	EXPECT_EQ(bytes[1], 0x02);
+
+	// Truncated input is rejected
+	uint32_t decoded = 0;
+	EXPECT_EQ(varint::decode(bytes, 1, decoded), 0u);
+}
+
+TEST(TelemetryTests, CobsRoundTrip) {
+	std::vector<std::vector<uint8_t>> inputs = {
+		{},
+		{0x00},
+		{0x11, 0x22, 0x00, 0x33},
+		{0x00, 0x00},
+		std::vector<uint8_t>(254, 0x01),
+		std::vector<uint8_t>(600, 0x7F),
+	};
+	inputs.back()[300] = 0;
+
+	for (const auto& input : inputs) {
+		std::vector<uint8_t> encoded(cobs::max_encoded_size(input.size()) + 1);
+		cobs::Encoder encoder;
+		encoder.begin(encoded.data());
+		encoder.put(input.data(), input.size());
+		std::size_t len = encoder.finish();
+
+		ASSERT_LE(len, encoded.size());
+		EXPECT_EQ(encoded[len - 1], 0);
+		EXPECT_EQ(std::memchr(encoded.data(), 0, len - 1), nullptr);
+
+		std::vector<uint8_t> decoded(input.size() + 1);
+		std::size_t decoded_len = cobs::decode(encoded.data(), len - 1, decoded.data());
+		decoded.resize(decoded_len);
+		EXPECT_EQ(decoded, input);
+	}
+
+	// Known encoding
+	const uint8_t input[] = {0x11, 0x22, 0x00, 0x33};
+	uint8_t encoded[8];
+	cobs::Encoder encoder;
+	encoder.begin(encoded);
+	encoder.put(input, sizeof(input));
+	ASSERT_EQ(encoder.finish(), 6u);
+	const uint8_t expected[] = {0x03, 0x11, 0x22, 0x02, 0x33, 0x00};
+	EXPECT_EQ(std::memcmp(encoded, expected, sizeof(expected)), 0);
+}
+
+TEST(TelemetryTests, BatcherRoundTrip) {
+	using Batcher = esp32::TelemetryBatcher<4, 256>;
+	Batcher batcher;
+
+	std::vector<Batcher::Sample> samples;
+	std::vector<Batcher::Sample> decoded;
+	std::vector<uint16_t> sequences;
+	std::size_t datagrams = 0;
+
+	auto decode = [&](std::span<const uint8_t> datagram) {
+		ASSERT_LE(datagram.size(), 256u);
+		ASSERT_EQ(datagram.back(), 0);
+
+		std::vector<uint8_t> frame(datagram.begin(), datagram.end() - 1);
+		uint16_t sequence = 0;
+		EXPECT_TRUE(esp32::decode_telemetry_frame<4>(frame.data(), frame.size(), [&](const Batcher::Sample& s) {
+			decoded.push_back(s);
+		}, sequence));
+		sequences.push_back(sequence);
+		++datagrams;
+	};
+
+	for (uint32_t i = 0; i < 200; ++i) {
+		Batcher::Sample s;
+		s.timestamp_us = 1'000'000 + i * 1000 + (i % 3);
+		s.values = {static_cast<int32_t>(i), -static_cast<int32_t>(i * 7), 1000 + static_cast<int32_t>(i % 5), 0};
+		if (i == 50) {
+			s.values[3] = INT32_MIN;
+		}
+		samples.push_back(s);
+
+		if (!batcher.has_room()) {
+			decode(batcher.finish());
+		}
+		batcher.add(s);
+	}
+	decode(batcher.finish());
+
+	ASSERT_EQ(decoded.size(), samples.size());
+	for (std::size_t i = 0; i < samples.size(); ++i) {
+		EXPECT_EQ(decoded[i].timestamp_us, samples[i].timestamp_us);
+		EXPECT_EQ(decoded[i].values, samples[i].values);
+	}
+
+	// Slowly changing samples pack far more densely than their 20-byte raw size
+	EXPECT_LT(datagrams, 200u * 20 / 256);
+	for (std::size_t i = 0; i < sequences.size(); ++i) {
+		EXPECT_EQ(sequences[i], i);
+	}
+}
+
+TEST(TelemetryTests, ExtremeChangesRoundTrip) {
+	using Batcher = esp32::TelemetryBatcher<2, 256>;
+	Batcher batcher;
+
+	// Jumps between the ends of the range are larger than an int32_t can hold, so the deltas wrap around
+	const std::vector<Batcher::Sample> samples = {
+		{0, {INT32_MAX, INT32_MIN}},
+		{1, {INT32_MIN, INT32_MAX}},
+		{2, {1, -1}},
+		{3, {INT32_MIN, INT32_MIN}},
+		{4, {INT32_MAX, 0}},
+	};
+	for (const auto& sample : samples) {
+		batcher.add(sample);
+	}
+
+	std::span<const uint8_t> datagram = batcher.finish();
+	std::vector<uint8_t> frame(datagram.begin(), datagram.end() - 1);
+	std::vector<Batcher::Sample> decoded;
+	uint16_t sequence = 0;
+	ASSERT_TRUE(esp32::decode_telemetry_frame<2>(frame.data(), frame.size(), [&](const Batcher::Sample& s) {
+		decoded.push_back(s);
+	}, sequence));
+
+	ASSERT_EQ(decoded.size(), samples.size());
+	for (std::size_t i = 0; i < samples.size(); ++i) {
+		EXPECT_EQ(decoded[i].values, samples[i].values) << "sample " << i;
+	}
+}
+
+TEST(TelemetryTests, CorruptFrameIsRejected) {
+	esp32::TelemetryBatcher<2, 128> batcher;
+	batcher.add({1000, {5, 6}});
+	batcher.add({2000, {7, 8}});
+	auto datagram = batcher.finish();
+
+	std::vector<uint8_t> frame(datagram.begin(), datagram.end() - 1);
+	frame[3] ^= 0x10;
+
+	uint16_t sequence = 0;
+	int count = 0;
+	EXPECT_FALSE(esp32::decode_telemetry_frame<2>(frame.data(), frame.size(), [&](const auto&) { ++count; },
+		sequence));
+	EXPECT_EQ(count, 0);
+}
+
+TEST(TelemetryTests, DownlinkStreamsDatagrams) {
+	ScriptedEsp32 esp;
+	AtClient client(esp);
+	TelemetryDownlink downlink(client, esp);
+
+	esp.expect("AT+CIPMUX=0\r\n", {"\r\nOK\r\n"});
+	esp.expect("AT+CIPSTART=\"UDP\",\"192.168.4.2\",5005,5006,0\r\n", {"CONNECT\r\n\r\nOK\r\n"});
+	esp.expect("AT+CIPMODE=1\r\n", {"\r\nOK\r\n"});
+	esp.expect("AT+CIPSEND\r\n", {"\r\nOK\r\n", "\r\n>"});
+
+	// Datagrams are dropped until the connection is up
+	const uint8_t datagram[] = {0x02, 0x01, 0x00};
+	EXPECT_FALSE(downlink.send({datagram, sizeof(datagram)}, 1));
+
+	ASSERT_TRUE(downlink.start("192.168.4.2", 5005, 5006));
+	EXPECT_EQ(downlink.get_state(), TelemetryDownlink::State::CONNECTING);
+
+	for (uint32_t t = 0; t < 10; ++t) {
+		client.poll(t);
+	}
+	EXPECT_TRUE(esp.script_done());
+	EXPECT_TRUE(esp.unexpected.empty());
+	ASSERT_EQ(downlink.get_state(), TelemetryDownlink::State::STREAMING);
+
+	// Each datagram goes out as a single raw message
+	std::size_t before = esp.sent.size();
+	EXPECT_TRUE(downlink.send({datagram, sizeof(datagram)}, 1));
+	ASSERT_EQ(esp.sent.size(), before + 1);
+	EXPECT_EQ(esp.sent.back(), std::string(reinterpret_cast<const char*>(datagram), sizeof(datagram)));
+
+	downlink.stop();
+	EXPECT_EQ(esp.sent.back(), "+++");
+	EXPECT_EQ(downlink.get_state(), TelemetryDownlink::State::IDLE);
+
+	const auto& stats = downlink.get_stats();
+	EXPECT_EQ(stats.datagrams, 1u);
+	EXPECT_EQ(stats.samples, 1u);
+	EXPECT_EQ(stats.bytes, sizeof(datagram));
+	EXPECT_EQ(stats.dropped, 1u);
+}
+
+TEST(TelemetryTests, DownlinkSetupFailure) {
+	ScriptedEsp32 esp;
+	AtClient client(esp);
+	TelemetryDownlink downlink(client, esp);
+
+	esp.expect("AT+CIPMUX=0\r\n", {"\r\nOK\r\n"});
+	esp.expect("AT+CIPSTART=\"UDP\",\"10.0.0.1\",9000,0,0\r\n", {"\r\nERROR\r\n"});
+	esp.expect("AT+CIPMODE=1\r\n", {"\r\nOK\r\n"});
+	esp.expect("AT+CIPSEND\r\n", {"\r\nERROR\r\n"});
+
+	ASSERT_TRUE(downlink.start("10.0.0.1", 9000));
+	for (uint32_t t = 0; t < 10; ++t) {
+		client.poll(t);
+	}
+	EXPECT_EQ(downlink.get_state(), TelemetryDownlink::State::FAILED);
+}
@@ -0,0 +1,84 @@
+/// Convert a black box recording to CSV
+///
+/// The input is the raw contents of the recorder's flash region, e.g. read back with the debugger. Pages are decoded
+/// in order until the first erased one, and corrupt pages are reported and skipped.
+///
+/// Build and run on the host:
+///
+///     g++ -std=c++17 -Ilib/storage -Ilib/embedded_util tools/blackbox_replay.cpp -o blackbox_replay
+///     ./blackbox_replay blackbox.bin > flight.csv
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <storage/blackbox.hpp>
+
+int main(int argc, char** argv) {
+	if (argc < 2 || argc > 3) {
+		std::fprintf(stderr, "usage: %s <dump.bin> [page size]\n", argv[0]);
+		return 2;
+	}
+
+	std::size_t page_size = (argc == 3) ? std::strtoul(argv[2], nullptr, 0) : 256;
+	if (page_size < storage::BLACKBOX_HEADER_SIZE + 2) {
+		std::fprintf(stderr, "invalid page size %s\n", argv[2]);
+		return 2;
+	}
+
+	std::FILE* in = std::fopen(argv[1], "rb");
+	if (!in) {
+		std::perror(argv[1]);
+		return 1;
+	}
+
+	std::vector<uint8_t> page(page_size);
+	std::size_t channels = 0;
+	std::size_t index = 0;
+	std::size_t corrupt = 0;
+	std::size_t samples = 0;
+	uint16_t expected_sequence = 0;
+
+	auto print_sample = [&](uint32_t timestamp_us, const int32_t* values, std::size_t n) {
+		if (n != channels) {
+			// The header goes before the first sample and again if a later page has another layout
+			channels = n;
+			std::printf("time_us");
+			for (std::size_t i = 0; i < n; ++i) {
+				std::printf(",ch%zu", i);
+			}
+			std::printf("\n");
+		}
+
+		std::printf("%lu", static_cast<unsigned long>(timestamp_us));
+		for (std::size_t i = 0; i < n; ++i) {
+			std::printf(",%ld", static_cast<long>(values[i]));
+		}
+		std::printf("\n");
+		++samples;
+	};
+
+	for (; std::fread(page.data(), 1, page_size, in) == page_size; ++index) {
+		uint16_t sequence = 0;
+		storage::BlackboxPage result = storage::decode_blackbox_page(page.data(), page_size, print_sample, sequence);
+
+		if (result == storage::BlackboxPage::ERASED) {
+			break;
+		}
+		if (result == storage::BlackboxPage::CORRUPT) {
+			std::fprintf(stderr, "page %zu: corrupt, skipped\n", index);
+			++corrupt;
+			++expected_sequence;
+			continue;
+		}
+
+		if (sequence != expected_sequence) {
+			std::fprintf(stderr, "page %zu: expected sequence %u, found %u\n", index, expected_sequence, sequence);
+		}
+		expected_sequence = static_cast<uint16_t>(sequence + 1);
+	}
+
+	std::fclose(in);
+	std::fprintf(stderr, "%zu samples from %zu pages, %zu corrupt\n", samples, index, corrupt);
+	return (corrupt > 0) ? 1 : 0;
+}
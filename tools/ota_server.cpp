@@ -0,0 +1,142 @@
+/// Serve a firmware update to the board's OTA=<host>,<port> command
+///
+/// The image is the program region only: the firmware binary without the 4 KiB boot selector at its start. Build and
+/// run on the host (POSIX):
+///
+///     g++ -std=c++17 -Ilib/embedded_util tools/ota_server.cpp -o ota_server
+///     riscv64-unknown-elf-objcopy -O binary .pio/build/hifive1-revb/firmware.elf firmware.bin
+///     ./ota_server firmware.bin 9000 4096
+///
+/// See esp32::OtaSession for the protocol.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <embedded_util/crc.hpp>
+
+// Must match esp32::OtaSession
+static constexpr uint32_t STREAM_MAGIC = 0x5341544F;
+static constexpr std::size_t ACK_SIZE = 5;
+static constexpr std::size_t WINDOW = 512 - 12;
+
+static void store_u32(uint8_t* p, uint32_t value) {
+	p[0] = static_cast<uint8_t>(value);
+	p[1] = static_cast<uint8_t>(value >> 8);
+	p[2] = static_cast<uint8_t>(value >> 16);
+	p[3] = static_cast<uint8_t>(value >> 24);
+}
+
+static bool send_all(int fd, const uint8_t* data, std::size_t len) {
+	while (len > 0) {
+		ssize_t n = send(fd, data, len, 0);
+		if (n <= 0) {
+			return false;
+		}
+		data += n;
+		len -= static_cast<std::size_t>(n);
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3 || argc > 4) {
+		std::fprintf(stderr, "usage: %s <firmware.bin> <port> [bytes to skip]\n", argv[0]);
+		return 2;
+	}
+
+	std::FILE* in = std::fopen(argv[1], "rb");
+	if (!in) {
+		std::perror(argv[1]);
+		return 1;
+	}
+	std::vector<uint8_t> image;
+	for (int c = std::fgetc(in); c != EOF; c = std::fgetc(in)) {
+		image.push_back(static_cast<uint8_t>(c));
+	}
+	std::fclose(in);
+
+	std::size_t skip = (argc == 4) ? std::strtoul(argv[3], nullptr, 0) : 0;
+	if (skip >= image.size()) {
+		std::fprintf(stderr, "nothing left after skipping %zu bytes\n", skip);
+		return 2;
+	}
+	image.erase(image.begin(), image.begin() + static_cast<std::ptrdiff_t>(skip));
+
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	sockaddr_in address {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(static_cast<uint16_t>(std::atoi(argv[2])));
+	if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 1) != 0) {
+		std::perror("listen");
+		return 1;
+	}
+
+	std::fprintf(stderr, "serving %zu bytes on port %s\n", image.size(), argv[2]);
+	int fd = accept(listener, nullptr, nullptr);
+	if (fd < 0) {
+		std::perror("accept");
+		return 1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	uint8_t header[12];
+	store_u32(header, STREAM_MAGIC);
+	store_u32(header + 4, static_cast<uint32_t>(image.size()));
+	store_u32(header + 8, Crc32::calculate(image.data(), image.size()));
+	if (!send_all(fd, header, sizeof(header))) {
+		std::perror("send");
+		return 1;
+	}
+
+	std::size_t sent = 0;
+	uint32_t acked = 0;
+	uint8_t ack[ACK_SIZE];
+	std::size_t ack_length = 0;
+
+	for (;;) {
+		// Keep the window full, then wait for the board to take more
+		if (sent < image.size() && sent < acked + WINDOW) {
+			std::size_t n = std::min(image.size() - sent, acked + WINDOW - sent);
+			if (!send_all(fd, image.data() + sent, n)) {
+				std::perror("send");
+				return 1;
+			}
+			sent += n;
+		}
+
+		ssize_t n = recv(fd, ack + ack_length, ACK_SIZE - ack_length, 0);
+		if (n <= 0) {
+			std::fprintf(stderr, "\nconnection closed after %u bytes\n", acked);
+			return 1;
+		}
+		ack_length += static_cast<std::size_t>(n);
+		if (ack_length < ACK_SIZE) {
+			continue;
+		}
+		ack_length = 0;
+
+		acked = ack[0] | (ack[1] << 8) | (ack[2] << 16) | (static_cast<uint32_t>(ack[3]) << 24);
+		std::fprintf(stderr, "\r%u / %zu", acked, image.size());
+
+		if (ack[4] == 1) {
+			std::fprintf(stderr, "\nstored; reset the board to install it\n");
+			return 0;
+		}
+		if (ack[4] == 2) {
+			std::fprintf(stderr, "\nthe board rejected the image\n");
+			return 1;
+		}
+	}
+}